@@ -1,9 +1,80 @@
+/// Kernel translation units, relative to ../kernel.
+const SOURCES: &[&str] = &[
+    "cpu.c",
+    "bus.c",
+    "opcodes.c",
+    "block.c",
+    "jit.c",
+    "jit_x86_64.c",
+    "ppu.c",
+    "machine.c",
+    "rewind.c",
+    "rom.c",
+    "sched.c",
+    "riot.c",
+    "tia.c",
+    "input.c",
+    "trace.c",
+    "debug.c",
+    "batch.c",
+    "profile.c",
+];
+
+/// Kernel headers the sources include.
+const HEADERS: &[&str] = &[
+    "cpu.h",
+    "isa.h",
+    "bus.h",
+    "block.h",
+    "jit.h",
+    "ppu.h",
+    "machine.h",
+    "rewind.h",
+    "rom.h",
+    "stats.h",
+    "sched.h",
+    "riot.h",
+    "tia.h",
+    "input.h",
+    "trace.h",
+    "debug.h",
+    "batch.h",
+    "profile.h",
+];
+
 fn main() {
-    cc::Build::new()
-        .file("../kernel/cpu.c")
-        .file("../kernel/bus.c")
-        .file("../kernel/opcodes.c")
+    let mut build = cc::Build::new();
+
+    if std::env::var_os("CARGO_FEATURE_STATS").is_some() {
+        build.define("RVM_STATS", "1");
+    }
+    // wasm32-wasip1-threads (web/README.md): the PPU kernels take their
+    // SIMD128 path, and the kernel objects must be built for the shared
+    // memory the Rust side links against. The C compiler needs a WASI
+    // sysroot, e.g. WASI_SYSROOT=/opt/wasi-sdk/share/wasi-sysroot.
+    if std::env::var("CARGO_CFG_TARGET_ARCH").as_deref() == Ok("wasm32") {
+        build.flag("-msimd128");
+        let features = std::env::var("CARGO_CFG_TARGET_FEATURE").unwrap_or_default();
+        if features.split(',').any(|f| f == "atomics") {
+            build
+                .flag("-pthread")
+                .flag("-matomics")
+                .flag("-mbulk-memory");
+        }
+    }
+
+    for source in SOURCES {
+        build.file(format!("../kernel/{source}"));
+    }
+    build
+        // Opcode handlers share one signature; not all of them use every
+        // parameter.
+        .flag_if_supported("-Wno-unused-parameter")
         .compile("rvm8_kernel");
 
-    println!("cargo:rerun-if-changed=../kernel/cpu.h");
-}
\ No newline at end of file
+    // Every file the library is built from, so editing any of them
+    // rebuilds it
+    for file in SOURCES.iter().chain(HEADERS) {
+        println!("cargo:rerun-if-changed=../kernel/{file}");
+    }
+}
@@ -0,0 +1,183 @@
+//! Audio from the kernel's TIA, resampled for an output device.
+//!
+//! A machine with an [`AudioRing`] attached pushes its samples into the
+//! ring in batches as it runs (`kernel/tia.h`). The audio side drains the
+//! ring through a [`Resampler`] at its own pace. Neither side waits for
+//! the other. The emulation is paced by frames and the device by its own
+//! clock, so the two drift apart. To hold latency steady, the resampler
+//! runs slightly fast or slow depending on how full the ring is.
+
+use std::fs::File;
+use std::io::{self, BufWriter, Write};
+use std::path::Path;
+use std::ptr::NonNull;
+use std::sync::Arc;
+use std::sync::atomic::{AtomicBool, Ordering};
+
+use crate::ffi;
+
+/// Samples the resampler keeps queued in the ring, about 33 ms.
+const TARGET_LEVEL: usize = 1024;
+/// Largest correction of the resampling ratio, as a fraction.
+const MAX_ADJUST: f64 = 0.005;
+/// Samples taken from the ring at a time.
+const CHUNK: usize = 256;
+
+/// Owns a `TiaRing` from `kernel/tia.h` and frees it on drop.
+pub struct AudioRing {
+    raw: NonNull<ffi::TiaRing>,
+    /// Whether a [`Resampler`] reads this ring
+    consumed: AtomicBool,
+}
+
+// One machine pushes and one resampler reads, each through its own atomic
+// counter; the ring itself is never moved.
+unsafe impl Send for AudioRing {}
+unsafe impl Sync for AudioRing {}
+
+impl AudioRing {
+    /// Allocates an empty ring.
+    pub fn new() -> Arc<AudioRing> {
+        // SAFETY: no preconditions; NULL means allocation failed.
+        let raw = unsafe { ffi::tia_ring_create() };
+
+        Arc::new(AudioRing {
+            raw: NonNull::new(raw).expect("out of memory creating an audio ring"),
+            consumed: AtomicBool::new(false),
+        })
+    }
+
+    pub(crate) fn as_ptr(&self) -> *mut ffi::TiaRing {
+        self.raw.as_ptr()
+    }
+
+    /// Samples waiting to be read.
+    pub fn level(&self) -> usize {
+        // SAFETY: either side may read the counters.
+        unsafe { ffi::tia_ring_level(self.raw.as_ptr()) }
+    }
+
+    /// Samples dropped because nobody read them in time.
+    pub fn dropped(&self) -> u32 {
+        // SAFETY: as above.
+        unsafe { ffi::tia_ring_dropped(self.raw.as_ptr()) }
+    }
+}
+
+impl Drop for AudioRing {
+    fn drop(&mut self) {
+        // SAFETY: created by tia_ring_create(); machines hold an `Arc` while
+        // it is attached.
+        unsafe { ffi::tia_ring_destroy(self.raw.as_ptr()) }
+    }
+}
+
+/// The consumer side of an [`AudioRing`]: linear resampling from
+/// [`ffi::AUDIO_RATE`] to the device rate.
+pub struct Resampler {
+    ring: Arc<AudioRing>,
+    /// Ring samples per output sample, at nominal rates
+    step: f64,
+    /// Position of the next output sample between `prev` and `next`
+    pos: f64,
+    prev: f32,
+    next: f32,
+    /// Samples taken from the ring but not used yet
+    pending: Vec<i16>,
+    used: usize,
+    /// Whether the ring held `TARGET_LEVEL` samples since it last ran dry
+    primed: bool,
+}
+
+impl Resampler {
+    /// Becomes the reader of `ring`, producing `rate` samples per second.
+    ///
+    /// Panics if the ring already has a reader.
+    pub fn new(ring: Arc<AudioRing>, rate: u32) -> Resampler {
+        assert!(
+            !ring.consumed.swap(true, Ordering::AcqRel),
+            "an audio ring takes a single reader"
+        );
+        Resampler {
+            ring,
+            step: ffi::AUDIO_RATE / f64::from(rate),
+            pos: 0.0,
+            prev: 0.0,
+            next: 0.0,
+            pending: Vec::with_capacity(CHUNK),
+            used: 0,
+            primed: false,
+        }
+    }
+
+    /// Takes the next ring sample, if there is one.
+    fn pop(&mut self) -> Option<i16> {
+        if self.used == self.pending.len() {
+            self.pending.resize(CHUNK, 0);
+            // SAFETY: this resampler is the ring's only reader, and
+            // `pending` has room for CHUNK samples.
+            let read =
+                unsafe { ffi::tia_ring_read(self.ring.as_ptr(), self.pending.as_mut_ptr(), CHUNK) };
+            self.pending.truncate(read);
+            self.used = 0;
+        }
+        let sample = self.pending.get(self.used).copied()?;
+        self.used += 1;
+        Some(sample)
+    }
+
+    /// Fills `out` with resampled audio; never blocks.
+    ///
+    /// Until enough samples are queued, and again after the ring runs dry,
+    /// the last sample is held instead.
+    pub fn fill(&mut self, out: &mut [i16]) {
+        let level = self.ring.level() + (self.pending.len() - self.used);
+
+        if !self.primed && level < TARGET_LEVEL {
+            out.fill(self.next as i16);
+            return;
+        }
+        self.primed = true;
+
+        // Run fast when the ring fills up and slow when it drains
+        let error = (level as f64 - TARGET_LEVEL as f64) / TARGET_LEVEL as f64;
+        let step = self.step * (1.0 + (error * MAX_ADJUST).clamp(-MAX_ADJUST, MAX_ADJUST));
+
+        for sample in out.iter_mut() {
+            while self.pos >= 1.0 {
+                self.pos -= 1.0;
+                self.prev = self.next;
+                match self.pop() {
+                    Some(next) => self.next = f32::from(next),
+                    None => self.primed = false,
+                }
+            }
+            *sample = (self.prev + (self.next - self.prev) * self.pos as f32) as i16;
+            self.pos += step;
+        }
+    }
+}
+
+/// Writes 16-bit mono samples as a WAV file.
+pub fn write_wav(path: &Path, rate: u32, samples: &[i16]) -> io::Result<()> {
+    let bytes = u32::try_from(samples.len() * 2)
+        .map_err(|_| io::Error::new(io::ErrorKind::InvalidInput, "too many samples"))?;
+    let mut file = BufWriter::new(File::create(path)?);
+
+    file.write_all(b"RIFF")?;
+    file.write_all(&(36 + bytes).to_le_bytes())?;
+    file.write_all(b"WAVEfmt ")?;
+    file.write_all(&16u32.to_le_bytes())?;
+    file.write_all(&1u16.to_le_bytes())?; // PCM
+    file.write_all(&1u16.to_le_bytes())?; // Mono
+    file.write_all(&rate.to_le_bytes())?;
+    file.write_all(&(rate * 2).to_le_bytes())?;
+    file.write_all(&2u16.to_le_bytes())?; // Bytes per frame
+    file.write_all(&16u16.to_le_bytes())?;
+    file.write_all(b"data")?;
+    file.write_all(&bytes.to_le_bytes())?;
+    for sample in samples {
+        file.write_all(&sample.to_le_bytes())?;
+    }
+    file.flush()
+}
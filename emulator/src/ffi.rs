@@ -0,0 +1,325 @@
+//! Bindings to the C kernel.
+//!
+//! These mirror the `#[repr(C)]` layout of the kernel structures the host
+//! reads in place. Keep them in sync with the headers in `../kernel`.
+
+use std::cell::UnsafeCell;
+use std::ffi::{c_char, c_int, c_uint};
+use std::ops::Range;
+use std::sync::atomic::{AtomicU32, AtomicU64, Ordering};
+
+/// `MACHINE_FRAME_RATE` in `kernel/machine.h`.
+pub const FRAME_RATE: u32 = 60;
+
+/// `PPU_WIDTH` in `kernel/ppu.h`.
+pub const PPU_WIDTH: usize = 160;
+/// `PPU_HEIGHT` in `kernel/ppu.h`.
+pub const PPU_HEIGHT: usize = 144;
+/// `PPU_LINE_WORDS` in `kernel/ppu.h`.
+pub const PPU_LINE_WORDS: usize = PPU_HEIGHT.div_ceil(32);
+
+/// `BUS_PAGE_COUNT` in `kernel/bus.h`.
+pub const PAGE_COUNT: u32 = 256;
+
+/// `StopReason` in `kernel/cpu.h`.
+#[repr(C)]
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum StopReason {
+    Budget,
+    Breakpoint,
+    Halt,
+    Illegal,
+    Watchpoint,
+}
+
+/// `Machine` in `kernel/machine.h`, only ever handled by pointer.
+#[repr(C)]
+pub struct Machine {
+    _private: [u8; 0],
+}
+
+unsafe extern "C" {
+    pub fn machine_create() -> *mut Machine;
+    pub fn machine_destroy(machine: *mut Machine);
+    pub fn machine_load_image(machine: *mut Machine, image: *const u8, size: usize) -> c_int;
+    pub fn machine_run_frame(machine: *mut Machine) -> StopReason;
+    pub fn machine_hash(machine: *const Machine) -> u64;
+    pub fn machine_frames(machine: *const Machine) -> *const PpuFrames;
+    pub fn machine_stats(machine: *const Machine) -> *const Stats;
+    pub fn machine_reset_stats(machine: *mut Machine);
+    pub fn machine_set_audio(machine: *mut Machine, ring: *mut TiaRing);
+    pub fn machine_set_input(machine: *mut Machine, port: *const InputPort);
+    pub fn machine_set_tracer(machine: *mut Machine, tracer: *mut Tracer);
+    pub fn machine_set_profiler(machine: *mut Machine, profiler: *mut Profiler);
+    pub fn machine_set_render_interval(machine: *mut Machine, interval: u32);
+    pub fn machine_render_interval(machine: *const Machine) -> u32;
+}
+
+/// `InputPort` in `kernel/input.h`: where the host publishes the buttons
+/// held, for the machine to latch at the start of its next frame.
+#[repr(C)]
+pub struct InputPort {
+    word: AtomicU64,
+}
+
+const _: () = assert!(std::mem::size_of::<InputPort>() == 8);
+
+impl InputPort {
+    /// A port with nothing pressed.
+    pub fn new() -> InputPort {
+        InputPort {
+            word: AtomicU64::new(0),
+        }
+    }
+
+    /// Publishes the buttons held, pad 0 in the low byte and pad 1 in the
+    /// high one, with a host timestamp (48 bits are kept). Like
+    /// `input_publish()`, a single store from any thread; it never waits
+    /// for the machine.
+    pub fn publish(&self, buttons: u16, stamp: u64) {
+        self.word
+            .store(u64::from(buttons) | stamp << 16, Ordering::Release);
+    }
+}
+
+/// `MACHINE_AUDIO_RATE` in `kernel/machine.h`, before rounding: samples
+/// per second of emulated time.
+pub const AUDIO_RATE: f64 = 1_789_773.0 / 57.0;
+
+/// `TiaRing` in `kernel/tia.h`, only ever handled by pointer.
+#[repr(C)]
+pub struct TiaRing {
+    _private: [u8; 0],
+}
+
+unsafe extern "C" {
+    pub fn tia_ring_create() -> *mut TiaRing;
+    pub fn tia_ring_destroy(ring: *mut TiaRing);
+    pub fn tia_ring_read(ring: *mut TiaRing, out: *mut i16, max: usize) -> usize;
+    pub fn tia_ring_level(ring: *const TiaRing) -> usize;
+    pub fn tia_ring_dropped(ring: *const TiaRing) -> u32;
+}
+
+/// `Tracer` in `kernel/trace.h`, only ever handled by pointer.
+#[repr(C)]
+pub struct Tracer {
+    _private: [u8; 0],
+}
+
+unsafe extern "C" {
+    pub fn trace_open(path: *const c_char) -> *mut Tracer;
+    pub fn trace_close(tracer: *mut Tracer) -> c_int;
+    pub fn trace_records(tracer: *const Tracer) -> u64;
+}
+
+/// `Profiler` in `kernel/profile.h`, only ever handled by pointer.
+#[repr(C)]
+pub struct Profiler {
+    _private: [u8; 0],
+}
+
+unsafe extern "C" {
+    pub fn profile_create(interval: u32) -> *mut Profiler;
+    pub fn profile_destroy(profiler: *mut Profiler);
+    pub fn profile_samples(profiler: *const Profiler) -> u64;
+    pub fn profile_load_labels(profiler: *mut Profiler, path: *const c_char) -> c_int;
+    pub fn profile_write(
+        profiler: *const Profiler,
+        root: *const c_char,
+        path: *const c_char,
+    ) -> c_int;
+}
+
+/// `Rewind` in `kernel/rewind.h`, only ever handled by pointer.
+#[repr(C)]
+pub struct Rewind {
+    _private: [u8; 0],
+}
+
+unsafe extern "C" {
+    pub fn rewind_create(machine: *mut Machine, snapshots: c_uint, pages: c_uint) -> *mut Rewind;
+    pub fn rewind_destroy(rewind: *mut Rewind);
+    pub fn rewind_snapshot(rewind: *mut Rewind);
+    pub fn rewind_restore(rewind: *mut Rewind, back: c_uint) -> c_int;
+    pub fn rewind_clear(rewind: *mut Rewind);
+    pub fn rewind_depth(rewind: *const Rewind) -> c_uint;
+}
+
+/// `STATS_REGION_COUNT` in `kernel/stats.h`.
+pub const STATS_REGION_COUNT: usize = 4;
+
+/// Names of the `StatsRegion` values in `kernel/stats.h`.
+pub const STATS_REGIONS: [&str; STATS_REGION_COUNT] = ["vram", "ppu", "input", "other"];
+
+/// `Stats` in `kernel/stats.h`: instrumentation counters of one machine.
+#[repr(C)]
+#[derive(Clone)]
+pub struct Stats {
+    /// Times each opcode ran.
+    pub executed: [u64; 256],
+    /// Cycles spent in each opcode.
+    pub cycles: [u64; 256],
+    /// Page crossings that cost each opcode a cycle.
+    pub page_crossings: [u64; 256],
+    /// Slow-path reads per region.
+    pub reads: [u64; STATS_REGION_COUNT],
+    /// Slow-path writes per region.
+    pub writes: [u64; STATS_REGION_COUNT],
+}
+
+const _: () = assert!(std::mem::size_of::<Stats>() == 8 * (3 * 256 + 2 * STATS_REGION_COUNT));
+
+/// `Rom` in `kernel/rom.h`.
+#[repr(C)]
+pub struct Rom {
+    pub data: *const u8,
+    pub size: usize,
+    pub mapped: c_int,
+}
+
+/// `RomError` in `kernel/rom.h`.
+#[repr(C)]
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum RomError {
+    Ok,
+    Io,
+    Header,
+    Section,
+    Placement,
+}
+
+unsafe extern "C" {
+    pub fn rom_open(rom: *mut Rom, path: *const c_char) -> RomError;
+    pub fn rom_close(rom: *mut Rom);
+    pub fn rom_load(machine: *mut Machine, rom: *const Rom);
+}
+
+/// `PpuFrames` in `kernel/ppu.h`: the PPU's front and back framebuffers.
+///
+/// The C kernel owns this structure and keeps drawing into the back buffer
+/// while the host reads the front one, so the pixels sit behind
+/// `UnsafeCell` and are only ever borrowed through [`PpuFrames::front`].
+#[repr(C)]
+pub struct PpuFrames {
+    sequence: AtomicU32,
+    buffers: [UnsafeCell<[u8; PPU_WIDTH * PPU_HEIGHT]>; 2],
+    dirty: [UnsafeCell<[u32; PPU_LINE_WORDS]>; 2],
+}
+
+const _: () = assert!(
+    std::mem::size_of::<PpuFrames>() == 4 + 2 * PPU_WIDTH * PPU_HEIGHT + 2 * 4 * PPU_LINE_WORDS
+);
+
+// The sequence number is the only shared mutable state the host touches.
+unsafe impl Sync for PpuFrames {}
+
+impl PpuFrames {
+    /// Number of frames the PPU has published.
+    pub fn sequence(&self) -> u32 {
+        self.sequence.load(Ordering::Acquire)
+    }
+
+    /// Borrows the most recently published frame without copying it.
+    pub fn front(&self) -> Frame<'_> {
+        let sequence = self.sequence();
+        let front = (sequence & 1) as usize;
+
+        // SAFETY: the C side only draws into the other buffer, and marks
+        // only its lines, until it publishes the frame after `sequence`;
+        // `Frame::intact` tells the caller whether that happened while it
+        // was reading.
+        unsafe {
+            Frame {
+                frames: self,
+                sequence,
+                shades: &*self.buffers[front].get(),
+                dirty: &*self.dirty[front].get(),
+            }
+        }
+    }
+}
+
+/// A published frame, read in place from the C framebuffer.
+///
+/// Pixels are shade indices (0 = lightest, 3 = darkest), one byte each,
+/// row-major. They are meant to be uploaded as a one-channel texture and
+/// expanded to colors when sampled, so the host never walks the pixels.
+pub struct Frame<'a> {
+    frames: &'a PpuFrames,
+    sequence: u32,
+    shades: &'a [u8; PPU_WIDTH * PPU_HEIGHT],
+    dirty: &'a [u32; PPU_LINE_WORDS],
+}
+
+impl Frame<'_> {
+    /// Sequence number of this frame.
+    pub fn sequence(&self) -> u32 {
+        self.sequence
+    }
+
+    /// The frame's shades.
+    pub fn shades(&self) -> &[u8] {
+        self.shades
+    }
+
+    /// The lines that differ from the frame published before this one.
+    /// Only a host that has that frame can upload just these; one that
+    /// missed frames needs [`DirtyLines::all`].
+    pub fn dirty(&self) -> DirtyLines {
+        DirtyLines(*self.dirty)
+    }
+
+    /// Whether the PPU has left this buffer alone so far.
+    ///
+    /// Check after using [`Frame::shades`]; a frame that was published over
+    /// while it was being read may be torn and should be dropped.
+    pub fn intact(&self) -> bool {
+        self.frames.sequence() == self.sequence
+    }
+}
+
+/// A set of framebuffer lines, as the PPU marks them (`PpuFrames::dirty`
+/// in `kernel/ppu.h`): bit `line % 32` of word `line / 32`.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct DirtyLines([u32; PPU_LINE_WORDS]);
+
+impl DirtyLines {
+    /// No lines.
+    pub const NONE: DirtyLines = DirtyLines([0; PPU_LINE_WORDS]);
+
+    /// Every line of the frame.
+    pub fn all() -> DirtyLines {
+        let mut lines = DirtyLines([u32::MAX; PPU_LINE_WORDS]);
+        if PPU_HEIGHT % 32 != 0 {
+            lines.0[PPU_LINE_WORDS - 1] = (1 << (PPU_HEIGHT % 32)) - 1;
+        }
+        lines
+    }
+
+    /// Whether `line` is in the set.
+    pub fn contains(&self, line: usize) -> bool {
+        self.0[line / 32] & 1 << (line % 32) != 0
+    }
+
+    /// Number of lines in the set.
+    pub fn count(&self) -> usize {
+        self.0.iter().map(|word| word.count_ones() as usize).sum()
+    }
+
+    /// The set as runs of adjacent lines, top to bottom: one partial
+    /// texture write each.
+    pub fn runs(&self) -> impl Iterator<Item = Range<usize>> + '_ {
+        let mut line = 0;
+
+        std::iter::from_fn(move || {
+            while line < PPU_HEIGHT && !self.contains(line) {
+                line += 1;
+            }
+            let start = line;
+            while line < PPU_HEIGHT && self.contains(line) {
+                line += 1;
+            }
+            (start < line).then_some(start..line)
+        })
+    }
+}
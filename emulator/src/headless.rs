@@ -0,0 +1,416 @@
+//! Headless batch runner: run many ROMs for a fixed number of frames.
+//!
+//! Every ROM gets its own machine, and the ROMs are spread over a
+//! work-stealing pool with one worker per core. Each one is reported with
+//! the hash of its end state, so a CI job can pin expected results.
+
+use std::fs;
+use std::path::{Path, PathBuf};
+use std::sync::Arc;
+use std::time::Instant;
+
+use crate::audio::{self, AudioRing, Resampler};
+use crate::ffi::{FRAME_RATE, InputPort, STATS_REGIONS, Stats, StopReason};
+use crate::machine::{Machine, Rom};
+use crate::pool;
+use crate::rollback::{self, Session};
+
+/// One ROM to run, as given on the command line.
+pub struct Case {
+    /// Path to a `.rvm` ROM or a raw image.
+    pub path: String,
+    /// Hash the run must end with, if pinned.
+    pub expected: Option<u64>,
+}
+
+impl Case {
+    /// Parses `PATH` or `PATH=HASH`, with the hash in hex.
+    pub fn parse(arg: &str) -> Result<Case, String> {
+        match arg.rsplit_once('=') {
+            Some((path, hash)) => Ok(Case {
+                path: path.to_string(),
+                expected: Some(
+                    u64::from_str_radix(hash, 16).map_err(|_| format!("bad hash in {arg:?}"))?,
+                ),
+            }),
+            None => Ok(Case {
+                path: arg.to_string(),
+                expected: None,
+            }),
+        }
+    }
+}
+
+/// How the cases are run.
+pub struct Settings {
+    /// Frames to run each case for, at most.
+    pub frames: u32,
+    /// Worker threads.
+    pub workers: usize,
+    /// Collect instrumentation counters, see `--stats`.
+    pub stats: bool,
+    /// Record the audio of the (single) case to this WAV file.
+    pub wav: Option<PathBuf>,
+    /// Trace every instruction of the (single) case to this file.
+    pub trace: Option<PathBuf>,
+    /// Sample the (single) case's PC into this collapsed-stack file.
+    pub profile: Option<PathBuf>,
+    /// Label map naming the samples, see `--labels`.
+    pub labels: Option<PathBuf>,
+    /// Render only every this many frames and the last, see
+    /// `--fast-forward`.
+    pub render_interval: u32,
+    /// Buttons to press, in frame order; see [`parse_input_log`].
+    pub input: Vec<InputEvent>,
+    /// Play pad 1 of the input as a remote player whose buttons arrive
+    /// this many frames late, see `--rollback`.
+    pub rollback: Option<u32>,
+    /// Show the picture this many frames ahead, see `--run-ahead`.
+    pub run_ahead: u32,
+}
+
+/// From frame `frame` on, `buttons` are held (pad 0 in the low byte).
+#[derive(Clone, Copy)]
+pub struct InputEvent {
+    pub frame: u32,
+    pub buttons: u16,
+}
+
+/// Parses an input log: one `FRAME BUTTONS` line per change, the buttons
+/// in hex, frames in increasing order. Blank lines and `#` comments are
+/// skipped.
+pub fn parse_input_log(text: &str) -> Result<Vec<InputEvent>, String> {
+    let mut events: Vec<InputEvent> = Vec::new();
+
+    for (n, line) in text.lines().enumerate() {
+        let line = line.split('#').next().unwrap_or("").trim();
+        if line.is_empty() {
+            continue;
+        }
+        let bad = || format!("line {}: expected FRAME BUTTONS", n + 1);
+        let (frame, buttons) = line.split_once(char::is_whitespace).ok_or_else(bad)?;
+        let event = InputEvent {
+            frame: frame.parse().map_err(|_| bad())?,
+            buttons: u16::from_str_radix(buttons.trim(), 16).map_err(|_| bad())?,
+        };
+        if events.last().is_some_and(|last| last.frame >= event.frame) {
+            return Err(format!("line {}: frames must increase", n + 1));
+        }
+        events.push(event);
+    }
+    Ok(events)
+}
+
+/// Output rate of `--wav`.
+const WAV_RATE: u32 = 48_000;
+
+/// How a case ended.
+pub struct Outcome {
+    /// Frames actually run.
+    pub frames: u32,
+    /// End-state hash, see `machine_hash()`.
+    pub hash: u64,
+    /// Why the case failed, if it did.
+    pub failure: Option<String>,
+    /// Instrumentation counters of the run, with `--stats`.
+    pub stats: Option<Stats>,
+}
+
+/// Records a machine's audio as it runs, the way an audio callback would
+/// drain it: a fixed number of device samples per frame.
+struct Recorder {
+    ring: Arc<AudioRing>,
+    resampler: Resampler,
+    samples: Vec<i16>,
+}
+
+impl Recorder {
+    fn attach(machine: &mut Machine) -> Recorder {
+        let ring = AudioRing::new();
+
+        machine.set_audio(Some(ring.clone()));
+        Recorder {
+            resampler: Resampler::new(ring.clone(), WAV_RATE),
+            ring,
+            samples: Vec::new(),
+        }
+    }
+
+    fn frame(&mut self) {
+        let start = self.samples.len();
+
+        self.samples
+            .resize(start + (WAV_RATE / FRAME_RATE) as usize, 0);
+        self.resampler.fill(&mut self.samples[start..]);
+    }
+
+    fn save(&self, path: &Path) -> Result<(), String> {
+        if self.ring.dropped() > 0 {
+            eprintln!(
+                "{}: {} audio samples dropped",
+                path.display(),
+                self.ring.dropped()
+            );
+        }
+        audio::write_wav(path, WAV_RATE, &self.samples)
+            .map_err(|err| format!("{}: {err}", path.display()))
+    }
+}
+
+/// Loads a `.rvm` ROM, or else a raw image, into `machine`.
+pub fn load(machine: &mut Machine, path: &str) -> Result<(), String> {
+    if path.ends_with(".rvm") {
+        let rom = Rom::open(Path::new(path)).map_err(|err| format!("bad ROM: {err:?}"))?;
+        machine.load_rom(Arc::new(rom));
+    } else {
+        let image = fs::read(path).map_err(|err| err.to_string())?;
+        machine
+            .load_image(&image)
+            .map_err(|_| format!("image of {} bytes is too large", image.len()))?;
+    }
+    Ok(())
+}
+
+/// Confirms the remote buttons of every frame that ran on a prediction,
+/// as a netplay session waits for them before it ends; returns why the
+/// last frame stopped.
+fn settle(
+    session: &mut Session,
+    machine: &mut Machine,
+    remote: &[u8],
+    mut reason: StopReason,
+) -> StopReason {
+    while session.confirmed() < session.frames() {
+        let buttons = remote[session.confirmed()];
+        if let Some(replayed) = session
+            .confirm(machine, buttons)
+            .expect("confirmed within the window")
+        {
+            reason = replayed;
+        }
+    }
+    reason
+}
+
+/// Finishes the `--trace` file, if one is being written; returns why that
+/// failed.
+fn finish_trace(machine: &mut Machine, settings: &Settings) -> Option<String> {
+    let path = settings.trace.as_ref()?;
+
+    match machine.stop_trace() {
+        Ok(records) => {
+            eprintln!("trace: {records} instructions in {}", path.display());
+            None
+        }
+        Err(err) => Some(format!("{}: {err}", path.display())),
+    }
+}
+
+/// Writes the `--profile` file, if the case is being profiled, with the
+/// ROM's name as the root frame; returns why that failed.
+fn finish_profile(machine: &mut Machine, case: &Case, settings: &Settings) -> Option<String> {
+    let path = settings.profile.as_ref()?;
+    let root = Path::new(&case.path).file_stem().map_or_else(
+        || case.path.clone(),
+        |stem| stem.to_string_lossy().into_owned(),
+    );
+
+    match machine.stop_profile(path, &root) {
+        Ok(samples) => {
+            eprintln!("profile: {samples} samples in {}", path.display());
+            None
+        }
+        Err(err) => Some(format!("{}: {err}", path.display())),
+    }
+}
+
+fn run_case(case: &Case, settings: &Settings) -> Outcome {
+    let mut machine = Machine::new();
+    let fail = |frames, hash, why: String| Outcome {
+        frames,
+        hash,
+        failure: Some(why),
+        stats: None,
+    };
+
+    if let Err(why) = load(&mut machine, &case.path) {
+        return fail(0, 0, why);
+    }
+
+    if let Some(path) = &settings.trace {
+        if let Err(err) = machine.start_trace(path) {
+            return fail(0, 0, format!("{}: {err}", path.display()));
+        }
+    }
+    if settings.profile.is_some() {
+        if let Err(err) = machine.start_profile(0, settings.labels.as_deref()) {
+            let labels = settings.labels.as_deref().unwrap_or(Path::new(""));
+            return fail(0, 0, format!("{}: {err}", labels.display()));
+        }
+    }
+    machine.reset_stats();
+    let mut recorder = settings
+        .wav
+        .as_ref()
+        .map(|_| Recorder::attach(&mut machine));
+    // Published through a port as a UI thread would, stamped with the frame
+    let port = Arc::new(InputPort::new());
+    let mut input = settings.input.iter().peekable();
+    let mut session = settings
+        .rollback
+        .map(|delay| Session::start(&mut machine, delay));
+    if session.is_none() {
+        machine.set_input(Some(port.clone()));
+    }
+    if settings.run_ahead > 0 {
+        machine.start_rewind(2);
+    }
+
+    let mut held = 0;
+    // With --rollback: pad 1's buttons by frame, confirmed `delay` late
+    let mut remote = Vec::new();
+    let mut ran = 0;
+    let mut reason = StopReason::Budget;
+    while ran < settings.frames && reason == StopReason::Budget {
+        if let Some(event) = input.next_if(|event| event.frame <= ran) {
+            held = event.buttons;
+            if session.is_none() {
+                port.publish(held, u64::from(ran));
+            }
+        }
+        // The last frame is always rendered, so the hash is the same
+        let last = ran + 1 == settings.frames;
+        if let (Some(session), Some(delay)) = (&mut session, settings.rollback) {
+            remote.push((held >> 8) as u8);
+            if let Some(late) = ran.checked_sub(delay) {
+                let buttons = remote[late as usize];
+                if let Some(replayed) = session
+                    .confirm(&mut machine, buttons)
+                    .expect("confirmed within the window")
+                {
+                    reason = replayed;
+                }
+            }
+            if reason == StopReason::Budget {
+                reason = session.advance(&mut machine, held as u8);
+            }
+            ran = session.frames() as u32;
+        } else if settings.run_ahead > 0 && !last {
+            reason = rollback::run_ahead(&mut machine, settings.run_ahead);
+            ran += 1;
+        } else {
+            machine.set_render_interval(if last { 1 } else { settings.render_interval });
+            reason = machine.run_frame();
+            ran += 1;
+        }
+        if let Some(recorder) = &mut recorder {
+            recorder.frame();
+        }
+    }
+    if let Some(session) = &mut session {
+        reason = settle(session, &mut machine, &remote, reason);
+        ran = session.frames() as u32;
+        eprintln!(
+            "rollback {}: {} rollbacks, {} frames run again",
+            case.path, session.rollbacks, session.resimulated
+        );
+    }
+    // A ROM that halts early, or on a breakpoint, has not failed
+    if reason == StopReason::Illegal {
+        let mut why = format!("illegal opcode in frame {ran}");
+        for err in [
+            finish_trace(&mut machine, settings),
+            finish_profile(&mut machine, case, settings),
+        ]
+        .into_iter()
+        .flatten()
+        {
+            why += &format!(", and {err}");
+        }
+        return fail(ran, machine.hash(), why);
+    }
+
+    let hash = machine.hash();
+    let mut failure = match case.expected {
+        Some(expected) if expected != hash => Some(format!("expected hash {expected:016x}")),
+        _ => None,
+    };
+    if let (Some(recorder), Some(path)) = (&recorder, &settings.wav) {
+        failure = failure.or(recorder.save(path).err());
+    }
+    failure = failure.or(finish_trace(&mut machine, settings));
+    failure = failure.or(finish_profile(&mut machine, case, settings));
+    Outcome {
+        frames: ran,
+        hash,
+        failure,
+        stats: if settings.stats {
+            machine.stats()
+        } else {
+            None
+        },
+    }
+}
+
+/// Number of opcodes `--stats` lists per ROM.
+const TOP_OPCODES: usize = 8;
+
+/// Prints the opcodes that took the most cycles and the slow-path
+/// accesses per region.
+fn print_stats(path: &str, stats: &Stats) {
+    let total: u64 = stats.cycles.iter().sum();
+    let mut opcodes: Vec<usize> = (0..256).filter(|&op| stats.executed[op] > 0).collect();
+    opcodes.sort_by_key(|&op| std::cmp::Reverse(stats.cycles[op]));
+
+    eprintln!("stats {path}: {total} cycles");
+    for &op in opcodes.iter().take(TOP_OPCODES) {
+        eprintln!(
+            "  ${op:02X} {:>12} runs {:>12} cycles ({:5.1}%) {:>10} crossings",
+            stats.executed[op],
+            stats.cycles[op],
+            100.0 * stats.cycles[op] as f64 / total.max(1) as f64,
+            stats.page_crossings[op],
+        );
+    }
+    for (region, name) in STATS_REGIONS.iter().enumerate() {
+        eprintln!(
+            "  {name:<6} {:>12} reads {:>12} writes",
+            stats.reads[region], stats.writes[region],
+        );
+    }
+}
+
+/// Runs every case as `settings` say, prints one line per case (and its
+/// counters, with `stats`) and a summary, and returns whether all cases
+/// passed.
+pub fn run(cases: Vec<Case>, settings: &Settings) -> bool {
+    let start = Instant::now();
+    let outcomes = pool::run(cases.iter().collect(), settings.workers, |case| {
+        run_case(case, settings)
+    });
+    let elapsed = start.elapsed().as_secs_f64();
+
+    let mut failed = 0;
+    let mut total_frames = 0u64;
+    for (case, outcome) in cases.iter().zip(&outcomes) {
+        total_frames += u64::from(outcome.frames);
+        match &outcome.failure {
+            None => println!("PASS {:016x} {}", outcome.hash, case.path),
+            Some(why) => {
+                failed += 1;
+                println!("FAIL {:016x} {} ({why})", outcome.hash, case.path);
+            }
+        }
+        if let Some(stats) = &outcome.stats {
+            print_stats(&case.path, stats);
+        }
+    }
+
+    eprintln!(
+        "{} passed, {failed} failed; {total_frames} frames in {elapsed:.3} s ({:.0} frames/s, {} workers)",
+        cases.len() - failed,
+        total_frames as f64 / elapsed.max(1e-9),
+        settings.workers,
+    );
+    failed == 0
+}
@@ -0,0 +1,374 @@
+//! Safe handles to C emulator instances and ROMs.
+
+use std::ffi::CString;
+use std::io;
+use std::path::Path;
+use std::ptr::{self, NonNull};
+use std::sync::Arc;
+
+use crate::audio::AudioRing;
+use crate::ffi::{self, RomError, Stats, StopReason};
+
+/// Owns a `Machine` from `kernel/machine.h` and frees it on drop.
+pub struct Machine {
+    raw: NonNull<ffi::Machine>,
+    /// ROM whose sections the bus currently maps
+    rom: Option<Arc<Rom>>,
+    /// Ring the TIA pushes samples to
+    audio: Option<Arc<AudioRing>>,
+    /// Port the input registers are latched from
+    input: Option<Arc<ffi::InputPort>>,
+    /// Tracer recording every instruction, see `kernel/trace.h`
+    tracer: Option<NonNull<ffi::Tracer>>,
+    /// Sampling profiler, see `kernel/profile.h`
+    profiler: Option<NonNull<ffi::Profiler>>,
+    /// Snapshots to go back to, see `kernel/rewind.h`
+    rewind: Option<NonNull<ffi::Rewind>>,
+}
+
+// A machine shares no mutable state with other machines, so it may move
+// to another thread; `&mut self` keeps it to one thread at a time.
+unsafe impl Send for Machine {}
+
+/// Why a ROM image could not be loaded.
+#[derive(Debug)]
+pub struct ImageTooLarge;
+
+/// Why a snapshot could not be restored: none was kept that far back.
+#[derive(Debug)]
+pub struct NoSnapshot;
+
+impl Machine {
+    /// Powers on a machine with zeroed memory.
+    pub fn new() -> Machine {
+        // SAFETY: no preconditions; NULL means allocation failed.
+        let raw = unsafe { ffi::machine_create() };
+
+        Machine {
+            raw: NonNull::new(raw).expect("out of memory creating a machine"),
+            rom: None,
+            audio: None,
+            input: None,
+            tracer: None,
+            profiler: None,
+            rewind: None,
+        }
+    }
+
+    /// Loads a `.rvm` ROM and resets. Its sections are mapped, not copied,
+    /// so the machine keeps the ROM alive until the next load.
+    pub fn load_rom(&mut self, rom: Arc<Rom>) {
+        // SAFETY: the ROM stays mapped while `self.rom` holds it.
+        unsafe { ffi::rom_load(self.raw.as_ptr(), &rom.raw) };
+        self.rom = Some(rom);
+        self.clear_rewind();
+    }
+
+    /// Loads a raw program image so that it ends at 0xFFFF, and resets.
+    pub fn load_image(&mut self, image: &[u8]) -> Result<(), ImageTooLarge> {
+        // SAFETY: the kernel copies `image` and keeps no pointer to it.
+        match unsafe { ffi::machine_load_image(self.raw.as_ptr(), image.as_ptr(), image.len()) } {
+            0 => {
+                self.rom = None;
+                self.clear_rewind();
+                Ok(())
+            }
+            _ => Err(ImageTooLarge),
+        }
+    }
+
+    /// Runs one frame and publishes it to the front buffer.
+    pub fn run_frame(&mut self) -> StopReason {
+        // SAFETY: `self.raw` is a live machine owned by this handle.
+        unsafe { ffi::machine_run_frame(self.raw.as_ptr()) }
+    }
+
+    /// Renders only the frames that complete a group of `interval`, or none
+    /// with 0; the default, 1, renders them all. Skipped frames run the
+    /// same but are not published, so only the picture (and [`hash`]) can
+    /// differ.
+    ///
+    /// [`hash`]: Machine::hash
+    pub fn set_render_interval(&mut self, interval: u32) {
+        // SAFETY: `self.raw` is a live machine owned by this handle.
+        unsafe { ffi::machine_set_render_interval(self.raw.as_ptr(), interval) }
+    }
+
+    /// The interval set with [`set_render_interval`].
+    ///
+    /// [`set_render_interval`]: Machine::set_render_interval
+    pub fn render_interval(&self) -> u32 {
+        // SAFETY: `self.raw` is a live machine owned by this handle.
+        unsafe { ffi::machine_render_interval(self.raw.as_ptr()) }
+    }
+
+    /// Attaches the ring the machine's audio goes to, or detaches it with
+    /// `None`; without a ring no audio is synthesized.
+    pub fn set_audio(&mut self, ring: Option<Arc<AudioRing>>) {
+        let raw = ring.as_ref().map_or(ptr::null_mut(), |ring| ring.as_ptr());
+
+        // SAFETY: the machine only pushes to the ring while `self.audio`
+        // holds it.
+        unsafe { ffi::machine_set_audio(self.raw.as_ptr(), raw) };
+        self.audio = ring;
+    }
+
+    /// The ring attached with [`set_audio`], if any.
+    ///
+    /// [`set_audio`]: Machine::set_audio
+    pub fn audio(&self) -> Option<Arc<AudioRing>> {
+        self.audio.clone()
+    }
+
+    /// Makes the machine latch its input from `port` at the start of every
+    /// frame, or from a port of its own with `None`.
+    pub fn set_input(&mut self, port: Option<Arc<ffi::InputPort>>) {
+        let raw = port.as_ref().map_or(ptr::null(), |port| Arc::as_ptr(port));
+
+        // SAFETY: the machine only reads the port while `self.input` holds
+        // it.
+        unsafe { ffi::machine_set_input(self.raw.as_ptr(), raw) };
+        self.input = port;
+    }
+
+    /// Starts recording every instruction to a trace file at `path`, in
+    /// place of any trace already running. Traced frames take the
+    /// single-stepping path through the CPU.
+    pub fn start_trace(&mut self, path: &Path) -> io::Result<()> {
+        let path = c_path(path)?;
+
+        self.stop_trace()?;
+        // SAFETY: `path` is a valid C string; NULL means the file, memory or
+        // writer thread could not be had.
+        let tracer = NonNull::new(unsafe { ffi::trace_open(path.as_ptr()) })
+            .ok_or_else(io::Error::last_os_error)?;
+        // SAFETY: the tracer stays open while `self.tracer` holds it.
+        unsafe { ffi::machine_set_tracer(self.raw.as_ptr(), tracer.as_ptr()) };
+        self.tracer = Some(tracer);
+        Ok(())
+    }
+
+    /// Stops tracing and finishes the file. Returns the instructions
+    /// recorded, 0 when no trace was running.
+    pub fn stop_trace(&mut self) -> io::Result<u64> {
+        let Some(tracer) = self.tracer.take() else {
+            return Ok(0);
+        };
+
+        // SAFETY: the tracer is detached before it is closed, and closed
+        // once.
+        unsafe {
+            ffi::machine_set_tracer(self.raw.as_ptr(), ptr::null_mut());
+            let records = ffi::trace_records(tracer.as_ptr());
+            match ffi::trace_close(tracer.as_ptr()) {
+                0 => Ok(records),
+                _ => Err(io::Error::other("writing the trace failed")),
+            }
+        }
+    }
+
+    /// Starts sampling the PC every `interval` cycles on average (0 for
+    /// the kernel's default), in place of any profile already running.
+    /// Samples are named by the label map at `labels`, as `rvm-asm -l`
+    /// writes it.
+    pub fn start_profile(&mut self, interval: u32, labels: Option<&Path>) -> io::Result<()> {
+        let labels = labels.map(c_path).transpose()?;
+
+        self.discard_profile();
+        // SAFETY: no preconditions; NULL means allocation failed.
+        let profiler = NonNull::new(unsafe { ffi::profile_create(interval) })
+            .ok_or_else(|| io::Error::from(io::ErrorKind::OutOfMemory))?;
+        if let Some(labels) = labels {
+            // SAFETY: the profiler is not attached yet; `labels` is a valid
+            // C string.
+            if unsafe { ffi::profile_load_labels(profiler.as_ptr(), labels.as_ptr()) } != 0 {
+                // SAFETY: created above and not attached.
+                unsafe { ffi::profile_destroy(profiler.as_ptr()) };
+                return Err(io::Error::new(
+                    io::ErrorKind::InvalidData,
+                    "unreadable label map",
+                ));
+            }
+        }
+        // SAFETY: the profiler stays alive while `self.profiler` holds it.
+        unsafe { ffi::machine_set_profiler(self.raw.as_ptr(), profiler.as_ptr()) };
+        self.profiler = Some(profiler);
+        Ok(())
+    }
+
+    /// Stops profiling and writes the samples to `path` as collapsed
+    /// stacks, each under `root`. Returns the samples taken, 0 when no
+    /// profile was running.
+    pub fn stop_profile(&mut self, path: &Path, root: &str) -> io::Result<u64> {
+        let path = c_path(path)?;
+        let root = CString::new(root).map_err(|_| io::Error::from(io::ErrorKind::InvalidInput))?;
+        let Some(profiler) = self.profiler else {
+            return Ok(0);
+        };
+
+        // SAFETY: the profiler is detached before it is read; `path` and
+        // `root` are valid C strings.
+        let written = unsafe {
+            ffi::machine_set_profiler(self.raw.as_ptr(), ptr::null_mut());
+            ffi::profile_write(profiler.as_ptr(), root.as_ptr(), path.as_ptr())
+        };
+        let samples = self.discard_profile();
+        match written {
+            0 => Ok(samples),
+            _ => Err(io::Error::other("writing the profile failed")),
+        }
+    }
+
+    /// Detaches and frees the profiler, if any; returns its samples.
+    fn discard_profile(&mut self) -> u64 {
+        let Some(profiler) = self.profiler.take() else {
+            return 0;
+        };
+
+        // SAFETY: the profiler is detached before it is freed, and freed
+        // once.
+        unsafe {
+            ffi::machine_set_profiler(self.raw.as_ptr(), ptr::null_mut());
+            let samples = ffi::profile_samples(profiler.as_ptr());
+            ffi::profile_destroy(profiler.as_ptr());
+            samples
+        }
+    }
+
+    /// Starts keeping the last `snapshots` states taken with [`snapshot`],
+    /// dropping any kept before. The page pool is sized so that no
+    /// snapshot is dropped before `snapshots` newer ones are taken.
+    ///
+    /// [`snapshot`]: Machine::snapshot
+    pub fn start_rewind(&mut self, snapshots: u32) {
+        self.stop_rewind();
+        // SAFETY: the machine outlives the ring, which `Drop` frees first;
+        // NULL means allocation failed.
+        let rewind = unsafe {
+            ffi::rewind_create(
+                self.raw.as_ptr(),
+                snapshots,
+                snapshots.saturating_mul(ffi::PAGE_COUNT),
+            )
+        };
+        self.rewind = Some(NonNull::new(rewind).expect("out of memory creating a rewind ring"));
+    }
+
+    /// Stops keeping snapshots and frees those kept.
+    pub fn stop_rewind(&mut self) {
+        if let Some(rewind) = self.rewind.take() {
+            // SAFETY: created by rewind_create() and not freed before.
+            unsafe { ffi::rewind_destroy(rewind.as_ptr()) }
+        }
+    }
+
+    fn clear_rewind(&mut self) {
+        if let Some(rewind) = self.rewind {
+            // SAFETY: the ring is live while `self.rewind` holds it.
+            unsafe { ffi::rewind_clear(rewind.as_ptr()) }
+        }
+    }
+
+    /// Takes a snapshot of the state between two frames; does nothing
+    /// unless [`start_rewind`] was called.
+    ///
+    /// [`start_rewind`]: Machine::start_rewind
+    pub fn snapshot(&mut self) {
+        if let Some(rewind) = self.rewind {
+            // SAFETY: as above.
+            unsafe { ffi::rewind_snapshot(rewind.as_ptr()) }
+        }
+    }
+
+    /// Returns to the snapshot `back` before the newest (0 for the newest)
+    /// and drops those newer than it.
+    pub fn restore(&mut self, back: u32) -> Result<(), NoSnapshot> {
+        let rewind = self.rewind.ok_or(NoSnapshot)?;
+
+        // SAFETY: as above.
+        match unsafe { ffi::rewind_restore(rewind.as_ptr(), back) } {
+            0 => Ok(()),
+            _ => Err(NoSnapshot),
+        }
+    }
+
+    /// The PPU's framebuffers, for reading the last published frame.
+    pub fn frames(&self) -> &ffi::PpuFrames {
+        // SAFETY: the framebuffers live inside the machine, and the PPU only
+        // draws while it runs, which needs `&mut self`.
+        unsafe { &*ffi::machine_frames(self.raw.as_ptr()) }
+    }
+
+    /// Hash of the registers, memory and the last frame.
+    pub fn hash(&self) -> u64 {
+        // SAFETY: as above.
+        unsafe { ffi::machine_hash(self.raw.as_ptr()) }
+    }
+
+    /// Copy of the instrumentation counters, or `None` unless the kernel
+    /// was built with the `stats` feature.
+    pub fn stats(&self) -> Option<Stats> {
+        // SAFETY: the counters live inside the machine and only change
+        // while it runs, which needs `&mut self`.
+        unsafe { ffi::machine_stats(self.raw.as_ptr()).as_ref().cloned() }
+    }
+
+    /// Zeroes the instrumentation counters.
+    pub fn reset_stats(&mut self) {
+        // SAFETY: as above.
+        unsafe { ffi::machine_reset_stats(self.raw.as_ptr()) }
+    }
+}
+
+/// `path` as a C string, for the kernel to open.
+fn c_path(path: &Path) -> io::Result<CString> {
+    CString::new(path.as_os_str().as_encoded_bytes())
+        .map_err(|_| io::Error::from(io::ErrorKind::InvalidInput))
+}
+
+impl Drop for Machine {
+    fn drop(&mut self) {
+        // A trace that fails to finish here has no one left to tell
+        let _ = self.stop_trace();
+        self.discard_profile();
+        self.stop_rewind();
+        // SAFETY: created by machine_create() and not freed before. The ROM,
+        // audio and input fields are dropped after this, once nothing uses
+        // them.
+        unsafe { ffi::machine_destroy(self.raw.as_ptr()) }
+    }
+}
+
+/// A validated `.rvm` file, mapped read-only.
+pub struct Rom {
+    raw: ffi::Rom,
+}
+
+// The mapping is never written, so machines on any thread may share it.
+unsafe impl Send for Rom {}
+unsafe impl Sync for Rom {}
+
+impl Rom {
+    /// Maps and validates a ROM file.
+    pub fn open(path: &Path) -> Result<Rom, RomError> {
+        let path = CString::new(path.as_os_str().as_encoded_bytes()).map_err(|_| RomError::Io)?;
+        let mut raw = ffi::Rom {
+            data: ptr::null(),
+            size: 0,
+            mapped: 0,
+        };
+
+        // SAFETY: `raw` is only filled in on success.
+        match unsafe { ffi::rom_open(&mut raw, path.as_ptr()) } {
+            RomError::Ok => Ok(Rom { raw }),
+            err => Err(err),
+        }
+    }
+}
+
+impl Drop for Rom {
+    fn drop(&mut self) {
+        // SAFETY: opened by rom_open(); machines hold an `Arc` while mapped.
+        unsafe { ffi::rom_close(&mut self.raw) }
+    }
+}
@@ -1,3 +1,284 @@
-fn main() {
-    println!("Hello, world!");
+mod audio;
+#[allow(dead_code)]
+mod ffi;
+mod headless;
+mod machine;
+mod pipeline;
+mod pool;
+mod rollback;
+mod triple;
+#[cfg(target_arch = "wasm32")]
+mod web;
+
+use std::process::ExitCode;
+use std::thread;
+use std::time::Duration;
+
+const USAGE: &str =
+    "usage: emulator --headless [--frames N] [--jobs N] [--stats] [--wav FILE] [--input LOG]
+                          [--trace FILE] [--profile FILE [--labels FILE]]
+                          [--fast-forward N | --rollback N | --run-ahead N]
+                          ROM[=HASH]... [@LIST]...
+
+Runs each ROM (.rvm, or else a raw image) for N frames (default 60) on
+N worker threads (default: one per core) and prints PASS or FAIL with the
+end-state hash. A ROM given as PATH=HASH fails unless it ends with that
+hash. @LIST reads more ROMs from a file, one per line. --stats prints
+each ROM's busiest opcodes and device accesses (needs the stats feature).
+--wav records the audio of a single ROM as a 48 kHz WAV file. --input
+replays a log of `FRAME BUTTONS` lines (hex; pad 0 in the low byte) into
+every ROM. --trace writes a binary trace of every instruction a single
+ROM runs (kernel/trace.h; print it with kernel's rvm-trace). --profile
+samples where a single ROM spends its cycles and writes collapsed stacks
+for flamegraph.pl or speedscope (kernel/profile.h), named by the label
+map of --labels (rvm-asm -l).
+--fast-forward renders only every Nth frame and the last one; the
+others still run in full, so a ROM that does not stop early ends with
+the same hash. --rollback plays pad 1 of the input as a remote player
+whose buttons arrive N frames late: frames run on predicted buttons and
+are rolled back and run again when the real ones differ. --run-ahead
+shows each frame N frames ahead of the state it keeps. Both end with the
+hash of a plain run.
+
+       emulator --pipeline [--frames N] [--refresh HZ] [--present-ms MS] ROM
+
+Runs one ROM in real time, emulating on its own thread and presenting the
+newest frame at HZ (default 60), each present taking MS milliseconds
+(default 0), then prints frame-time, latency and queue-depth metrics.
+
+       emulator --web ROM
+
+WebAssembly build only: runs one ROM in real time inside web/worker.js,
+sharing its framebuffers and input port with the page.";
+
+fn parse_count(value: Option<String>, flag: &str) -> Result<usize, String> {
+    value
+        .as_deref()
+        .and_then(|v| v.parse().ok())
+        .filter(|&n| n > 0)
+        .ok_or_else(|| format!("{flag} needs a positive number"))
+}
+
+fn parse_number(value: Option<String>, flag: &str) -> Result<f64, String> {
+    value
+        .as_deref()
+        .and_then(|v| v.parse().ok())
+        .filter(|n: &f64| n.is_finite() && *n >= 0.0)
+        .ok_or_else(|| format!("{flag} needs a number"))
+}
+
+/// Parsed command line.
+enum Options {
+    Headless(Vec<headless::Case>, headless::Settings),
+    Pipeline(String, pipeline::Settings),
+    #[cfg(target_arch = "wasm32")]
+    Web(String),
+}
+
+fn parse_args() -> Result<Options, String> {
+    let mut args = std::env::args().skip(1);
+    let mut headless = false;
+    let mut pipeline = false;
+    let mut web = false;
+    let mut refresh = 60.0;
+    let mut present_ms = 0.0;
+    let mut frames = 60;
+    let mut jobs = thread::available_parallelism().map_or(1, |n| n.get());
+    let mut stats = false;
+    let mut wav = None;
+    let mut trace = None;
+    let mut profile = None;
+    let mut labels = None;
+    let mut render_interval = 1;
+    let mut rollback = None;
+    let mut run_ahead = 0;
+    let mut input = Vec::new();
+    let mut cases = Vec::new();
+
+    while let Some(arg) = args.next() {
+        match arg.as_str() {
+            "--headless" => headless = true,
+            "--pipeline" => pipeline = true,
+            "--web" if cfg!(target_arch = "wasm32") => web = true,
+            "--web" => return Err("--web needs the wasm32 build".to_string()),
+            "--refresh" => {
+                refresh = parse_number(args.next(), "--refresh")?;
+                if refresh == 0.0 {
+                    return Err("--refresh needs a positive rate".to_string());
+                }
+            }
+            "--present-ms" => present_ms = parse_number(args.next(), "--present-ms")?,
+            "--frames" => {
+                frames = parse_count(args.next(), "--frames")?
+                    .try_into()
+                    .map_err(|_| "--frames is too large")?
+            }
+            "--jobs" => jobs = parse_count(args.next(), "--jobs")?,
+            "--stats" if cfg!(feature = "stats") => stats = true,
+            "--stats" => return Err("--stats needs a build with --features stats".to_string()),
+            "--input" => {
+                let log = args.next().ok_or("--input needs a file name")?;
+                let text = std::fs::read_to_string(&log).map_err(|err| format!("{log}: {err}"))?;
+                input = headless::parse_input_log(&text).map_err(|err| format!("{log}: {err}"))?;
+            }
+            "--wav" => wav = Some(args.next().ok_or("--wav needs a file name")?.into()),
+            "--fast-forward" => {
+                render_interval = parse_count(args.next(), "--fast-forward")?
+                    .try_into()
+                    .map_err(|_| "--fast-forward is too large")?
+            }
+            "--rollback" => {
+                rollback = Some(
+                    parse_count(args.next(), "--rollback")?
+                        .try_into()
+                        .map_err(|_| "--rollback is too large")?,
+                )
+            }
+            "--run-ahead" => {
+                run_ahead = parse_count(args.next(), "--run-ahead")?
+                    .try_into()
+                    .map_err(|_| "--run-ahead is too large")?
+            }
+            "--trace" => trace = Some(args.next().ok_or("--trace needs a file name")?.into()),
+            "--profile" => profile = Some(args.next().ok_or("--profile needs a file name")?.into()),
+            "--labels" => labels = Some(args.next().ok_or("--labels needs a file name")?.into()),
+            "-h" | "--help" => return Err(String::new()),
+            _ if arg.starts_with("--") => return Err(format!("unknown option {arg}")),
+            _ => match arg.strip_prefix('@') {
+                Some(list) => {
+                    let text =
+                        std::fs::read_to_string(list).map_err(|err| format!("{list}: {err}"))?;
+                    for line in text.lines().map(str::trim).filter(|l| !l.is_empty()) {
+                        cases.push(headless::Case::parse(line)?);
+                    }
+                }
+                None => cases.push(headless::Case::parse(&arg)?),
+            },
+        }
+    }
+
+    if [headless, pipeline, web]
+        .iter()
+        .filter(|&&mode| mode)
+        .count()
+        != 1
+    {
+        return Err("give one of --headless, --pipeline and --web".to_string());
+    }
+    if cases.is_empty() {
+        return Err("no ROMs given".to_string());
+    }
+    if !headless {
+        if cases.len() > 1 || cases[0].expected.is_some() {
+            return Err("--pipeline and --web run a single ROM, without a hash".to_string());
+        }
+        if stats
+            || wav.is_some()
+            || trace.is_some()
+            || profile.is_some()
+            || !input.is_empty()
+            || render_interval != 1
+            || rollback.is_some()
+            || run_ahead != 0
+        {
+            return Err(
+                "--stats, --wav, --trace, --profile, --input, --fast-forward, \
+                        --rollback and --run-ahead need --headless"
+                    .to_string(),
+            );
+        }
+    }
+    if [render_interval != 1, rollback.is_some(), run_ahead != 0]
+        .iter()
+        .filter(|&&mode| mode)
+        .count()
+        > 1
+    {
+        return Err("give at most one of --fast-forward, --rollback and --run-ahead".to_string());
+    }
+    #[cfg(target_arch = "wasm32")]
+    if web {
+        return Ok(Options::Web(cases.remove(0).path));
+    }
+    if pipeline {
+        let settings = pipeline::Settings {
+            frames,
+            refresh,
+            present_cost: Duration::from_secs_f64(present_ms / 1e3),
+        };
+        return Ok(Options::Pipeline(cases.remove(0).path, settings));
+    }
+    if wav.is_some() && cases.len() > 1 {
+        return Err("--wav records a single ROM".to_string());
+    }
+    if trace.is_some() && cases.len() > 1 {
+        return Err("--trace records a single ROM".to_string());
+    }
+    if profile.is_some() && cases.len() > 1 {
+        return Err("--profile samples a single ROM".to_string());
+    }
+    if labels.is_some() && profile.is_none() {
+        return Err("--labels needs --profile".to_string());
+    }
+    Ok(Options::Headless(
+        cases,
+        headless::Settings {
+            frames,
+            workers: jobs,
+            stats,
+            wav,
+            trace,
+            profile,
+            labels,
+            render_interval,
+            input,
+            rollback,
+            run_ahead,
+        },
+    ))
+}
+
+/// A machine with the ROM at `path` loaded, or None after reporting why
+/// it could not be.
+fn start(path: &str) -> Option<machine::Machine> {
+    let mut machine = machine::Machine::new();
+
+    match headless::load(&mut machine, path) {
+        Ok(()) => Some(machine),
+        Err(why) => {
+            eprintln!("emulator: {path}: {why}");
+            None
+        }
+    }
+}
+
+fn main() -> ExitCode {
+    match parse_args() {
+        Ok(options) => {
+            let passed = match options {
+                Options::Headless(cases, settings) => headless::run(cases, &settings),
+                Options::Pipeline(path, settings) => match start(&path) {
+                    Some(machine) => pipeline::run(machine, &path, &settings),
+                    None => false,
+                },
+                #[cfg(target_arch = "wasm32")]
+                Options::Web(path) => match start(&path) {
+                    Some(machine) => web::run(machine, &path),
+                    None => false,
+                },
+            };
+            if passed {
+                ExitCode::SUCCESS
+            } else {
+                ExitCode::FAILURE
+            }
+        }
+        Err(why) => {
+            if !why.is_empty() {
+                eprintln!("emulator: {why}");
+            }
+            eprintln!("{USAGE}");
+            ExitCode::from(2)
+        }
+    }
 }
@@ -0,0 +1,263 @@
+//! Pipeline mode: emulation and presentation on separate threads.
+//!
+//! The emulation thread runs the machine one frame at a time on the fixed
+//! timestep and publishes every finished frame into a triple buffer. The
+//! render thread wakes once per display refresh and presents the newest
+//! frame. A slow present never holds up emulation, and a slow frame never
+//! holds up presentation: the display shows the previous frame again.
+//!
+//! The render thread keeps its own copy of the picture, standing in for
+//! the GPU texture, and writes only the lines the PPU marked dirty into
+//! it, like a partial texture upload. A frame identical to the one shown
+//! is not presented at all.
+
+use std::thread;
+use std::time::{Duration, Instant};
+
+use crate::ffi::{self, DirtyLines, PPU_HEIGHT, PPU_WIDTH, StopReason};
+use crate::machine::Machine;
+use crate::triple::{self, Writer};
+
+/// How the pipeline runs.
+pub struct Settings {
+    /// Frames to emulate.
+    pub frames: u32,
+    /// Display refresh rate, in Hz.
+    pub refresh: f64,
+    /// Time each present takes, standing in for the GPU.
+    pub present_cost: Duration,
+}
+
+/// Frames the emulation may fall behind real time before it stops trying
+/// to catch up.
+const MAX_LAG: u32 = 4;
+
+/// The fixed timestep: one frame every 1/FRAME_RATE seconds.
+pub struct Timestep {
+    period: Duration,
+    due: Instant,
+}
+
+impl Timestep {
+    /// Starts with the first frame due now.
+    pub fn new() -> Timestep {
+        Timestep {
+            period: Duration::from_secs_f64(1.0 / f64::from(ffi::FRAME_RATE)),
+            due: Instant::now(),
+        }
+    }
+
+    /// Sleeps until the next frame is due. Returns whether it had fallen
+    /// more than MAX_LAG frames behind and skipped ahead instead.
+    pub fn wait(&mut self) -> bool {
+        let now = Instant::now();
+        let resync = if now < self.due {
+            thread::sleep(self.due - now);
+            false
+        } else if now - self.due > self.period * MAX_LAG {
+            self.due = now;
+            true
+        } else {
+            false
+        };
+        self.due += self.period;
+        resync
+    }
+}
+
+/// A finished frame on its way to the display.
+#[derive(Clone)]
+struct Slot {
+    /// Frame number, from 1; 0 before the first frame
+    frame: u32,
+    shades: Vec<u8>,
+    /// Lines that differ from the frame before
+    dirty: DirtyLines,
+    /// When the emulation thread published it
+    published: Instant,
+}
+
+/// Durations of one kind, summarized at the end.
+#[derive(Default)]
+struct Timings(Vec<Duration>);
+
+impl Timings {
+    fn record(&mut self, duration: Duration) {
+        self.0.push(duration);
+    }
+
+    fn mean(&self) -> Duration {
+        self.0.iter().sum::<Duration>() / (self.0.len().max(1) as u32)
+    }
+
+    /// Mean, 99th percentile and worst case, in milliseconds.
+    fn summary(&mut self) -> String {
+        let ms = |d: Duration| d.as_secs_f64() * 1e3;
+
+        self.0.sort();
+        let p99 = self
+            .0
+            .get(self.0.len() * 99 / 100)
+            .copied()
+            .unwrap_or_default();
+        let max = self.0.last().copied().unwrap_or_default();
+        format!(
+            "{:.2} ms mean, {:.2} p99, {:.2} max",
+            ms(self.mean()),
+            ms(p99),
+            ms(max)
+        )
+    }
+}
+
+/// What the emulation thread saw.
+struct Emulation {
+    frames: u32,
+    /// Wall time of each `run_frame()`
+    run: Timings,
+    /// Times it fell more than MAX_LAG frames behind and skipped ahead
+    resyncs: u32,
+    /// Frames replaced in the triple buffer before the display took them
+    unseen: u32,
+    stop: StopReason,
+    hash: u64,
+}
+
+/// The emulation thread: one frame per fixed timestep, each published as
+/// soon as it is done.
+fn emulate(mut machine: Machine, frames: u32, mut writer: Writer<Slot>) -> Emulation {
+    let mut timestep = Timestep::new();
+    let mut report = Emulation {
+        frames: 0,
+        run: Timings::default(),
+        resyncs: 0,
+        unseen: 0,
+        stop: StopReason::Budget,
+        hash: 0,
+    };
+
+    while report.frames < frames {
+        if timestep.wait() {
+            report.resyncs += 1;
+        }
+
+        let start = Instant::now();
+        report.stop = machine.run_frame();
+        report.run.record(start.elapsed());
+        report.frames += 1;
+
+        let front = machine.frames().front();
+        let slot = writer.back();
+        slot.frame = report.frames;
+        slot.shades.copy_from_slice(front.shades());
+        slot.dirty = front.dirty();
+        slot.published = Instant::now();
+        if writer.publish() {
+            report.unseen += 1;
+        }
+        if report.stop != StopReason::Budget {
+            break;
+        }
+    }
+    report.hash = machine.hash();
+    report
+}
+
+/// Runs `machine` in pipeline mode, prints the metrics and returns whether
+/// the ROM ran without an illegal opcode.
+pub fn run(machine: Machine, path: &str, settings: &Settings) -> bool {
+    let blank = Slot {
+        frame: 0,
+        shades: vec![0; PPU_WIDTH * PPU_HEIGHT],
+        dirty: DirtyLines::NONE,
+        published: Instant::now(),
+    };
+    let (writer, mut reader) = triple::triple(blank);
+    let refresh = Duration::from_secs_f64(1.0 / settings.refresh);
+    let mut latency = Timings::default();
+    // Presents by frames finished since the previous one: 0 (a repeat), 1,
+    // 2 or more (frames skipped)
+    let mut depths = [0u32; 3];
+    let mut missed = 0;
+    let mut shown = 0;
+    // The picture on screen, starting out blank like the PPU's buffers
+    let mut texture = vec![0; PPU_WIDTH * PPU_HEIGHT];
+    let mut uploaded = 0;
+    let mut identical = 0;
+
+    let start = Instant::now();
+    let mut emulation = thread::scope(|scope| {
+        let frames = settings.frames;
+        let emulation = scope.spawn(move || emulate(machine, frames, writer));
+        let mut vblank = Instant::now() + refresh;
+
+        loop {
+            let done = emulation.is_finished();
+            let now = Instant::now();
+            if now < vblank {
+                thread::sleep(vblank - now);
+                vblank += refresh;
+            } else {
+                // The last present overran its refresh
+                missed += 1;
+                vblank = now + refresh;
+            }
+
+            match reader.take() {
+                Some(slot) => {
+                    depths[((slot.frame - shown) as usize).min(2)] += 1;
+                    // The dirty lines are against the frame before; past
+                    // a skipped frame the whole texture is behind
+                    let dirty = if slot.frame == shown + 1 {
+                        slot.dirty
+                    } else {
+                        DirtyLines::all()
+                    };
+                    shown = slot.frame;
+                    if dirty == DirtyLines::NONE {
+                        identical += 1;
+                        continue;
+                    }
+                    for lines in dirty.runs() {
+                        let bytes = lines.start * PPU_WIDTH..lines.end * PPU_WIDTH;
+                        texture[bytes.clone()].copy_from_slice(&slot.shades[bytes]);
+                    }
+                    uploaded += dirty.count();
+                    debug_assert!(texture == slot.shades);
+                    thread::sleep(settings.present_cost);
+                    latency.record(slot.published.elapsed());
+                }
+                None if done => break,
+                None => depths[0] += 1,
+            }
+        }
+        emulation.join().expect("emulation thread panicked")
+    });
+    let elapsed = start.elapsed().as_secs_f64();
+
+    let period = 1.0 / f64::from(ffi::FRAME_RATE);
+    let headroom = 100.0 * (1.0 - emulation.run.mean().as_secs_f64() / period);
+    println!("{:?} {:016x} {path}", emulation.stop, emulation.hash);
+    eprintln!(
+        "emulation: {} frames in {elapsed:.3} s, run_frame {} ({headroom:.1}% headroom), {} resyncs",
+        emulation.frames,
+        emulation.run.summary(),
+        emulation.resyncs,
+    );
+    eprintln!(
+        "present:   {} at {} Hz, latency {}, {missed} refreshes missed",
+        latency.0.len(),
+        settings.refresh,
+        latency.summary(),
+    );
+    eprintln!(
+        "upload:    {uploaded} of {} lines ({:.1}%), {identical} identical frames not presented",
+        latency.0.len() * PPU_HEIGHT,
+        100.0 * uploaded as f64 / (latency.0.len() * PPU_HEIGHT).max(1) as f64,
+    );
+    eprintln!(
+        "queue depth at refresh: 0 (repeat) {}, 1 {}, 2+ {}; {} frames never shown",
+        depths[0], depths[1], depths[2], emulation.unseen,
+    );
+    emulation.stop != StopReason::Illegal
+}
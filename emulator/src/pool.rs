@@ -0,0 +1,69 @@
+//! A work-stealing thread pool for batches of independent jobs.
+//!
+//! Jobs are dealt round-robin to one queue per worker. A worker takes jobs
+//! from the front of its own queue and, once that is empty, steals from the
+//! back of the others, so long-running jobs never leave the rest of the
+//! machine idle.
+
+use std::collections::VecDeque;
+use std::sync::Mutex;
+use std::thread;
+
+/// Runs `work` on every job with `workers` threads and returns the results
+/// in job order.
+pub fn run<T, R, F>(jobs: Vec<T>, workers: usize, work: F) -> Vec<R>
+where
+    T: Send,
+    R: Send,
+    F: Fn(T) -> R + Sync,
+{
+    let count = jobs.len();
+    let workers = workers.clamp(1, count.max(1));
+    let queues: Vec<Mutex<VecDeque<(usize, T)>>> =
+        (0..workers).map(|_| Mutex::new(VecDeque::new())).collect();
+
+    for (index, job) in jobs.into_iter().enumerate() {
+        queues[index % workers]
+            .lock()
+            .unwrap()
+            .push_back((index, job));
+    }
+
+    let mut results: Vec<Option<R>> = (0..count).map(|_| None).collect();
+    thread::scope(|scope| {
+        let handles: Vec<_> = (0..workers)
+            .map(|me| {
+                let queues = &queues;
+                let work = &work;
+                scope.spawn(move || {
+                    let mut done = Vec::new();
+                    while let Some((index, job)) = next_job(queues, me) {
+                        done.push((index, work(job)));
+                    }
+                    done
+                })
+            })
+            .collect();
+
+        for handle in handles {
+            for (index, result) in handle.join().unwrap() {
+                results[index] = Some(result);
+            }
+        }
+    });
+
+    results.into_iter().map(Option::unwrap).collect()
+}
+
+/// Takes the next job for worker `me`, stealing when its queue is empty.
+///
+/// No jobs are added once the pool runs, so `None` means all work is taken.
+fn next_job<T>(queues: &[Mutex<VecDeque<(usize, T)>>], me: usize) -> Option<(usize, T)> {
+    if let Some(job) = queues[me].lock().unwrap().pop_front() {
+        return Some(job);
+    }
+    (1..queues.len()).find_map(|offset| {
+        let victim = (me + offset) % queues.len();
+        queues[victim].lock().unwrap().pop_back()
+    })
+}
@@ -0,0 +1,206 @@
+//! Rollback netplay and run-ahead on top of the kernel's rewind ring.
+//!
+//! Both rest on two properties of the machine: a frame is a pure function
+//! of the state before it and the buttons latched at its start, and a
+//! snapshot between frames is cheap (copy-on-write pages, see
+//! `kernel/rewind.h`). So the past can be rewritten by restoring a
+//! snapshot and replaying the frames since with other buttons, and the
+//! future can be shown by running ahead and coming back.
+//!
+//! Replayed and speculative frames are neither heard nor, except the
+//! last one, drawn: they only rebuild state, which is what makes them
+//! cheaper than the frames the player sees.
+
+use std::sync::Arc;
+
+use crate::ffi::{InputPort, StopReason};
+use crate::machine::Machine;
+
+/// Why remote buttons could not be applied: the frame they belong to is
+/// further back than the session keeps snapshots for.
+#[derive(Debug)]
+pub struct TooLate;
+
+/// A two-player session: pad 0 is the local player, whose buttons are
+/// known when a frame runs, and pad 1 the remote one, whose buttons
+/// arrive later and are predicted until then.
+pub struct Session {
+    port: Arc<InputPort>,
+    /// Frames that can still be rolled back
+    window: u32,
+    /// Buttons each frame ran with, pad 0 in the low byte
+    ran: Vec<u16>,
+    /// Remote buttons confirmed so far, for the first frames in order
+    remote: Vec<u8>,
+    /// Times a confirmation disagreed with the prediction
+    pub rollbacks: u64,
+    /// Frames run again after a rollback
+    pub resimulated: u64,
+}
+
+impl Session {
+    /// Starts a session on `machine`, which from now latches its input
+    /// from the session and keeps `window` snapshots. Remote buttons may
+    /// be confirmed up to `window` frames after their frame ran.
+    pub fn start(machine: &mut Machine, window: u32) -> Session {
+        let port = Arc::new(InputPort::new());
+
+        machine.set_input(Some(port.clone()));
+        machine.start_rewind(window.max(1));
+        Session {
+            port,
+            window: window.max(1),
+            ran: Vec::new(),
+            remote: Vec::new(),
+            rollbacks: 0,
+            resimulated: 0,
+        }
+    }
+
+    /// Frames run so far.
+    pub fn frames(&self) -> usize {
+        self.ran.len()
+    }
+
+    /// Frames whose remote buttons are confirmed; the frames after them
+    /// ran on predictions.
+    pub fn confirmed(&self) -> usize {
+        self.remote.len()
+    }
+
+    /// The remote buttons a frame runs with: those confirmed for it, or
+    /// else the last confirmed, as players mostly hold buttons down.
+    fn remote_at(&self, frame: usize) -> u8 {
+        match self.remote.get(frame) {
+            Some(&buttons) => buttons,
+            None => self.remote.last().copied().unwrap_or(0),
+        }
+    }
+
+    /// Publishes the buttons of a frame and runs it.
+    fn run(&mut self, machine: &mut Machine, frame: usize, local: u8) -> StopReason {
+        let buttons = u16::from(local) | u16::from(self.remote_at(frame)) << 8;
+
+        self.port.publish(buttons, frame as u64);
+        if frame == self.ran.len() {
+            self.ran.push(buttons);
+        } else {
+            self.ran[frame] = buttons;
+        }
+        machine.run_frame()
+    }
+
+    /// Runs the next frame with the local player holding `local`.
+    pub fn advance(&mut self, machine: &mut Machine, local: u8) -> StopReason {
+        machine.snapshot();
+        self.run(machine, self.ran.len(), local)
+    }
+
+    /// Confirms the remote buttons of the oldest frame not confirmed yet.
+    /// If that frame already ran with others, the machine goes back to it
+    /// and runs every frame since again. Returns why the last frame run
+    /// stopped, or `None` if nothing ran again.
+    ///
+    /// A replayed frame that stops early ends the replay there, with the
+    /// frames after it forgotten, as if they had never run.
+    ///
+    /// The replay draws only the frame it ends on, whatever the render
+    /// interval, and leaves the interval as it found it.
+    pub fn confirm(
+        &mut self,
+        machine: &mut Machine,
+        buttons: u8,
+    ) -> Result<Option<StopReason>, TooLate> {
+        let frame = self.remote.len();
+
+        if frame < self.ran.len() && self.ran.len() - frame > self.window as usize {
+            return Err(TooLate);
+        }
+        self.remote.push(buttons);
+        if frame >= self.ran.len() || (self.ran[frame] >> 8) as u8 == buttons {
+            return Ok(None);
+        }
+
+        // The snapshot taken before `frame` ran
+        let back = (self.ran.len() - 1 - frame) as u32;
+        machine.restore(back).map_err(|_| TooLate)?;
+        self.rollbacks += 1;
+
+        let end = self.ran.len();
+        let audio = machine.audio();
+        let interval = machine.render_interval();
+        machine.set_audio(None);
+        machine.set_render_interval(0);
+        let mut reason = StopReason::Budget;
+        for replayed in frame..end {
+            if replayed > frame {
+                machine.snapshot();
+            }
+            let last = replayed + 1 == end;
+            if last {
+                machine.set_render_interval(1);
+            }
+            let local = self.ran[replayed] as u8;
+            reason = self.run(machine, replayed, local);
+            self.resimulated += 1;
+            if reason != StopReason::Budget {
+                if !last {
+                    // Run it again drawn, so the picture is the one a
+                    // straight run would have stopped on
+                    let _ = machine.restore(0);
+                    machine.set_render_interval(1);
+                    reason = self.run(machine, replayed, local);
+                }
+                self.ran.truncate(replayed + 1);
+                break;
+            }
+        }
+        machine.set_render_interval(interval);
+        machine.set_audio(audio);
+        Ok(Some(reason))
+    }
+}
+
+/// Runs one frame on `machine`, then `ahead` more that are drawn but not
+/// kept: the picture is the one due `ahead` frames from now, which hides
+/// that many frames of input latency, while the state and the audio stay
+/// in the present. The machine needs two snapshots, see
+/// [`Machine::start_rewind`].
+///
+/// A frame that stops early is run again drawn, and nothing is run ahead.
+/// With `ahead` 0 this is a plain [`Machine::run_frame`].
+///
+/// Otherwise the frame shown is drawn whatever the render interval, and
+/// the interval is left as it was.
+pub fn run_ahead(machine: &mut Machine, ahead: u32) -> StopReason {
+    if ahead == 0 {
+        return machine.run_frame();
+    }
+    let interval = machine.render_interval();
+    machine.snapshot();
+    machine.set_render_interval(0);
+    let reason = machine.run_frame();
+    if reason != StopReason::Budget {
+        let _ = machine.restore(0);
+        machine.set_render_interval(1);
+        let reason = machine.run_frame();
+        machine.set_render_interval(interval);
+        return reason;
+    }
+
+    machine.snapshot();
+    let audio = machine.audio();
+    machine.set_audio(None);
+    for frame in 0..ahead {
+        if frame + 1 == ahead {
+            machine.set_render_interval(1);
+        }
+        if machine.run_frame() != StopReason::Budget {
+            break;
+        }
+    }
+    let _ = machine.restore(0);
+    machine.set_render_interval(interval);
+    machine.set_audio(audio);
+    reason
+}
@@ -0,0 +1,88 @@
+//! A lock-free triple buffer between one writer and one reader.
+//!
+//! The writer fills its back slot and publishes it; the reader takes the
+//! newest published slot. The third slot sits in the middle, so neither
+//! side ever waits for the other. A value the reader had no time for is
+//! simply replaced by a newer one.
+
+use std::cell::UnsafeCell;
+use std::sync::Arc;
+use std::sync::atomic::{AtomicU8, Ordering};
+
+/// Set in `middle` while the slot there was published but not yet taken.
+const FRESH: u8 = 4;
+/// Mask of the slot index in `middle`.
+const INDEX: u8 = 3;
+
+struct Shared<T> {
+    slots: [UnsafeCell<T>; 3],
+    /// Index of the middle slot, plus `FRESH`
+    middle: AtomicU8,
+}
+
+// Each slot is owned by exactly one side at a time, handed over through
+// `middle`, so a value is never touched by two threads at once.
+unsafe impl<T: Send> Sync for Shared<T> {}
+
+/// The publishing side of a triple buffer.
+pub struct Writer<T> {
+    shared: Arc<Shared<T>>,
+    back: u8,
+}
+
+/// The consuming side of a triple buffer.
+pub struct Reader<T> {
+    shared: Arc<Shared<T>>,
+    front: u8,
+}
+
+/// Creates a triple buffer whose three slots start out as `init`.
+pub fn triple<T: Clone>(init: T) -> (Writer<T>, Reader<T>) {
+    let shared = Arc::new(Shared {
+        slots: [
+            UnsafeCell::new(init.clone()),
+            UnsafeCell::new(init.clone()),
+            UnsafeCell::new(init),
+        ],
+        middle: AtomicU8::new(1),
+    });
+
+    (
+        Writer {
+            shared: shared.clone(),
+            back: 0,
+        },
+        Reader { shared, front: 2 },
+    )
+}
+
+impl<T> Writer<T> {
+    /// The slot to fill before the next [`Writer::publish`]. It holds an
+    /// older value, which may be overwritten in place.
+    pub fn back(&mut self) -> &mut T {
+        // SAFETY: the back slot belongs to the writer until it publishes.
+        unsafe { &mut *self.shared.slots[self.back as usize].get() }
+    }
+
+    /// Publishes the back slot as the newest value. Returns whether it
+    /// replaced a value the reader never took.
+    pub fn publish(&mut self) -> bool {
+        // Release hands the slot's contents over with the index
+        let old = self.shared.middle.swap(self.back | FRESH, Ordering::AcqRel);
+        self.back = old & INDEX;
+        old & FRESH != 0
+    }
+}
+
+impl<T> Reader<T> {
+    /// Takes the newest value if one was published since the last take.
+    pub fn take(&mut self) -> Option<&T> {
+        if self.shared.middle.load(Ordering::Relaxed) & FRESH == 0 {
+            return None;
+        }
+        let old = self.shared.middle.swap(self.front, Ordering::AcqRel);
+        self.front = old & INDEX;
+        // SAFETY: the front slot belongs to the reader until its next take.
+        Some(unsafe { &*self.shared.slots[self.front as usize].get() })
+    }
+}
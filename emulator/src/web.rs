@@ -0,0 +1,52 @@
+//! Web mode: the emulation side of the WebAssembly build.
+//!
+//! The page puts the module's linear memory in a `SharedArrayBuffer` and
+//! starts the emulator in a Web Worker (`web/worker.js`). Once the ROM is
+//! loaded, the worker hands the page the addresses of the PPU framebuffers
+//! and of the input port, and from then on the two sides only meet in
+//! that shared memory: the main thread reads the front framebuffer in
+//! place at every display refresh and stores the buttons straight into
+//! the port, with the same sequence and latch handshakes the native host
+//! uses. No frame or input is ever copied between them.
+
+use std::sync::Arc;
+
+use crate::ffi::{InputPort, PpuFrames, StopReason};
+use crate::machine::Machine;
+use crate::pipeline::Timestep;
+
+#[link(wasm_import_module = "rvm")]
+unsafe extern "C" {
+    /// Implemented by `web/worker.js`: passes both addresses on to the
+    /// main thread.
+    fn ready(frames: *const PpuFrames, input: *const InputPort);
+}
+
+/// Runs `machine` on the fixed timestep until the ROM stops, and returns
+/// whether it stopped without an illegal opcode.
+pub fn run(mut machine: Machine, path: &str) -> bool {
+    let input = Arc::new(InputPort::new());
+    let mut timestep = Timestep::new();
+    let mut resyncs = 0;
+
+    machine.set_input(Some(input.clone()));
+    // SAFETY: both live as long as `machine`, which never returns to the
+    // page once running; the page only reads the frames and stores inputs.
+    unsafe { ready(machine.frames(), Arc::as_ptr(&input)) };
+
+    let stop = loop {
+        if timestep.wait() {
+            resyncs += 1;
+        }
+        let stop = machine.run_frame();
+        if stop != StopReason::Budget {
+            break stop;
+        }
+    };
+    println!("{stop:?} {:016x} {path}", machine.hash());
+    eprintln!(
+        "web: {} frames, {resyncs} resyncs",
+        machine.frames().sequence()
+    );
+    stop != StopReason::Illegal
+}
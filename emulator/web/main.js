@@ -0,0 +1,155 @@
+// rvm-8/emulator/web/main.js
+//
+// Main thread side of the WebAssembly build: owns the shared linear
+// memory, starts the emulator in worker.js, then presents the PPU front
+// framebuffer at display refresh and publishes the keyboard as pad 0.
+//
+// Copyright (c) 2025 foxomax
+// SPDX-License-Identifier: MIT
+//
+// Frames and input never travel in messages. The worker only sends their
+// addresses; the framebuffer is read in place with the PPU's sequence
+// handshake (ppu.h), and input is stored straight into the InputPort
+// word (input.h) that the machine latches at every frame start. Only
+// the lines the PPU marked dirty are converted and put on the canvas,
+// and a frame identical to the one shown is not put at all.
+
+"use strict";
+
+const PPU_WIDTH = 160;
+const PPU_HEIGHT = 144;
+const PPU_PIXELS = PPU_WIDTH * PPU_HEIGHT;
+const PPU_LINE_WORDS = Math.ceil(PPU_HEIGHT / 32);
+
+// Shades 0 (lightest) to 3 (darkest), as RGBA words in memory order
+const PALETTE = new Uint32Array([0xFFD0F8E0, 0xFF70C088, 0xFF566834,
+                                 0xFF201808]);
+
+const BUTTONS = {
+  KeyX: 0x01,       // A
+  KeyZ: 0x02,       // B
+  ShiftRight: 0x04, // SELECT
+  Enter: 0x08,      // START
+  ArrowUp: 0x10,
+  ArrowDown: 0x20,
+  ArrowLeft: 0x40,
+  ArrowRight: 0x80,
+};
+
+// 64 KiB pages; the maximum must match the module's (1 GiB by default
+// for wasm32-wasip1-threads)
+const MEMORY_PAGES = 64;
+const MEMORY_MAX_PAGES = 16384;
+
+const canvas = document.getElementById("screen");
+const status = document.getElementById("status");
+const context = canvas.getContext("2d");
+const image = context.createImageData(PPU_WIDTH, PPU_HEIGHT);
+const pixels = new Uint32Array(image.data.buffer);
+
+function log(text) {
+  status.textContent += text + "\n";
+}
+
+/** Presents the newest frame at every refresh until the worker exits. */
+function present(memory, frames) {
+  const words = new Int32Array(memory.buffer);
+  const buffers = [
+    new Uint8Array(memory.buffer, frames + 4, PPU_PIXELS),
+    new Uint8Array(memory.buffer, frames + 4 + PPU_PIXELS, PPU_PIXELS),
+  ];
+  // PpuFrames.dirty, right after the buffers
+  const dirty = (frames + 4 + 2 * PPU_PIXELS) >> 2;
+  let shown = 0;
+
+  function isDirty(sequence, line) {
+    const word = words[dirty + (sequence & 1) * PPU_LINE_WORDS + (line >> 5)];
+    return (word >>> (line & 31)) & 1;
+  }
+
+  function refresh() {
+    const sequence = Atomics.load(words, frames >> 2);
+    if (sequence !== shown) {
+      const shades = buffers[sequence & 1];
+      // The dirty lines are against the frame before; past a frame that
+      // was never shown, the whole canvas is behind
+      const all = sequence !== shown + 1;
+      const runs = [];
+      for (let line = 0; line < PPU_HEIGHT; line++) {
+        if (!all && !isDirty(sequence, line))
+          continue;
+        for (let i = line * PPU_WIDTH; i < (line + 1) * PPU_WIDTH; i++)
+          pixels[i] = PALETTE[shades[i] & 3];
+        if (runs.length && runs[runs.length - 1].end === line)
+          runs[runs.length - 1].end++;
+        else
+          runs.push({start: line, end: line + 1});
+      }
+      // A frame published over while it was read may be torn; the next
+      // refresh shows the newer one instead, whole
+      if (Atomics.load(words, frames >> 2) === sequence) {
+        for (const {start, end} of runs)
+          context.putImageData(image, 0, 0, 0, start, PPU_WIDTH, end - start);
+        shown = sequence;
+      }
+    }
+    requestAnimationFrame(refresh);
+  }
+  requestAnimationFrame(refresh);
+}
+
+/** Publishes the keys held as pad 0, stamped in microseconds. */
+function attachInput(memory, input) {
+  const words = new BigUint64Array(memory.buffer);
+  let buttons = 0;
+
+  function publish() {
+    const stamp = BigInt.asUintN(48, BigInt(Math.round(performance.now() * 1e3)));
+    Atomics.store(words, input >> 3, BigInt(buttons) | stamp << 16n);
+  }
+  for (const [type, press] of [["keydown", true], ["keyup", false]]) {
+    addEventListener(type, (event) => {
+      const bit = BUTTONS[event.code];
+      if (!bit)
+        return;
+      event.preventDefault();
+      buttons = press ? buttons | bit : buttons & ~bit;
+      publish();
+    });
+  }
+}
+
+async function start(file) {
+  if (!crossOriginIsolated) {
+    log("SharedArrayBuffer needs a cross-origin isolated page, see README.md");
+    return;
+  }
+  const module = await WebAssembly.compileStreaming(fetch("emulator.wasm"));
+  const memory = new WebAssembly.Memory({
+    initial: MEMORY_PAGES,
+    maximum: MEMORY_MAX_PAGES,
+    shared: true,
+  });
+  const worker = new Worker("worker.js");
+
+  worker.onmessage = ({data}) => {
+    if (data.log !== undefined) {
+      log(data.log);
+    } else if (data.frames !== undefined) {
+      present(memory, data.frames);
+      attachInput(memory, data.input);
+    } else if (data.exit !== undefined) {
+      log(`exited with ${data.exit}`);
+    }
+  };
+  worker.postMessage({module, memory, name: file.name,
+                      rom: await file.arrayBuffer()});
+}
+
+document.getElementById("rom").addEventListener("change", (event) => {
+  const [file] = event.target.files;
+  if (file) {
+    event.target.disabled = true;
+    start(file);
+  }
+});
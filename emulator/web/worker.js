@@ -0,0 +1,264 @@
+// rvm-8/emulator/web/worker.js
+//
+// Web Worker side of the WebAssembly build: runs `emulator --web ROM` on
+// the shared linear memory the page created, and passes the addresses of
+// the framebuffers and the input port back to it.
+//
+// Copyright (c) 2025 foxomax
+// SPDX-License-Identifier: MIT
+//
+// Only the part of WASI the emulator uses is provided: arguments, the
+// clocks, sleeping, stdout/stderr and a read-only preopened "/" holding
+// the ROM. Everything else fails with ENOSYS.
+
+"use strict";
+
+const ESUCCESS = 0;
+const EBADF = 8;
+const EINVAL = 28;
+const ENOENT = 44;
+const ENOSYS = 52;
+
+const FILETYPE_CHARACTER_DEVICE = 2;
+const FILETYPE_DIRECTORY = 3;
+const FILETYPE_REGULAR_FILE = 4;
+
+const ROOT_FD = 3;
+
+class Exit {
+  constructor(code) {
+    this.code = code;
+  }
+}
+
+function wasi(memory, args, files) {
+  const encoder = new TextEncoder();
+  const decoder = new TextDecoder();
+  const argv = args.map((arg) => encoder.encode(arg + "\0"));
+  const open = new Map();
+  const lines = ["", ""];
+  const nap = new Int32Array(new SharedArrayBuffer(4));
+  let nextFd = ROOT_FD + 1;
+
+  // Views are made per call: the buffer object changes when memory grows
+  const view = () => new DataView(memory.buffer);
+  const bytes = (ptr, len) => new Uint8Array(memory.buffer, ptr, len);
+  // TextDecoder refuses views of shared memory, so decode a copy
+  const string = (ptr, len) => decoder.decode(bytes(ptr, len).slice());
+
+  function iovecs(iovs, count) {
+    const v = view();
+    const list = [];
+    for (let i = 0; i < count; i++)
+      list.push(bytes(v.getUint32(iovs + 8 * i, true),
+                      v.getUint32(iovs + 8 * i + 4, true)));
+    return list;
+  }
+
+  function filestat(ptr, filetype, size) {
+    const v = view();
+    bytes(ptr, 64).fill(0);
+    v.setUint8(ptr + 16, filetype);
+    v.setBigUint64(ptr + 24, 1n, true);
+    v.setBigUint64(ptr + 32, BigInt(size), true);
+  }
+
+  const imports = {
+    args_sizes_get(countPtr, sizePtr) {
+      const v = view();
+      v.setUint32(countPtr, argv.length, true);
+      v.setUint32(sizePtr, argv.reduce((n, arg) => n + arg.length, 0), true);
+      return ESUCCESS;
+    },
+    args_get(argvPtr, bufPtr) {
+      const v = view();
+      argv.forEach((arg, i) => {
+        v.setUint32(argvPtr + 4 * i, bufPtr, true);
+        bytes(bufPtr, arg.length).set(arg);
+        bufPtr += arg.length;
+      });
+      return ESUCCESS;
+    },
+    environ_sizes_get(countPtr, sizePtr) {
+      view().setUint32(countPtr, 0, true);
+      view().setUint32(sizePtr, 0, true);
+      return ESUCCESS;
+    },
+    environ_get() {
+      return ESUCCESS;
+    },
+    clock_time_get(id, precision, timePtr) {
+      const ms = id === 0 ? performance.timeOrigin + performance.now()
+                          : performance.now();
+      view().setBigUint64(timePtr, BigInt(Math.round(ms * 1e6)), true);
+      return ESUCCESS;
+    },
+    clock_res_get(id, resPtr) {
+      view().setBigUint64(resPtr, 1000n, true);
+      return ESUCCESS;
+    },
+    // Only clock subscriptions, which is how thread::sleep() waits
+    poll_oneoff(inPtr, outPtr, count, eventsPtr) {
+      const v = view();
+      let wait = 0;
+      for (let i = 0; i < count; i++) {
+        const sub = inPtr + 48 * i;
+        if (v.getUint8(sub + 8) !== 0)
+          return ENOSYS;
+        let ns = Number(v.getBigUint64(sub + 24, true));
+        if (v.getUint16(sub + 40, true) & 1)
+          ns -= performance.now() * 1e6;
+        wait = Math.max(wait, ns / 1e6);
+      }
+      if (wait > 0)
+        Atomics.wait(nap, 0, 0, wait);
+      for (let i = 0; i < count; i++) {
+        const event = outPtr + 32 * i;
+        v.setBigUint64(event, v.getBigUint64(inPtr + 48 * i, true), true);
+        v.setUint16(event + 8, 0, true);
+        v.setUint8(event + 10, 0);
+      }
+      v.setUint32(eventsPtr, count, true);
+      return ESUCCESS;
+    },
+    sched_yield() {
+      return ESUCCESS;
+    },
+    random_get(ptr, len) {
+      // getRandomValues refuses views of shared memory too
+      const random = new Uint8Array(len);
+      for (let i = 0; i < len; i += 65536)
+        crypto.getRandomValues(random.subarray(i, i + 65536));
+      bytes(ptr, len).set(random);
+      return ESUCCESS;
+    },
+    proc_exit(code) {
+      throw new Exit(code);
+    },
+    fd_prestat_get(fd, ptr) {
+      if (fd !== ROOT_FD)
+        return EBADF;
+      view().setUint8(ptr, 0);
+      view().setUint32(ptr + 4, 1, true);
+      return ESUCCESS;
+    },
+    fd_prestat_dir_name(fd, ptr, len) {
+      if (fd !== ROOT_FD)
+        return EBADF;
+      bytes(ptr, len).set(encoder.encode("/").subarray(0, len));
+      return ESUCCESS;
+    },
+    fd_fdstat_get(fd, ptr) {
+      const filetype = fd <= 2 ? FILETYPE_CHARACTER_DEVICE
+                     : fd === ROOT_FD ? FILETYPE_DIRECTORY
+                     : open.has(fd) ? FILETYPE_REGULAR_FILE : 0;
+      if (!filetype)
+        return EBADF;
+      const v = view();
+      bytes(ptr, 24).fill(0);
+      v.setUint8(ptr, filetype);
+      v.setBigUint64(ptr + 8, 0xFFFFFFFFFFFFFFFFn, true);
+      v.setBigUint64(ptr + 16, 0xFFFFFFFFFFFFFFFFn, true);
+      return ESUCCESS;
+    },
+    fd_fdstat_set_flags() {
+      return ESUCCESS;
+    },
+    path_open(dirFd, dirFlags, pathPtr, pathLen, oflags, base, inheriting,
+              fdFlags, fdPtr) {
+      const data = files.get(string(pathPtr, pathLen));
+      if (dirFd !== ROOT_FD)
+        return EBADF;
+      if (data === undefined)
+        return ENOENT;
+      open.set(nextFd, {data, pos: 0});
+      view().setUint32(fdPtr, nextFd++, true);
+      return ESUCCESS;
+    },
+    path_filestat_get(dirFd, flags, pathPtr, pathLen, ptr) {
+      const data = files.get(string(pathPtr, pathLen));
+      if (data === undefined)
+        return ENOENT;
+      filestat(ptr, FILETYPE_REGULAR_FILE, data.length);
+      return ESUCCESS;
+    },
+    fd_filestat_get(fd, ptr) {
+      const file = open.get(fd);
+      if (!file)
+        return EBADF;
+      filestat(ptr, FILETYPE_REGULAR_FILE, file.data.length);
+      return ESUCCESS;
+    },
+    fd_read(fd, iovs, count, readPtr) {
+      const file = open.get(fd);
+      let read = 0;
+      if (!file && fd !== 0)
+        return EBADF;
+      for (const iov of file ? iovecs(iovs, count) : []) {
+        const chunk = file.data.subarray(file.pos, file.pos + iov.length);
+        iov.set(chunk);
+        file.pos += chunk.length;
+        read += chunk.length;
+      }
+      view().setUint32(readPtr, read, true);
+      return ESUCCESS;
+    },
+    fd_seek(fd, offset, whence, posPtr) {
+      const file = open.get(fd);
+      if (!file)
+        return EBADF;
+      const base = [0, file.pos, file.data.length][whence];
+      const pos = base + Number(offset);
+      if (base === undefined || pos < 0)
+        return EINVAL;
+      file.pos = pos;
+      view().setBigUint64(posPtr, BigInt(pos), true);
+      return ESUCCESS;
+    },
+    fd_close(fd) {
+      return open.delete(fd) ? ESUCCESS : EBADF;
+    },
+    // stdout and stderr go to the page a line at a time
+    fd_write(fd, iovs, count, writtenPtr) {
+      let written = 0;
+      if (fd !== 1 && fd !== 2)
+        return EBADF;
+      for (const iov of iovecs(iovs, count)) {
+        lines[fd - 1] += decoder.decode(iov.slice(), {stream: true});
+        written += iov.length;
+      }
+      const text = lines[fd - 1].split("\n");
+      lines[fd - 1] = text.pop();
+      for (const line of text)
+        postMessage({log: line, stream: fd === 1 ? "stdout" : "stderr"});
+      view().setUint32(writtenPtr, written, true);
+      return ESUCCESS;
+    },
+  };
+
+  return new Proxy(imports, {
+    get: (target, name) => target[name] ?? (() => ENOSYS),
+  });
+}
+
+onmessage = async ({data: {module, memory, name, rom}}) => {
+  const path = "rom/" + name.replace(/[^\w.-]/g, "_");
+  const instance = await WebAssembly.instantiate(module, {
+    env: {memory},
+    // --web runs on this one thread
+    wasi: {"thread-spawn": () => -1},
+    wasi_snapshot_preview1: wasi(memory, ["emulator", "--web", "/" + path],
+                                 new Map([[path, new Uint8Array(rom)]])),
+    rvm: {ready: (frames, input) => postMessage({frames, input})},
+  });
+  let code = 0;
+
+  try {
+    instance.exports._start();
+  } catch (err) {
+    if (!(err instanceof Exit))
+      throw err;
+    code = err.code;
+  }
+  postMessage({exit: code});
+};
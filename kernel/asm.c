@@ -0,0 +1,1251 @@
+/*
+ * rvm-8/kernel/asm.c
+ *
+ * Two-pass assembler for rvm-8.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ *
+ * Notes:
+ * - Each file is read into the arena once and lexed twice: the first
+ *   run only counts tokens, so the token array can be allocated from
+ *   the arena at its exact size. Tokens point into the source text.
+ * - Pass 1 records one Stmt per instruction or data directive, holding
+ *   its address and the tokens of its operands. Pass 2 only walks that
+ *   list, so macros and includes are expanded exactly once.
+ * - An instruction's size is fixed in pass 1: an operand is assembled
+ *   as zero page only if its value is already known there and fits in
+ *   a byte. Forward references get the absolute form.
+ * - Symbols starting with '@' inside a macro body are local to one
+ *   expansion.
+ * - Errors unwind to asm_assemble() with longjmp(), so the parser can
+ *   stop at the first one without checking every call.
+ */
+
+#include "asm.h"
+#include "cpu.h"
+#include "isa.h"
+#include "rom.h"
+#include <ctype.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_CHUNK (64 * 1024)
+#define MAX_DEPTH 32 // Nesting of includes and macro expansions
+#define MODE_COUNT (MODE_RELATIVE + 1)
+#define FNV_OFFSET 0xCBF29CE484222325ull
+#define FNV_PRIME 0x100000001B3ull
+
+/* What a page of output holds */
+enum { PAGE_NONE, PAGE_CODE, PAGE_DATA, PAGE_TILES };
+
+/* --- Arena ------------------------------------------------------------ */
+
+typedef struct ArenaChunk {
+  struct ArenaChunk *next;
+  size_t used;
+  size_t cap;
+  max_align_t data[];
+} ArenaChunk;
+
+/* --- Tokens and statements -------------------------------------------- */
+
+typedef enum { TOK_EOL, TOK_IDENT, TOK_NUMBER, TOK_STRING, TOK_PUNCT } TokenKind;
+
+typedef struct {
+  /** Source text; for strings, the contents between the quotes */
+  const char *text;
+  uint32_t len;
+  uint32_t line;
+  /** TOK_NUMBER: the value, TOK_PUNCT: the character */
+  int32_t value;
+  uint16_t file;
+  uint8_t kind;
+} Token;
+
+typedef enum { STMT_INSN, STMT_BYTES, STMT_WORDS } StmtKind;
+
+typedef struct Stmt {
+  struct Stmt *next;
+  /** Operand tokens: the expression, or the list of a data directive */
+  const Token *args;
+  const Token *args_end;
+  /** First token of the line, for error messages */
+  const Token *where;
+  uint16_t pc;
+  /** File the emitted bytes count as exports of */
+  uint16_t owner;
+  uint8_t kind;
+  uint8_t opcode;
+  uint8_t mode;
+  uint8_t section;
+} Stmt;
+
+typedef struct {
+  const Token *params;
+  unsigned param_count;
+  const Token *body;
+  const Token *body_end;
+} Macro;
+
+/* --- Symbol tables ---------------------------------------------------- */
+
+typedef struct {
+  const char *name;
+  uint32_t len;
+  uint32_t hash;
+  int32_t value;
+  /** Macro* for macros, int16_t[MODE_COUNT] opcodes for mnemonics */
+  const void *data;
+  /** Symbols: defined as a label, not with '=' or .equ */
+  uint8_t label;
+} Entry;
+
+/** Open-addressing hash table with linear probing */
+typedef struct {
+  Entry *slots;
+  uint32_t cap;
+  uint32_t count;
+} Table;
+
+struct Asm {
+  ArenaChunk *arena;
+  Table symbols;
+  Table macros;
+  Table mnemonics;
+  AsmFile *files;
+  unsigned file_count;
+  unsigned file_cap;
+  Stmt *stmts;
+  Stmt **stmt_tail;
+  uint32_t pc;
+  uint8_t section;
+  int depth;
+  unsigned expansions;
+  jmp_buf fail;
+  int failed;
+  char error[256];
+  int has_palette;
+  uint8_t palette[2];
+  uint8_t page_kind[BUS_PAGE_COUNT];
+  uint8_t written[RVM_MEM_SIZE / 8];
+  uint8_t image[RVM_MEM_SIZE];
+};
+
+/* --- Errors ----------------------------------------------------------- */
+
+/**
+ * @brief Records an error at a token and unwinds to asm_assemble().
+ */
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((noreturn, format(printf, 3, 4)))
+#endif
+static void
+asm_fail(Asm *as, const Token *at, const char *fmt, ...) {
+  va_list args;
+  int n = 0;
+
+  if (at != NULL)
+    n = snprintf(as->error, sizeof(as->error), "%s:%u: ",
+                 as->files[at->file].path, (unsigned)at->line);
+  if (n < 0 || (size_t)n >= sizeof(as->error))
+    n = 0;
+  va_start(args, fmt);
+  vsnprintf(as->error + n, sizeof(as->error) - n, fmt, args);
+  va_end(args);
+  as->failed = 1;
+  longjmp(as->fail, 1);
+}
+
+static void *asm_alloc(Asm *as, size_t size) {
+  ArenaChunk *chunk = as->arena;
+
+  size = (size + sizeof(max_align_t) - 1) & ~(sizeof(max_align_t) - 1);
+  if (chunk == NULL || chunk->cap - chunk->used < size) {
+    size_t cap = size > ARENA_CHUNK ? size : ARENA_CHUNK;
+
+    chunk = malloc(sizeof(ArenaChunk) + cap);
+    if (chunk == NULL)
+      asm_fail(as, NULL, "out of memory");
+    chunk->next = as->arena;
+    chunk->used = 0;
+    chunk->cap = cap;
+    as->arena = chunk;
+  }
+
+  void *p = (char *)chunk->data + chunk->used;
+  chunk->used += size;
+  return p;
+}
+
+/* --- Hashing ---------------------------------------------------------- */
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t size) {
+  const uint8_t *p = data;
+
+  for (size_t i = 0; i < size; i++) {
+    hash ^= p[i];
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+/**
+ * @brief Folds an export event into a file's exports hash.
+ */
+static void asm_export(Asm *as, unsigned file, char tag, const void *data,
+                       size_t size) {
+  AsmFile *f = &as->files[file];
+
+  f->exports = fnv1a(f->exports, &tag, 1);
+  f->exports = fnv1a(f->exports, data, size);
+}
+
+static uint32_t hash_name(const char *name, uint32_t len) {
+  return (uint32_t)fnv1a(FNV_OFFSET, name, len);
+}
+
+/* --- Tables ----------------------------------------------------------- */
+
+static Entry *table_probe(const Table *t, const char *name, uint32_t len,
+                          uint32_t hash) {
+  uint32_t mask = t->cap - 1;
+
+  for (uint32_t i = hash & mask;; i = (i + 1) & mask) {
+    Entry *e = &t->slots[i];
+    if (e->name == NULL ||
+        (e->hash == hash && e->len == len && memcmp(e->name, name, len) == 0))
+      return e;
+  }
+}
+
+static const Entry *table_find(const Table *t, const char *name,
+                               uint32_t len) {
+  if (t->cap == 0)
+    return NULL;
+
+  const Entry *e = table_probe(t, name, len, hash_name(name, len));
+  return e->name ? e : NULL;
+}
+
+/**
+ * @brief Adds a name, growing the table past 3/4 full.
+ *
+ * @return The new entry, or NULL if the name is already there.
+ */
+static Entry *table_add(Asm *as, Table *t, const char *name, uint32_t len) {
+  if ((t->count + 1) * 4 > t->cap * 3) {
+    Table grown = {calloc(t->cap ? 2 * t->cap : 64, sizeof(Entry)),
+                   t->cap ? 2 * t->cap : 64, t->count};
+    if (grown.slots == NULL)
+      asm_fail(as, NULL, "out of memory");
+    for (uint32_t i = 0; i < t->cap; i++) {
+      const Entry *e = &t->slots[i];
+      if (e->name)
+        *table_probe(&grown, e->name, e->len, e->hash) = *e;
+    }
+    free(t->slots);
+    *t = grown;
+  }
+
+  uint32_t hash = hash_name(name, len);
+  Entry *e = table_probe(t, name, len, hash);
+  if (e->name)
+    return NULL;
+  *e = (Entry){name, len, hash, 0, NULL};
+  t->count++;
+  return e;
+}
+
+/* --- Lexer ------------------------------------------------------------ */
+
+static int is_ident_start(char c) {
+  return isalpha((unsigned char)c) || c == '_' || c == '.' || c == '@';
+}
+
+static int is_ident_char(char c) {
+  return is_ident_start(c) || isdigit((unsigned char)c);
+}
+
+static int digit_value(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return 99;
+}
+
+/**
+ * @brief Lexes a whole file.
+ *
+ * @param out Token array, or NULL to only count.
+ * @return Number of tokens, always ending in TOK_EOL.
+ */
+static uint32_t asm_lex(Asm *as, const char *src, size_t size, uint16_t file,
+                        Token *out) {
+  const char *p = src, *end = src + size;
+  uint32_t count = 0, line = 1;
+
+  for (;;) {
+    Token tok = {p, 1, line, 0, file, TOK_PUNCT};
+
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+      p++;
+    if (p < end && *p == ';')
+      while (p < end && *p != '\n')
+        p++;
+    if (p == end) {
+      if (out)
+        out[count] = (Token){p, 0, line, 0, file, TOK_EOL};
+      return count + 1;
+    }
+
+    tok.text = p;
+    if (*p == '\n') {
+      tok.kind = TOK_EOL;
+      p++;
+      line++;
+    } else if (is_ident_start(*p)) {
+      tok.kind = TOK_IDENT;
+      while (p < end && is_ident_char(*p))
+        p++;
+    } else if (isdigit((unsigned char)*p) || *p == '$' ||
+               (*p == '%' && p + 1 < end && (p[1] == '0' || p[1] == '1'))) {
+      int base = 10;
+
+      if (*p == '$') {
+        base = 16;
+        p++;
+      } else if (*p == '%') {
+        base = 2;
+        p++;
+      } else if (*p == '0' && p + 1 < end && (p[1] == 'x' || p[1] == 'X')) {
+        base = 16;
+        p += 2;
+      }
+      tok.kind = TOK_NUMBER;
+      const char *digits = p;
+      int64_t value = 0;
+      for (; p < end && is_ident_char(*p); p++) {
+        int d = digit_value(*p);
+        if (d >= base)
+          asm_fail(as, &tok, "bad digit '%c' in number", *p);
+        value = value * base + d;
+        if (value > INT32_MAX)
+          asm_fail(as, &tok, "number is too large");
+      }
+      if (p == digits)
+        asm_fail(as, &tok, "number has no digits");
+      tok.value = (int32_t)value;
+    } else if (*p == '\'') {
+      if (p + 2 >= end || p[2] != '\'')
+        asm_fail(as, &tok, "bad character literal");
+      tok.kind = TOK_NUMBER;
+      tok.value = (uint8_t)p[1];
+      p += 3;
+    } else if (*p == '"') {
+      tok.kind = TOK_STRING;
+      tok.text = ++p;
+      while (p < end && *p != '"' && *p != '\n')
+        p += (*p == '\\' && p + 1 < end) ? 2 : 1;
+      if (p >= end || *p != '"')
+        asm_fail(as, &tok, "unterminated string");
+      tok.len = (uint32_t)(p - tok.text);
+      p++;
+    } else if (strchr("#,()+-<>:=*", *p)) {
+      tok.value = *p++;
+    } else {
+      asm_fail(as, &tok, "unexpected character '%c'", *p);
+    }
+
+    if (tok.kind == TOK_IDENT || tok.kind == TOK_NUMBER)
+      tok.len = (uint32_t)(p - tok.text);
+    if (out)
+      out[count] = tok;
+    count++;
+  }
+}
+
+/* --- Files ------------------------------------------------------------ */
+
+/**
+ * @brief Reads and lexes a file, adding it to the file list.
+ *
+ * @return Index of the file.
+ */
+static unsigned asm_load_file(Asm *as, const char *path, const Token *from,
+                              const Token **tokens, uint32_t *count) {
+  FILE *f = fopen(path, "rb");
+  char *src = NULL;
+  long size = -1;
+
+  if (f != NULL && fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) >= 0 &&
+      fseek(f, 0, SEEK_SET) == 0) {
+    src = asm_alloc(as, size + 1);
+    if (fread(src, 1, size, f) != (size_t)size)
+      size = -1;
+  }
+  if (f != NULL)
+    fclose(f);
+  if (size < 0)
+    asm_fail(as, from, "cannot read %s", path);
+
+  if (as->file_count == as->file_cap) {
+    unsigned cap = as->file_cap ? 2 * as->file_cap : 8;
+    AsmFile *files = realloc(as->files, cap * sizeof(AsmFile));
+    if (files == NULL || cap > UINT16_MAX)
+      asm_fail(as, from, "too many files");
+    as->files = files;
+    as->file_cap = cap;
+  }
+
+  unsigned index = as->file_count++;
+  char *name = asm_alloc(as, strlen(path) + 1);
+  strcpy(name, path);
+  as->files[index] = (AsmFile){name, fnv1a(FNV_OFFSET, src, size), FNV_OFFSET};
+
+  *count = asm_lex(as, src, size, index, NULL);
+  Token *toks = asm_alloc(as, *count * sizeof(Token));
+  asm_lex(as, src, size, index, toks);
+  *tokens = toks;
+  return index;
+}
+
+int asm_hash_file(const char *path, uint64_t *hash) {
+  FILE *f = fopen(path, "rb");
+  uint8_t buf[4096];
+  size_t n;
+
+  if (f == NULL)
+    return -1;
+  *hash = FNV_OFFSET;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    *hash = fnv1a(*hash, buf, n);
+  fclose(f);
+  return 0;
+}
+
+/* --- Expressions ------------------------------------------------------ */
+
+static int is_punct(const Token *t, const Token *end, char c) {
+  return t < end && t->kind == TOK_PUNCT && t->value == c;
+}
+
+static int ident_is(const Token *t, const char *word) {
+  size_t len = strlen(word);
+
+  if (t->kind != TOK_IDENT || t->len != len)
+    return 0;
+  for (size_t i = 0; i < len; i++)
+    if (tolower((unsigned char)t->text[i]) != word[i])
+      return 0;
+  return 1;
+}
+
+/**
+ * @brief Evaluates [t, end): an optional < or > (low or high byte) and
+ * terms joined by + and -. A term is a number, a symbol, * (the current
+ * address) or a negated term.
+ *
+ * @param must Fail on undefined symbols instead of returning 0.
+ * @return 1 if every symbol was defined, 0 otherwise.
+ */
+static int asm_eval(Asm *as, const Token *t, const Token *end, uint32_t pc,
+                    int32_t *value, int must) {
+  const Token *start = t;
+  int select = 0, known = 1;
+  int64_t total = 0;
+
+  if (t == end)
+    asm_fail(as, t, "expected an expression");
+  if (is_punct(t, end, '<') || is_punct(t, end, '>'))
+    select = (t++)->value;
+
+  for (int sign = 1;;) {
+    int negate = 0;
+    int64_t term = 0;
+
+    while (is_punct(t, end, '-')) {
+      negate ^= 1;
+      t++;
+    }
+    if (t == end)
+      asm_fail(as, start, "expression ends early");
+
+    if (t->kind == TOK_NUMBER) {
+      term = t->value;
+    } else if (t->kind == TOK_IDENT) {
+      const Entry *e = table_find(&as->symbols, t->text, t->len);
+      if (e != NULL)
+        term = e->value;
+      else if (must)
+        asm_fail(as, t, "undefined symbol %.*s", (int)t->len, t->text);
+      else
+        known = 0;
+    } else if (is_punct(t, end, '*')) {
+      term = pc;
+    } else {
+      asm_fail(as, t, "expected a number or symbol");
+    }
+    t++;
+    total += sign * (negate ? -term : term);
+
+    if (t == end)
+      break;
+    if (is_punct(t, end, '+'))
+      sign = 1;
+    else if (is_punct(t, end, '-'))
+      sign = -1;
+    else
+      asm_fail(as, t, "unexpected token in expression");
+    t++;
+  }
+
+  if (total < INT32_MIN || total > INT32_MAX)
+    asm_fail(as, start, "value is out of range");
+  if (select == '<')
+    total &= 0xFF;
+  else if (select == '>')
+    total = (total >> 8) & 0xFF;
+  *value = (int32_t)total;
+  return known;
+}
+
+/**
+ * @brief Splits [t, end) at top-level commas.
+ *
+ * @param parts Start of each part, followed by one past the last part's
+ *        end (so part i is parts[i] to parts[i + 1] - 1); max + 1 entries.
+ * @return Number of parts, or max + 1 if there are more than max.
+ */
+static unsigned asm_split(const Token *t, const Token *end,
+                          const Token **parts, unsigned max) {
+  unsigned n = 0;
+  int depth = 0;
+
+  if (t == end)
+    return 0;
+  parts[n++] = t;
+  for (; t < end; t++) {
+    if (is_punct(t, end, '('))
+      depth++;
+    else if (is_punct(t, end, ')'))
+      depth--;
+    else if (is_punct(t, end, ',') && depth == 0) {
+      if (n == max)
+        return max + 1;
+      parts[n++] = t + 1;
+    }
+  }
+  parts[n] = end + 1;
+  return n;
+}
+
+/* --- Pass 1 ----------------------------------------------------------- */
+
+static void asm_define(Asm *as, const Token *name, int32_t value, int label,
+                       unsigned owner) {
+  Entry *e = table_add(as, &as->symbols, name->text, name->len);
+
+  if (e == NULL)
+    asm_fail(as, name, "%.*s is already defined", (int)name->len, name->text);
+  e->value = value;
+  e->label = (uint8_t)label;
+  if (name->text[0] == '@')
+    return; // Local to a macro expansion
+  asm_export(as, owner, 'S', name->text, name->len);
+  asm_export(as, owner, '=', &value, sizeof(value));
+}
+
+static Stmt *asm_add_stmt(Asm *as, StmtKind kind, const Token *where,
+                          const Token *args, const Token *args_end,
+                          unsigned size, unsigned owner) {
+  Stmt *s = asm_alloc(as, sizeof(Stmt));
+
+  if (as->pc + size > RVM_MEM_SIZE)
+    asm_fail(as, where, "program runs past $FFFF");
+  *s = (Stmt){NULL, args, args_end, where, (uint16_t)as->pc, (uint16_t)owner,
+              kind, 0, 0, as->section};
+  *as->stmt_tail = s;
+  as->stmt_tail = &s->next;
+  as->pc += size;
+  return s;
+}
+
+/**
+ * @brief Size of a string literal once escapes are processed.
+ */
+static unsigned asm_string_size(const Token *t) {
+  unsigned n = 0;
+
+  for (uint32_t i = 0; i < t->len; i++, n++)
+    if (t->text[i] == '\\')
+      i++;
+  return n;
+}
+
+static void asm_instruction(Asm *as, const Token *mn, const Token *end,
+                            const int16_t *opcodes, unsigned owner) {
+  const Token *t = mn + 1, *expr = t, *expr_end = end;
+  int mode;
+
+#define HAS(m) (opcodes[MODE_##m] >= 0)
+  if (t == end) {
+    mode = HAS(IMPLIED) ? MODE_IMPLIED : MODE_ACCUMULATOR;
+  } else if (end - t == 1 && ident_is(t, "a") && HAS(ACCUMULATOR)) {
+    mode = MODE_ACCUMULATOR;
+    expr = expr_end = end;
+  } else if (is_punct(t, end, '#')) {
+    mode = MODE_IMMEDIATE;
+    expr = t + 1;
+  } else if (is_punct(t, end, '(')) {
+    expr = t + 1;
+    if (end - t >= 5 && is_punct(end - 1, end, ')') && ident_is(end - 2, "x") &&
+        is_punct(end - 3, end, ',')) {
+      mode = MODE_INDIRECT_X;
+      expr_end = end - 3;
+    } else if (end - t >= 5 && ident_is(end - 1, "y") &&
+               is_punct(end - 2, end, ',') && is_punct(end - 3, end, ')')) {
+      mode = MODE_INDIRECT_Y;
+      expr_end = end - 3;
+    } else if (is_punct(end - 1, end, ')')) {
+      mode = MODE_INDIRECT;
+      expr_end = end - 1;
+    } else {
+      asm_fail(as, t, "bad indirect operand");
+    }
+  } else {
+    int32_t value;
+    int zp, abs;
+
+    if (end - t >= 3 && is_punct(end - 2, end, ',') &&
+        (ident_is(end - 1, "x") || ident_is(end - 1, "y"))) {
+      int x = ident_is(end - 1, "x");
+      zp = x ? MODE_ZEROPAGE_X : MODE_ZEROPAGE_Y;
+      abs = x ? MODE_ABSOLUTE_X : MODE_ABSOLUTE_Y;
+      expr_end = end - 2;
+    } else if (HAS(RELATIVE)) {
+      zp = abs = MODE_RELATIVE;
+    } else {
+      zp = MODE_ZEROPAGE;
+      abs = MODE_ABSOLUTE;
+    }
+
+    if (opcodes[zp] >= 0 && opcodes[abs] >= 0)
+      mode = asm_eval(as, expr, expr_end, as->pc, &value, 0) && value >= 0 &&
+                     value <= 0xFF
+                 ? zp
+                 : abs;
+    else
+      mode = opcodes[zp] >= 0 ? zp : abs;
+  }
+#undef HAS
+
+  if (opcodes[mode] < 0)
+    asm_fail(as, mn, "%.*s does not take this operand", (int)mn->len,
+             mn->text);
+
+  Stmt *s = asm_add_stmt(as, STMT_INSN, mn, expr, expr_end,
+                         instruction_size(mode), owner);
+  s->opcode = (uint8_t)opcodes[mode];
+  s->mode = (uint8_t)mode;
+}
+
+static void asm_data(Asm *as, const Token *dir, const Token *end, int words,
+                     unsigned owner) {
+  const Token *parts[257];
+  unsigned n = asm_split(dir + 1, end, parts, 256), size = 0;
+
+  if (n == 0)
+    asm_fail(as, dir, "%.*s needs at least one value", (int)dir->len,
+             dir->text);
+  if (n > 256)
+    asm_fail(as, dir, "too many values on one line");
+  for (unsigned i = 0; i < n; i++) {
+    const Token *item = parts[i], *item_end = parts[i + 1] - 1;
+
+    if (item_end - item == 1 && item->kind == TOK_STRING && !words)
+      size += asm_string_size(item);
+    else if (item == item_end)
+      asm_fail(as, dir, "empty value in list");
+    else
+      size += words ? 2 : 1;
+  }
+
+  asm_add_stmt(as, words ? STMT_WORDS : STMT_BYTES, dir, dir + 1, end, size,
+               owner);
+}
+
+static void asm_process(Asm *as, const Token *t, const Token *end,
+                        unsigned owner);
+
+static void asm_include(Asm *as, const Token *dir, const Token *end,
+                        unsigned owner) {
+  const Token *name = dir + 1;
+
+  if (end - dir != 2 || name->kind != TOK_STRING)
+    asm_fail(as, dir, ".include needs a file name in quotes");
+
+  // Relative to the directory of the including file
+  const char *from = as->files[name->file].path;
+  const char *slash = strrchr(from, '/');
+  size_t dir_len = name->text[0] == '/' || slash == NULL ? 0 : slash - from + 1;
+  char *path = asm_alloc(as, dir_len + name->len + 1);
+  memcpy(path, from, dir_len);
+  memcpy(path + dir_len, name->text, name->len);
+  path[dir_len + name->len] = 0;
+
+  asm_export(as, owner, 'I', name->text, name->len);
+  for (unsigned i = 0; i < as->file_count; i++)
+    if (strcmp(as->files[i].path, path) == 0)
+      return; // Already included
+
+  if (as->depth >= MAX_DEPTH)
+    asm_fail(as, dir, "includes nest too deeply");
+
+  const Token *toks;
+  uint32_t count;
+  unsigned file = asm_load_file(as, path, dir, &toks, &count);
+
+  as->depth++;
+  asm_process(as, toks, toks + count, file);
+  as->depth--;
+
+  // Where the file leaves the origin and section matters to its includer
+  uint8_t state[3] = {(uint8_t)as->pc, (uint8_t)(as->pc >> 8), as->section};
+  asm_export(as, file, 'E', state, sizeof(state));
+}
+
+/**
+ * @brief Records a .macro definition.
+ *
+ * @return The .endm line's EOL token.
+ */
+static const Token *asm_macro(Asm *as, const Token *dir, const Token *end,
+                              unsigned owner) {
+  const Token *t = dir + 1, *eol = dir;
+
+  while (eol->kind != TOK_EOL)
+    eol++;
+  if (t == eol || t->kind != TOK_IDENT)
+    asm_fail(as, dir, ".macro needs a name");
+
+  Macro *m = asm_alloc(as, sizeof(Macro));
+  Token *params = asm_alloc(as, (eol - t) * sizeof(Token));
+  m->params = params;
+  m->param_count = 0;
+  for (const Token *p = t + 1; p < eol; p++) {
+    if (p->kind == TOK_IDENT)
+      params[m->param_count++] = *p;
+    else if (!is_punct(p, eol, ','))
+      asm_fail(as, p, "bad macro parameter");
+  }
+
+  // The body runs to the first line starting with .endm
+  m->body = eol + 1;
+  const Token *line = eol + 1;
+  for (;;) {
+    if (line >= end)
+      asm_fail(as, dir, ".macro without .endm");
+    if (ident_is(line, ".endm"))
+      break;
+    if (ident_is(line, ".macro"))
+      asm_fail(as, line, "macros cannot be defined inside macros");
+    while (line->kind != TOK_EOL)
+      line++;
+    line++;
+  }
+  m->body_end = line;
+
+  Entry *e = table_add(as, &as->macros, t->text, t->len);
+  if (e == NULL)
+    asm_fail(as, t, "macro %.*s is already defined", (int)t->len, t->text);
+  e->data = m;
+
+  asm_export(as, owner, 'M', t->text, t->len);
+  for (const Token *b = m->params; b < m->params + m->param_count; b++)
+    asm_export(as, owner, 'P', b->text, b->len);
+  for (const Token *b = m->body; b < m->body_end; b++)
+    asm_export(as, owner, b->kind, b->text, b->len);
+
+  while (line->kind != TOK_EOL)
+    line++;
+  return line;
+}
+
+static void asm_expand(Asm *as, const Token *call, const Token *end,
+                       const Macro *m, unsigned owner) {
+  const Token *args[257];
+  unsigned n = asm_split(call + 1, end, args, 256);
+  unsigned count = 0, id = ++as->expansions;
+
+  if (n != m->param_count)
+    asm_fail(as, call, "%.*s takes %u arguments, not %u", (int)call->len,
+             call->text, m->param_count, n);
+  if (as->depth >= MAX_DEPTH)
+    asm_fail(as, call, "macros nest too deeply");
+
+  // Two runs: count the tokens, then copy them with arguments in place
+  for (Token *out = NULL;; out = asm_alloc(as, count * sizeof(Token))) {
+    unsigned k = 0;
+
+    for (const Token *b = m->body; b < m->body_end; b++) {
+      unsigned p = 0;
+
+      while (p < n && !(b->kind == TOK_IDENT && b->len == m->params[p].len &&
+                        memcmp(b->text, m->params[p].text, b->len) == 0))
+        p++;
+      if (p < n) {
+        for (const Token *a = args[p]; a < args[p + 1] - 1; a++, k++)
+          if (out)
+            out[k] = *a;
+      } else {
+        if (out) {
+          out[k] = *b;
+          if (b->kind == TOK_IDENT && b->text[0] == '@') {
+            char *name = asm_alloc(as, b->len + 16);
+            out[k].len = sprintf(name, "%.*s#%u", (int)b->len, b->text, id);
+            out[k].text = name;
+          }
+        }
+        k++;
+      }
+    }
+
+    if (out) {
+      as->depth++;
+      asm_process(as, out, out + count, owner);
+      as->depth--;
+      return;
+    }
+    count = k;
+    if (count == 0)
+      return;
+  }
+}
+
+static void asm_directive(Asm *as, const Token *t, const Token *end,
+                          unsigned owner) {
+  int32_t value;
+
+  if (ident_is(t, ".org")) {
+    asm_eval(as, t + 1, end, as->pc, &value, 1);
+    if (value < 0 || value > 0xFFFF)
+      asm_fail(as, t, ".org address is out of range");
+    as->pc = (uint32_t)value;
+  } else if (ident_is(t, ".code")) {
+    as->section = PAGE_CODE;
+  } else if (ident_is(t, ".data")) {
+    as->section = PAGE_DATA;
+  } else if (ident_is(t, ".db") || ident_is(t, ".byte")) {
+    asm_data(as, t, end, 0, owner);
+  } else if (ident_is(t, ".dw") || ident_is(t, ".word")) {
+    asm_data(as, t, end, 1, owner);
+  } else if (ident_is(t, ".include")) {
+    asm_include(as, t, end, owner);
+  } else if (ident_is(t, ".reset")) {
+    uint32_t pc = as->pc;
+    uint8_t section = as->section;
+
+    as->pc = 0xFFFC;
+    as->section = PAGE_CODE;
+    asm_add_stmt(as, STMT_WORDS, t, t + 1, end, 2, owner);
+    as->pc = pc;
+    as->section = section;
+  } else if (ident_is(t, ".palette")) {
+    const Token *parts[3];
+
+    if (asm_split(t + 1, end, parts, 2) != 2)
+      asm_fail(as, t, ".palette needs a background and a sprite palette");
+    for (int i = 0; i < 2; i++) {
+      asm_eval(as, parts[i], parts[i + 1] - 1, as->pc, &value, 1);
+      if (value < 0 || value > 0xFF)
+        asm_fail(as, t, "palette value is out of range");
+      as->palette[i] = (uint8_t)value;
+    }
+    as->has_palette = 1;
+    asm_export(as, owner, 'C', as->palette, 2);
+  } else if (ident_is(t, ".endm")) {
+    asm_fail(as, t, ".endm without .macro");
+  } else {
+    asm_fail(as, t, "unknown directive %.*s", (int)t->len, t->text);
+  }
+}
+
+/**
+ * @brief Pass 1 over a token stream: a file or a macro expansion.
+ *
+ * @param owner File that definitions and output count as exports of.
+ */
+static void asm_process(Asm *as, const Token *t, const Token *end,
+                        unsigned owner) {
+  while (t < end) {
+    const Token *eol = t;
+    while (eol->kind != TOK_EOL)
+      eol++;
+
+    if (t->kind == TOK_IDENT && is_punct(t + 1, eol, ':')) {
+      if (t->text[0] == '.')
+        asm_fail(as, t, "labels cannot start with '.'");
+      asm_define(as, t, (int32_t)as->pc, 1, owner);
+      t += 2;
+    }
+
+    if (t == eol) {
+      // Empty line
+    } else if (t->kind == TOK_IDENT &&
+               (is_punct(t + 1, eol, '=') ||
+                (t + 1 < eol && ident_is(t + 1, ".equ")))) {
+      int32_t value;
+      asm_eval(as, t + 2, eol, as->pc, &value, 1);
+      asm_define(as, t, value, 0, owner);
+    } else if (ident_is(t, ".macro")) {
+      eol = asm_macro(as, t, end, owner);
+    } else if (t->kind == TOK_IDENT && t->text[0] == '.') {
+      asm_directive(as, t, eol, owner);
+    } else if (t->kind == TOK_IDENT) {
+      char upper[8];
+      const Entry *e = NULL;
+
+      if (t->len < sizeof(upper)) {
+        for (uint32_t i = 0; i < t->len; i++)
+          upper[i] = (char)toupper((unsigned char)t->text[i]);
+        e = table_find(&as->mnemonics, upper, t->len);
+      }
+      if (e != NULL) {
+        asm_instruction(as, t, eol, e->data, owner);
+      } else if ((e = table_find(&as->macros, t->text, t->len)) != NULL) {
+        asm_expand(as, t, eol, e->data, owner);
+      } else {
+        asm_fail(as, t, "unknown instruction or macro %.*s", (int)t->len,
+                 t->text);
+      }
+    } else {
+      asm_fail(as, t, "expected a label, instruction or directive");
+    }
+
+    t = eol + 1;
+  }
+}
+
+/* --- Pass 2 ----------------------------------------------------------- */
+
+static void asm_emit(Asm *as, const Stmt *s, uint32_t addr, uint8_t byte) {
+  uint8_t page = BUS_PAGE(addr);
+  uint8_t kind = s->section;
+
+  if (addr >= PPU_TILE_DATA + PPU_TILE_COUNT * PPU_TILE_BYTES &&
+      addr < (BUS_INPUT_PAGE + 1) * BUS_PAGE_SIZE)
+    asm_fail(as, s->where, "$%04X is not ROM (VRAM or a device register)",
+             (unsigned)addr);
+  if (as->written[addr / 8] & (1 << (addr % 8)))
+    asm_fail(as, s->where, "$%04X is written twice", (unsigned)addr);
+
+  if (addr >= PPU_TILE_DATA && addr < PPU_TILEMAP)
+    kind = PAGE_TILES;
+  if (as->page_kind[page] == PAGE_NONE || as->page_kind[page] == PAGE_DATA)
+    as->page_kind[page] = kind;
+  as->written[addr / 8] |= 1 << (addr % 8);
+  as->image[addr] = byte;
+
+  uint8_t event[4] = {(uint8_t)addr, (uint8_t)(addr >> 8), byte, kind};
+  asm_export(as, s->owner, 'B', event, sizeof(event));
+}
+
+static int32_t asm_value(Asm *as, const Stmt *s, const Token *t,
+                         const Token *end, int32_t min, int32_t max) {
+  int32_t value;
+
+  asm_eval(as, t, end, s->pc, &value, 1);
+  if (value < min || value > max)
+    asm_fail(as, t, "value %d does not fit", (int)value);
+  return value;
+}
+
+static void asm_pass2(Asm *as, const Stmt *s) {
+  uint32_t pc = s->pc;
+
+  if (s->kind == STMT_INSN) {
+    int32_t v = 0;
+
+    asm_emit(as, s, pc, s->opcode);
+    switch (s->mode) {
+    case MODE_IMPLIED:
+    case MODE_ACCUMULATOR:
+      break;
+    case MODE_RELATIVE:
+      v = asm_value(as, s, s->args, s->args_end, 0, 0xFFFF) - (pc + 2);
+      if (v < -128 || v > 127)
+        asm_fail(as, s->where, "branch target is %d bytes away", (int)v);
+      asm_emit(as, s, pc + 1, (uint8_t)v);
+      break;
+    case MODE_ABSOLUTE:
+    case MODE_ABSOLUTE_X:
+    case MODE_ABSOLUTE_Y:
+    case MODE_INDIRECT:
+      v = asm_value(as, s, s->args, s->args_end, 0, 0xFFFF);
+      asm_emit(as, s, pc + 1, (uint8_t)v);
+      asm_emit(as, s, pc + 2, (uint8_t)(v >> 8));
+      break;
+    case MODE_IMMEDIATE:
+      v = asm_value(as, s, s->args, s->args_end, -128, 0xFF);
+      asm_emit(as, s, pc + 1, (uint8_t)v);
+      break;
+    default: // Zero page forms
+      v = asm_value(as, s, s->args, s->args_end, 0, 0xFF);
+      asm_emit(as, s, pc + 1, (uint8_t)v);
+      break;
+    }
+    return;
+  }
+
+  const Token *parts[257];
+  unsigned n = asm_split(s->args, s->args_end, parts, 256);
+  for (unsigned i = 0; i < n; i++) {
+    const Token *item = parts[i], *item_end = parts[i + 1] - 1;
+
+    if (s->kind == STMT_WORDS) {
+      int32_t v = asm_value(as, s, item, item_end, -0x8000, 0xFFFF);
+      asm_emit(as, s, pc++, (uint8_t)v);
+      asm_emit(as, s, pc++, (uint8_t)(v >> 8));
+    } else if (item_end - item == 1 && item->kind == TOK_STRING) {
+      for (uint32_t k = 0; k < item->len; k++) {
+        char c = item->text[k];
+        if (c == '\\') {
+          c = item->text[++k];
+          c = c == 'n' ? '\n' : c == '0' ? '\0' : c;
+        }
+        asm_emit(as, s, pc++, (uint8_t)c);
+      }
+    } else {
+      asm_emit(as, s, pc++, (uint8_t)asm_value(as, s, item, item_end, -128,
+                                                0xFF));
+    }
+  }
+}
+
+/* --- Interface -------------------------------------------------------- */
+
+Asm *asm_create(void) {
+  Asm *as = calloc(1, sizeof(Asm));
+
+  if (as == NULL)
+    return NULL;
+  as->stmt_tail = &as->stmts;
+  as->pc = ASM_DEFAULT_ORG;
+  as->section = PAGE_CODE;
+  if (setjmp(as->fail)) {
+    asm_destroy(as);
+    return NULL;
+  }
+
+  // Mnemonic table from the same list as instruction_table
+  static const struct {
+    const char *name;
+    uint8_t opcode;
+    uint8_t mode;
+  } isa[] = {
+#define ISA_ENTRY(opc, mn, mode, cycles) {#mn, opc, MODE_##mode},
+      RVM_ISA(ISA_ENTRY)
+#undef ISA_ENTRY
+  };
+  for (size_t i = 0; i < sizeof(isa) / sizeof(isa[0]); i++) {
+    uint32_t len = (uint32_t)strlen(isa[i].name);
+    const Entry *found = table_find(&as->mnemonics, isa[i].name, len);
+    int16_t *opcodes;
+
+    if (found == NULL) {
+      Entry *e = table_add(as, &as->mnemonics, isa[i].name, len);
+      opcodes = asm_alloc(as, MODE_COUNT * sizeof(int16_t));
+      for (int m = 0; m < MODE_COUNT; m++)
+        opcodes[m] = -1;
+      e->data = opcodes;
+    } else {
+      opcodes = (int16_t *)found->data;
+    }
+    opcodes[isa[i].mode] = isa[i].opcode;
+  }
+  return as;
+}
+
+void asm_destroy(Asm *as) {
+  if (as == NULL)
+    return;
+
+  while (as->arena) {
+    ArenaChunk *next = as->arena->next;
+    free(as->arena);
+    as->arena = next;
+  }
+  free(as->symbols.slots);
+  free(as->macros.slots);
+  free(as->mnemonics.slots);
+  free(as->files);
+  free(as);
+}
+
+int asm_assemble(Asm *as, const char *path) {
+  const Token *toks;
+  uint32_t count;
+
+  if (setjmp(as->fail))
+    return -1;
+
+  unsigned file = asm_load_file(as, path, NULL, &toks, &count);
+  asm_process(as, toks, toks + count, file);
+  for (const Stmt *s = as->stmts; s; s = s->next)
+    asm_pass2(as, s);
+  return 0;
+}
+
+const char *asm_error(const Asm *as) { return as->failed ? as->error : NULL; }
+
+int asm_symbol(const Asm *as, const char *name, int32_t *value) {
+  const Entry *e = table_find(&as->symbols, name, (uint32_t)strlen(name));
+
+  if (e == NULL)
+    return -1;
+  *value = e->value;
+  return 0;
+}
+
+static int compare_labels(const void *a, const void *b) {
+  const Entry *x = *(const Entry *const *)a, *y = *(const Entry *const *)b;
+
+  if (x->value != y->value)
+    return x->value < y->value ? -1 : 1;
+  int order = memcmp(x->name, y->name, x->len < y->len ? x->len : y->len);
+  if (order != 0)
+    return order;
+  return x->len < y->len ? -1 : x->len > y->len;
+}
+
+int asm_write_labels(const Asm *as, const char *path) {
+  const Entry **labels = malloc((as->symbols.count + 1) * sizeof(Entry *));
+  unsigned count = 0;
+  FILE *f;
+  int ok;
+
+  if (labels == NULL)
+    return -1;
+  for (uint32_t i = 0; i < as->symbols.cap; i++) {
+    const Entry *e = &as->symbols.slots[i];
+    // A label after the last byte of memory names no code
+    if (e->name && e->label && e->name[0] != '@' && e->value < RVM_MEM_SIZE)
+      labels[count++] = e;
+  }
+  qsort(labels, count, sizeof(Entry *), compare_labels);
+
+  f = fopen(path, "w");
+  ok = f != NULL;
+  for (unsigned i = 0; ok && i < count; i++)
+    ok = fprintf(f, "%04X %.*s\n", (unsigned)labels[i]->value,
+                 (int)labels[i]->len, labels[i]->name) > 0;
+  if (f != NULL && fclose(f) != 0)
+    ok = 0;
+  free(labels);
+  return ok ? 0 : -1;
+}
+
+unsigned asm_file_count(const Asm *as) { return as->file_count; }
+
+const AsmFile *asm_file(const Asm *as, unsigned index) {
+  return &as->files[index];
+}
+
+/**
+ * @brief Kind of an output page; the first tile page is kept whenever
+ * the second is used, since tile sections start at PPU_TILE_DATA.
+ */
+static uint8_t asm_page_kind(const Asm *as, unsigned page) {
+  if (page == BUS_PAGE(PPU_TILE_DATA) &&
+      as->page_kind[page + 1] == PAGE_TILES)
+    return PAGE_TILES;
+  return as->page_kind[page];
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+  for (int i = 0; i < 4; i++)
+    p[i] = (uint8_t)(v >> (8 * i));
+}
+
+size_t asm_build_rom(const Asm *as, uint8_t *out, size_t cap) {
+  unsigned sections = as->has_palette, data_size = as->has_palette ? 2 : 0;
+
+  // Each run of pages of one kind becomes one section
+  for (unsigned page = 0; page < BUS_PAGE_COUNT; page++) {
+    uint8_t kind = asm_page_kind(as, page);
+    if (kind != PAGE_NONE) {
+      data_size += BUS_PAGE_SIZE;
+      if (page == 0 || asm_page_kind(as, page - 1) != kind)
+        sections++;
+    }
+  }
+
+  size_t table = ROM_HEADER_SIZE + sections * ROM_SECTION_SIZE;
+  size_t size = table + data_size;
+  if (out == NULL || size > cap)
+    return size;
+
+  memset(out, 0, table);
+  memcpy(out, ROM_MAGIC, 4);
+  out[4] = ROM_VERSION;
+  out[6] = (uint8_t)sections;
+  out[7] = (uint8_t)(sections >> 8);
+
+  uint8_t *entry = out + ROM_HEADER_SIZE;
+  size_t offset = table;
+  for (unsigned page = 0; page < BUS_PAGE_COUNT;) {
+    uint8_t kind = asm_page_kind(as, page);
+    unsigned first = page;
+
+    if (kind == PAGE_NONE) {
+      page++;
+      continue;
+    }
+    while (page < BUS_PAGE_COUNT && asm_page_kind(as, page) == kind)
+      page++;
+
+    uint32_t bytes = (page - first) * BUS_PAGE_SIZE;
+    static const uint8_t types[] = {0, ROM_SECTION_CODE, ROM_SECTION_DATA,
+                                    ROM_SECTION_TILES};
+    entry[0] = types[kind];
+    entry[1] = (uint8_t)first;
+    put_u32(entry + 4, (uint32_t)offset);
+    put_u32(entry + 8, bytes);
+    memcpy(out + offset, &as->image[first * BUS_PAGE_SIZE], bytes);
+    entry += ROM_SECTION_SIZE;
+    offset += bytes;
+  }
+
+  if (as->has_palette) {
+    entry[0] = ROM_SECTION_PALETTE;
+    put_u32(entry + 4, (uint32_t)offset);
+    put_u32(entry + 8, 2);
+    memcpy(out + offset, as->palette, 2);
+  }
+  return size;
+}
+
+int asm_write_rom(const Asm *as, const char *path) {
+  size_t size = asm_build_rom(as, NULL, 0);
+  uint8_t *buf = malloc(size);
+  FILE *f;
+  int ok;
+
+  if (buf == NULL)
+    return -1;
+  asm_build_rom(as, buf, size);
+  f = fopen(path, "wb");
+  ok = f != NULL && fwrite(buf, 1, size, f) == size;
+  if (f != NULL && fclose(f) != 0)
+    ok = 0;
+  free(buf);
+  return ok ? 0 : -1;
+}
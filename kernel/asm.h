@@ -0,0 +1,152 @@
+/**
+ * rvm-8/kernel/asm.h
+ *
+ * Two-pass assembler for rvm-8 `.asm` sources.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ *
+ * Turns a source file (and the files it includes) into a `.rvm` ROM as
+ * described in specs/SPEC.md, section 7. Opcodes are encoded from the
+ * RVM_ISA list in isa.h, the same list instruction_table is built from,
+ * so the assembler always knows exactly the instructions the CPU runs.
+ *
+ * - The first pass lexes each file once, expands includes and macros,
+ *   assigns addresses to labels and picks the size of every
+ *   instruction. The second pass evaluates operands and emits bytes.
+ * - Source text, tokens and statements live in one arena that is freed
+ *   with the assembler. Labels, macros and mnemonics are kept in
+ *   open-addressing hash tables.
+ * - For incremental builds, every file read during assembly is listed
+ *   with a hash of its contents and a hash of its exports: the symbols
+ *   and macros it defines, the files it includes and the bytes it
+ *   emits. A room only needs to be rebuilt when one of its files
+ *   changed in a way that changes its exports (see tools/rvm_asm.c).
+ *
+ * An Asm assembles one source; create a new one for the next.
+ */
+
+#ifndef RVM_ASM_H
+#define RVM_ASM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Origin used until the first .org */
+#define ASM_DEFAULT_ORG 0x8000
+
+typedef struct Asm Asm;
+
+/**
+ * @brief A file read while assembling.
+ */
+typedef struct {
+  /** Path as opened, relative to the working directory */
+  const char *path;
+  /** 64-bit FNV-1a hash of the contents */
+  uint64_t hash;
+  /** Hash of everything the file defines and emits */
+  uint64_t exports;
+} AsmFile;
+
+/**
+ * @brief Create an assembler.
+ *
+ * @return The assembler, or NULL if allocation failed.
+ */
+Asm *asm_create(void);
+
+/**
+ * @brief Free an assembler and everything it allocated.
+ *
+ * @param as The assembler, or NULL.
+ */
+void asm_destroy(Asm *as);
+
+/**
+ * @brief Assemble a source file.
+ *
+ * @param as A fresh assembler.
+ * @param path Source file.
+ * @return 0 on success, -1 on error (see asm_error()).
+ */
+int asm_assemble(Asm *as, const char *path);
+
+/**
+ * @brief Get the error that stopped assembly.
+ *
+ * @param as Pointer to the assembler.
+ * @return "file:line: message", or NULL if there was no error.
+ */
+const char *asm_error(const Asm *as);
+
+/**
+ * @brief Look up a label or constant after assembly.
+ *
+ * @param as Pointer to the assembler.
+ * @param name Symbol name.
+ * @param value Receives the value.
+ * @return 0 if the symbol is defined, -1 otherwise.
+ */
+int asm_symbol(const Asm *as, const char *name, int32_t *value);
+
+/**
+ * @brief Write the label map of the assembled program.
+ *
+ * One `ADDR NAME` line per label, the address as four hex digits, in
+ * address order and then name order. Constants defined with '=' or .equ
+ * and labels local to a macro expansion are left out. profile.h reads
+ * the map to name the code a profile samples.
+ *
+ * @param as An assembler that assembled without errors.
+ * @param path Output file.
+ * @return 0 on success, -1 if the file could not be written.
+ */
+int asm_write_labels(const Asm *as, const char *path);
+
+/**
+ * @brief Get the number of files read, including the source itself.
+ *
+ * @param as Pointer to the assembler.
+ * @return File count.
+ */
+unsigned asm_file_count(const Asm *as);
+
+/**
+ * @brief Get a file read during assembly.
+ *
+ * @param as Pointer to the assembler.
+ * @param index 0 for the source, then includes in the order read.
+ * @return The file.
+ */
+const AsmFile *asm_file(const Asm *as, unsigned index);
+
+/**
+ * @brief Build the `.rvm` image of the assembled program.
+ *
+ * @param as An assembler that assembled without errors.
+ * @param out Buffer for the image, or NULL to only get its size.
+ * @param cap Size of @p out.
+ * @return Size of the image; nothing is written if it exceeds @p cap.
+ */
+size_t asm_build_rom(const Asm *as, uint8_t *out, size_t cap);
+
+/**
+ * @brief Write the `.rvm` image of the assembled program to a file.
+ *
+ * @param as An assembler that assembled without errors.
+ * @param path Output file.
+ * @return 0 on success, -1 if the file could not be written.
+ */
+int asm_write_rom(const Asm *as, const char *path);
+
+/**
+ * @brief Hash a file's contents the way AsmFile.hash does.
+ *
+ * @param path File to read.
+ * @param hash Receives the hash.
+ * @return 0 on success, -1 if the file could not be read.
+ */
+int asm_hash_file(const char *path, uint64_t *hash);
+
+#endif
@@ -0,0 +1,1000 @@
+/*
+ * rvm-8/kernel/batch.c
+ *
+ * Lockstep batch interpreter for rvm-8.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ *
+ * Notes:
+ * - Each round picks the lowest PC among the lanes still running and
+ *   steps the lanes there (the group). Lanes that took the other side of
+ *   a branch wait at a higher PC until the ones behind catch up with
+ *   them, which is where loops and frame waits bring them back together.
+ * - Vector steps run over every lane with the group as a 0x00/0xFF mask,
+ *   blending results in rather than branching. They use the GCC/Clang
+ *   vector types, not intrinsics, so the same code is SSE2, NEON or WASM
+ *   SIMD; GCC does not vectorize the plain loops at -O2. Other compilers,
+ *   and RVM_NO_SIMD, get the scalar path alone. A step costs the same
+ *   for one lane in the group as for all of them, hence min_group.
+ * - After a vector step the next group is guessed from where the group
+ *   went and the lowest PC of the rest, saving a scan; a guess with no
+ *   lanes at it falls back to the scan.
+ * - A group too small for a vector step runs lane by lane, each lane
+ *   until it reaches the PC of the next group, so lanes that diverged for
+ *   good cost one scan per stretch of code rather than per instruction.
+ *   A group whose code differs between lanes takes one step per lane.
+ * - The vector path needs the opcode and operand to be the same in every
+ *   lane of the group: always so on an unwritten page, checked row by
+ *   row on a copied one, and never assumed for the input page. Loads and
+ *   stores move whole rows when the address agrees too, including indexed
+ *   ones whose index does.
+ * - Cycle counts are 32 bits relative to `base`, which batch_run() moves
+ *   up to the slowest lane before every slice of at most BATCH_SLICE
+ *   cycles. A lane that hit an illegal opcode stops counting; its total
+ *   is kept in `stopped_at` instead.
+ * - The lazy Z and N inputs are one byte, as every instruction that sets
+ *   one sets the other from the same value; cpu_reset() flags (FLAG_I
+ *   only) start it at 1.
+ */
+
+#include "batch.h"
+#include "bus.h"
+#include "input.h"
+#include "isa.h"
+#include "machine.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define BATCH_SLICE (1u << 30)
+
+#define MNEMONIC_ID(mn, flow, flags, stores) MN_##mn,
+enum { MN_NONE, RVM_MNEMONICS(MNEMONIC_ID) MN_COUNT };
+#undef MNEMONIC_ID
+
+#define OPCODE_MNEMONIC(opc, mn, mode, cyc) [opc] = MN_##mn,
+static const uint8_t mnemonic_of[256] = {RVM_ISA(OPCODE_MNEMONIC)};
+#undef OPCODE_MNEMONIC
+
+struct Batch {
+  unsigned lanes;
+  /** Lanes in every array: `lanes` rounded up to BATCH_VECTOR; the ones
+   *  past `lanes` never run */
+  unsigned width;
+  unsigned min_group;
+  int failed;
+  /** Cycle count `cycles` is relative to */
+  uint64_t base;
+  uint64_t vector_steps;
+  uint64_t scalar_steps;
+
+  uint64_t *stopped_at;
+  uint32_t *cycles;
+  uint16_t *pc;
+  uint16_t *sp;
+  /** Scratch: per-lane next PC of a vector step */
+  uint16_t *target;
+  uint8_t *a;
+  uint8_t *x;
+  uint8_t *y;
+  /** Lazy Z and N: Z when 0, N from bit 7 */
+  uint8_t *nz;
+  /** Carry, 0 or 1 */
+  uint8_t *c;
+  /** V from bit 7 */
+  uint8_t *v;
+  /** Flags not tracked lazily */
+  uint8_t *p;
+  uint8_t *pad0;
+  uint8_t *pad1;
+  /** 0xFF while the lane runs in the current slice */
+  uint8_t *live;
+  /** 0xFF once the lane hit an illegal opcode */
+  uint8_t *illegal;
+  /** Scratch: the group, operand values, extra cycles */
+  uint8_t *mask;
+  uint8_t *val;
+  uint8_t *extra;
+
+  /** The loaded image, what every unwritten page reads as */
+  uint8_t image[RVM_MEM_SIZE];
+  /** Written pages, byte `off` of lane `l` at [off * width + l] */
+  uint8_t *pages[BUS_PAGE_COUNT];
+};
+
+/* --- Memory ----------------------------------------------------------- */
+
+/** @brief Whether lanes can write a page, as in the SPEC memory map. */
+static int batch_writable(uint8_t page) {
+  return page != BUS_PPU_PAGE && page != BUS_INPUT_PAGE &&
+         page != BUS_ROM_PAGE;
+}
+
+/**
+ * @brief The copies of a page, made on the first write to it.
+ *
+ * @return The copies, or NULL for a page lanes cannot write or if
+ *         allocation failed.
+ */
+static uint8_t *batch_page(Batch *b, uint8_t page) {
+  uint8_t *copy = b->pages[page];
+
+  if (copy != NULL || !batch_writable(page))
+    return copy;
+  copy = malloc((size_t)BUS_PAGE_SIZE * b->width);
+  if (copy == NULL) {
+    b->failed = 1;
+    return NULL;
+  }
+  for (int off = 0; off < BUS_PAGE_SIZE; off++)
+    memset(copy + (size_t)off * b->width, b->image[page << 8 | off], b->width);
+  b->pages[page] = copy;
+  return copy;
+}
+
+static uint8_t lane_read(const Batch *b, unsigned lane, uint16_t addr) {
+  const uint8_t *copy = b->pages[BUS_PAGE(addr)];
+
+  if (copy != NULL)
+    return copy[(size_t)(addr & 0xFF) * b->width + lane];
+  if (addr == INPUT_REG_PAD0)
+    return b->pad0[lane];
+  if (addr == INPUT_REG_PAD1)
+    return b->pad1[lane];
+  return b->image[addr];
+}
+
+static void lane_write(Batch *b, unsigned lane, uint16_t addr, uint8_t val) {
+  uint8_t *copy = batch_page(b, BUS_PAGE(addr));
+
+  if (copy != NULL)
+    copy[(size_t)(addr & 0xFF) * b->width + lane] = val;
+}
+
+/* --- One lane --------------------------------------------------------- */
+
+/**
+ * @brief effective_address() of opcodes.c for one lane.
+ */
+static uint16_t lane_address(const Batch *b, unsigned lane,
+                             AddressingMode mode, uint16_t operand,
+                             uint8_t *penalty) {
+  uint16_t base, addr;
+
+  switch (mode) {
+  case MODE_ZEROPAGE_X:
+    return (operand + b->x[lane]) & 0xFF;
+  case MODE_ZEROPAGE_Y:
+    return (operand + b->y[lane]) & 0xFF;
+  case MODE_ABSOLUTE_X:
+  case MODE_ABSOLUTE_Y:
+    addr = operand + (mode == MODE_ABSOLUTE_X ? b->x[lane] : b->y[lane]);
+    if ((operand & 0xFF00) != (addr & 0xFF00))
+      *penalty += 1;
+    return addr;
+  case MODE_INDIRECT:
+    return lane_read(b, lane, operand) |
+           lane_read(b, lane, operand + 1) << 8;
+  case MODE_INDIRECT_X:
+    base = (operand + b->x[lane]) & 0xFF;
+    return lane_read(b, lane, base) |
+           lane_read(b, lane, (base + 1) & 0xFF) << 8;
+  case MODE_INDIRECT_Y:
+    base = lane_read(b, lane, operand) |
+           lane_read(b, lane, (operand + 1) & 0xFF) << 8;
+    addr = base + b->y[lane];
+    if ((base & 0xFF00) != (addr & 0xFF00))
+      *penalty += 1;
+    return addr;
+  default:
+    return operand;
+  }
+}
+
+static uint8_t lane_load(const Batch *b, unsigned lane, AddressingMode mode,
+                         uint16_t operand, uint8_t *penalty) {
+  if (mode == MODE_IMMEDIATE)
+    return lo8(operand);
+  return lane_read(b, lane, lane_address(b, lane, mode, operand, penalty));
+}
+
+/**
+ * @brief Runs one instruction of one lane, as the handlers in opcodes.c
+ *        do.
+ */
+static void lane_step(Batch *b, unsigned lane) {
+  uint16_t pc = b->pc[lane];
+  uint8_t opcode = lane_read(b, lane, pc);
+  const Instruction *instr = &instruction_table[opcode];
+  AddressingMode mode = instr->mode;
+  uint8_t cycles = instr->cycles, unused = 0, val;
+  uint16_t operand = 0, addr;
+  int taken;
+
+  if (instr->handler == NULL) {
+    b->illegal[lane] = 0xFF;
+    b->stopped_at[lane] = b->base + b->cycles[lane];
+    return;
+  }
+  uint8_t size = instruction_info[opcode].size;
+  if (size > 1)
+    operand = lane_read(b, lane, pc + 1);
+  if (size > 2)
+    operand |= lane_read(b, lane, pc + 2) << 8;
+  uint16_t next = pc + size;
+
+  switch (mnemonic_of[opcode]) {
+  case MN_LDA:
+    b->a[lane] = b->nz[lane] = lane_load(b, lane, mode, operand, &cycles);
+    break;
+  case MN_LDX:
+    b->x[lane] = b->nz[lane] = lane_load(b, lane, mode, operand, &cycles);
+    break;
+  case MN_LDY:
+    b->y[lane] = b->nz[lane] = lane_load(b, lane, mode, operand, &cycles);
+    break;
+  case MN_LSR:
+    if (mode == MODE_ACCUMULATOR) {
+      b->c[lane] = b->a[lane] & 0x01;
+      b->a[lane] = b->nz[lane] = b->a[lane] >> 1;
+      break;
+    }
+    addr = lane_address(b, lane, mode, operand, &unused);
+    val = lane_read(b, lane, addr);
+    b->c[lane] = val & 0x01;
+    b->nz[lane] = val >> 1;
+    lane_write(b, lane, addr, val >> 1);
+    break;
+  case MN_ADC: {
+    uint8_t a = b->a[lane];
+    val = lane_load(b, lane, mode, operand, &cycles);
+    uint16_t sum = a + val + b->c[lane];
+    b->a[lane] = b->nz[lane] = lo8(sum);
+    b->c[lane] = sum >> 8;
+    b->v[lane] = ~(a ^ val) & (a ^ sum) & 0x80;
+    break;
+  }
+  case MN_STA:
+    lane_write(b, lane, lane_address(b, lane, mode, operand, &unused),
+               b->a[lane]);
+    break;
+  case MN_STX:
+    lane_write(b, lane, lane_address(b, lane, mode, operand, &unused),
+               b->x[lane]);
+    break;
+  case MN_STY:
+    lane_write(b, lane, lane_address(b, lane, mode, operand, &unused),
+               b->y[lane]);
+    break;
+  case MN_INX:
+    b->x[lane] = b->nz[lane] = b->x[lane] + 1;
+    break;
+  case MN_INY:
+    b->y[lane] = b->nz[lane] = b->y[lane] + 1;
+    break;
+  case MN_DEX:
+    b->x[lane] = b->nz[lane] = b->x[lane] - 1;
+    break;
+  case MN_DEY:
+    b->y[lane] = b->nz[lane] = b->y[lane] - 1;
+    break;
+  case MN_JMP:
+    next = lane_address(b, lane, mode, operand, &unused);
+    break;
+  case MN_NOP:
+    break;
+  default:
+    switch (mnemonic_of[opcode]) {
+    case MN_BPL: taken = !(b->nz[lane] & 0x80); break;
+    case MN_BMI: taken = b->nz[lane] & 0x80; break;
+    case MN_BVC: taken = !(b->v[lane] & 0x80); break;
+    case MN_BVS: taken = b->v[lane] & 0x80; break;
+    case MN_BCC: taken = !b->c[lane]; break;
+    case MN_BCS: taken = b->c[lane]; break;
+    case MN_BNE: taken = b->nz[lane] != 0; break;
+    default: taken = b->nz[lane] == 0; break;
+    }
+    if (taken) {
+      addr = next + (int8_t)lo8(operand);
+      cycles += BUS_PAGE(next) != BUS_PAGE(addr) ? 2 : 1;
+      next = addr;
+    }
+    break;
+  }
+  b->pc[lane] = next;
+  b->cycles[lane] += cycles;
+  b->scalar_steps++;
+}
+
+/**
+ * @brief Runs one lane of a small group until it reaches the PC @p stop
+ *        of the group after it, or its slice ends.
+ */
+static void lane_run(Batch *b, unsigned lane, uint16_t stop,
+                     uint32_t limit) {
+  do
+    lane_step(b, lane);
+  while (!b->illegal[lane] && b->cycles[lane] < limit && b->pc[lane] < stop);
+  b->live[lane] = !b->illegal[lane] && b->cycles[lane] < limit ? 0xFF : 0;
+}
+
+/* --- Vector steps ----------------------------------------------------- */
+
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(RVM_NO_SIMD)
+
+/*
+ * Every type is one 16-byte register, the width SSE2, NEON and WASM SIMD
+ * all have: 16 lanes of bytes, 8 of PCs, 4 of cycle counts. Wider types
+ * would be split up by the compiler, but GCC takes their compares apart
+ * lane by lane. Rows are accessed through the *Mem variants, which may
+ * be unaligned and alias the arrays, as _mm_loadu does; the narrow ones
+ * hold the bytes of the lanes of one VecU16 or the halves of one VecU32.
+ */
+typedef uint8_t VecU8 __attribute__((vector_size(BATCH_VECTOR)));
+typedef int8_t VecI8 __attribute__((vector_size(BATCH_VECTOR)));
+typedef uint16_t VecU16 __attribute__((vector_size(BATCH_VECTOR)));
+typedef int16_t VecI16 __attribute__((vector_size(BATCH_VECTOR)));
+typedef uint32_t VecU32 __attribute__((vector_size(BATCH_VECTOR)));
+typedef int32_t VecI32 __attribute__((vector_size(BATCH_VECTOR)));
+typedef int8_t HalfI8 __attribute__((vector_size(BATCH_VECTOR / 2)));
+
+#define MEM_TYPE(name, elem, size)                                        \
+  typedef elem name __attribute__((vector_size(size), aligned(1), may_alias))
+MEM_TYPE(VecU8Mem, uint8_t, BATCH_VECTOR);
+MEM_TYPE(VecU16Mem, uint16_t, BATCH_VECTOR);
+MEM_TYPE(VecU32Mem, uint32_t, BATCH_VECTOR);
+MEM_TYPE(HalfU8Mem, uint8_t, BATCH_VECTOR / 2);
+MEM_TYPE(HalfI8Mem, int8_t, BATCH_VECTOR / 2);
+MEM_TYPE(HalfU16Mem, uint16_t, BATCH_VECTOR / 2);
+#undef MEM_TYPE
+
+/** Lanes in a VecU16 and a VecU32 */
+#define LANES16 (BATCH_VECTOR / 2)
+#define LANES32 (BATCH_VECTOR / 4)
+
+#define LOAD_U8(p) ((VecU8) * (const VecU8Mem *)(p))
+#define LOAD_U16(p) ((VecU16) * (const VecU16Mem *)(p))
+#define LOAD_U32(p) ((VecU32) * (const VecU32Mem *)(p))
+#define STORE_U8(p, v) (*(VecU8Mem *)(p) = (v))
+#define STORE_U16(p, v) (*(VecU16Mem *)(p) = (v))
+#define STORE_U32(p, v) (*(VecU32Mem *)(p) = (v))
+
+/* The bytes at p of LANES16 lanes, widened; masks sign-extend */
+#define WIDEN_U8(p) __builtin_convertvector(*(const HalfU8Mem *)(p), VecU16)
+#define WIDEN_MASK(p)                                                     \
+  ((VecU16)__builtin_convertvector(*(const HalfI8Mem *)(p), VecI16))
+/* The 16-bit values at p of LANES32 lanes, widened */
+#define WIDEN_U16(p) __builtin_convertvector(*(const HalfU16Mem *)(p), VecU32)
+/* A 16-bit mask narrowed to its bytes at p */
+#define STORE_NARROW_MASK(p, m)                                           \
+  (*(HalfI8Mem *)(p) = __builtin_convertvector((VecI16)(m), HalfI8))
+
+/* Unsigned x < y through the signed compares SSE2 has */
+#define LESS_U16(x, y)                                                    \
+  ((VecU16)((VecI16)((x) ^ 0x8000) < (VecI16)((y) ^ 0x8000)))
+#define LESS_U32(x, y)                                                    \
+  ((VecU32)((VecI32)((x) ^ 0x80000000u) < (VecI32)((y) ^ 0x80000000u)))
+
+#define FOR_VECTORS16(b, k) for (unsigned k = 0; k < (b)->width; k += LANES16)
+#define FOR_VECTORS32(b, k) for (unsigned k = 0; k < (b)->width; k += LANES32)
+#define FOR_VECTORS(b, k) for (unsigned k = 0; k < (b)->width; k += BATCH_VECTOR)
+
+/* Masked select: @p yes in the lanes where @p m is all ones, else @p no. */
+static inline VecU8 select_u8(VecU8 m, VecU8 yes, VecU8 no) {
+  return (yes & m) | (no & ~m);
+}
+
+/**
+ * @brief Byte @p addr of every lane into @p out.
+ */
+static void batch_read_row(const Batch *b, uint16_t addr, uint8_t *out) {
+  const uint8_t *copy = b->pages[BUS_PAGE(addr)];
+
+  if (copy != NULL)
+    memcpy(out, copy + (size_t)(addr & 0xFF) * b->width, b->width);
+  else if (addr == INPUT_REG_PAD0)
+    memcpy(out, b->pad0, b->width);
+  else if (addr == INPUT_REG_PAD1)
+    memcpy(out, b->pad1, b->width);
+  else
+    memset(out, b->image[addr], b->width);
+}
+
+/**
+ * @brief Whether @p row holds the same byte in every lane of the group.
+ *
+ * @param byte Receives the byte.
+ */
+static int batch_row_same(const Batch *b, const uint8_t *row, uint8_t *byte) {
+  const uint8_t *mask = b->mask;
+  VecU8 diff = {0}, first;
+  unsigned lane = 0;
+
+  while (lane < b->width && !mask[lane])
+    lane++;
+  *byte = lane < b->width ? row[lane] : 0;
+  first = (VecU8){0} + *byte;
+  FOR_VECTORS(b, k)
+    diff |= (LOAD_U8(row + k) ^ first) & LOAD_U8(mask + k);
+  for (int j = 1; j < BATCH_VECTOR; j++)
+    diff[0] |= diff[j];
+  return diff[0] == 0;
+}
+
+/**
+ * @brief Whether byte @p addr is the same in every lane of the group, as
+ *        code must be for a vector step.
+ *
+ * @param byte Receives the byte.
+ */
+static int batch_uniform(const Batch *b, uint16_t addr, uint8_t *byte) {
+  const uint8_t *copy = b->pages[BUS_PAGE(addr)];
+
+  if (BUS_PAGE(addr) == BUS_INPUT_PAGE)
+    return 0;
+  if (copy == NULL) {
+    *byte = b->image[addr];
+    return 1;
+  }
+  return batch_row_same(b, copy + (size_t)(addr & 0xFF) * b->width, byte);
+}
+
+/**
+ * @brief The effective address of the group, if every lane has the
+ *        same: direct modes, and indexed ones whose index agrees.
+ *
+ * @param penalty Receives the page-cross cycles, the same in every lane.
+ * @return 0 if the lanes may address different bytes.
+ */
+static int batch_address(const Batch *b, AddressingMode mode,
+                         uint16_t operand, uint16_t *addr, uint8_t *penalty) {
+  uint8_t index;
+
+  switch (mode) {
+  case MODE_ZEROPAGE:
+  case MODE_ABSOLUTE:
+    *addr = operand;
+    return 1;
+  case MODE_ZEROPAGE_X:
+  case MODE_ABSOLUTE_X:
+  case MODE_ZEROPAGE_Y:
+  case MODE_ABSOLUTE_Y:
+    if (!batch_row_same(b,
+                        mode == MODE_ZEROPAGE_X || mode == MODE_ABSOLUTE_X
+                            ? b->x
+                            : b->y,
+                        &index))
+      return 0;
+    *addr = mode == MODE_ZEROPAGE_X || mode == MODE_ZEROPAGE_Y
+                ? (operand + index) & 0xFF
+                : (uint16_t)(operand + index);
+    if (mode == MODE_ABSOLUTE_X || mode == MODE_ABSOLUTE_Y)
+      *penalty = (operand & 0xFF00) != (*addr & 0xFF00);
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+/**
+ * @brief The operand value of every lane of the group into `val`.
+ *
+ * @return Non-zero if the mode has page-cross penalties, which go into
+ *         `extra`.
+ */
+static int batch_load(Batch *b, AddressingMode mode, uint16_t operand) {
+  int penalties = mode == MODE_ABSOLUTE_X || mode == MODE_ABSOLUTE_Y ||
+                  mode == MODE_INDIRECT_Y;
+  uint8_t penalty = 0;
+  uint16_t addr;
+
+  if (mode == MODE_IMMEDIATE) {
+    memset(b->val, lo8(operand), b->width);
+    return 0;
+  }
+  if (batch_address(b, mode, operand, &addr, &penalty)) {
+    batch_read_row(b, addr, b->val);
+    if (penalties)
+      memset(b->extra, penalty, b->width);
+    return penalties;
+  }
+
+  for (unsigned i = 0; i < b->width; i++) {
+    if (b->mask[i]) {
+      penalty = 0;
+      b->val[i] = lane_load(b, i, mode, operand, &penalty);
+      b->extra[i] = penalty;
+    }
+  }
+  return penalties;
+}
+
+/**
+ * @brief Stores @p src of every lane of the group.
+ */
+static void batch_store(Batch *b, AddressingMode mode, uint16_t operand,
+                        const uint8_t *src) {
+  uint8_t unused = 0;
+  uint16_t addr;
+
+  if (batch_address(b, mode, operand, &addr, &unused)) {
+    uint8_t *copy = batch_page(b, BUS_PAGE(addr));
+    if (copy == NULL)
+      return;
+    uint8_t *row = copy + (size_t)(addr & 0xFF) * b->width;
+    FOR_VECTORS(b, k) {
+      VecU8 m = LOAD_U8(b->mask + k);
+      STORE_U8(row + k, select_u8(m, LOAD_U8(src + k), LOAD_U8(row + k)));
+    }
+    return;
+  }
+
+  for (unsigned i = 0; i < b->width; i++) {
+    if (b->mask[i])
+      lane_write(b, i, lane_address(b, i, mode, operand, &unused), src[i]);
+  }
+}
+
+/* reg = nz = val, in the group */
+static void batch_set(Batch *b, uint8_t *reg) {
+  FOR_VECTORS(b, k) {
+    VecU8 m = LOAD_U8(b->mask + k), val = LOAD_U8(b->val + k);
+
+    STORE_U8(reg + k, select_u8(m, val, LOAD_U8(reg + k)));
+    STORE_U8(b->nz + k, select_u8(m, val, LOAD_U8(b->nz + k)));
+  }
+}
+
+/* reg += delta, nz = reg, in the group */
+static void batch_step_index(Batch *b, uint8_t *reg, uint8_t delta) {
+  FOR_VECTORS(b, k) {
+    VecU8 m = LOAD_U8(b->mask + k), r = LOAD_U8(reg + k) + delta;
+
+    STORE_U8(reg + k, select_u8(m, r, LOAD_U8(reg + k)));
+    STORE_U8(b->nz + k, select_u8(m, r, LOAD_U8(b->nz + k)));
+  }
+}
+
+static void batch_adc(Batch *b) {
+  FOR_VECTORS(b, k) {
+    VecU8 m = LOAD_U8(b->mask + k), val = LOAD_U8(b->val + k);
+    VecU8 a = LOAD_U8(b->a + k), c = LOAD_U8(b->c + k);
+    VecU8 s = a + val + c;
+    VecU8 carry = ((VecU8)(s < a) | ((VecU8)(s == a) & c)) & 1;
+    VecU8 overflow = ~(a ^ val) & (a ^ s) & 0x80;
+
+    STORE_U8(b->a + k, select_u8(m, s, a));
+    STORE_U8(b->nz + k, select_u8(m, s, LOAD_U8(b->nz + k)));
+    STORE_U8(b->c + k, select_u8(m, carry, c));
+    STORE_U8(b->v + k, select_u8(m, overflow, LOAD_U8(b->v + k)));
+  }
+}
+
+/* val >>= 1, with the flags, in the group */
+static void batch_lsr(Batch *b, uint8_t *val) {
+  FOR_VECTORS(b, k) {
+    VecU8 m = LOAD_U8(b->mask + k), v = LOAD_U8(val + k), r = v >> 1;
+
+    STORE_U8(b->c + k, select_u8(m, v & 1, LOAD_U8(b->c + k)));
+    STORE_U8(b->nz + k, select_u8(m, r, LOAD_U8(b->nz + k)));
+    STORE_U8(val + k, select_u8(m, r, v));
+  }
+}
+
+/**
+ * @brief Branch conditions of the group into `val`, 0xFF where taken.
+ */
+static void batch_conditions(Batch *b, int mnemonic) {
+  FOR_VECTORS(b, k) {
+    VecU8 nz = LOAD_U8(b->nz + k), t;
+
+    switch (mnemonic) {
+    case MN_BPL: t = (VecU8)((nz & 0x80) == 0); break;
+    case MN_BMI: t = (VecU8)((nz & 0x80) != 0); break;
+    case MN_BVC: t = (VecU8)((LOAD_U8(b->v + k) & 0x80) == 0); break;
+    case MN_BVS: t = (VecU8)((LOAD_U8(b->v + k) & 0x80) != 0); break;
+    case MN_BCC: t = (VecU8)(LOAD_U8(b->c + k) == 0); break;
+    case MN_BCS: t = (VecU8)(LOAD_U8(b->c + k) != 0); break;
+    case MN_BNE: t = (VecU8)(nz != 0); break;
+    default: t = (VecU8)(nz == 0); break;
+    }
+    STORE_U8(b->val + k, t & LOAD_U8(b->mask + k));
+  }
+}
+
+/**
+ * @brief Moves the group on to its next PC and charges it the cycles.
+ *
+ * @param next Next PC, unless @p lane_pc takes it from `target`.
+ * @param lane_extra Add the per-lane cycles in `extra`.
+ */
+RVM_ALWAYS_INLINE void batch_finish(Batch *b, uint16_t next, uint8_t cycles,
+                                    int lane_pc, int lane_extra,
+                                    uint32_t limit) {
+  VecU32 ended = {0};
+
+  // Then `target` holds the cycles each lane spent, 0 outside the group
+  FOR_VECTORS16(b, k) {
+    VecU16 m = WIDEN_MASK(b->mask + k), pc = LOAD_U16(b->pc + k);
+    VecU16 to = lane_pc ? LOAD_U16(b->target + k) : (VecU16){0} + next;
+    VecU16 spent = (VecU16){0} + cycles;
+
+    if (lane_extra)
+      spent += WIDEN_U8(b->extra + k);
+    STORE_U16(b->pc + k, (to & m) | (pc & ~m));
+    STORE_U16(b->target + k, spent & m);
+  }
+  FOR_VECTORS32(b, k) {
+    VecU32 spent = WIDEN_U16(b->target + k);
+    VecU32 total = LOAD_U32(b->cycles + k) + spent;
+
+    STORE_U32(b->cycles + k, total);
+    ended |= ~LESS_U32(total, (VecU32){0} + limit) & (VecU32)(spent != 0);
+  }
+  for (int j = 1; j < LANES32; j++)
+    ended[0] |= ended[j];
+  if (ended[0] == 0)
+    return;
+  // Some lane reached the limit, which is rare enough for a scalar pass
+  for (unsigned i = 0; i < b->width; i++) {
+    if (b->mask[i] && b->cycles[i] >= limit)
+      b->live[i] = 0;
+  }
+}
+
+/**
+ * @brief Runs the instruction at @p pc in every lane of the group.
+ *
+ * @param low Receives a PC no higher than any the group went on to.
+ * @return 0, having run nothing, if the lanes disagree on the code.
+ */
+static int batch_step_group(Batch *b, uint16_t pc, unsigned count,
+                            uint32_t limit, uint16_t *low) {
+  uint8_t opcode, lo = 0, hi = 0;
+
+  if (!batch_uniform(b, pc, &opcode) ||
+      instruction_table[opcode].handler == NULL)
+    return 0;
+  uint8_t size = instruction_info[opcode].size;
+  if ((size > 1 && !batch_uniform(b, pc + 1, &lo)) ||
+      (size > 2 && !batch_uniform(b, pc + 2, &hi)))
+    return 0;
+
+  const Instruction *instr = &instruction_table[opcode];
+  AddressingMode mode = instr->mode;
+  uint8_t cycles = instr->cycles;
+  uint16_t operand = lo | hi << 8, next = pc + size;
+  int mnemonic = mnemonic_of[opcode];
+
+  b->vector_steps += count;
+  *low = next;
+  switch (mnemonic) {
+  case MN_LDA:
+  case MN_LDX:
+  case MN_LDY:
+  case MN_ADC: {
+    int penalty = batch_load(b, mode, operand);
+    if (mnemonic == MN_ADC)
+      batch_adc(b);
+    else
+      batch_set(b, mnemonic == MN_LDA ? b->a : mnemonic == MN_LDX ? b->x : b->y);
+    if (penalty)
+      batch_finish(b, next, cycles, 0, 1, limit);
+    else
+      batch_finish(b, next, cycles, 0, 0, limit);
+    return 1;
+  }
+  case MN_LSR:
+    if (mode == MODE_ACCUMULATOR) {
+      batch_lsr(b, b->a);
+    } else {
+      batch_load(b, mode, operand);
+      batch_lsr(b, b->val);
+      batch_store(b, mode, operand, b->val);
+    }
+    break;
+  case MN_STA:
+    batch_store(b, mode, operand, b->a);
+    break;
+  case MN_STX:
+    batch_store(b, mode, operand, b->x);
+    break;
+  case MN_STY:
+    batch_store(b, mode, operand, b->y);
+    break;
+  case MN_INX:
+    batch_step_index(b, b->x, 1);
+    break;
+  case MN_INY:
+    batch_step_index(b, b->y, 1);
+    break;
+  case MN_DEX:
+    batch_step_index(b, b->x, 0xFF);
+    break;
+  case MN_DEY:
+    batch_step_index(b, b->y, 0xFF);
+    break;
+  case MN_NOP:
+    break;
+  case MN_JMP:
+    if (mode == MODE_ABSOLUTE) {
+      next = *low = operand;
+      break;
+    }
+    batch_read_row(b, operand, b->val);
+    batch_read_row(b, operand + 1, b->extra);
+    FOR_VECTORS16(b, k)
+      STORE_U16(b->target + k, WIDEN_U8(b->val + k) | WIDEN_U8(b->extra + k)
+                                                          << 8);
+    *low = 0;
+    batch_finish(b, 0, cycles, 1, 0, limit);
+    return 1;
+  default: {
+    uint16_t to = next + (int8_t)lo;
+    uint8_t cost = BUS_PAGE(next) != BUS_PAGE(to) ? 2 : 1;
+
+    *low = to < next ? to : next;
+    batch_conditions(b, mnemonic);
+    FOR_VECTORS(b, k)
+      STORE_U8(b->extra + k, LOAD_U8(b->val + k) & cost);
+    FOR_VECTORS16(b, k) {
+      VecU16 taken = WIDEN_MASK(b->val + k);
+      STORE_U16(b->target + k, (to & taken) | (next & ~taken));
+    }
+    batch_finish(b, 0, cycles, 1, 1, limit);
+    return 1;
+  }
+  }
+  batch_finish(b, next, cycles, 0, 0, limit);
+  return 1;
+}
+
+/* --- Scheduling ------------------------------------------------------- */
+
+/**
+ * @brief The lowest PC of the running lanes.
+ *
+ * @return 0 if no lane is running.
+ */
+static int batch_lowest(const Batch *b, uint16_t *low) {
+  VecU16 min = (VecU16){0} + 0xFFFF;
+  VecU8 any = {0};
+
+  FOR_VECTORS(b, k)
+    any |= LOAD_U8(b->live + k);
+  for (int j = 1; j < BATCH_VECTOR; j++)
+    any[0] |= any[j];
+  if (any[0] == 0)
+    return 0;
+
+  FOR_VECTORS16(b, k) {
+    VecU16 key = LOAD_U16(b->pc + k) | ~WIDEN_MASK(b->live + k);
+    VecU16 lower = LESS_U16(key, min);
+
+    min = (key & lower) | (min & ~lower);
+  }
+  *low = 0xFFFF;
+  for (int j = 0; j < LANES16; j++)
+    *low = min[j] < *low ? min[j] : *low;
+  return 1;
+}
+
+/**
+ * @brief Puts the running lanes at @p pc into `mask`.
+ *
+ * @param next Receives the lowest PC of the other running lanes, or
+ *        0xFFFF.
+ * @return Lanes in the group.
+ */
+static unsigned batch_group(Batch *b, uint16_t pc, uint16_t *next) {
+  VecU16 min = (VecU16){0} + 0xFFFF, count = {0}, want = (VecU16){0} + pc;
+  unsigned total = 0;
+
+  FOR_VECTORS16(b, k) {
+    VecU16 live = WIDEN_MASK(b->live + k), lane_pc = LOAD_U16(b->pc + k);
+    VecU16 at = (VecU16)(lane_pc == want) & live;
+    VecU16 key = lane_pc | ~(live & ~at);
+    VecU16 lower = LESS_U16(key, min);
+
+    STORE_NARROW_MASK(b->mask + k, at);
+    count -= at;
+    min = (key & lower) | (min & ~lower);
+  }
+  *next = 0xFFFF;
+  for (int j = 0; j < LANES16; j++) {
+    *next = min[j] < *next ? min[j] : *next;
+    total += count[j];
+  }
+  return total;
+}
+
+#else
+
+/* No vector types: every group runs lane by lane. */
+static int batch_step_group(Batch *b, uint16_t pc, unsigned count,
+                            uint32_t limit, uint16_t *low) {
+  return 0;
+}
+
+static int batch_lowest(const Batch *b, uint16_t *low) {
+  int any = 0;
+
+  *low = 0xFFFF;
+  for (unsigned i = 0; i < b->width; i++) {
+    if (b->live[i] && b->pc[i] <= *low) {
+      *low = b->pc[i];
+      any = 1;
+    }
+  }
+  return any;
+}
+
+static unsigned batch_group(Batch *b, uint16_t pc, uint16_t *next) {
+  unsigned count = 0;
+
+  *next = 0xFFFF;
+  for (unsigned i = 0; i < b->width; i++) {
+    b->mask[i] = b->live[i] && b->pc[i] == pc ? 0xFF : 0;
+    count += b->mask[i] & 1;
+    if (b->live[i] && b->pc[i] != pc && b->pc[i] < *next)
+      *next = b->pc[i];
+  }
+  return count;
+}
+
+#endif
+
+static void batch_run_to(Batch *b, uint32_t limit) {
+  uint16_t pc, next, low;
+
+  for (unsigned i = 0; i < b->width; i++)
+    b->live[i] =
+        i < b->lanes && !b->illegal[i] && b->cycles[i] < limit ? 0xFF : 0;
+
+  int running = batch_lowest(b, &pc);
+  while (running) {
+    unsigned count = batch_group(b, pc, &next);
+
+    if (count == 0) {
+      // The guess after a vector step was too low
+      running = batch_lowest(b, &pc);
+      continue;
+    }
+    if (count >= b->min_group) {
+      if (batch_step_group(b, pc, count, limit, &low)) {
+        // Nothing runs below where the group and the rest are now
+        pc = low < next ? low : next;
+        continue;
+      }
+      // The code differs between lanes: one step each, and they may
+      // well be back together after it
+      next = 0;
+    }
+    for (unsigned i = 0; i < b->width; i++) {
+      if (b->mask[i])
+        lane_run(b, i, next, limit);
+    }
+    running = batch_lowest(b, &pc);
+  }
+}
+
+/**
+ * @brief Moves `base` up to the slowest lane still running.
+ */
+static void batch_rebase(Batch *b) {
+  uint32_t min = UINT32_MAX;
+
+  for (unsigned i = 0; i < b->lanes; i++) {
+    if (!b->illegal[i] && b->cycles[i] < min)
+      min = b->cycles[i];
+  }
+  if (min == UINT32_MAX)
+    return;
+  for (unsigned i = 0; i < b->lanes; i++)
+    b->cycles[i] -= b->illegal[i] ? 0 : min;
+  b->base += min;
+}
+
+/* --- Interface -------------------------------------------------------- */
+
+Batch *batch_create(const uint8_t *image, size_t size, unsigned lanes) {
+  if (size > MACHINE_IMAGE_MAX || lanes == 0 || lanes > BATCH_LANES_MAX)
+    return NULL;
+
+  Batch *b = calloc(1, sizeof(Batch));
+  unsigned w = (lanes + BATCH_VECTOR - 1) / BATCH_VECTOR * BATCH_VECTOR;
+  // Widest arrays first, so that each one stays aligned
+  size_t bytes = (size_t)w * (8 + 4 + 3 * 2 + 14);
+  uint8_t *arena = b != NULL ? calloc(1, bytes) : NULL;
+
+  if (arena == NULL) {
+    free(b);
+    return NULL;
+  }
+  b->lanes = lanes;
+  b->width = w;
+  b->min_group = w / 16 > 2 ? w / 16 : 2;
+  b->stopped_at = (uint64_t *)arena;
+  b->cycles = (uint32_t *)(arena + (size_t)w * 8);
+  b->pc = (uint16_t *)(arena + (size_t)w * 12);
+  b->sp = b->pc + w;
+  b->target = b->sp + w;
+  uint8_t **rows[] = {&b->a,    &b->x,    &b->y,       &b->nz,   &b->c,
+                      &b->v,    &b->p,    &b->pad0,    &b->pad1, &b->live,
+                      &b->illegal, &b->mask, &b->val, &b->extra};
+  for (size_t r = 0; r < sizeof(rows) / sizeof(rows[0]); r++)
+    *rows[r] = arena + (size_t)w * (18 + r);
+
+  memcpy(b->image + RVM_MEM_SIZE - size, image, size);
+  uint16_t reset = b->image[0xFFFC] | b->image[0xFFFD] << 8;
+  for (unsigned i = 0; i < w; i++) {
+    b->pc[i] = reset;
+    b->sp[i] = 0xFD;
+    b->nz[i] = 1;
+    b->p[i] = FLAG_I;
+  }
+  return b;
+}
+
+void batch_destroy(Batch *batch) {
+  if (batch == NULL)
+    return;
+  for (int page = 0; page < BUS_PAGE_COUNT; page++)
+    free(batch->pages[page]);
+  free(batch->stopped_at);
+  free(batch);
+}
+
+void batch_set_buttons(Batch *batch, unsigned lane, uint16_t buttons) {
+  batch->pad0[lane] = (uint8_t)buttons;
+  batch->pad1[lane] = buttons >> 8;
+}
+
+int batch_run(Batch *batch, uint64_t until) {
+  int running = 0;
+
+  while (!batch->failed) {
+    batch_rebase(batch);
+    if (until <= batch->base)
+      break;
+    uint64_t span = until - batch->base;
+    batch_run_to(batch, span > BATCH_SLICE ? BATCH_SLICE : (uint32_t)span);
+    if (span <= BATCH_SLICE)
+      break;
+  }
+  if (batch->failed)
+    return -1;
+  for (unsigned i = 0; i < batch->lanes; i++)
+    running += !batch->illegal[i];
+  return running;
+}
+
+void batch_lane(const Batch *batch, unsigned lane, BatchLane *out) {
+  const Batch *b = batch;
+  uint8_t nz = b->nz[lane];
+
+  out->a = b->a[lane];
+  out->x = b->x[lane];
+  out->y = b->y[lane];
+  out->flags = (b->p[lane] & ~CPU_LAZY_FLAGS) | (nz & FLAG_N) |
+               (nz == 0 ? FLAG_Z : 0) | b->c[lane] |
+               (b->v[lane] & 0x80 ? FLAG_V : 0);
+  out->pc = b->pc[lane];
+  out->sp = b->sp[lane];
+  out->cycles = b->illegal[lane] ? b->stopped_at[lane]
+                                 : b->base + b->cycles[lane];
+  out->reason = b->illegal[lane] ? STOP_ILLEGAL : STOP_BUDGET;
+}
+
+uint8_t batch_read(const Batch *batch, unsigned lane, uint16_t addr) {
+  return lane_read(batch, lane, addr);
+}
+
+void batch_set_min_group(Batch *batch, unsigned lanes) {
+  batch->min_group = lanes;
+}
+
+void batch_steps(const Batch *batch, uint64_t *vector, uint64_t *scalar) {
+  *vector = batch->vector_steps;
+  *scalar = batch->scalar_steps;
+}
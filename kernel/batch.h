@@ -0,0 +1,154 @@
+/**
+ * rvm-8/kernel/batch.h
+ *
+ * Lockstep batch interpreter: many instances of one program, stepped
+ * together a vector of instances at a time.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ *
+ * For fuzzing and search, where thousands of copies of one ROM run on
+ * different inputs. A batch keeps the registers of all its instances
+ * (lanes) as structure-of-arrays, one array per register, and their
+ * memory interleaved by lane, so that byte `addr` of every lane sits in
+ * one row. Lanes whose PCs agree run the instruction there together: the
+ * register and flag arithmetic works on 16 lanes at a time in SIMD
+ * registers, and a load or store to an address that is the same in every
+ * lane moves a whole row. Groups smaller than a threshold, and code that
+ * the lanes have rewritten differently, are stepped one lane at a time
+ * on a scalar path instead.
+ *
+ * Memory is copy-on-write over the loaded image a page at a time, for
+ * the whole batch: a page nobody has written is read from the image,
+ * and the first write to it gives every lane its own copy.
+ *
+ * A lane is the CPU of a Machine with nothing but memory and the pads:
+ * it runs the same instructions, with the same cycle counts, as a
+ * Machine that loaded the same image and latched the same buttons, for
+ * programs that use only RAM and INPUT_REG_PAD0/1. The PPU registers and
+ * the rest of the input page (timer, sound) read as 0 and ignore writes,
+ * and there are no interrupts.
+ */
+
+#ifndef RVM_BATCH_H
+#define RVM_BATCH_H
+
+#include "cpu.h"
+#include <stddef.h>
+
+/** Lanes one vector step covers; batches round their lanes up to this */
+#define BATCH_VECTOR 16
+/** Most lanes a batch can hold */
+#define BATCH_LANES_MAX 65536
+
+typedef struct Batch Batch;
+
+/**
+ * @brief Registers and state of one lane, as batch_lane() reports them.
+ */
+typedef struct {
+  uint8_t a;
+  uint8_t x;
+  uint8_t y;
+  /** Processor status, packed as cpu_pack_flags() does */
+  uint8_t flags;
+  uint16_t pc;
+  uint16_t sp;
+  /** Cycles run since the batch was created */
+  uint64_t cycles;
+  /** STOP_ILLEGAL once the lane hit an opcode without a handler, with
+   *  the PC on it; STOP_BUDGET otherwise */
+  StopReason reason;
+} BatchLane;
+
+/**
+ * @brief Create a batch of lanes running one image.
+ *
+ * The image is placed so that it ends at 0xFFFF, as machine_load_image()
+ * does, and every lane starts from the reset vector with the registers
+ * of cpu_reset() and no buttons held.
+ *
+ * @param image Image contents; copied.
+ * @param size Bytes in the image, at most MACHINE_IMAGE_MAX.
+ * @param lanes Number of lanes, 1 to BATCH_LANES_MAX.
+ * @return The batch, or NULL on a bad size or if allocation failed.
+ */
+Batch *batch_create(const uint8_t *image, size_t size, unsigned lanes);
+
+/**
+ * @brief Free a batch.
+ *
+ * @param batch The batch, or NULL.
+ */
+void batch_destroy(Batch *batch);
+
+/**
+ * @brief Set the buttons a lane reads from the pads.
+ *
+ * Like a latched InputPort, the value holds until it is set again.
+ *
+ * @param batch Pointer to the batch.
+ * @param lane Lane index.
+ * @param buttons Pad 0 in the low byte, pad 1 in the high byte.
+ */
+void batch_set_buttons(Batch *batch, unsigned lane, uint16_t buttons);
+
+/**
+ * @brief Run every lane up to a cycle count.
+ *
+ * Each lane runs until its cycle count since creation reaches @p until,
+ * overshooting by the last instruction as cpu_run() does, or until it
+ * hits an illegal opcode. Called with (f + 1) * MACHINE_FRAME_CYCLES for
+ * frame f, the lanes stop where machine_run_frame() would.
+ *
+ * @param batch Pointer to the batch.
+ * @param until Cycle count to run to.
+ * @return The lanes that have not hit an illegal opcode, or -1 if a page
+ *         copy could not be allocated, after which the batch's memory is
+ *         no longer exact.
+ */
+int batch_run(Batch *batch, uint64_t until);
+
+/**
+ * @brief Read the registers of a lane.
+ *
+ * @param batch Pointer to the batch.
+ * @param lane Lane index.
+ * @param out Receives the state.
+ */
+void batch_lane(const Batch *batch, unsigned lane, BatchLane *out);
+
+/**
+ * @brief Read a byte of a lane's memory, as the lane would.
+ *
+ * @param batch Pointer to the batch.
+ * @param lane Lane index.
+ * @param addr Address.
+ * @return The byte.
+ */
+uint8_t batch_read(const Batch *batch, unsigned lane, uint16_t addr);
+
+/**
+ * @brief Set the smallest group of lanes stepped on the vector path.
+ *
+ * A vector step costs about the same for any group, so smaller groups
+ * are faster stepped one lane at a time. 1 steps every group as a
+ * vector, BATCH_LANES_MAX + 1 every lane on its own; both give the same
+ * results.
+ *
+ * @param batch Pointer to the batch.
+ * @param lanes Lanes a group needs for a vector step.
+ */
+void batch_set_min_group(Batch *batch, unsigned lanes);
+
+/**
+ * @brief Lane steps run so far on each path.
+ *
+ * @param batch Pointer to the batch.
+ * @param vector Receives the instructions run in vector steps, summed
+ *        over the lanes that ran them.
+ * @param scalar Receives the instructions run one lane at a time.
+ */
+void batch_steps(const Batch *batch, uint64_t *vector, uint64_t *scalar);
+
+#endif
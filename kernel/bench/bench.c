@@ -0,0 +1,678 @@
+/*
+ * rvm-8/kernel/bench/bench.c
+ *
+ * rvm-bench: microbenchmarks for the rvm-8 core, reported as JSON.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ *
+ *   rvm-bench [--quick] [--engine interp|blocks|jit|batch]
+ *             [--filter TEXT] [--cpu N] [--repeats N]
+ *
+ * Notes:
+ * - "opcode" cases run one instruction from RVM_ISA unrolled in a loop,
+ *   so the numbers are per instruction and mode. Indexed modes are run
+ *   with and without a page crossing. "mmio" cases hammer the device
+ *   pages through the bus callbacks, "frame" cases run whole frames
+ *   through machine_run_frame(), rendering included. "batch" cases run
+ *   BATCH_LANES copies of a program on different buttons, as a lockstep
+ *   batch (batch.h) and as that many Machines with each engine; they
+ *   report the time per instruction of one lane.
+ * - Every case runs with each engine: the plain interpreter, the block
+ *   cache, and the block cache with the recompiler (where built in).
+ * - The process is pinned to one CPU, and each case is run once untimed
+ *   before the timed repeats so caches, blocks and native code are warm.
+ *   The median is reported along with the best run and the spread
+ *   ((max - min) / median), so a gate can refuse a noisy run instead of
+ *   trusting it.
+ * - The work per repeat is a fixed number of emulated cycles (or
+ *   frames), never a time slice, so results compare across hosts and
+ *   commits. "target" names the architecture it was built for, so a
+ *   wasm32 run (make bench-wasm) can sit next to the native one.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <sched.h>
+#endif
+
+#include "../batch.h"
+#include "../block.h"
+#include "../isa.h"
+#include "../machine.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define CODE_BASE 0x8000
+#define UNROLL 32
+#define DATA 0x3000           // RAM used by the loads and stores
+#define ZP_DATA 0x40          // Zero-page operand
+#define ZP_POINTER 0x60       // (zp),Y pointer to DATA
+#define ZP_POINTER_CROSS 0x62 // (zp),Y pointer to DATA + 0xF8
+#define INDEX 0x10            // X and Y at the start of every run
+#define POINTERS 0x3400       // JMP (ind) targets
+
+#define OPCODE_CYCLES 4000000
+#define FRAME_COUNT 60
+#define BATCH_LANES 256
+#define BATCH_FRAMES 4
+#define REPEATS 5
+
+typedef enum { ENGINE_INTERP, ENGINE_BLOCKS, ENGINE_JIT, ENGINE_BATCH } Engine;
+
+static const char *engine_names[] = {"interp", "blocks", "jit", "batch"};
+
+typedef enum { GROUP_OPCODE, GROUP_MMIO, GROUP_FRAME, GROUP_BATCH } Group;
+
+static const char *group_names[] = {"opcode", "mmio", "frame", "batch"};
+
+typedef struct {
+  char name[32];
+  Group group;
+  int opcode; // -1 for loops of several instructions
+  /** Program; the code starts at CODE_BASE and loops forever */
+  uint8_t image[RVM_MEM_SIZE];
+  /** Instructions and cycles in one trip around the loop */
+  uint32_t loop_insns;
+  uint32_t loop_cycles;
+} Case;
+
+typedef struct {
+  int quick;
+  int engine; // -1 for all
+  const char *filter;
+  int cpu;
+  int repeats;
+} Options;
+
+static const char *mode_syntax[] = {
+    [MODE_IMMEDIATE] = "#imm",     [MODE_ZEROPAGE] = "zp",
+    [MODE_ABSOLUTE] = "abs",       [MODE_ZEROPAGE_X] = "zp,X",
+    [MODE_ZEROPAGE_Y] = "zp,Y",    [MODE_ABSOLUTE_X] = "abs,X",
+    [MODE_ABSOLUTE_Y] = "abs,Y",   [MODE_INDIRECT] = "(abs)",
+    [MODE_INDIRECT_X] = "(zp,X)",  [MODE_INDIRECT_Y] = "(zp),Y",
+    [MODE_IMPLIED] = "",           [MODE_ACCUMULATOR] = "A",
+    [MODE_RELATIVE] = "rel",
+};
+
+#if defined(__wasm32__)
+#define BENCH_TARGET "wasm32"
+#elif defined(__x86_64__)
+#define BENCH_TARGET "x86_64"
+#elif defined(__aarch64__)
+#define BENCH_TARGET "aarch64"
+#else
+#define BENCH_TARGET "other"
+#endif
+
+static Case bench_case;
+static int first_result = 1;
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * @brief Pins the process to one CPU.
+ *
+ * @return The CPU, or -1 where pinning is not supported.
+ */
+static int pin_cpu(int cpu) {
+#ifdef __linux__
+  cpu_set_t set;
+
+  if (cpu < 0)
+    cpu = sched_getcpu();
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if (cpu >= 0 && sched_setaffinity(0, sizeof(set), &set) == 0)
+    return cpu;
+#endif
+  (void)cpu;
+  return -1;
+}
+
+/* --- Programs --------------------------------------------------------- */
+
+static uint16_t put(uint16_t pc, int count, ...) {
+  va_list args;
+
+  va_start(args, count);
+  for (int i = 0; i < count; i++)
+    bench_case.image[pc++] = (uint8_t)va_arg(args, int);
+  va_end(args);
+  return pc;
+}
+
+static uint16_t put_insn(uint16_t pc, uint8_t opcode, AddressingMode mode,
+                         uint16_t operand) {
+  bench_case.image[pc] = opcode;
+  if (instruction_size(mode) > 1)
+    bench_case.image[pc + 1] = (uint8_t)operand;
+  if (instruction_size(mode) > 2)
+    bench_case.image[pc + 2] = (uint8_t)(operand >> 8);
+  return pc + instruction_size(mode);
+}
+
+static void begin_case(const char *name, Group group, int opcode) {
+  memset(&bench_case, 0, sizeof(bench_case));
+  snprintf(bench_case.name, sizeof(bench_case.name), "%s", name);
+  bench_case.group = group;
+  bench_case.opcode = opcode;
+  bench_case.image[0xFFFC] = (uint8_t)CODE_BASE;
+  bench_case.image[0xFFFD] = CODE_BASE >> 8;
+}
+
+/**
+ * @brief One instruction, unrolled, then a jump back.
+ *
+ * @param cross For indexed modes, make the effective address cross a
+ *        page.
+ */
+static void build_opcode(uint8_t opcode, AddressingMode mode, int cross) {
+  uint16_t pc = CODE_BASE;
+  uint16_t operand = 0;
+
+  switch (mode) {
+  case MODE_IMMEDIATE:
+    operand = 0x01;
+    break;
+  case MODE_ZEROPAGE:
+  case MODE_ZEROPAGE_X:
+  case MODE_ZEROPAGE_Y:
+    operand = ZP_DATA;
+    break;
+  case MODE_ABSOLUTE:
+  case MODE_ABSOLUTE_X:
+  case MODE_ABSOLUTE_Y:
+    operand = cross ? DATA + 0xF8 : DATA;
+    break;
+  case MODE_INDIRECT_X:
+    operand = ZP_POINTER - INDEX;
+    break;
+  case MODE_INDIRECT_Y:
+    operand = cross ? ZP_POINTER_CROSS : ZP_POINTER;
+    break;
+  default:
+    break;
+  }
+
+  for (int i = 0; i < UNROLL; i++) {
+    if (opcode == 0x4C) {
+      // JMP abs: each one jumps to the next
+      pc = put_insn(pc, opcode, mode, pc + 3);
+    } else if (mode == MODE_INDIRECT) {
+      uint16_t pointer = POINTERS + 2 * i;
+      bench_case.image[pointer] = (uint8_t)(pc + 3);
+      bench_case.image[pointer + 1] = (uint8_t)((pc + 3) >> 8);
+      pc = put_insn(pc, opcode, mode, pointer);
+    } else {
+      // Branches get offset 0: taken or not, they go to the next one
+      pc = put_insn(pc, opcode, mode, operand);
+    }
+  }
+  put(pc, 3, 0x4C, (uint8_t)CODE_BASE, CODE_BASE >> 8);
+}
+
+/* --- Running ---------------------------------------------------------- */
+
+/**
+ * @brief A machine with the current case loaded and the engine set,
+ *        straight from reset.
+ *
+ * @return The machine, or NULL if the engine is not available.
+ */
+static Machine *load_machine(Engine engine) {
+  Machine *machine = machine_create();
+
+  if (machine == NULL) {
+    fprintf(stderr, "rvm-bench: out of memory\n");
+    exit(1);
+  }
+  machine_load_image(machine, &bench_case.image[MACHINE_IMAGE_BASE],
+                     MACHINE_IMAGE_MAX);
+
+  if (engine == ENGINE_INTERP) {
+    block_cache_detach(&machine->cpu);
+  } else if (machine->cpu.blocks == NULL ||
+             (block_cache_set_jit(&machine->cpu, engine == ENGINE_JIT) != 0 &&
+              engine == ENGINE_JIT)) {
+    machine_destroy(machine);
+    return NULL;
+  }
+  return machine;
+}
+
+/**
+ * @brief load_machine() with the pointers and index registers the opcode
+ *        cases expect.
+ */
+static Machine *start_machine(Engine engine) {
+  Machine *machine = load_machine(engine);
+
+  if (machine == NULL)
+    return NULL;
+  // Zero-page pointers lie below the image
+  uint8_t *zp = machine->memory;
+  zp[ZP_POINTER] = (uint8_t)DATA;
+  zp[ZP_POINTER + 1] = DATA >> 8;
+  zp[ZP_POINTER_CROSS] = (uint8_t)(DATA + 0xF8);
+  zp[ZP_POINTER_CROSS + 1] = (DATA + 0xF8) >> 8;
+  machine->cpu.x = machine->cpu.y = INDEX;
+  return machine;
+}
+
+/**
+ * @brief Steps once around the loop to count its instructions and
+ * cycles.
+ */
+static void measure_loop(void) {
+  Machine *machine = start_machine(ENGINE_INTERP);
+  CPU *cpu = &machine->cpu;
+
+  bench_case.loop_insns = 0;
+  do {
+    if (cpu_step(cpu) != STOP_BUDGET) {
+      fprintf(stderr, "rvm-bench: %s stopped\n", bench_case.name);
+      exit(1);
+    }
+    bench_case.loop_insns++;
+  } while (cpu->pc != CODE_BASE);
+  bench_case.loop_cycles = cpu->cycles;
+  machine_destroy(machine);
+}
+
+/**
+ * @brief Times one repeat.
+ *
+ * @param work Emulated cycles, or frames for GROUP_FRAME.
+ * @param cycles Receives the cycles actually run.
+ * @return Elapsed nanoseconds.
+ */
+static double run_once(Machine *machine, uint32_t work, uint64_t *cycles) {
+  uint64_t start = machine->cpu.cycles;
+  double t0 = now_ns();
+
+  if (bench_case.group == GROUP_FRAME) {
+    for (uint32_t i = 0; i < work; i++)
+      machine_run_frame(machine);
+  } else {
+    cpu_run(&machine->cpu, work, NULL);
+  }
+
+  double elapsed = now_ns() - t0;
+  *cycles = machine->cpu.cycles - start;
+  return elapsed;
+}
+
+/**
+ * @brief Prints one result as JSON.
+ *
+ * @param ns_per_unit Time per instruction or frame of each repeat,
+ *        sorted.
+ * @param mhz Emulated clock rate at the median.
+ */
+static void print_result(int engine, const double *ns_per_unit, int repeats,
+                         double mhz) {
+  const char *unit =
+      bench_case.group == GROUP_FRAME ? "ns_per_frame" : "ns_per_insn";
+  double median = ns_per_unit[repeats / 2];
+  double best = ns_per_unit[0];
+  double spread = (ns_per_unit[repeats - 1] - best) / median;
+
+  printf("%s\n    {\"name\": \"%s\", \"group\": \"%s\", \"engine\": \"%s\", ",
+         first_result ? "" : ",", bench_case.name,
+         group_names[bench_case.group], engine_names[engine]);
+  if (bench_case.opcode >= 0)
+    printf("\"opcode\": \"0x%02X\", ", bench_case.opcode);
+  printf("\"%s\": %.3f, \"%s_best\": %.3f, \"spread\": %.4f, "
+         "\"mhz\": %.2f}",
+         unit, median, unit, best, spread, mhz);
+  fflush(stdout);
+  first_result = 0;
+}
+
+static void run_case(const Options *opt) {
+  uint32_t work = bench_case.group == GROUP_FRAME ? FRAME_COUNT : OPCODE_CYCLES;
+
+  if (opt->filter && !strstr(bench_case.name, opt->filter))
+    return;
+  if (opt->quick)
+    work /= 10;
+  if (bench_case.group != GROUP_FRAME)
+    measure_loop();
+
+  for (int engine = ENGINE_INTERP; engine <= ENGINE_JIT; engine++) {
+    double ns[64], ns_per_unit[64];
+    uint64_t cycles = 0;
+    Machine *machine;
+
+    if (opt->engine >= 0 && engine != opt->engine)
+      continue;
+    if ((machine = start_machine(engine)) == NULL)
+      continue;
+
+    run_once(machine, work, &cycles); // Warm-up
+    for (int r = 0; r < opt->repeats; r++) {
+      ns[r] = run_once(machine, work, &cycles);
+      if (bench_case.group == GROUP_FRAME)
+        ns_per_unit[r] = ns[r] / work;
+      else
+        ns_per_unit[r] = ns[r] * bench_case.loop_cycles /
+                         ((double)cycles * bench_case.loop_insns);
+    }
+    machine_destroy(machine);
+
+    qsort(ns_per_unit, opt->repeats, sizeof(double), compare_doubles);
+    double median = ns_per_unit[opt->repeats / 2];
+
+    // Emulated clock rate at the median
+    double mhz;
+    if (bench_case.group == GROUP_FRAME)
+      mhz = (double)cycles / (median * work) * 1e3;
+    else
+      mhz = bench_case.loop_cycles * 1e3 / (median * bench_case.loop_insns);
+    print_result(engine, ns_per_unit, opt->repeats, mhz);
+  }
+}
+
+/* --- Cases ------------------------------------------------------------ */
+
+static void opcode_cases(const Options *opt) {
+  static const struct {
+    uint8_t opcode;
+    const char *name;
+    AddressingMode mode;
+  } isa[] = {
+#define ROW(opc, mn, mode, cycles) {opc, #mn, MODE_##mode},
+      RVM_ISA(ROW)
+#undef ROW
+  };
+
+  for (size_t i = 0; i < sizeof(isa) / sizeof(isa[0]); i++) {
+    AddressingMode mode = isa[i].mode;
+    int indexed = mode == MODE_ABSOLUTE_X || mode == MODE_ABSOLUTE_Y ||
+                  mode == MODE_INDIRECT_Y;
+
+    for (int cross = 0; cross <= indexed; cross++) {
+      char name[32];
+
+      snprintf(name, sizeof(name), "%s%s%s%s", isa[i].name,
+               *mode_syntax[mode] ? " " : "", mode_syntax[mode],
+               !indexed ? "" : cross ? " cross" : " nocross");
+      begin_case(name, GROUP_OPCODE, isa[i].opcode);
+      build_opcode(isa[i].opcode, mode, cross);
+      run_case(opt);
+    }
+  }
+}
+
+static void mmio_cases(const Options *opt) {
+  uint16_t pc;
+
+  // PPU registers: reads and writes through the I/O callbacks
+  begin_case("mmio ppu regs", GROUP_MMIO, -1);
+  pc = CODE_BASE;
+  for (int i = 0; i < UNROLL / 4; i++) {
+    pc = put(pc, 3, 0xAD, 0x01, 0x24); // LDA $2401 (BGP)
+    pc = put(pc, 3, 0x8D, 0x01, 0x24); // STA $2401
+    pc = put(pc, 3, 0xAD, 0x00, 0x24); // LDA $2400 (CTRL)
+    pc = put(pc, 3, 0x8D, 0x00, 0x24); // STA $2400
+  }
+  put(pc, 3, 0x4C, 0x00, 0x80);
+  run_case(opt);
+
+  // Input registers: reads only
+  begin_case("mmio input", GROUP_MMIO, -1);
+  pc = CODE_BASE;
+  for (int i = 0; i < UNROLL / 2; i++) {
+    pc = put(pc, 3, 0xAD, 0x00, 0x25); // LDA $2500
+    pc = put(pc, 3, 0xAE, 0x01, 0x25); // LDX $2501
+  }
+  put(pc, 3, 0x4C, 0x00, 0x80);
+  run_case(opt);
+
+  // VRAM stores: RAM, but trapped for the PPU's tile cache
+  begin_case("mmio vram stores", GROUP_MMIO, -1);
+  pc = CODE_BASE;
+  for (int i = 0; i < UNROLL / 2; i++) {
+    pc = put(pc, 3, 0x9D, 0x00, 0x20); // STA $2000,X (tiles)
+    pc = put(pc, 3, 0x9D, 0x00, 0x22); // STA $2200,X (tilemap)
+  }
+  put(pc, 3, 0x4C, 0x00, 0x80);
+  run_case(opt);
+}
+
+static void frame_cases(const Options *opt) {
+  uint16_t pc;
+
+  // Arithmetic over a RAM table; the PPU only renders
+  begin_case("frame compute", GROUP_FRAME, -1);
+  pc = put(CODE_BASE, 2, 0xA2, 0x00);  // LDX #0
+  pc = put(pc, 3, 0xBD, 0x00, 0x30);   // loop: LDA $3000,X
+  pc = put(pc, 2, 0x69, 0x03);         // ADC #3
+  pc = put(pc, 1, 0x4A);               // LSR A
+  pc = put(pc, 3, 0x9D, 0x00, 0x31);   // STA $3100,X
+  pc = put(pc, 2, 0xA4, 0x40);         // LDY $40
+  pc = put(pc, 1, 0xC8);               // INY
+  pc = put(pc, 2, 0x84, 0x40);         // STY $40
+  pc = put(pc, 1, 0xE8);               // INX
+  pc = put(pc, 2, 0xD0, 0xEF);         // BNE loop
+  put(pc, 3, 0x4C, 0x00, 0x80);        // JMP $8000
+  run_case(opt);
+
+  // Rewrites tiles and the tilemap, so every frame redecodes tiles
+  begin_case("frame vram", GROUP_FRAME, -1);
+  pc = put(CODE_BASE, 2, 0xA2, 0x00);  // LDX #0
+  pc = put(pc, 3, 0xBD, 0x00, 0x30);   // loop: LDA $3000,X
+  pc = put(pc, 2, 0x69, 0x01);         // ADC #1
+  pc = put(pc, 3, 0x9D, 0x00, 0x30);   // STA $3000,X
+  pc = put(pc, 3, 0x9D, 0x00, 0x20);   // STA $2000,X
+  pc = put(pc, 1, 0x4A);               // LSR A
+  pc = put(pc, 3, 0x9D, 0x00, 0x22);   // STA $2200,X
+  pc = put(pc, 1, 0xE8);               // INX
+  pc = put(pc, 2, 0xD0, 0xEE);         // BNE loop
+  put(pc, 3, 0x4C, 0x00, 0x80);        // JMP $8000
+  run_case(opt);
+
+  // A little work, then a wait on the timer for the rest of the frame;
+  // the block cache skips the wait (block.h)
+  begin_case("frame idle", GROUP_FRAME, -1);
+  pc = put(CODE_BASE, 2, 0xA9, 0x1C);  // LDA #28
+  pc = put(pc, 3, 0x8D, 0x13, 0x25);   // STA T1024T
+  pc = put(pc, 2, 0xA2, 0x00);         // LDX #0
+  pc = put(pc, 3, 0xBD, 0x00, 0x30);   // loop: LDA $3000,X
+  pc = put(pc, 2, 0x69, 0x01);         // ADC #1
+  pc = put(pc, 3, 0x9D, 0x00, 0x30);   // STA $3000,X
+  pc = put(pc, 1, 0xE8);               // INX
+  pc = put(pc, 2, 0xD0, 0xF5);         // BNE loop
+  pc = put(pc, 3, 0xAD, 0x11, 0x25);   // wait: LDA TIMINT
+  pc = put(pc, 2, 0x10, 0xFB);         // BPL wait
+  put(pc, 3, 0x4C, 0x00, 0x80);        // JMP $8000
+  run_case(opt);
+}
+
+/* --- Batches --------------------------------------------------------- */
+
+/* Buttons of a lane in a frame, the same for every engine. */
+static uint16_t lane_buttons(unsigned lane, uint32_t frame) {
+  uint32_t h = (lane + 1) * 0x9E3779B1u ^ (frame + 1) * 0x85EBCA77u;
+  return (uint16_t)(h ^ h >> 16);
+}
+
+/**
+ * @brief Times one repeat of a batch case: every lane for @p frames.
+ *
+ * @param insns Receives the instructions run by all lanes, or NULL.
+ * @return Elapsed nanoseconds, or -1 if the engine is not available.
+ */
+static double run_batch_once(Engine engine, uint32_t frames,
+                             uint64_t *insns) {
+  double elapsed = 0;
+
+  if (engine == ENGINE_BATCH) {
+    Batch *batch = batch_create(&bench_case.image[MACHINE_IMAGE_BASE],
+                                MACHINE_IMAGE_MAX, BATCH_LANES);
+    uint64_t vector, scalar;
+
+    if (batch == NULL) {
+      fprintf(stderr, "rvm-bench: out of memory\n");
+      exit(1);
+    }
+    double t0 = now_ns();
+    for (uint32_t f = 0; f < frames; f++) {
+      for (unsigned lane = 0; lane < BATCH_LANES; lane++)
+        batch_set_buttons(batch, lane, lane_buttons(lane, f));
+      batch_run(batch, (uint64_t)(f + 1) * MACHINE_FRAME_CYCLES);
+    }
+    elapsed = now_ns() - t0;
+    batch_steps(batch, &vector, &scalar);
+    if (insns != NULL)
+      *insns = vector + scalar;
+    batch_destroy(batch);
+    return elapsed;
+  }
+
+  // One Machine per lane, not rendering: the batch has no PPU either
+  for (unsigned lane = 0; lane < BATCH_LANES; lane++) {
+    Machine *machine = load_machine(engine);
+
+    if (machine == NULL)
+      return -1;
+    machine_set_render_interval(machine, 0);
+    double t0 = now_ns();
+    for (uint32_t f = 0; f < frames; f++) {
+      input_publish(&machine->input.local, lane_buttons(lane, f), f);
+      machine_run_frame(machine);
+    }
+    elapsed += now_ns() - t0;
+    machine_destroy(machine);
+  }
+  return elapsed;
+}
+
+static void run_batch_case(const Options *opt) {
+  uint32_t frames = opt->quick ? 1 : BATCH_FRAMES;
+  uint64_t insns;
+
+  if (opt->filter && !strstr(bench_case.name, opt->filter))
+    return;
+  run_batch_once(ENGINE_BATCH, frames, &insns); // Counts the work
+
+  for (int engine = ENGINE_INTERP; engine <= ENGINE_BATCH; engine++) {
+    double ns_per_unit[64];
+
+    if (opt->engine >= 0 && engine != opt->engine)
+      continue;
+    if (run_batch_once(engine, frames, NULL) < 0) // Warm-up
+      continue;
+    for (int r = 0; r < opt->repeats; r++)
+      ns_per_unit[r] = run_batch_once(engine, frames, NULL) / insns;
+
+    qsort(ns_per_unit, opt->repeats, sizeof(double), compare_doubles);
+    double median = ns_per_unit[opt->repeats / 2];
+    // Emulated clock rate of all lanes together
+    double mhz = (double)frames * MACHINE_FRAME_CYCLES * BATCH_LANES * 1e3 /
+                 (median * insns);
+    print_result(engine, ns_per_unit, opt->repeats, mhz);
+  }
+}
+
+static void batch_cases(const Options *opt) {
+  uint16_t pc;
+
+  // The same work in every lane; the lanes never split up
+  begin_case("batch compute", GROUP_BATCH, -1);
+  pc = put(CODE_BASE, 2, 0xA2, 0x00);  // LDX #0
+  pc = put(pc, 3, 0xBD, 0x00, 0x30);   // loop: LDA $3000,X
+  pc = put(pc, 2, 0x69, 0x03);         // ADC #3
+  pc = put(pc, 1, 0x4A);               // LSR A
+  pc = put(pc, 3, 0x9D, 0x00, 0x31);   // STA $3100,X
+  pc = put(pc, 2, 0xA4, 0x40);         // LDY $40
+  pc = put(pc, 1, 0xC8);               // INY
+  pc = put(pc, 2, 0x84, 0x40);         // STY $40
+  pc = put(pc, 1, 0xE8);               // INX
+  pc = put(pc, 2, 0xD0, 0xEF);         // BNE loop
+  put(pc, 3, 0x4C, 0x00, 0x80);        // JMP $8000
+  run_batch_case(opt);
+
+  // Branches on the buttons, so the lanes split and meet again
+  begin_case("batch pads", GROUP_BATCH, -1);
+  pc = put(CODE_BASE, 3, 0xAD, 0x00, 0x25); // LDA $2500
+  pc = put(pc, 2, 0x85, 0x40);              // STA $40
+  pc = put(pc, 3, 0xAE, 0x01, 0x25);        // LDX $2501
+  pc = put(pc, 2, 0x46, 0x40);              // loop: LSR $40
+  pc = put(pc, 2, 0x90, 0x03);              // BCC skip
+  pc = put(pc, 3, 0x6D, 0x41, 0x00);        // ADC $0041
+  pc = put(pc, 3, 0x9D, 0x00, 0x30);        // skip: STA $3000,X
+  pc = put(pc, 2, 0x85, 0x41);              // STA $41
+  pc = put(pc, 1, 0xE8);                    // INX
+  pc = put(pc, 2, 0xD0, 0xF1);              // BNE loop
+  put(pc, 3, 0x4C, 0x00, 0x80);             // JMP $8000
+  run_batch_case(opt);
+}
+
+static void usage(void) {
+  fprintf(stderr, "usage: rvm-bench [--quick] "
+                  "[--engine interp|blocks|jit|batch] "
+                  "[--filter TEXT] [--cpu N] [--repeats N]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  Options opt = {0, -1, NULL, -1, REPEATS};
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i], *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+    if (strcmp(arg, "--quick") == 0) {
+      opt.quick = 1;
+      continue;
+    }
+    if (value == NULL)
+      usage();
+    i++;
+    if (strcmp(arg, "--engine") == 0) {
+      for (opt.engine = ENGINE_BATCH; opt.engine >= 0; opt.engine--)
+        if (strcmp(value, engine_names[opt.engine]) == 0)
+          break;
+      if (opt.engine < 0)
+        usage();
+    } else if (strcmp(arg, "--filter") == 0) {
+      opt.filter = value;
+    } else if (strcmp(arg, "--cpu") == 0) {
+      opt.cpu = atoi(value);
+    } else if (strcmp(arg, "--repeats") == 0) {
+      opt.repeats = atoi(value);
+      if (opt.repeats < 1 || opt.repeats > 64)
+        usage();
+    } else {
+      usage();
+    }
+  }
+
+  int cpu = pin_cpu(opt.cpu);
+  if (cpu < 0)
+    fprintf(stderr, "rvm-bench: not pinned, expect noise\n");
+
+  printf("{\n  \"schema\": 1,\n  \"target\": \"%s\",\n"
+         "  \"pinned_cpu\": %d,\n  \"repeats\": %d,\n"
+         "  \"quick\": %s,\n  \"results\": [",
+         BENCH_TARGET, cpu, opt.repeats, opt.quick ? "true" : "false");
+  opcode_cases(&opt);
+  mmio_cases(&opt);
+  frame_cases(&opt);
+  batch_cases(&opt);
+  printf("\n  ]\n}\n");
+  return 0;
+}
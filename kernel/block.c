@@ -0,0 +1,449 @@
+/*
+ * rvm-8/kernel/block.c
+ *
+ * Predecoded basic-block cache for rvm-8.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ *
+ * Notes:
+ * - Blocks are indexed by page, then by the low byte of their PC, so a
+ *   lookup is two loads and invalidating a page only walks that page.
+ * - Invalidated blocks go back to a free list instead of being freed.
+ *   A write can invalidate the block that is executing it; the block's
+ *   memory stays valid until the next decode, and its count is zeroed
+ *   so the run loop leaves it after the current instruction.
+ * - An idle loop is skipped only on its third turn in the same state.
+ *   The second turn arms the skip with how long the memory it reads
+ *   holds still from then on; the third proves that a turn reading
+ *   those values ends where it started. Indirect modes are left out, as
+ *   their pointers could lead into I/O pages.
+ */
+
+#include "block.h"
+#include "debug.h"
+#include "jit.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define BLOCK_CHUNK 64
+#define OPCODE_JMP_ABSOLUTE 0x4C
+/* Where every instruction is counted, idle loops run every turn */
+#define BLOCK_SKIP_IDLE (!RVM_STATS)
+
+/**
+ * @brief Blocks starting in one bus page, indexed by PC low byte.
+ */
+typedef struct {
+  Block *entry[BUS_PAGE_SIZE];
+} BlockPage;
+
+/**
+ * @brief A batch of blocks allocated together.
+ */
+typedef struct BlockChunk {
+  struct BlockChunk *next;
+  Block blocks[BLOCK_CHUNK];
+} BlockChunk;
+
+struct BlockCache {
+  CPU *cpu;
+  BlockPage *pages[BUS_PAGE_COUNT];
+  Block *free_list;
+  BlockChunk *chunks;
+  /** Recompiler for hot blocks, NULL when disabled or unavailable */
+  Jit *jit;
+};
+
+/**
+ * @brief Bus trap hook: a page holding cached code was written or
+ *        remapped.
+ */
+static void block_cache_on_write(void *ctx, uint16_t addr) {
+  block_cache_invalidate_page(ctx, BUS_PAGE(addr));
+}
+
+/**
+ * @brief Takes a block from the free list, growing the pool if needed.
+ *
+ * @param cache The block cache.
+ * @return A cleared block, or NULL if allocation failed.
+ */
+static Block *block_alloc(BlockCache *cache) {
+  if (cache->free_list == NULL) {
+    BlockChunk *chunk = malloc(sizeof(BlockChunk));
+    if (chunk == NULL)
+      return NULL;
+
+    chunk->next = cache->chunks;
+    cache->chunks = chunk;
+    for (int i = 0; i < BLOCK_CHUNK; i++) {
+      chunk->blocks[i].next = cache->free_list;
+      cache->free_list = &chunk->blocks[i];
+    }
+  }
+
+  Block *block = cache->free_list;
+  cache->free_list = block->next;
+  block->count = 0;
+  block->idle = 0;
+  block->cycles = 0;
+  block->hits = 0;
+  block->native = NULL;
+  return block;
+}
+
+static void block_release(BlockCache *cache, Block *block) {
+  block->count = 0;
+  block->next = cache->free_list;
+  cache->free_list = block;
+}
+
+/**
+ * @brief Whether a block loops back to itself without storing, so that
+ *        it may be an idle loop.
+ */
+static int block_is_idle(const Block *block) {
+  const DecodedOp *last = &block->ops[block->count - 1];
+  uint16_t target;
+
+  for (unsigned i = 0; i < block->count; i++) {
+    const Instruction *instr = &instruction_table[block->ops[i].opcode];
+
+    if (instr->stores || instr->mode == MODE_INDIRECT_X ||
+        instr->mode == MODE_INDIRECT_Y)
+      return 0;
+  }
+  if (instruction_table[last->opcode].mode == MODE_RELATIVE)
+    target = last->next_pc + (int8_t)last->operand;
+  else if (last->opcode == OPCODE_JMP_ABSOLUTE)
+    target = last->operand;
+  else
+    return 0;
+  return target == block->pc;
+}
+
+/**
+ * @brief Decodes the block starting at a PC and inserts it in the cache.
+ *
+ * @param cache The block cache.
+ * @param pc Address of the first instruction.
+ * @return The new block, or NULL if nothing at @p pc can be cached.
+ */
+static Block *block_compile(BlockCache *cache, uint16_t pc) {
+  Bus *bus = &cache->cpu->bus;
+  const Debugger *debug = cache->cpu->debug;
+  uint8_t page = BUS_PAGE(pc);
+  const uint8_t *code = bus->read_map[page];
+
+  if (code == NULL)
+    return NULL;
+  // The debugger's checks run on the single-step path
+  if (debug != NULL && (debug->stop || debug_breakpoint_at(debug, pc)))
+    return NULL;
+
+  if (cache->pages[page] == NULL) {
+    cache->pages[page] = calloc(1, sizeof(BlockPage));
+    if (cache->pages[page] == NULL)
+      return NULL;
+  }
+
+  Block *block = block_alloc(cache);
+  if (block == NULL)
+    return NULL;
+
+  unsigned offset = pc & 0xFF;
+  while (block->count < BLOCK_MAX_OPS) {
+    const Instruction *instr = &instruction_table[code[offset]];
+    unsigned size = instruction_size(instr->mode);
+
+    if (instr->handler == NULL || offset + size > BUS_PAGE_SIZE)
+      break;
+    if (block->count > 0 && debug != NULL &&
+        debug_breakpoint_at(debug, (page << 8) + offset))
+      break;
+
+    DecodedOp *op = &block->ops[block->count++];
+    op->handler = instr->handler;
+    op->operand = 0;
+    if (size > 1)
+      op->operand = code[offset + 1];
+    if (size > 2)
+      op->operand |= code[offset + 2] << 8;
+    op->cycles = instr->cycles;
+    op->opcode = code[offset];
+    offset += size;
+    op->next_pc = (page << 8) + offset;
+    block->cycles += instr->cycles;
+
+    if (instr->flow != FLOW_NONE || offset == BUS_PAGE_SIZE)
+      break;
+  }
+
+  if (block->count == 0) {
+    block_release(cache, block);
+    return NULL;
+  }
+
+  block->pc = pc;
+  block->next_pc = block->ops[block->count - 1].next_pc;
+  // A page crossing adds one cycle, a taken branch at most two
+  block->max_cycles = block->cycles + 2 * block->count;
+  block->idle = block_is_idle(block);
+  cache->pages[page]->entry[pc & 0xFF] = block;
+  bus_trap_writes(bus, page, BUS_TRAP_CODE);
+  return block;
+}
+
+int block_cache_attach(CPU *cpu) {
+  if (cpu->blocks)
+    return 0;
+
+  BlockCache *cache = calloc(1, sizeof(BlockCache));
+  if (cache == NULL)
+    return -1;
+
+  cache->cpu = cpu;
+  cache->jit = jit_create();
+  cpu->blocks = cache;
+  bus_set_trap_hook(&cpu->bus, BUS_TRAP_CODE, block_cache_on_write, cache);
+  return 0;
+}
+
+void block_cache_detach(CPU *cpu) {
+  BlockCache *cache = cpu->blocks;
+
+  if (cache == NULL)
+    return;
+
+  for (int page = 0; page < BUS_PAGE_COUNT; page++) {
+    if (cache->pages[page])
+      bus_release_writes(&cpu->bus, page, BUS_TRAP_CODE);
+    free(cache->pages[page]);
+  }
+  while (cache->chunks) {
+    BlockChunk *next = cache->chunks->next;
+    free(cache->chunks);
+    cache->chunks = next;
+  }
+
+  bus_set_trap_hook(&cpu->bus, BUS_TRAP_CODE, NULL, NULL);
+  cpu->blocks = NULL;
+  jit_destroy(cache->jit);
+  free(cache);
+}
+
+/**
+ * @brief Drops the native code of every cached block and frees it.
+ */
+static void block_cache_flush_native(BlockCache *cache) {
+  for (int page = 0; page < BUS_PAGE_COUNT; page++) {
+    BlockPage *bp = cache->pages[page];
+    if (bp == NULL)
+      continue;
+    for (int i = 0; i < BUS_PAGE_SIZE; i++) {
+      if (bp->entry[i]) {
+        bp->entry[i]->native = NULL;
+        bp->entry[i]->hits = 0;
+      }
+    }
+  }
+  if (cache->jit)
+    jit_reset(cache->jit);
+}
+
+int block_cache_set_jit(CPU *cpu, int enabled) {
+  BlockCache *cache = cpu->blocks;
+
+  if (!enabled) {
+    block_cache_flush_native(cache);
+    jit_destroy(cache->jit);
+    cache->jit = NULL;
+    return 0;
+  }
+  if (cache->jit == NULL)
+    cache->jit = jit_create();
+  return cache->jit ? 0 : -1;
+}
+
+/**
+ * @brief Counts a run of a block and recompiles it once it is hot.
+ */
+static void block_tier_up(BlockCache *cache, Block *block) {
+  if (++block->hits != JIT_HOT_THRESHOLD)
+    return;
+
+  block->native = jit_compile(cache->jit, block);
+  if (block->native == NULL && jit_full(cache->jit)) {
+    // Start over with empty code memory; blocks that are still hot get
+    // recompiled as they reach the threshold again.
+    block_cache_flush_native(cache);
+    block->hits = 0;
+  }
+}
+
+void block_cache_invalidate_page(BlockCache *cache, uint8_t page) {
+  BlockPage *bp = cache->pages[page];
+
+  if (bp) {
+    for (int i = 0; i < BUS_PAGE_SIZE; i++) {
+      if (bp->entry[i]) {
+        block_release(cache, bp->entry[i]);
+        bp->entry[i] = NULL;
+      }
+    }
+  }
+  bus_release_writes(&cache->cpu->bus, page, BUS_TRAP_CODE);
+}
+
+Block *block_lookup(BlockCache *cache, uint16_t pc) {
+  BlockPage *bp = cache->pages[BUS_PAGE(pc)];
+  return bp ? bp->entry[pc & 0xFF] : NULL;
+}
+
+/**
+ * @brief The last idle block entered and the state it was entered in.
+ */
+typedef struct {
+  const Block *block;
+  /** Cycle of the entry */
+  uint64_t cycles;
+  /** Cycle the memory the block reads holds still until, once armed */
+  uint64_t until;
+  uint8_t armed;
+  uint8_t a, x, y, flags;
+  uint16_t sp;
+  LazyFlags lazy;
+} IdleMark;
+
+/**
+ * @brief First cycle at which a location an addressing mode may read
+ *        could change, as bus_steady_until().
+ */
+static uint64_t block_op_steady(const Bus *bus, const DecodedOp *op) {
+  uint16_t last = op->operand + 0xFF;
+
+  switch (instruction_table[op->opcode].mode) {
+  case MODE_ZEROPAGE:
+  case MODE_ABSOLUTE:
+    return bus_steady_until(bus, op->operand);
+  case MODE_ZEROPAGE_X:
+  case MODE_ZEROPAGE_Y:
+    return bus->pages[0].kind == BUS_IO ? 0 : UINT64_MAX;
+  case MODE_ABSOLUTE_X:
+  case MODE_ABSOLUTE_Y:
+    // The index can reach into the next page
+    return bus->pages[BUS_PAGE(op->operand)].kind == BUS_IO ||
+                   bus->pages[BUS_PAGE(last)].kind == BUS_IO
+               ? 0
+               : UINT64_MAX;
+  default:
+    return UINT64_MAX;
+  }
+}
+
+static void block_mark(const CPU *cpu, const Block *block, IdleMark *mark) {
+  *mark = (IdleMark){
+      .block = block,
+      .cycles = cpu->cycles,
+      .a = cpu->a,
+      .x = cpu->x,
+      .y = cpu->y,
+      .flags = cpu->flags,
+      .sp = cpu->sp,
+      .lazy = cpu->lazy,
+  };
+}
+
+/**
+ * @brief Called on entering an idle block; skips the turns of the loop
+ *        that would end in the state it is entered in.
+ *
+ * @param cpu Pointer to the CPU instance.
+ * @param block The block, about to run.
+ * @param mark The last idle block entered.
+ * @param end Cycle the run ends at.
+ * @return 1 if turns were skipped, 0 if the block should run.
+ */
+static int block_skip_idle(CPU *cpu, const Block *block, IdleMark *mark,
+                            uint64_t end) {
+  if (mark->block != block || cpu->a != mark->a || cpu->x != mark->x ||
+      cpu->y != mark->y || cpu->flags != mark->flags ||
+      cpu->sp != mark->sp ||
+      memcmp(&cpu->lazy, &mark->lazy, sizeof(LazyFlags)) != 0) {
+    block_mark(cpu, block, mark);
+    return 0;
+  }
+  if (!mark->armed) {
+    mark->until = end;
+    for (unsigned i = 0; i < block->count; i++) {
+      uint64_t steady = block_op_steady(&cpu->bus, &block->ops[i]);
+      if (steady < mark->until)
+        mark->until = steady;
+    }
+    mark->cycles = cpu->cycles;
+    mark->armed = 1;
+    return 0;
+  }
+
+  // The turn since the mark read what every turn before `until` reads
+  uint64_t period = cpu->cycles - mark->cycles, turns = 0;
+  if (cpu->cycles <= mark->until)
+    turns = (mark->until - cpu->cycles) / period;
+  cpu->cycles += turns * period;
+  block_mark(cpu, block, mark);
+  return turns > 0;
+}
+
+uint32_t block_run(CPU *cpu, uint32_t cycle_budget, StopReason *reason) {
+  BlockCache *cache = cpu->blocks;
+  uint64_t start = cpu->cycles;
+  IdleMark mark = {0};
+
+  *reason = STOP_BUDGET;
+
+  while (cpu->cycles - start < cycle_budget) {
+    Block *block = block_lookup(cache, cpu->pc);
+
+    if (block == NULL && (block = block_compile(cache, cpu->pc)) == NULL) {
+      StopReason step = STOP_BUDGET;
+
+      mark.block = NULL;
+      if (cpu->debug != NULL)
+        step = debug_check(cpu->debug, cpu->pc);
+      if (step == STOP_BUDGET)
+        step = cpu_step_lazy(cpu);
+      if (step != STOP_BUDGET) {
+        *reason = step;
+        break;
+      }
+      continue;
+    }
+    if (!block->idle)
+      mark.block = NULL;
+    else if (BLOCK_SKIP_IDLE &&
+             block_skip_idle(cpu, block, &mark, start + cycle_budget))
+      continue; // The turns skipped may have used up the budget
+
+    if (block->native && cycle_budget - (cpu->cycles - start) >
+                             block->max_cycles) {
+      block->native(cpu);
+      continue;
+    }
+    if (cache->jit)
+      block_tier_up(cache, block);
+
+    // block->count is re-read every iteration: a write from inside the
+    // block may invalidate it, which zeroes the count.
+    for (unsigned i = 0; i < block->count; i++) {
+      const DecodedOp *op = &block->ops[i];
+
+      cpu->pc = op->next_pc;
+      cpu->cycles += op->handler(cpu, op->operand);
+      if (cpu->cycles - start >= cycle_budget)
+        break;
+    }
+  }
+
+  return cpu->cycles - start;
+}
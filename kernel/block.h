@@ -0,0 +1,158 @@
+/**
+ * rvm-8/kernel/block.h
+ *
+ * Predecoded basic-block cache for the rvm-8 emulator.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ *
+ * A block is a run of straight-line instructions starting at some PC,
+ * decoded once into handler/operand pairs so that executing it again
+ * skips the opcode fetch, operand fetch and table lookup. A block ends
+ * after the first instruction that can change the PC, before an illegal
+ * opcode or a breakpoint (see debug.h), or at the end of its 256-byte
+ * page, so each block belongs to exactly one bus page.
+ *
+ * Pages holding cached code carry a BUS_TRAP_CODE write trap. The first
+ * write to such a RAM page, or remapping any of them, drops all of its
+ * blocks, which keeps self-modifying code and bank switching correct;
+ * pages without code never see the trap.
+ *
+ * The cache is opt-in: attach it to a CPU and cpu_run() uses it instead
+ * of the plain interpreter. Both paths produce identical results.
+ *
+ * Blocks that keep running are recompiled to native code by jit.h where
+ * the host supports it. A native block runs as a whole, so it is only
+ * entered when the remaining budget covers its worst case; otherwise the
+ * predecoded ops run one at a time as before.
+ *
+ * A block that branches or jumps back to its own start, stores nothing
+ * and reads only memory that holds still is a candidate idle loop: when
+ * it comes around twice with the registers and flags exactly as before,
+ * every further turn until the next scheduler event or until a device
+ * register it polls could change (BusSteadyFn) would do the same, so
+ * the CPU cycles are advanced over those turns instead of running them.
+ * The turns skipped are whole, and the loop resumes at the same
+ * instruction boundary the interpreter reaches, so no result changes.
+ * RVM_STATS builds run every turn, to count every instruction.
+ */
+
+#ifndef RVM_BLOCK_H
+#define RVM_BLOCK_H
+
+#include "cpu.h"
+
+#define BLOCK_MAX_OPS 32
+
+/**
+ * @brief Native code for a block, see jit_compile().
+ *
+ * @param cpu Pointer to the CPU instance.
+ * @return The number of cycles consumed.
+ */
+typedef uint32_t (*NativeBlockFn)(CPU *cpu);
+
+/**
+ * @brief One predecoded instruction.
+ */
+typedef struct {
+  /** Specialized handler of the opcode */
+  InstructionHandler handler;
+  /** Operand already read from the instruction stream */
+  uint16_t operand;
+  /** PC after this instruction */
+  uint16_t next_pc;
+  /** Base cycle count of the opcode */
+  uint8_t cycles;
+  /** Opcode byte, for the recompiler */
+  uint8_t opcode;
+} DecodedOp;
+
+/**
+ * @brief A predecoded run of straight-line code.
+ */
+typedef struct Block {
+  /** PC of the first instruction */
+  uint16_t pc;
+  /** Fall-through PC after the last instruction */
+  uint16_t next_pc;
+  /** Sum of the base cycles of all instructions */
+  uint16_t cycles;
+  /** Upper bound on the cycles of one run, page-cross penalties included */
+  uint16_t max_cycles;
+  /** Number of instructions; 0 once the block has been invalidated */
+  uint8_t count;
+  /** 1 if the block may be an idle loop, see above */
+  uint8_t idle;
+  /** Interpreted runs so far, for tiering */
+  uint32_t hits;
+  /** Recompiled code, NULL while interpreted */
+  NativeBlockFn native;
+  /** Free-list link */
+  struct Block *next;
+  DecodedOp ops[BLOCK_MAX_OPS];
+} Block;
+
+/**
+ * @brief Allocate a block cache and attach it to a CPU.
+ *
+ * Call after the memory map is set up; cpu_init() does not know about
+ * the cache, so detach it before re-initializing the CPU.
+ *
+ * @param cpu Pointer to the CPU instance.
+ * @return 0 on success, -1 if allocation failed.
+ */
+int block_cache_attach(CPU *cpu);
+
+/**
+ * @brief Detach and free the block cache of a CPU, if any.
+ *
+ * @param cpu Pointer to the CPU instance.
+ */
+void block_cache_detach(CPU *cpu);
+
+/**
+ * @brief Enable or disable recompilation of hot blocks.
+ *
+ * The recompiler is enabled by block_cache_attach() where available.
+ * Disabling it drops all native code; blocks keep their decoded form.
+ *
+ * @param cpu Pointer to a CPU with a block cache attached.
+ * @param enabled Nonzero to enable.
+ * @return 0 on success, -1 if there is no recompiler for this host.
+ */
+int block_cache_set_jit(CPU *cpu, int enabled);
+
+/**
+ * @brief Drop every cached block that starts in a page.
+ *
+ * @param cache The block cache.
+ * @param page Bus page index.
+ */
+void block_cache_invalidate_page(BlockCache *cache, uint8_t page);
+
+/**
+ * @brief Look up the block starting at a PC.
+ *
+ * @param cache The block cache.
+ * @param pc Address of the first instruction.
+ * @return The cached block, or NULL if none is cached.
+ */
+Block *block_lookup(BlockCache *cache, uint16_t pc);
+
+/**
+ * @brief Run cached blocks until the cycle budget is consumed.
+ *
+ * Used by cpu_run() when a cache is attached. Code that cannot be
+ * cached (I/O pages, instructions straddling a page, breakpoints) is
+ * single-stepped. Like opcodes_run(), expects the flags to be unpacked.
+ *
+ * @param cpu Pointer to the CPU instance.
+ * @param cycle_budget Number of cycles to execute.
+ * @param reason Set to STOP_BUDGET or STOP_ILLEGAL, or to the
+ *        debugger's STOP_BREAKPOINT or STOP_WATCHPOINT.
+ * @return The number of cycles consumed.
+ */
+uint32_t block_run(CPU *cpu, uint32_t cycle_budget, StopReason *reason);
+
+#endif
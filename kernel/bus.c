@@ -1,10 +1,175 @@
 /*
  * rvm-8/kernel/bus.c
  *
- * Memory bus implementation for rvm-8 (currently a stub).
+ * Memory bus implementation for rvm-8.
  *
  * Copyright (c) 2025 foxomax
  * SPDX-License-Identifier: MIT
+ *
+ * Notes:
+ * - Only the slow path lives here. bus_read()/bus_write() in bus.h are
+ *   inlined into the opcode handlers and touch this file only for pages
+ *   without a direct host pointer.
+ * - bus_steady_until() is only asked when the block cache sets up an
+ *   idle loop skip, never per access.
+ */
+
+#include "bus.h"
+#include <string.h>
+
+/**
+ * @brief Recomputes the fast-path pointers of a page from its config.
+ *
+ * @param bus Pointer to the bus.
+ * @param page Page index to refresh.
+ */
+static void bus_refresh_page(Bus *bus, uint8_t page) {
+  BusPage *p = &bus->pages[page];
+
+  switch (p->kind) {
+  case BUS_RAM:
+    bus->read_map[page] = p->host;
+    bus->write_map[page] = p->write_traps ? NULL : p->host;
+    break;
+  case BUS_ROM:
+    bus->read_map[page] = p->host;
+    bus->write_map[page] = bus->rom_sink;
+    break;
+  default:
+    bus->read_map[page] = NULL;
+    bus->write_map[page] = NULL;
+    break;
+  }
+}
+
+/**
+ * @brief Calls the hooks of every trap armed in @p traps.
+ *
+ * @param bus Pointer to the bus.
+ * @param traps Bitmask of armed traps.
+ * @param addr Address reported to the hooks.
+ */
+static void bus_run_traps(Bus *bus, uint8_t traps, uint16_t addr) {
+  for (int trap = 0; trap < BUS_TRAP_COUNT; trap++) {
+    const BusTrapHook *hook = &bus->write_hooks[trap];
+
+    if ((traps & (1 << trap)) && hook->fn)
+      hook->fn(hook->ctx, addr);
+  }
+}
+
+/**
+ * @brief Installs a page configuration over a range of pages.
+ *
+ * @param bus Pointer to the bus.
+ * @param first_page First page to configure.
+ * @param count Number of pages; clipped to the end of the address space.
+ * @param cfg Template; host is advanced by one page per entry.
  */
+static void bus_set_pages(Bus *bus, uint8_t first_page, unsigned count,
+                          const BusPage *cfg) {
+  for (unsigned i = 0; i < count && first_page + i < BUS_PAGE_COUNT; i++) {
+    uint8_t page = first_page + i;
+
+    if (bus->pages[page].write_traps)
+      bus_run_traps(bus, bus->pages[page].write_traps, page << 8);
+    bus->pages[page] = *cfg;
+    if (cfg->host)
+      bus->pages[page].host = cfg->host + i * BUS_PAGE_SIZE;
+    bus_refresh_page(bus, page);
+  }
+}
+
+void bus_init(Bus *bus, uint8_t *memory) {
+  memset(bus, 0, sizeof(Bus));
+  bus_map_ram(bus, 0x00, BUS_PAGE_COUNT, memory);
+}
+
+void bus_map_spec(Bus *bus, uint8_t *memory) {
+  bus_map_ram(bus, 0x00, BUS_PAGE_COUNT, memory);
+  bus_unmap(bus, BUS_PPU_PAGE, 1);
+  bus_unmap(bus, BUS_INPUT_PAGE, 1);
+  bus_map_rom(bus, BUS_ROM_PAGE, 1, memory + BUS_ROM_PAGE * BUS_PAGE_SIZE);
+}
+
+void bus_map_ram(Bus *bus, uint8_t first_page, unsigned count, uint8_t *host) {
+  BusPage cfg = {.host = host, .kind = BUS_RAM};
+  bus_set_pages(bus, first_page, count, &cfg);
+}
+
+void bus_map_rom(Bus *bus, uint8_t first_page, unsigned count,
+                 const uint8_t *host) {
+  // ROM pages are never written through host; the cast only lets them
+  // share BusPage with RAM pages.
+  BusPage cfg = {.host = (uint8_t *)host, .kind = BUS_ROM};
+  bus_set_pages(bus, first_page, count, &cfg);
+}
+
+void bus_map_io(Bus *bus, uint8_t first_page, unsigned count, BusReadFn read,
+                BusWriteFn write, void *ctx) {
+  BusPage cfg = {.read = read, .write = write, .ctx = ctx, .kind = BUS_IO};
+  bus_set_pages(bus, first_page, count, &cfg);
+}
+
+void bus_set_steady(Bus *bus, uint8_t first_page, unsigned count,
+                    BusSteadyFn steady) {
+  for (unsigned i = 0; i < count && first_page + i < BUS_PAGE_COUNT; i++) {
+    BusPage *p = &bus->pages[first_page + i];
+
+    if (p->kind == BUS_IO)
+      p->steady = steady;
+  }
+}
+
+uint64_t bus_steady_until(const Bus *bus, uint16_t addr) {
+  const BusPage *p = &bus->pages[BUS_PAGE(addr)];
+
+  if (p->kind != BUS_IO)
+    return UINT64_MAX;
+  return p->steady ? p->steady(p->ctx, addr) : 0;
+}
+
+void bus_unmap(Bus *bus, uint8_t first_page, unsigned count) {
+  BusPage cfg = {.kind = BUS_UNMAPPED};
+  bus_set_pages(bus, first_page, count, &cfg);
+}
+
+void bus_set_trap_hook(Bus *bus, BusTrap trap, BusTrapFn fn, void *ctx) {
+  bus->write_hooks[trap] = (BusTrapHook){fn, ctx};
+}
+
+void bus_trap_writes(Bus *bus, uint8_t page, BusTrap trap) {
+  BusPageKind kind = bus->pages[page].kind;
+
+  if (kind != BUS_RAM && kind != BUS_ROM)
+    return;
+  bus->pages[page].write_traps |= 1 << trap;
+  bus_refresh_page(bus, page);
+}
+
+void bus_release_writes(Bus *bus, uint8_t page, BusTrap trap) {
+  bus->pages[page].write_traps &= ~(1 << trap);
+  bus_refresh_page(bus, page);
+}
+
+uint8_t bus_read_slow(Bus *bus, uint16_t addr) {
+  const BusPage *p = &bus->pages[BUS_PAGE(addr)];
+
+  RVM_STATS_ACCESS(&bus->stats, reads, addr);
+  if (p->kind == BUS_IO && p->read)
+    return p->read(p->ctx, addr);
+  return 0;
+}
+
+void bus_write_slow(Bus *bus, uint16_t addr, uint8_t val) {
+  const BusPage *p = &bus->pages[BUS_PAGE(addr)];
+
+  RVM_STATS_ACCESS(&bus->stats, writes, addr);
+  if (p->write_traps)
+    bus_run_traps(bus, p->write_traps, addr);
 
-// ...file intentionally left as a stub for now...
+  if (p->kind == BUS_RAM)
+    p->host[addr & 0xFF] = val;
+  else if (p->kind == BUS_IO && p->write)
+    p->write(p->ctx, addr, val);
+}
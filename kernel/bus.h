@@ -0,0 +1,325 @@
+/**
+ * rvm-8/kernel/bus.h
+ *
+ * Memory bus for the rvm-8 emulator.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ *
+ * The 64 KiB address space is split into 256 pages of 256 bytes. Every
+ * page has a direct host pointer for reads and one for writes; when the
+ * pointer is set the access is a single load or store. A NULL pointer
+ * sends the access to the slow path in bus.c, which routes it to the
+ * page's I/O callbacks.
+ *
+ * ROM pages point their write pointer at a scratch page, so writes are
+ * discarded without any check on the fast path.
+ *
+ * Subsystems that need to see writes to ordinary RAM (the block cache
+ * watching pages that hold code, for example) arm a write trap on the
+ * page. That clears its write pointer, so only trapped pages pay for
+ * the hook.
+ */
+
+#ifndef RVM_BUS_H
+#define RVM_BUS_H
+
+#include "stats.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define BUS_PAGE_SIZE 256
+#define BUS_PAGE_COUNT 256
+
+/* Memory map from specs/SPEC.md, in pages */
+#define BUS_RAM_PAGE 0x00   // 0x0000-0x1FFF RAM
+#define BUS_RAM_PAGES 0x20
+#define BUS_VRAM_PAGE 0x20  // 0x2000-0x23FF VRAM
+#define BUS_VRAM_PAGES 0x04
+#define BUS_PPU_PAGE 0x24   // 0x2400-0x24FF PPU registers
+#define BUS_INPUT_PAGE 0x25 // 0x2500-0x25FF input, timer, sound registers
+#define BUS_ROM_PAGE 0xFF   // 0xFF00-0xFFFF ROM
+
+/** Page index of an address. */
+#define BUS_PAGE(addr) ((uint8_t)((addr) >> 8))
+
+#if defined(__GNUC__) || defined(__clang__)
+#define BUS_LIKELY(x) __builtin_expect(!!(x), 1)
+#else
+#define BUS_LIKELY(x) (x)
+#endif
+
+/**
+ * @brief Read callback for memory-mapped I/O pages.
+ *
+ * @param ctx The context pointer registered with the page.
+ * @param addr The full 16-bit address being read.
+ * @return The byte presented on the bus.
+ */
+typedef uint8_t (*BusReadFn)(void *ctx, uint16_t addr);
+
+/**
+ * @brief Write callback for memory-mapped I/O pages.
+ *
+ * @param ctx The context pointer registered with the page.
+ * @param addr The full 16-bit address being written.
+ * @param val The byte being written.
+ */
+typedef void (*BusWriteFn)(void *ctx, uint16_t addr, uint8_t val);
+
+/**
+ * @brief Steadiness callback for memory-mapped I/O pages.
+ *
+ * Tells the block cache how long reading @p addr keeps returning what it
+ * returns now, so that a loop polling it can be skipped (block.h).
+ *
+ * @param ctx The context pointer registered with the page.
+ * @param addr The full 16-bit address.
+ * @return The first cycle a read could return something else, UINT64_MAX
+ *         if none before the next scheduler event, or 0 if reads have
+ *         side effects or change with every cycle.
+ */
+typedef uint64_t (*BusSteadyFn)(void *ctx, uint16_t addr);
+
+/**
+ * @brief What a page is backed by.
+ */
+typedef enum {
+  BUS_UNMAPPED, // Reads as 0, writes are ignored
+  BUS_RAM,      // Host memory, readable and writable
+  BUS_ROM,      // Host memory, writes discarded
+  BUS_IO        // Read/write callbacks
+} BusPageKind;
+
+/**
+ * @brief Write traps a page can carry, one bit each.
+ */
+typedef enum {
+  BUS_TRAP_CODE,     // Page holds cached decoded code
+  BUS_TRAP_PPU,      // Page holds VRAM data the PPU caches
+  BUS_TRAP_SNAPSHOT, // Page is unchanged since the last snapshot
+  BUS_TRAP_WATCH,    // Page holds a debugger watchpoint
+  BUS_TRAP_COUNT
+} BusTrap;
+
+/**
+ * @brief Called before a trapped write is performed.
+ *
+ * Also called with the first address of the page when a trapped page is
+ * remapped, so the owner can drop state derived from the old contents.
+ *
+ * @param ctx The context pointer registered with the hook.
+ * @param addr The 16-bit address being written.
+ */
+typedef void (*BusTrapFn)(void *ctx, uint16_t addr);
+
+/**
+ * @brief Owner of one BusTrap bit.
+ */
+typedef struct {
+  BusTrapFn fn;
+  void *ctx;
+} BusTrapHook;
+
+/**
+ * @brief Configuration of a single 256-byte page.
+ *
+ * The fast-path pointers in Bus are derived from this; it is only
+ * consulted on the slow path.
+ */
+typedef struct {
+  /** Backing host memory for RAM/ROM pages, NULL otherwise */
+  uint8_t *host;
+  /** I/O read callback (BUS_IO pages) */
+  BusReadFn read;
+  /** I/O write callback (BUS_IO pages) */
+  BusWriteFn write;
+  /** I/O steadiness callback (BUS_IO pages), NULL if never steady */
+  BusSteadyFn steady;
+  /** Context passed to the callbacks */
+  void *ctx;
+  /** BusPageKind of the page */
+  uint8_t kind;
+  /** Armed write traps, one bit per BusTrap */
+  uint8_t write_traps;
+} BusPage;
+
+/**
+ * @brief Page table for one emulator instance.
+ */
+typedef struct {
+  /** Direct read pointer per page, NULL routes to the slow path */
+  const uint8_t *read_map[BUS_PAGE_COUNT];
+  /** Direct write pointer per page, NULL routes to the slow path */
+  uint8_t *write_map[BUS_PAGE_COUNT];
+  /** Per-page configuration */
+  BusPage pages[BUS_PAGE_COUNT];
+  /** Write target for ROM pages; its contents are never read */
+  uint8_t rom_sink[BUS_PAGE_SIZE];
+  /** Hooks for each BusTrap */
+  BusTrapHook write_hooks[BUS_TRAP_COUNT];
+#if RVM_STATS
+  /** Instrumentation counters of this bus and its CPU, see stats.h */
+  Stats stats;
+#endif
+} Bus;
+
+/**
+ * @brief Initialize a bus with the whole address space as flat RAM.
+ *
+ * @param bus Pointer to the bus to initialize.
+ * @param memory Backing buffer of at least 64 KiB.
+ */
+void bus_init(Bus *bus, uint8_t *memory);
+
+/**
+ * @brief Apply the memory map from specs/SPEC.md.
+ *
+ * RAM, VRAM and the unassigned range 0x2600-0xFEFF are backed by
+ * @p memory. The PPU (0x24xx) and input (0x25xx) pages are left as
+ * unmapped I/O until their devices register callbacks, and
+ * 0xFF00-0xFFFF is mapped as ROM. Trap hooks are kept.
+ *
+ * @param bus Pointer to the bus.
+ * @param memory Backing buffer of at least 64 KiB.
+ */
+void bus_map_spec(Bus *bus, uint8_t *memory);
+
+/**
+ * @brief Map pages to writable host memory.
+ *
+ * @param bus Pointer to the bus.
+ * @param first_page First page to map.
+ * @param count Number of consecutive pages.
+ * @param host Backing memory for @p first_page; following pages use
+ *        consecutive 256-byte blocks.
+ */
+void bus_map_ram(Bus *bus, uint8_t first_page, unsigned count, uint8_t *host);
+
+/**
+ * @brief Map pages to read-only host memory.
+ *
+ * @param bus Pointer to the bus.
+ * @param first_page First page to map.
+ * @param count Number of consecutive pages.
+ * @param host Backing memory for @p first_page.
+ */
+void bus_map_rom(Bus *bus, uint8_t first_page, unsigned count,
+                 const uint8_t *host);
+
+/**
+ * @brief Map pages to I/O callbacks.
+ *
+ * Either callback may be NULL, in which case reads return 0 or
+ * writes are ignored.
+ *
+ * @param bus Pointer to the bus.
+ * @param first_page First page to map.
+ * @param count Number of consecutive pages.
+ * @param read Read callback.
+ * @param write Write callback.
+ * @param ctx Context passed to both callbacks.
+ */
+void bus_map_io(Bus *bus, uint8_t first_page, unsigned count, BusReadFn read,
+                BusWriteFn write, void *ctx);
+
+/**
+ * @brief Tell the bus how long reads of I/O pages stay unchanged.
+ *
+ * Mapping the pages again clears it. Pages that are not I/O are left
+ * alone.
+ *
+ * @param bus Pointer to the bus.
+ * @param first_page First page.
+ * @param count Number of consecutive pages.
+ * @param steady Steadiness callback, called with the pages' context.
+ */
+void bus_set_steady(Bus *bus, uint8_t first_page, unsigned count,
+                    BusSteadyFn steady);
+
+/**
+ * @brief First cycle at which a read of @p addr could change.
+ *
+ * Memory pages only change through writes, so they are steady until
+ * the next scheduler event; I/O pages ask their BusSteadyFn.
+ *
+ * @param bus Pointer to the bus.
+ * @param addr 16-bit address.
+ * @return As BusSteadyFn; 0 for I/O pages without a callback.
+ */
+uint64_t bus_steady_until(const Bus *bus, uint16_t addr);
+
+/**
+ * @brief Remove the mapping of pages; reads return 0, writes are ignored.
+ */
+void bus_unmap(Bus *bus, uint8_t first_page, unsigned count);
+
+/**
+ * @brief Register the hook called for a write trap.
+ *
+ * @param bus Pointer to the bus.
+ * @param trap Which trap the hook serves.
+ * @param fn Hook function, NULL to remove it.
+ * @param ctx Context passed to @p fn.
+ */
+void bus_set_trap_hook(Bus *bus, BusTrap trap, BusTrapFn fn, void *ctx);
+
+/**
+ * @brief Route writes to a page through its trap hooks.
+ *
+ * Only RAM and ROM pages can be trapped. Writes to ROM are still
+ * discarded without calling the hooks, so a trap there only fires when
+ * the page is remapped. The trap stays armed until bus_release_writes().
+ *
+ * @param bus Pointer to the bus.
+ * @param page Page index.
+ * @param trap Trap to arm.
+ */
+void bus_trap_writes(Bus *bus, uint8_t page, BusTrap trap);
+
+/**
+ * @brief Disarm a write trap, restoring the fast path once none remain.
+ *
+ * @param bus Pointer to the bus.
+ * @param page Page index.
+ * @param trap Trap to disarm.
+ */
+void bus_release_writes(Bus *bus, uint8_t page, BusTrap trap);
+
+/** Slow path behind bus_read(); use bus_read() instead. */
+uint8_t bus_read_slow(Bus *bus, uint16_t addr);
+
+/** Slow path behind bus_write(); use bus_write() instead. */
+void bus_write_slow(Bus *bus, uint16_t addr, uint8_t val);
+
+/**
+ * @brief Read a byte through the page table.
+ *
+ * @param bus Pointer to the bus.
+ * @param addr 16-bit address to read.
+ * @return The byte at @p addr.
+ */
+static inline uint8_t bus_read(Bus *bus, uint16_t addr) {
+  const uint8_t *page = bus->read_map[BUS_PAGE(addr)];
+  if (BUS_LIKELY(page != NULL))
+    return page[addr & 0xFF];
+  return bus_read_slow(bus, addr);
+}
+
+/**
+ * @brief Write a byte through the page table.
+ *
+ * @param bus Pointer to the bus.
+ * @param addr 16-bit address to write.
+ * @param val Byte value to write.
+ */
+static inline void bus_write(Bus *bus, uint16_t addr, uint8_t val) {
+  uint8_t *page = bus->write_map[BUS_PAGE(addr)];
+  if (BUS_LIKELY(page != NULL)) {
+    page[addr & 0xFF] = val;
+    return;
+  }
+  bus_write_slow(bus, addr, val);
+}
+
+#endif
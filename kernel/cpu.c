@@ -13,7 +13,9 @@
  */
 
 #include "cpu.h"
-#include <stdio.h>
+#include "block.h"
+#include "debug.h"
+#include "trace.h"
 #include <string.h>
 
 /**
@@ -23,7 +25,7 @@
  * @param addr The 16-bit address to read from.
  * @return The byte value at the specified address.
  */
-uint8_t mem_read(CPU *cpu, uint16_t addr) { return cpu->memory[addr]; }
+uint8_t mem_read(CPU *cpu, uint16_t addr) { return bus_read(&cpu->bus, addr); }
 
 /**
  * @brief Writes a byte to a specified memory address.
@@ -35,13 +37,14 @@ uint8_t mem_read(CPU *cpu, uint16_t addr) { return cpu->memory[addr]; }
  * @param val The 8-bit value to write.
  */
 void mem_write(CPU *cpu, uint16_t addr, uint8_t val) {
-  cpu->memory[addr] = val;
+  bus_write(&cpu->bus, addr, val);
 }
 
 /**
  * @brief Initializes the CPU state.
  *
- * Sets up the CPU registers, memory pointer, and instruction table.
+ * Sets up the CPU registers, memory pointer, and instruction table. The
+ * bus starts out mapping @p memory as flat RAM.
  *
  * @param cpu Pointer to the CPU structure to initialize.
  * @param memory Pointer to the memory buffer.
@@ -49,18 +52,17 @@ void mem_write(CPU *cpu, uint16_t addr, uint8_t val) {
 void cpu_init(CPU *cpu, uint8_t *memory) {
   uint8_t *mem = memory;
 
-  init_instruction_table();
-
   memset(cpu, 0, sizeof(CPU));
   cpu->memory = mem;
+  bus_init(&cpu->bus, mem);
   cpu->a = 0;
   cpu->x = 0;
   cpu->y = 0;
   cpu->sp = 0xFD;
   cpu->flags = FLAG_I;
 
-  uint16_t lo = cpu->memory[0xFFFC];
-  uint16_t hi = cpu->memory[0xFFFD];
+  uint16_t lo = mem_read(cpu, 0xFFFC);
+  uint16_t hi = mem_read(cpu, 0xFFFD);
 
   cpu->pc = (hi << 8) | lo;
   cpu->cycles = 0;
@@ -70,13 +72,14 @@ void cpu_init(CPU *cpu, uint8_t *memory) {
  * @brief Resets the CPU to its initial state.
  *
  * Reloads the PC from the reset vector (0xFFFC-0xFFFD) and resets
- * flags/registers.
+ * flags/registers. The vector is read through the bus, so call this
+ * after changing the memory map.
  *
  * @param cpu Pointer to the CPU instance.
  */
 void cpu_reset(CPU *cpu) {
-  uint16_t lo = cpu->memory[0xFFFC];
-  uint16_t hi = cpu->memory[0xFFFD];
+  uint16_t lo = mem_read(cpu, 0xFFFC);
+  uint16_t hi = mem_read(cpu, 0xFFFD);
 
   cpu->pc = (hi << 8) | lo;
   cpu->flags = FLAG_I;
@@ -85,25 +88,122 @@ void cpu_reset(CPU *cpu) {
   cpu->x = 0;
   cpu->y = 0;
   cpu->cycles = 0;
+  cpu->halted = 0;
 }
 
 /**
  * @brief Executes a single CPU instruction.
  *
  * This function fetches an opcode from memory, looks up the corresponding
- * instruction, and executes its handler. It also handles illegal opcodes.
+ * instruction, and executes its handler. Illegal opcodes are reported to the
+ * caller with the PC left on the offending byte.
  *
  * @param cpu Pointer to the CPU instance.
+ * @return Why execution stopped (STOP_BUDGET when the instruction ran).
+ */
+StopReason cpu_step(CPU *cpu) {
+  cpu_unpack_flags(cpu);
+  if (cpu->debug != NULL)
+    debug_begin(cpu);
+  StopReason reason = cpu_step_lazy(cpu);
+  if (cpu->debug != NULL)
+    reason = debug_end(cpu, reason);
+  cpu_pack_flags(cpu);
+  return reason;
+}
+
+StopReason cpu_step_lazy(CPU *cpu) {
+  if (cpu->halted)
+    return STOP_HALT;
+
+  const Instruction *instr = &instruction_table[mem_read(cpu, cpu->pc)];
+
+  if (instr->handler == NULL)
+    return STOP_ILLEGAL;
+
+  cpu->pc++;
+  cpu->cycles += instr->handler(cpu, fetch_operand(cpu, instr->mode));
+  return STOP_BUDGET;
+}
+
+/**
+ * @brief cpu_step_lazy() that also records the instruction in the
+ *        attached tracer.
+ *
+ * @param cpu Pointer to the CPU instance, with a tracer attached.
+ * @return As cpu_step_lazy().
  */
-void cpu_step(CPU *cpu) {
-  uint8_t opcode = mem_read(cpu, cpu->pc++);
-  Instruction instr = instruction_table[opcode];
+static StopReason cpu_step_traced(CPU *cpu) {
+  if (cpu->halted)
+    return STOP_HALT;
+
+  uint16_t pc = cpu->pc;
+  uint8_t opcode = mem_read(cpu, pc);
+  const Instruction *instr = &instruction_table[opcode];
 
-  if (instr.handler == NULL) {
-    printf("Illegal opcode 0x%02X at PC 0x%04X\n", opcode, cpu->pc - 1);
-    return;
+  if (instr->handler == NULL)
+    return STOP_ILLEGAL;
+
+  TraceRecord *rec = trace_next(cpu->tracer);
+  uint64_t start = cpu->cycles;
+
+  rec->pc = pc;
+  rec->sp = cpu->sp;
+  rec->opcode = opcode;
+  rec->a = cpu->a;
+  rec->x = cpu->x;
+  rec->y = cpu->y;
+  rec->flags = cpu_pack_flags(cpu);
+  cpu->pc++;
+  cpu->cycles += instr->handler(cpu, fetch_operand(cpu, instr->mode));
+  rec->cycles = (uint8_t)(cpu->cycles - start);
+  return STOP_BUDGET;
+}
+
+/**
+ * @brief Runs instructions until the cycle budget is consumed.
+ *
+ * Without a tracer the work is handed to the block cache when one is
+ * attached, which keeps breakpoints out of its blocks (see debug.h), or
+ * else to the threaded interpreter in opcodes.c. With a tracer, or a
+ * debugger and no block cache, the CPU single-steps so every PC can be
+ * checked and every instruction recorded; only debugging sessions pay
+ * for that.
+ *
+ * @param cpu Pointer to the CPU instance.
+ * @param cycle_budget Number of cycles to execute.
+ * @param cycles_run Optional out parameter for the cycles consumed.
+ * @return Why the run stopped.
+ */
+StopReason cpu_run(CPU *cpu, uint32_t cycle_budget, uint32_t *cycles_run) {
+  uint64_t start = cpu->cycles;
+  StopReason reason = STOP_BUDGET;
+
+  cpu_unpack_flags(cpu);
+  if (cpu->debug != NULL)
+    debug_begin(cpu);
+  if (cpu->halted) {
+    reason = STOP_HALT;
+  } else if (cpu->tracer == NULL && cpu->blocks != NULL) {
+    block_run(cpu, cycle_budget, &reason);
+  } else if (cpu->tracer == NULL && cpu->debug == NULL) {
+    opcodes_run(cpu, cycle_budget, &reason);
+  } else {
+    while (cpu->cycles - start < cycle_budget) {
+      if (cpu->debug != NULL &&
+          (reason = debug_check(cpu->debug, cpu->pc)) != STOP_BUDGET)
+        break;
+      reason =
+          cpu->tracer != NULL ? cpu_step_traced(cpu) : cpu_step_lazy(cpu);
+      if (reason != STOP_BUDGET)
+        break;
+    }
   }
+  if (cpu->debug != NULL)
+    reason = debug_end(cpu, reason);
+  cpu_pack_flags(cpu);
 
-  uint8_t cycles = instr.handler(cpu, instr.mode);
-  cpu->cycles += cycles;
-}
\ No newline at end of file
+  if (cycles_run)
+    *cycles_run = cpu->cycles - start;
+  return reason;
+}
@@ -14,10 +14,15 @@
 #ifndef RVM_CPU_H
 #define RVM_CPU_H
 
+#include "bus.h"
 #include <stdint.h>
 
 #define RVM_MEM_SIZE 65536
 
+typedef struct BlockCache BlockCache;
+typedef struct Tracer Tracer;
+typedef struct Debugger Debugger;
+
 /**
  * CPU register conventions and notes (inspired by the MOS 6502):
  *
@@ -36,11 +41,39 @@
  *   typically decrements SP and a pop increments it.
  *
  * - Flags: 8-bit processor status containing condition flags that
- *   reflect the result of the most recent operations.
+ *   reflect the result of the most recent operations. While the CPU
+ *   executes, N/Z/C/V live in LazyFlags instead; `flags` is brought up
+ *   to date whenever cpu_run() or cpu_step() returns.
  *
  * - memory: pointer to the CPU's RAM backing store (byte array of
  *   size RVM_MEM_SIZE).
+ *
+ * - bus: page table every memory access goes through. cpu_init() maps
+ *   the whole backing store as flat RAM; call bus_map_spec() or the
+ *   bus_map_*() helpers afterwards for a different layout.
+ */
+/**
+ * @brief Inputs of the N/Z/C/V flags, kept instead of the flags.
+ *
+ * Flag-setting instructions only store their result (and, for V, the
+ * operands), which costs a few plain stores and no branches. The flag
+ * bits are derived from these when an instruction or the host needs
+ * them; see cpu_pack_flags().
  */
+typedef struct {
+  /** Z is set when this is zero */
+  uint8_t z;
+  /** N is bit 7 of this */
+  uint8_t n;
+  /** Carry flag, 0 or 1 */
+  uint8_t c;
+  /** V is bit 7 of ~(v_a ^ v_b) & (v_a ^ v_r): the adder's operands and
+   *  result */
+  uint8_t v_a;
+  uint8_t v_b;
+  uint8_t v_r;
+} LazyFlags;
+
 /**
  * @brief Core CPU state for the rvm-8 emulator.
  *
@@ -59,14 +92,40 @@ typedef struct {
   uint16_t pc;
   /** Stack pointer (16-bit) — stack grows downward */
   uint16_t sp;
-  /** Processor status / flags (8-bit) */
+  /** Processor status / flags (8-bit); N/Z/C/V are stale mid-run */
   uint8_t flags;
+  /** Authoritative N/Z/C/V while cpu_run() / cpu_step() execute */
+  LazyFlags lazy;
   /** Pointer to the RAM backing store (RVM_MEM_SIZE bytes) */
   uint8_t *memory;
-  /** Total Cycles*/
-  uint32_t cycles;
+  /** Cycles run since reset; 64-bit, as 32 bits wrap after 40 minutes */
+  uint64_t cycles;
+  /** Non-zero once the CPU has stopped; cpu_run() returns immediately */
+  uint8_t halted;
+  /** Breakpoints and watchpoints, NULL when not debugging (see debug.h) */
+  Debugger *debug;
+  /** Page table for memory accesses */
+  Bus bus;
+  /** Decoded block cache, NULL runs the plain interpreter (see block.h) */
+  BlockCache *blocks;
+  /** Execution tracer cpu_run() records into, or NULL (see trace.h) */
+  Tracer *tracer;
 } CPU;
 
+/**
+ * @brief Reasons for cpu_run() / cpu_step() to hand control back.
+ *
+ * On STOP_BREAKPOINT and STOP_ILLEGAL the PC is left pointing at the
+ * instruction that was not executed, so the host can inspect it.
+ */
+typedef enum {
+  STOP_BUDGET,     // Cycle budget consumed
+  STOP_BREAKPOINT, // PC reached an armed breakpoint
+  STOP_HALT,       // cpu->halted is set
+  STOP_ILLEGAL,    // Opcode without a handler
+  STOP_WATCHPOINT  // An instruction wrote to a watched address
+} StopReason;
+
 /**
  * @brief Defines the addressing modes for CPU instructions.
  *
@@ -92,26 +151,60 @@ typedef enum {
 /**
  * @brief Function pointer for an instruction handler.
  *
- * Each instruction in the CPU is implemented by a handler function that
- * takes a pointer to the CPU state and an addressing mode, and returns
- * the number of cycles it consumed.
+ * Each opcode has its own handler with the addressing mode fixed at
+ * compile time. The handler receives the raw operand already fetched
+ * from the instruction stream (see fetch_operand()) and returns the
+ * number of cycles it consumed.
+ */
+typedef uint8_t (*InstructionHandler)(CPU *cpu, uint16_t operand);
+
+/**
+ * @brief How an instruction affects the program counter.
+ *
+ * Decoders use this to find the end of straight-line code.
  */
-typedef uint8_t (*InstructionHandler)(CPU *cpu, AddressingMode mode);
+typedef enum {
+  FLOW_NONE,   // Falls through to the next instruction
+  FLOW_BRANCH, // Conditionally transfers control
+  FLOW_JUMP    // Always transfers control
+} InstructionFlow;
 
 /**
- * @brief Represents a single CPU instruction.
+ * @brief What executing or decoding an opcode needs.
  *
- * This struct defines an instruction's mnemonic name, its handler function,
- * the addressing mode it uses, and its base cycle count.
+ * The interpreters, the block cache and the recompiler read only this,
+ * so it is kept apart from the InstructionInfo the tools read: an entry
+ * is 16 bytes, four to a cache line. Unimplemented opcodes have a NULL
+ * handler.
  */
 typedef struct {
-  const char *name;
   InstructionHandler handler;
-  AddressingMode mode;
+  /** AddressingMode */
+  uint8_t mode;
+  /** Base cycle count */
   uint8_t cycles;
+  /** InstructionFlow */
+  uint8_t flow;
+  /** 1 if the instruction writes memory */
+  uint8_t stores;
 } Instruction;
 
-extern Instruction instruction_table[256];
+/**
+ * @brief What the tools show about an opcode: mnemonic, length and the
+ *        flags it can change. Zeroed for unimplemented opcodes.
+ */
+typedef struct {
+  /** Mnemonic, or NULL */
+  const char *name;
+  /** Bytes with the operand, as instruction_size() of the mode */
+  uint8_t size;
+  /** FLAG_* bits the instruction can change */
+  uint8_t flags;
+} InstructionInfo;
+
+/** Both tables are constant data generated from RVM_ISA in isa.h. */
+extern const Instruction instruction_table[256];
+extern const InstructionInfo instruction_info[256];
 
 uint8_t mem_read(CPU *cpu, uint16_t addr);
 void mem_write(CPU *cpu, uint16_t addr, uint8_t val);
@@ -162,17 +255,48 @@ void cpu_reset(CPU *cpu);
  * @brief Execute one CPU instruction (single step).
  *
  * Advances the PC and updates registers/flags according to the
- * semantics of the executed opcode.
+ * semantics of the executed opcode. Breakpoints are not checked.
  *
  * @param cpu Pointer to the CPU instance to step.
+ * @return STOP_BUDGET if the instruction ran, STOP_WATCHPOINT if it ran
+ *         and wrote to a watched address, STOP_HALT or STOP_ILLEGAL
+ *         otherwise.
  */
-void cpu_step(CPU *cpu);
+StopReason cpu_step(CPU *cpu);
+
+/**
+ * @brief cpu_step() for run loops that already track flags lazily.
+ *
+ * Skips the conversion between CPU.flags and CPU.lazy; the caller must
+ * have called cpu_unpack_flags() and calls cpu_pack_flags() when done.
+ *
+ * @param cpu Pointer to the CPU instance to step.
+ * @return As cpu_step().
+ */
+StopReason cpu_step_lazy(CPU *cpu);
+
+/**
+ * @brief Run instructions until a cycle budget is used up.
+ *
+ * Executes in a tight internal loop so the host can cover a whole
+ * timestep slice with one call. The last instruction may overshoot the
+ * budget; the overshoot is included in @p cycles_run. Breakpoints are
+ * checked before every instruction, the first included, except that a
+ * run starting on the breakpoint the previous run stopped at executes
+ * it, so the host can resume (see debug.h).
+ *
+ * @param cpu Pointer to the CPU instance.
+ * @param cycle_budget Number of cycles to execute.
+ * @param cycles_run Optional out parameter for the cycles consumed.
+ * @return Why the run stopped.
+ */
+StopReason cpu_run(CPU *cpu, uint32_t cycle_budget, uint32_t *cycles_run);
 
 /**
  * @brief Read a byte from the CPU memory.
  *
- * This helper centralizes memory reads and can be used to add bounds
- * checks, memory-mapped I/O handling, or instrumentation later.
+ * Out-of-line wrapper around bus_read() for hosts and FFI callers; the
+ * opcode handlers use the inline bus fast path directly.
  *
  * @param cpu Pointer to the CPU instance.
  * @param addr 16-bit memory address to read from.
@@ -183,8 +307,8 @@ uint8_t mem_read(CPU *cpu, uint16_t addr);
 /**
  * @brief Write a byte to the CPU memory.
  *
- * This helper centralizes memory writes and can be used to implement
- * memory-mapped I/O or write protection in the future.
+ * Out-of-line wrapper around bus_write(); writes to ROM pages are
+ * discarded and I/O pages reach their device callbacks.
  *
  * @param cpu Pointer to the CPU instance.
  * @param addr 16-bit memory address to write to.
@@ -192,8 +316,93 @@ uint8_t mem_read(CPU *cpu, uint16_t addr);
  */
 void mem_write(CPU *cpu, uint16_t addr, uint8_t val);
 
-void init_instruction_table(void);
+/**
+ * @brief Fetch the operand bytes of the current instruction.
+ *
+ * Reads 0, 1 or 2 bytes at the PC according to @p mode and advances
+ * the PC past them.
+ *
+ * @param cpu Pointer to the CPU instance.
+ * @param mode Addressing mode of the instruction being executed.
+ * @return The raw operand to pass to the instruction's handler.
+ */
+uint16_t fetch_operand(CPU *cpu, AddressingMode mode);
+
+/**
+ * @brief Interpreter loop used by cpu_run().
+ *
+ * Runs until @p cycle_budget is consumed or an illegal opcode is
+ * fetched. Does not check breakpoints or the halted flag. Flags must be
+ * unpacked, as cpu_run() does (see cpu_unpack_flags()).
+ *
+ * @param cpu Pointer to the CPU instance.
+ * @param cycle_budget Number of cycles to execute.
+ * @param reason Set to STOP_BUDGET or STOP_ILLEGAL.
+ * @return The number of cycles consumed.
+ */
+uint32_t opcodes_run(CPU *cpu, uint32_t cycle_budget, StopReason *reason);
 
 static inline uint8_t lo8(int value) { return value & 0xFF; }
 
+/** Flags tracked in LazyFlags rather than in CPU.flags */
+#define CPU_LAZY_FLAGS (FLAG_N | FLAG_V | FLAG_Z | FLAG_C)
+
+/**
+ * @brief Load CPU.lazy from the N/Z/C/V bits of CPU.flags.
+ *
+ * @param cpu Pointer to the CPU instance.
+ */
+static inline void cpu_unpack_flags(CPU *cpu) {
+  uint8_t f = cpu->flags;
+  cpu->lazy.z = ~f & FLAG_Z;
+  cpu->lazy.n = f;
+  cpu->lazy.c = f & FLAG_C;
+  cpu->lazy.v_a = 0;
+  cpu->lazy.v_b = 0;
+  cpu->lazy.v_r = f << 1;
+}
+
+/** @brief Whether the lazily tracked V flag is set. */
+static inline int cpu_lazy_v(const CPU *cpu) {
+  const LazyFlags *l = &cpu->lazy;
+  return (~(l->v_a ^ l->v_b) & (l->v_a ^ l->v_r)) & 0x80;
+}
+
+/**
+ * @brief Fold CPU.lazy back into CPU.flags.
+ *
+ * @param cpu Pointer to the CPU instance.
+ * @return The updated flags byte.
+ */
+static inline uint8_t cpu_pack_flags(CPU *cpu) {
+  uint8_t f = cpu->flags & ~CPU_LAZY_FLAGS;
+  f |= cpu->lazy.n & FLAG_N;
+  f |= cpu->lazy.z == 0 ? FLAG_Z : 0;
+  f |= cpu->lazy.c & FLAG_C;
+  f |= cpu_lazy_v(cpu) ? FLAG_V : 0;
+  cpu->flags = f;
+  return f;
+}
+
+/**
+ * @brief Length in bytes (opcode plus operand) of an instruction.
+ *
+ * @param mode Addressing mode of the instruction.
+ * @return 1, 2 or 3.
+ */
+static inline uint8_t instruction_size(AddressingMode mode) {
+  switch (mode) {
+  case MODE_IMPLIED:
+  case MODE_ACCUMULATOR:
+    return 1;
+  case MODE_ABSOLUTE:
+  case MODE_ABSOLUTE_X:
+  case MODE_ABSOLUTE_Y:
+  case MODE_INDIRECT:
+    return 3;
+  default:
+    return 2;
+  }
+}
+
 #endif
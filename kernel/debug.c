@@ -0,0 +1,134 @@
+/*
+ * rvm-8/kernel/debug.c
+ *
+ * Breakpoints and watchpoints for rvm-8.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ *
+ * Notes:
+ * - The watch hook runs inside the writing instruction, with cpu->pc
+ *   already on the next one. It cannot end the run itself, so it drops
+ *   the blocks of that page: the running block leaves after the current
+ *   instruction, as for self-modifying code, and the next lookup misses
+ *   into the single-step path, where debug_check() reports the hit.
+ *   Native blocks make the same check after every slow write.
+ * - Remapping a page calls its trap hooks and then clears its traps.
+ *   That happens outside a run, so a call there only marks the
+ *   watchpoints for re-arming at the start of the next run.
+ */
+
+#include "debug.h"
+#include "block.h"
+#include <stdlib.h>
+
+/**
+ * @brief Bus trap hook: a write hit a page holding a watchpoint.
+ */
+static void debug_on_write(void *ctx, uint16_t addr) {
+  Debugger *debug = ctx;
+  CPU *cpu = debug->cpu;
+
+  if (!debug->running) {
+    debug->resync = 1;
+    return;
+  }
+  if (debug->stop || !(debug->watchpoints[addr >> 3] & (1 << (addr & 7))))
+    return;
+
+  debug->stop = 1;
+  debug->hit = addr;
+  if (cpu->blocks != NULL)
+    block_cache_invalidate_page(cpu->blocks, BUS_PAGE(cpu->pc));
+}
+
+int debug_attach(CPU *cpu) {
+  if (cpu->debug)
+    return 0;
+
+  Debugger *debug = calloc(1, sizeof(Debugger));
+  if (debug == NULL)
+    return -1;
+
+  debug->cpu = cpu;
+  cpu->debug = debug;
+  bus_set_trap_hook(&cpu->bus, BUS_TRAP_WATCH, debug_on_write, debug);
+  return 0;
+}
+
+void debug_detach(CPU *cpu) {
+  Debugger *debug = cpu->debug;
+
+  if (debug == NULL)
+    return;
+
+  for (int page = 0; page < BUS_PAGE_COUNT; page++) {
+    if (debug->watched[page])
+      bus_release_writes(&cpu->bus, page, BUS_TRAP_WATCH);
+  }
+  bus_set_trap_hook(&cpu->bus, BUS_TRAP_WATCH, NULL, NULL);
+  cpu->debug = NULL;
+  free(debug);
+}
+
+void debug_set_breakpoint(CPU *cpu, uint16_t addr, int armed) {
+  Debugger *debug = cpu->debug;
+  uint8_t bit = 1 << (addr & 7);
+
+  if (armed)
+    debug->breakpoints[addr >> 3] |= bit;
+  else
+    debug->breakpoints[addr >> 3] &= ~bit;
+  // Blocks are decoded around breakpoints, so the page is redecoded
+  if (cpu->blocks != NULL)
+    block_cache_invalidate_page(cpu->blocks, BUS_PAGE(addr));
+}
+
+int debug_set_watchpoint(CPU *cpu, uint16_t addr, int armed) {
+  Debugger *debug = cpu->debug;
+  uint8_t page = BUS_PAGE(addr), bit = 1 << (addr & 7);
+  int was = (debug->watchpoints[addr >> 3] & bit) != 0;
+
+  if (armed && cpu->bus.pages[page].kind != BUS_RAM)
+    return -1;
+  if (!armed == !was)
+    return 0;
+
+  if (armed) {
+    debug->watchpoints[addr >> 3] |= bit;
+    if (debug->watched[page]++ == 0)
+      bus_trap_writes(&cpu->bus, page, BUS_TRAP_WATCH);
+  } else {
+    debug->watchpoints[addr >> 3] &= ~bit;
+    if (--debug->watched[page] == 0)
+      bus_release_writes(&cpu->bus, page, BUS_TRAP_WATCH);
+  }
+  return 0;
+}
+
+void debug_begin(CPU *cpu) {
+  Debugger *debug = cpu->debug;
+
+  if (debug->resync) {
+    for (int page = 0; page < BUS_PAGE_COUNT; page++) {
+      if (debug->watched[page])
+        bus_trap_writes(&cpu->bus, page, BUS_TRAP_WATCH);
+    }
+    debug->resync = 0;
+  }
+  // Only a run that starts where the last one stopped resumes
+  debug->resume = debug->resume && debug->resume_pc == cpu->pc;
+  debug->running = 1;
+}
+
+StopReason debug_end(CPU *cpu, StopReason reason) {
+  Debugger *debug = cpu->debug;
+
+  if (debug->stop && reason == STOP_BUDGET)
+    reason = STOP_WATCHPOINT;
+  debug->stop = 0;
+  debug->running = 0;
+  debug->resume = reason == STOP_BREAKPOINT;
+  debug->resume_pc = cpu->pc;
+  return reason;
+}
@@ -0,0 +1,144 @@
+/**
+ * rvm-8/kernel/debug.h
+ *
+ * Execution breakpoints and write watchpoints for the rvm-8 debugger.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ *
+ * Neither is a check on every instruction. With a block cache attached
+ * no block is decoded across an address holding a breakpoint, and none
+ * starts at one, so only those addresses leave the cached (and native)
+ * code for the single-step path that looks at the breakpoint bitmap.
+ * A page holding a watchpoint carries a BUS_TRAP_WATCH write trap, so
+ * only writes to that page reach the slow path; a write to a watched
+ * address ends the run after the instruction that made it.
+ *
+ * Without a block cache a CPU with a debugger attached single-steps.
+ * Without a debugger cpu_run() takes exactly the paths it always did.
+ */
+
+#ifndef RVM_DEBUG_H
+#define RVM_DEBUG_H
+
+#include "cpu.h"
+
+/**
+ * @brief Breakpoints and watchpoints of one CPU.
+ *
+ * Change them through the functions below, which keep the block cache
+ * and the bus traps in step; the fields are public for inspection.
+ */
+typedef struct Debugger {
+  CPU *cpu;
+  /** Execution breakpoints, one bit per address */
+  uint8_t breakpoints[RVM_MEM_SIZE / 8];
+  /** Write watchpoints, one bit per address */
+  uint8_t watchpoints[RVM_MEM_SIZE / 8];
+  /** Watchpoints armed in each page */
+  uint16_t watched[BUS_PAGE_COUNT];
+  /** Watched address the last STOP_WATCHPOINT run wrote to */
+  uint16_t hit;
+  /** Non-zero while cpu_run() or cpu_step() execute */
+  uint8_t running;
+  /** A watchpoint was hit; the run ends after the current instruction */
+  uint8_t stop;
+  /** A watched page may have been remapped, losing its trap */
+  uint8_t resync;
+  /** The last run stopped at the breakpoint on resume_pc; it is stepped
+   *  over if the next run starts there */
+  uint8_t resume;
+  uint16_t resume_pc;
+} Debugger;
+
+/**
+ * @brief Attach a debugger with nothing armed to a CPU.
+ *
+ * Call after the memory map is set up, like block_cache_attach().
+ *
+ * @param cpu Pointer to the CPU instance.
+ * @return 0 on success, -1 if allocation failed.
+ */
+int debug_attach(CPU *cpu);
+
+/**
+ * @brief Disarm everything, detach and free the debugger of a CPU, if any.
+ *
+ * @param cpu Pointer to the CPU instance.
+ */
+void debug_detach(CPU *cpu);
+
+/**
+ * @brief Arm or disarm an execution breakpoint.
+ *
+ * cpu_run() returns STOP_BREAKPOINT with the PC on @p addr before the
+ * instruction there runs. The next run starting on that PC executes it
+ * first, so calling cpu_run() again resumes.
+ *
+ * @param cpu Pointer to a CPU with a debugger attached.
+ * @param addr Address of the instruction.
+ * @param armed Nonzero to arm.
+ */
+void debug_set_breakpoint(CPU *cpu, uint16_t addr, int armed);
+
+/**
+ * @brief Arm or disarm a write watchpoint.
+ *
+ * cpu_run() returns STOP_WATCHPOINT after an instruction writes to
+ * @p addr, with the write done and the address in Debugger.hit. Writes
+ * made by the host outside cpu_run() and cpu_step() are not hits.
+ *
+ * @param cpu Pointer to a CPU with a debugger attached.
+ * @param addr Address to watch.
+ * @param armed Nonzero to arm.
+ * @return 0 on success, -1 when arming an address outside RAM.
+ */
+int debug_set_watchpoint(CPU *cpu, uint16_t addr, int armed);
+
+/**
+ * @brief Prepare for a run; called by cpu_run() and cpu_step().
+ *
+ * @param cpu Pointer to a CPU with a debugger attached.
+ */
+void debug_begin(CPU *cpu);
+
+/**
+ * @brief Finish a run; called by cpu_run() and cpu_step().
+ *
+ * @param cpu Pointer to a CPU with a debugger attached.
+ * @param reason Why the run stopped.
+ * @return @p reason, or STOP_WATCHPOINT if a watchpoint was hit.
+ */
+StopReason debug_end(CPU *cpu, StopReason reason);
+
+/**
+ * @brief Checks whether a breakpoint is armed at an address.
+ *
+ * @param debug The debugger.
+ * @param addr The 16-bit address to test.
+ * @return Non-zero if a breakpoint is set at @p addr.
+ */
+static inline int debug_breakpoint_at(const Debugger *debug, uint16_t addr) {
+  return debug->breakpoints[addr >> 3] & (1 << (addr & 7));
+}
+
+/**
+ * @brief Whether the instruction at a PC may run; called by the
+ *        single-step paths before each instruction.
+ *
+ * @param debug The debugger.
+ * @param pc Address of the next instruction.
+ * @return STOP_BUDGET to run it, else why the run stops first.
+ */
+static inline StopReason debug_check(Debugger *debug, uint16_t pc) {
+  if (debug->stop)
+    return STOP_WATCHPOINT;
+  if (debug_breakpoint_at(debug, pc)) {
+    if (!debug->resume)
+      return STOP_BREAKPOINT;
+    debug->resume = 0;
+  }
+  return STOP_BUDGET;
+}
+
+#endif
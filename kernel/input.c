@@ -0,0 +1,53 @@
+/*
+ * rvm-8/kernel/input.c
+ *
+ * Gamepad input registers for rvm-8.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ *
+ * Notes:
+ * - The latch is an acquire load and publishing a release store, so a
+ *   host that writes more state before publishing (a replay log entry,
+ *   say) has it visible once the word is latched.
+ * - The latched word is machine state like any register; a cleared
+ *   machine reads no buttons until its next frame starts.
+ */
+
+#include "input.h"
+#include <stddef.h>
+
+void input_init(Input *input) {
+  atomic_init(&input->local.word, 0);
+  input->port = &input->local;
+  input->latched = 0;
+}
+
+void input_reset(Input *input) { input->latched = 0; }
+
+void input_publish(InputPort *port, uint16_t buttons, uint64_t stamp) {
+  atomic_store_explicit(&port->word, INPUT_WORD(buttons, stamp),
+                        memory_order_release);
+}
+
+void input_set_port(Input *input, InputPort *port) {
+  input->port = port != NULL ? port : &input->local;
+}
+
+void input_latch(Input *input) {
+  input->latched = atomic_load_explicit(&input->port->word,
+                                        memory_order_acquire);
+}
+
+uint8_t input_read(const Input *input, uint16_t addr) {
+  uint16_t buttons = INPUT_WORD_BUTTONS(input->latched);
+
+  switch (addr) {
+  case INPUT_REG_PAD0:
+    return (uint8_t)buttons;
+  case INPUT_REG_PAD1:
+    return (uint8_t)(buttons >> 8);
+  default:
+    return 0;
+  }
+}
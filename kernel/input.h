@@ -0,0 +1,131 @@
+/**
+ * rvm-8/kernel/input.h
+ *
+ * Gamepad input registers for the rvm-8 emulator.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ *
+ * The host publishes the buttons held on both pads, with a timestamp of
+ * its own, into an InputPort from any thread; the machine latches the
+ * port once at the start of every frame, and the registers read that
+ * latch (specs/SPEC.md, section 5). The buttons and the timestamp share
+ * one atomic word, so publishing is a single store, latching a single
+ * load, and neither side ever waits for the other.
+ *
+ * A frame only ever sees the state latched at its start, so replaying
+ * the latched words of a run frame by frame reproduces it exactly.
+ */
+
+#ifndef RVM_INPUT_H
+#define RVM_INPUT_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+/* Input registers, in the BUS_INPUT_PAGE page; read-only */
+#define INPUT_REG_PAD0 0x2500 // Buttons held on pad 0, 1 = pressed
+#define INPUT_REG_PAD1 0x2501 // Buttons held on pad 1
+
+/** Whether an address is in the input register range, 0x2500-0x250F */
+#define INPUT_REG(addr) (((addr) & 0xFFF0) == INPUT_REG_PAD0)
+
+/* Button bits of a pad register */
+#define INPUT_BUTTON_A 0x01
+#define INPUT_BUTTON_B 0x02
+#define INPUT_BUTTON_SELECT 0x04
+#define INPUT_BUTTON_START 0x08
+#define INPUT_BUTTON_UP 0x10
+#define INPUT_BUTTON_DOWN 0x20
+#define INPUT_BUTTON_LEFT 0x40
+#define INPUT_BUTTON_RIGHT 0x80
+
+/** Bits of the timestamp kept in an input word */
+#define INPUT_STAMP_BITS 48
+
+/**
+ * @brief Pack pad buttons and a timestamp into an input word.
+ *
+ * @param buttons Pad 0 in the low byte, pad 1 in the high byte.
+ * @param stamp Host timestamp; only its low INPUT_STAMP_BITS bits are
+ *        kept.
+ */
+#define INPUT_WORD(buttons, stamp)                                             \
+  ((uint64_t)(uint16_t)(buttons) | ((uint64_t)(stamp) << 16))
+
+/** Buttons of an input word */
+#define INPUT_WORD_BUTTONS(word) ((uint16_t)(word))
+/** Timestamp of an input word */
+#define INPUT_WORD_STAMP(word) ((word) >> 16)
+
+/**
+ * @brief Where the host publishes input, see input_publish().
+ *
+ * The layout is mirrored by emulator/src/ffi.rs.
+ */
+typedef struct {
+  _Atomic uint64_t word;
+} InputPort;
+
+/**
+ * @brief Input state for one emulator instance.
+ */
+typedef struct {
+  /** Port used unless the host attaches its own */
+  InputPort local;
+  /** Port latched at frame start */
+  InputPort *port;
+  /** Input word the registers read, latched at the start of the frame */
+  uint64_t latched;
+} Input;
+
+/**
+ * @brief Initialize input with nothing pressed and the local port.
+ *
+ * @param input Pointer to the input state.
+ */
+void input_init(Input *input);
+
+/**
+ * @brief Clear the latch; the port stays selected.
+ *
+ * @param input Pointer to the input state.
+ */
+void input_reset(Input *input);
+
+/**
+ * @brief Publish the buttons currently held; safe from any thread.
+ *
+ * @param port Pointer to the port.
+ * @param buttons Pad 0 in the low byte, pad 1 in the high byte.
+ * @param stamp Host timestamp of the state, e.g. when it was polled;
+ *        the kernel only passes it on.
+ */
+void input_publish(InputPort *port, uint16_t buttons, uint64_t stamp);
+
+/**
+ * @brief Select the port to latch from.
+ *
+ * @param input Pointer to the input state.
+ * @param port The port, or NULL for the local one. It must stay valid
+ *        until another port is selected.
+ */
+void input_set_port(Input *input, InputPort *port);
+
+/**
+ * @brief Latch the port; called at the start of every frame.
+ *
+ * @param input Pointer to the input state.
+ */
+void input_latch(Input *input);
+
+/**
+ * @brief Bus read of an input register.
+ *
+ * @param input Pointer to the input state.
+ * @param addr Address, see INPUT_REG(); unused ones read as 0.
+ * @return The register value.
+ */
+uint8_t input_read(const Input *input, uint16_t addr);
+
+#endif
@@ -0,0 +1,133 @@
+/*
+ * rvm-8/kernel/isa.h
+ *
+ * Single source of truth for the rvm-8 instruction set.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ *
+ * RVM_ISA(X) expands X(opcode, mnemonic, mode, cycles) once per opcode.
+ * The instruction table, the specialized handlers and the dispatch loop
+ * are all generated from this list, so adding an opcode here is enough
+ * to make it available everywhere.
+ *
+ * - mnemonic selects the op_<mnemonic>() semantic in opcodes.c.
+ * - mode is an AddressingMode without the MODE_ prefix.
+ * - cycles is the base cycle count; page-cross and branch-taken
+ *   penalties are added at run time by the handler.
+ *
+ * RVM_MNEMONICS(M) expands M(mnemonic, flow, flags, stores) once per
+ * mnemonic with the properties shared by all of its opcodes. flow is an
+ * InstructionFlow telling decoders whether the instruction can change
+ * the PC; flags are the FLAG_* bits it can change; stores is 1 if it
+ * writes memory in its memory modes.
+ */
+
+#ifndef RVM_ISA_H
+#define RVM_ISA_H
+
+/*
+ * Handlers are written once per mnemonic with the addressing mode as a
+ * parameter; forcing them inline into each generated per-opcode handler
+ * lets the compiler fold the mode switch away at compile time.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define RVM_ALWAYS_INLINE static inline __attribute__((always_inline))
+#elif defined(_MSC_VER)
+#define RVM_ALWAYS_INLINE static __forceinline
+#else
+#define RVM_ALWAYS_INLINE static inline
+#endif
+
+/*
+ * Computed-goto threaded dispatch is a GNU extension. Define
+ * RVM_NO_THREADED_DISPATCH to force the portable switch loop.
+ */
+#if (defined(__GNUC__) || defined(__clang__)) &&                               \
+    !defined(RVM_NO_THREADED_DISPATCH)
+#define RVM_THREADED_DISPATCH 1
+#else
+#define RVM_THREADED_DISPATCH 0
+#endif
+
+#define RVM_ISA(X)                                                             \
+  X(0xA9, LDA, IMMEDIATE, 2)                                                   \
+  X(0xA5, LDA, ZEROPAGE, 3)                                                    \
+  X(0xAD, LDA, ABSOLUTE, 4)                                                    \
+  X(0xB5, LDA, ZEROPAGE_X, 4)                                                  \
+  X(0xBD, LDA, ABSOLUTE_X, 4)                                                  \
+  X(0xB9, LDA, ABSOLUTE_Y, 4)                                                  \
+  X(0xA1, LDA, INDIRECT_X, 6)                                                  \
+  X(0xB1, LDA, INDIRECT_Y, 5)                                                  \
+  X(0xA2, LDX, IMMEDIATE, 2)                                                   \
+  X(0xA6, LDX, ZEROPAGE, 3)                                                    \
+  X(0xAE, LDX, ABSOLUTE, 4)                                                    \
+  X(0xB6, LDX, ZEROPAGE_Y, 4)                                                  \
+  X(0xBE, LDX, ABSOLUTE_Y, 4)                                                  \
+  X(0xA0, LDY, IMMEDIATE, 2)                                                   \
+  X(0xA4, LDY, ZEROPAGE, 3)                                                    \
+  X(0xB4, LDY, ZEROPAGE_X, 4)                                                  \
+  X(0xAC, LDY, ABSOLUTE, 4)                                                    \
+  X(0xBC, LDY, ABSOLUTE_X, 4)                                                  \
+  X(0x4A, LSR, ACCUMULATOR, 2)                                                 \
+  X(0x46, LSR, ZEROPAGE, 5)                                                    \
+  X(0x56, LSR, ZEROPAGE_X, 6)                                                  \
+  X(0x4E, LSR, ABSOLUTE, 6)                                                    \
+  X(0x5E, LSR, ABSOLUTE_X, 7)                                                  \
+  X(0x69, ADC, IMMEDIATE, 2)                                                   \
+  X(0x65, ADC, ZEROPAGE, 3)                                                    \
+  X(0x6D, ADC, ABSOLUTE, 4)                                                    \
+  X(0x85, STA, ZEROPAGE, 3)                                                    \
+  X(0x95, STA, ZEROPAGE_X, 4)                                                  \
+  X(0x8D, STA, ABSOLUTE, 4)                                                    \
+  X(0x9D, STA, ABSOLUTE_X, 5)                                                  \
+  X(0x99, STA, ABSOLUTE_Y, 5)                                                  \
+  X(0x81, STA, INDIRECT_X, 6)                                                  \
+  X(0x91, STA, INDIRECT_Y, 6)                                                  \
+  X(0x86, STX, ZEROPAGE, 3)                                                    \
+  X(0x96, STX, ZEROPAGE_Y, 4)                                                  \
+  X(0x8E, STX, ABSOLUTE, 4)                                                    \
+  X(0x84, STY, ZEROPAGE, 3)                                                    \
+  X(0x94, STY, ZEROPAGE_X, 4)                                                  \
+  X(0x8C, STY, ABSOLUTE, 4)                                                    \
+  X(0xE8, INX, IMPLIED, 2)                                                     \
+  X(0xC8, INY, IMPLIED, 2)                                                     \
+  X(0xCA, DEX, IMPLIED, 2)                                                     \
+  X(0x88, DEY, IMPLIED, 2)                                                     \
+  X(0xEA, NOP, IMPLIED, 2)                                                     \
+  X(0x4C, JMP, ABSOLUTE, 3)                                                    \
+  X(0x6C, JMP, INDIRECT, 5)                                                    \
+  X(0x10, BPL, RELATIVE, 2)                                                    \
+  X(0x30, BMI, RELATIVE, 2)                                                    \
+  X(0x50, BVC, RELATIVE, 2)                                                    \
+  X(0x70, BVS, RELATIVE, 2)                                                    \
+  X(0x90, BCC, RELATIVE, 2)                                                    \
+  X(0xB0, BCS, RELATIVE, 2)                                                    \
+  X(0xD0, BNE, RELATIVE, 2)                                                    \
+  X(0xF0, BEQ, RELATIVE, 2)
+
+#define RVM_MNEMONICS(M)                                                       \
+  M(ADC, FLOW_NONE, FLAG_N | FLAG_V | FLAG_Z | FLAG_C, 0)                      \
+  M(LDA, FLOW_NONE, FLAG_N | FLAG_Z, 0)                                        \
+  M(LDX, FLOW_NONE, FLAG_N | FLAG_Z, 0)                                        \
+  M(LDY, FLOW_NONE, FLAG_N | FLAG_Z, 0)                                        \
+  M(LSR, FLOW_NONE, FLAG_N | FLAG_Z | FLAG_C, 1)                               \
+  M(STA, FLOW_NONE, 0, 1)                                                      \
+  M(STX, FLOW_NONE, 0, 1)                                                      \
+  M(STY, FLOW_NONE, 0, 1)                                                      \
+  M(INX, FLOW_NONE, FLAG_N | FLAG_Z, 0)                                        \
+  M(INY, FLOW_NONE, FLAG_N | FLAG_Z, 0)                                        \
+  M(DEX, FLOW_NONE, FLAG_N | FLAG_Z, 0)                                        \
+  M(DEY, FLOW_NONE, FLAG_N | FLAG_Z, 0)                                        \
+  M(NOP, FLOW_NONE, 0, 0)                                                      \
+  M(JMP, FLOW_JUMP, 0, 0)                                                      \
+  M(BPL, FLOW_BRANCH, 0, 0)                                                    \
+  M(BMI, FLOW_BRANCH, 0, 0)                                                    \
+  M(BVC, FLOW_BRANCH, 0, 0)                                                    \
+  M(BVS, FLOW_BRANCH, 0, 0)                                                    \
+  M(BCC, FLOW_BRANCH, 0, 0)                                                    \
+  M(BCS, FLOW_BRANCH, 0, 0)                                                    \
+  M(BNE, FLOW_BRANCH, 0, 0)                                                    \
+  M(BEQ, FLOW_BRANCH, 0, 0)
+
+#endif
@@ -0,0 +1,141 @@
+/*
+ * rvm-8/kernel/jit.c
+ *
+ * Code memory management for the rvm-8 dynamic recompiler.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ *
+ * Notes:
+ * - Code is emitted into a scratch buffer first, then copied into a
+ *   chunk of mapped memory that is flipped RW -> RX around the copy.
+ * - Individual blocks are never freed. Invalidated code simply stays in
+ *   its chunk until the block cache resets the whole JIT, which keeps
+ *   code alive while a block may still be returning through it.
+ */
+
+#include "jit.h"
+
+#if RVM_JIT
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define JIT_CHUNK_SIZE (64 * 1024)
+#define JIT_MAX_CODE (4 * 1024 * 1024)
+#define JIT_SCRATCH_SIZE (16 * 1024)
+
+typedef struct JitChunk {
+  struct JitChunk *next;
+  uint8_t *mem;
+  size_t used;
+} JitChunk;
+
+struct Jit {
+  /** Chunk being filled; older chunks follow through next */
+  JitChunk *chunks;
+  /** Bytes of code memory mapped so far */
+  size_t mapped;
+  uint8_t scratch[JIT_SCRATCH_SIZE];
+};
+
+static JitChunk *jit_new_chunk(Jit *jit) {
+  JitChunk *chunk = malloc(sizeof(JitChunk));
+  if (chunk == NULL)
+    return NULL;
+
+  chunk->mem = mmap(NULL, JIT_CHUNK_SIZE, PROT_READ | PROT_EXEC,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (chunk->mem == MAP_FAILED) {
+    free(chunk);
+    return NULL;
+  }
+
+  chunk->used = 0;
+  chunk->next = jit->chunks;
+  jit->chunks = chunk;
+  jit->mapped += JIT_CHUNK_SIZE;
+  return chunk;
+}
+
+Jit *jit_create(void) {
+  Jit *jit = calloc(1, sizeof(Jit));
+  if (jit == NULL)
+    return NULL;
+
+  // Probe the W^X policy once up front: a host that refuses to flip a
+  // page between writable and executable gets no JIT at all.
+  JitChunk *chunk = jit_new_chunk(jit);
+  if (chunk == NULL ||
+      mprotect(chunk->mem, JIT_CHUNK_SIZE, PROT_READ | PROT_WRITE) != 0 ||
+      mprotect(chunk->mem, JIT_CHUNK_SIZE, PROT_READ | PROT_EXEC) != 0) {
+    jit_destroy(jit);
+    return NULL;
+  }
+  return jit;
+}
+
+void jit_destroy(Jit *jit) {
+  if (jit == NULL)
+    return;
+  jit_reset(jit);
+  free(jit);
+}
+
+void jit_reset(Jit *jit) {
+  while (jit->chunks) {
+    JitChunk *next = jit->chunks->next;
+    munmap(jit->chunks->mem, JIT_CHUNK_SIZE);
+    free(jit->chunks);
+    jit->chunks = next;
+  }
+  jit->mapped = 0;
+}
+
+int jit_full(const Jit *jit) { return jit->mapped >= JIT_MAX_CODE; }
+
+NativeBlockFn jit_compile(Jit *jit, const Block *block) {
+  size_t size = jit_emit_block(jit->scratch, sizeof(jit->scratch), block);
+  if (size == 0)
+    return NULL;
+
+  JitChunk *chunk = jit->chunks;
+  if (chunk == NULL || chunk->used + size > JIT_CHUNK_SIZE) {
+    if (jit_full(jit) || (chunk = jit_new_chunk(jit)) == NULL)
+      return NULL;
+  }
+
+  if (mprotect(chunk->mem, JIT_CHUNK_SIZE, PROT_READ | PROT_WRITE) != 0)
+    return NULL;
+
+  uint8_t *code = chunk->mem + chunk->used;
+  memcpy(code, jit->scratch, size);
+  // Keep the next block 16-byte aligned
+  chunk->used += (size + 15) & ~(size_t)15;
+
+  if (mprotect(chunk->mem, JIT_CHUNK_SIZE, PROT_READ | PROT_EXEC) != 0)
+    return NULL;
+  __builtin___clear_cache((char *)code, (char *)code + size);
+
+  NativeBlockFn fn;
+  memcpy(&fn, &code, sizeof(fn));
+  return fn;
+}
+
+#else
+
+Jit *jit_create(void) { return NULL; }
+void jit_destroy(Jit *jit) { (void)jit; }
+void jit_reset(Jit *jit) { (void)jit; }
+int jit_full(const Jit *jit) {
+  (void)jit;
+  return 1;
+}
+NativeBlockFn jit_compile(Jit *jit, const Block *block) {
+  (void)jit;
+  (void)block;
+  return NULL;
+}
+
+#endif
@@ -0,0 +1,97 @@
+/**
+ * rvm-8/kernel/jit.h
+ *
+ * Dynamic recompiler for hot blocks of the rvm-8 block cache.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ *
+ * The block cache counts how often each block runs. Once a block gets
+ * hot it is handed to jit_compile(), which emits native code that keeps
+ * A/X/Y and the N/Z/C/V flags in host registers and adds the block's
+ * base cycles in one go. Instructions the backend does not cover are
+ * compiled as calls to their interpreter handler.
+ *
+ * Code memory is mapped writable, filled, then flipped to executable, so
+ * pages are never writable and executable at once. If the host refuses
+ * to make memory executable the JIT reports itself unavailable and the
+ * block cache keeps interpreting.
+ *
+ * Only an x86-64 (System V) backend exists today. On every other target,
+ * with RVM_NO_JIT defined, or in instrumented builds (stats.h),
+ * jit_create() returns NULL.
+ */
+
+#ifndef RVM_JIT_H
+#define RVM_JIT_H
+
+#include "block.h"
+#include <stddef.h>
+
+#if !defined(RVM_NO_JIT) && !RVM_STATS && defined(__x86_64__) &&             \
+    !defined(_WIN32)
+#define RVM_JIT_X86_64 1
+#define RVM_JIT 1
+#else
+#define RVM_JIT 0
+#endif
+
+/** Executions of a block before it is recompiled */
+#define JIT_HOT_THRESHOLD 16
+
+typedef struct Jit Jit;
+
+/**
+ * @brief Create a recompiler with its own code memory.
+ *
+ * @return The recompiler, or NULL if there is no backend for this host
+ *         or executable memory could not be obtained.
+ */
+Jit *jit_create(void);
+
+/**
+ * @brief Free a recompiler and all code it emitted.
+ *
+ * No function returned by jit_compile() may be running or called again.
+ */
+void jit_destroy(Jit *jit);
+
+/**
+ * @brief Compile a block to native code.
+ *
+ * The returned function runs the whole block against @p cpu, updating
+ * the registers, PC and cycle counter, and returns the cycles used. It
+ * must only be called when at least block->max_cycles remain in the
+ * budget.
+ *
+ * @param jit The recompiler.
+ * @param block The block to compile; must stay allocated while the code
+ *        can run.
+ * @return The native function, or NULL if the code memory is full (see
+ *         jit_reset()) or compilation failed.
+ */
+NativeBlockFn jit_compile(Jit *jit, const Block *block);
+
+/**
+ * @brief Whether the code memory has reached its size limit.
+ */
+int jit_full(const Jit *jit);
+
+/**
+ * @brief Discard all emitted code so the memory can be reused.
+ *
+ * The caller must first drop every pointer returned by jit_compile().
+ */
+void jit_reset(Jit *jit);
+
+/**
+ * @brief Backend entry point: emit native code for a block.
+ *
+ * @param buf Output buffer.
+ * @param cap Size of @p buf in bytes.
+ * @param block The block to compile.
+ * @return Number of bytes written, or 0 if @p buf was too small.
+ */
+size_t jit_emit_block(uint8_t *buf, size_t cap, const Block *block);
+
+#endif
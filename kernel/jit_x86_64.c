@@ -0,0 +1,787 @@
+/*
+ * rvm-8/kernel/jit_x86_64.c
+ *
+ * x86-64 (System V) backend of the rvm-8 dynamic recompiler.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ *
+ * Notes:
+ * - Host register assignment while a block runs:
+ *     rbx  CPU *                 r12d A     r13d X     r14d Y
+ *     rbp  cpu->cycles on entry  r15d cycles not known at compile time
+ *     r8d  N (bit 7)             r9d  Z (zero when Z is set)
+ *     r10d C (0 or 1)            r11d V (bit 7)
+ *   Guest registers are kept zero-extended to 32 bits. The flag
+ *   registers mirror cpu->lazy (see LazyFlags) and are only written back
+ *   when the block exits or calls into C.
+ * - Base cycles are accumulated at compile time; only page-cross
+ *   penalties and interpreter fallbacks add to r15d at run time.
+ * - Memory accesses inline the bus fast path. A NULL page pointer calls
+ *   bus_read_slow()/bus_write_slow() after writing back the registers,
+ *   PC and cycle count the interpreter would show at that point, so
+ *   devices see identical state. A slow write may invalidate the running block; the code then
+ *   exits after that instruction, like block_run() does.
+ */
+
+#include "jit.h"
+
+#if RVM_JIT_X86_64
+
+#include "isa.h"
+#include <stddef.h>
+#include <string.h>
+
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+enum { CC_E = 0x4, CC_NE = 0x5 };
+
+/* Guest state in host registers */
+#define REG_A R12
+#define REG_X R13
+#define REG_Y R14
+#define REG_N R8
+#define REG_Z R9
+#define REG_C R10
+#define REG_V R11
+
+#define OFF_A offsetof(CPU, a)
+#define OFF_X offsetof(CPU, x)
+#define OFF_Y offsetof(CPU, y)
+#define OFF_PC offsetof(CPU, pc)
+#define OFF_LAZY_Z offsetof(CPU, lazy.z)
+#define OFF_LAZY_N offsetof(CPU, lazy.n)
+#define OFF_LAZY_C offsetof(CPU, lazy.c)
+#define OFF_LAZY_VA offsetof(CPU, lazy.v_a)
+#define OFF_LAZY_VB offsetof(CPU, lazy.v_b)
+#define OFF_LAZY_VR offsetof(CPU, lazy.v_r)
+#define OFF_CYCLES offsetof(CPU, cycles)
+#define OFF_BUS offsetof(CPU, bus)
+#define OFF_READ_MAP offsetof(CPU, bus.read_map)
+#define OFF_WRITE_MAP offsetof(CPU, bus.write_map)
+
+#define MAX_EXITS 160
+
+#define MNEMONIC_ID(mn, flow, flags, stores) MN_##mn,
+enum { MN_NONE, RVM_MNEMONICS(MNEMONIC_ID) MN_COUNT };
+#undef MNEMONIC_ID
+
+#define OPCODE_MNEMONIC(opc, mn, mode, cyc) [opc] = MN_##mn,
+static const uint8_t mnemonic_of[256] = {RVM_ISA(OPCODE_MNEMONIC)};
+#undef OPCODE_MNEMONIC
+
+typedef struct {
+  uint8_t *buf;
+  size_t pos;
+  size_t cap;
+  int overflow;
+  /** Positions of rel32 jumps to the common epilogue */
+  size_t exits[MAX_EXITS];
+  int exit_count;
+  const Block *block;
+} Emitter;
+
+/* --- Encoding helpers ------------------------------------------------- */
+
+static void emit8(Emitter *e, uint8_t b) {
+  if (e->pos < e->cap)
+    e->buf[e->pos++] = b;
+  else
+    e->overflow = 1;
+}
+
+static void emit32(Emitter *e, uint32_t v) {
+  for (int i = 0; i < 4; i++)
+    emit8(e, v >> (8 * i));
+}
+
+static void emit64(Emitter *e, uint64_t v) {
+  for (int i = 0; i < 8; i++)
+    emit8(e, v >> (8 * i));
+}
+
+/* REX prefix; force is needed to address spl/bpl/sil/dil as bytes. */
+static void rex(Emitter *e, int w, int r, int x, int b, int force) {
+  uint8_t v = 0x40 | (w << 3) | ((r >> 3) << 2) | ((x >> 3) << 1) | (b >> 3);
+  if (v != 0x40 || force)
+    emit8(e, v);
+}
+
+static int byte_reg_needs_rex(int reg) { return reg >= RSP && reg <= RDI; }
+
+static void modrm(Emitter *e, int mod, int reg, int rm) {
+  emit8(e, (mod << 6) | ((reg & 7) << 3) | (rm & 7));
+}
+
+/* [base + disp32] */
+static void mem(Emitter *e, int reg, int base, int32_t disp) {
+  modrm(e, 2, reg, (base & 7) == RSP ? 4 : base);
+  if ((base & 7) == RSP)
+    emit8(e, 0x24);
+  emit32(e, disp);
+}
+
+/* [base + index * (1 << scale) + disp32] */
+static void mem_sib(Emitter *e, int reg, int base, int index, int scale,
+                    int32_t disp) {
+  modrm(e, 2, reg, 4);
+  emit8(e, (scale << 6) | ((index & 7) << 3) | (base & 7));
+  emit32(e, disp);
+}
+
+/* op r/m32, r32 (mov 0x89, add 0x01, or 0x09, and 0x21, xor 0x31,
+ * test 0x85) */
+static void alu_rr(Emitter *e, uint8_t op, int dst, int src) {
+  rex(e, 0, src, 0, dst, 0);
+  emit8(e, op);
+  modrm(e, 3, src, dst);
+}
+
+static void mov_rr(Emitter *e, int dst, int src) { alu_rr(e, 0x89, dst, src); }
+
+static void mov_rr64(Emitter *e, int dst, int src) {
+  rex(e, 1, src, 0, dst, 0);
+  emit8(e, 0x89);
+  modrm(e, 3, src, dst);
+}
+
+/* op r/m32, imm32 (add /0, or /1, and /4, sub /5, xor /6, cmp /7) */
+enum { ALU_ADD = 0, ALU_OR = 1, ALU_AND = 4, ALU_SUB = 5, ALU_CMP = 7 };
+
+static void alu_ri(Emitter *e, int ext, int dst, uint32_t imm) {
+  rex(e, 0, 0, 0, dst, 0);
+  emit8(e, 0x81);
+  modrm(e, 3, ext, dst);
+  emit32(e, imm);
+}
+
+static void test_rr64(Emitter *e, int reg) {
+  rex(e, 1, reg, 0, reg, 0);
+  emit8(e, 0x85);
+  modrm(e, 3, reg, reg);
+}
+
+static void test_ri(Emitter *e, int dst, uint32_t imm) {
+  rex(e, 0, 0, 0, dst, 0);
+  emit8(e, 0xF7);
+  modrm(e, 3, 0, dst);
+  emit32(e, imm);
+}
+
+enum { SHIFT_SHL = 4, SHIFT_SHR = 5 };
+
+static void shift_ri(Emitter *e, int ext, int dst, uint8_t imm) {
+  rex(e, 0, 0, 0, dst, 0);
+  emit8(e, 0xC1);
+  modrm(e, 3, ext, dst);
+  emit8(e, imm);
+}
+
+static void not_r(Emitter *e, int dst) {
+  rex(e, 0, 0, 0, dst, 0);
+  emit8(e, 0xF7);
+  modrm(e, 3, 2, dst);
+}
+
+static void mov_ri(Emitter *e, int dst, uint32_t imm) {
+  rex(e, 0, 0, 0, dst, 0);
+  emit8(e, 0xB8 + (dst & 7));
+  emit32(e, imm);
+}
+
+static void mov_ri64(Emitter *e, int dst, uint64_t imm) {
+  rex(e, 1, 0, 0, dst, 0);
+  emit8(e, 0xB8 + (dst & 7));
+  emit64(e, imm);
+}
+
+/* movzx r32, r8 */
+static void movzx_rr8(Emitter *e, int dst, int src) {
+  rex(e, 0, dst, 0, src, byte_reg_needs_rex(src));
+  emit8(e, 0x0F);
+  emit8(e, 0xB6);
+  modrm(e, 3, dst, src);
+}
+
+/* movzx r32, byte [base + disp32] */
+static void load8(Emitter *e, int dst, int base, int32_t disp) {
+  rex(e, 0, dst, 0, base, 0);
+  emit8(e, 0x0F);
+  emit8(e, 0xB6);
+  mem(e, dst, base, disp);
+}
+
+/* movzx r32, byte [base + index] */
+static void load8_idx(Emitter *e, int dst, int base, int index) {
+  rex(e, 0, dst, index, base, 0);
+  emit8(e, 0x0F);
+  emit8(e, 0xB6);
+  mem_sib(e, dst, base, index, 0, 0);
+}
+
+/* mov byte [base + disp32], r8 */
+static void store8(Emitter *e, int base, int32_t disp, int src) {
+  rex(e, 0, src, 0, base, byte_reg_needs_rex(src));
+  emit8(e, 0x88);
+  mem(e, src, base, disp);
+}
+
+/* mov byte [base + disp32], imm8 */
+static void store8_imm(Emitter *e, int base, int32_t disp, uint8_t imm) {
+  rex(e, 0, 0, 0, base, 0);
+  emit8(e, 0xC6);
+  mem(e, 0, base, disp);
+  emit8(e, imm);
+}
+
+/* mov byte [base + index], r8 */
+static void store8_idx(Emitter *e, int base, int index, int src) {
+  rex(e, 0, src, index, base, byte_reg_needs_rex(src));
+  emit8(e, 0x88);
+  mem_sib(e, src, base, index, 0, 0);
+}
+
+/* mov r64, [base + disp32] / mov [base + disp32], r64 /
+ * mov r64, [base + index * 8 + disp32] */
+static void load64(Emitter *e, int dst, int base, int32_t disp) {
+  rex(e, 1, dst, 0, base, 0);
+  emit8(e, 0x8B);
+  mem(e, dst, base, disp);
+}
+
+static void store64(Emitter *e, int base, int32_t disp, int src) {
+  rex(e, 1, src, 0, base, 0);
+  emit8(e, 0x89);
+  mem(e, src, base, disp);
+}
+
+static void load64_idx8(Emitter *e, int dst, int base, int index,
+                        int32_t disp) {
+  rex(e, 1, dst, index, base, 0);
+  emit8(e, 0x8B);
+  mem_sib(e, dst, base, index, 3, disp);
+}
+
+/* mov word [base + disp32], imm16 */
+static void store16_imm(Emitter *e, int base, int32_t disp, uint16_t imm) {
+  emit8(e, 0x66);
+  rex(e, 0, 0, 0, base, 0);
+  emit8(e, 0xC7);
+  mem(e, 0, base, disp);
+  emit8(e, imm & 0xFF);
+  emit8(e, imm >> 8);
+}
+
+/* lea r32, [base + disp32] / lea r32, [base + index + disp32] */
+static void lea32(Emitter *e, int dst, int base, int32_t disp) {
+  rex(e, 0, dst, 0, base, 0);
+  emit8(e, 0x8D);
+  mem(e, dst, base, disp);
+}
+
+static void lea32_idx(Emitter *e, int dst, int base, int index, int32_t disp) {
+  rex(e, 0, dst, index, base, 0);
+  emit8(e, 0x8D);
+  mem_sib(e, dst, base, index, 0, disp);
+}
+
+static void lea64(Emitter *e, int dst, int base, int32_t disp) {
+  rex(e, 1, dst, 0, base, 0);
+  emit8(e, 0x8D);
+  mem(e, dst, base, disp);
+}
+
+static void lea64_idx(Emitter *e, int dst, int base, int index, int32_t disp) {
+  rex(e, 1, dst, index, base, 0);
+  emit8(e, 0x8D);
+  mem_sib(e, dst, base, index, 0, disp);
+}
+
+/* cmp byte [base], imm8 */
+static void cmp8_mem_imm(Emitter *e, int base, uint8_t imm) {
+  rex(e, 0, 0, 0, base, 0);
+  emit8(e, 0x80);
+  mem(e, 7, base, 0);
+  emit8(e, imm);
+}
+
+static void setcc(Emitter *e, int cc, int dst) {
+  rex(e, 0, 0, 0, dst, byte_reg_needs_rex(dst));
+  emit8(e, 0x0F);
+  emit8(e, 0x90 + cc);
+  modrm(e, 3, 0, dst);
+}
+
+static void push(Emitter *e, int reg) {
+  rex(e, 0, 0, 0, reg, 0);
+  emit8(e, 0x50 + (reg & 7));
+}
+
+static void pop(Emitter *e, int reg) {
+  rex(e, 0, 0, 0, reg, 0);
+  emit8(e, 0x58 + (reg & 7));
+}
+
+static void call_abs(Emitter *e, const void *fn) {
+  uint64_t target;
+  memcpy(&target, &fn, sizeof(target));
+  mov_ri64(e, RAX, target);
+  emit8(e, 0xFF);
+  modrm(e, 3, 2, RAX);
+}
+
+/* Forward jumps: emit with a zero rel32 and patch once the target is known */
+static size_t jcc_fwd(Emitter *e, int cc) {
+  emit8(e, 0x0F);
+  emit8(e, 0x80 + cc);
+  emit32(e, 0);
+  return e->pos - 4;
+}
+
+static size_t jmp_fwd(Emitter *e) {
+  emit8(e, 0xE9);
+  emit32(e, 0);
+  return e->pos - 4;
+}
+
+static void patch_here(Emitter *e, size_t at) {
+  if (e->overflow)
+    return;
+  uint32_t rel = (uint32_t)(e->pos - (at + 4));
+  memcpy(&e->buf[at], &rel, 4);
+}
+
+/* --- Guest state ------------------------------------------------------ */
+
+/* Loads A/X/Y and the flag registers from cpu->lazy. */
+static void emit_load_state(Emitter *e) {
+  load8(e, REG_A, RBX, OFF_A);
+  load8(e, REG_X, RBX, OFF_X);
+  load8(e, REG_Y, RBX, OFF_Y);
+  load8(e, REG_N, RBX, OFF_LAZY_N);
+  load8(e, REG_Z, RBX, OFF_LAZY_Z);
+  load8(e, REG_C, RBX, OFF_LAZY_C);
+  // V = ~(v_a ^ v_b) & (v_a ^ v_r)
+  load8(e, RAX, RBX, OFF_LAZY_VA);
+  load8(e, REG_V, RBX, OFF_LAZY_VB);
+  alu_rr(e, 0x31, REG_V, RAX);
+  not_r(e, REG_V);
+  load8(e, RCX, RBX, OFF_LAZY_VR);
+  alu_rr(e, 0x31, RCX, RAX);
+  alu_rr(e, 0x21, REG_V, RCX);
+}
+
+/* Stores A/X/Y and the flag registers back to cpu->lazy. */
+static void emit_store_state(Emitter *e) {
+  store8(e, RBX, OFF_A, REG_A);
+  store8(e, RBX, OFF_X, REG_X);
+  store8(e, RBX, OFF_Y, REG_Y);
+  store8(e, RBX, OFF_LAZY_N, REG_N);
+  store8(e, RBX, OFF_LAZY_Z, REG_Z);
+  store8(e, RBX, OFF_LAZY_C, REG_C);
+  // With both operands zero, V is bit 7 of the result
+  store8_imm(e, RBX, OFF_LAZY_VA, 0);
+  store8_imm(e, RBX, OFF_LAZY_VB, 0);
+  store8(e, RBX, OFF_LAZY_VR, REG_V);
+}
+
+/* cpu->cycles = entry cycles + r15d + known (clobbers rcx). */
+static void emit_sync_cycles(Emitter *e, uint32_t known) {
+  lea64_idx(e, RCX, RBP, R15, known);
+  store64(e, RBX, OFF_CYCLES, RCX);
+}
+
+static void emit_set_nz(Emitter *e, int reg) {
+  mov_rr(e, REG_N, reg);
+  mov_rr(e, REG_Z, reg);
+}
+
+/*
+ * Leaves the block: optionally stores the PC, puts the cycle count in eax
+ * and jumps to the shared epilogue. pc < 0 keeps cpu->pc as it is.
+ */
+static void emit_exit(Emitter *e, int32_t pc, uint32_t known) {
+  if (pc >= 0)
+    store16_imm(e, RBX, OFF_PC, (uint16_t)pc);
+  lea32(e, RAX, R15, known);
+  if (e->exit_count < MAX_EXITS)
+    e->exits[e->exit_count++] = jmp_fwd(e);
+  else
+    e->overflow = 1;
+}
+
+/* Exits after the current instruction if a write invalidated the block. */
+static void emit_check_invalidated(Emitter *e, int32_t pc, uint32_t known) {
+  uint64_t count_addr;
+  const uint8_t *count = &e->block->count;
+
+  memcpy(&count_addr, &count, sizeof(count_addr));
+  mov_ri64(e, RAX, count_addr);
+  cmp8_mem_imm(e, RAX, 0);
+  size_t still_valid = jcc_fwd(e, CC_NE);
+  emit_exit(e, pc, known);
+  patch_here(e, still_valid);
+}
+
+/* --- Memory access ---------------------------------------------------- */
+
+static void emit_push_flags(Emitter *e) {
+  push(e, R8);
+  push(e, R9);
+  push(e, R10);
+  push(e, R11);
+}
+
+static void emit_pop_flags(Emitter *e) {
+  pop(e, R11);
+  pop(e, R10);
+  pop(e, R9);
+  pop(e, R8);
+}
+
+/*
+ * Makes cpu look exactly as it would inside the interpreter handler of
+ * @p op before a device callback can see it (clobbers rcx).
+ */
+static void emit_sync_state(Emitter *e, const DecodedOp *op, uint32_t known) {
+  emit_store_state(e);
+  store16_imm(e, RBX, OFF_PC, op->next_pc);
+  emit_sync_cycles(e, known);
+}
+
+/* Slow read of the address in eax; result in eax. */
+static void emit_read_slow(Emitter *e, const DecodedOp *op, uint32_t known) {
+  emit_push_flags(e);
+  mov_rr(e, RSI, RAX);
+  emit_sync_state(e, op, known);
+  lea64(e, RDI, RBX, OFF_BUS);
+  call_abs(e, (const void *)bus_read_slow);
+  movzx_rr8(e, RAX, RAX);
+  emit_pop_flags(e);
+}
+
+/* Slow write of @p val to the address in eax. */
+static void emit_write_slow(Emitter *e, const DecodedOp *op, uint32_t known,
+                            int val) {
+  emit_push_flags(e);
+  mov_rr(e, RSI, RAX);
+  emit_sync_state(e, op, known);
+  mov_rr(e, RDX, val);
+  lea64(e, RDI, RBX, OFF_BUS);
+  call_abs(e, (const void *)bus_write_slow);
+  emit_pop_flags(e);
+}
+
+static int index_register(AddressingMode mode) {
+  return (mode == MODE_ZEROPAGE_Y || mode == MODE_ABSOLUTE_Y) ? REG_Y : REG_X;
+}
+
+/* Computes the effective address of an indexed mode into eax. */
+static void emit_indexed_address(Emitter *e, AddressingMode mode,
+                                 uint16_t operand) {
+  lea32(e, RAX, index_register(mode), operand);
+  if (mode == MODE_ZEROPAGE_X || mode == MODE_ZEROPAGE_Y)
+    alu_ri(e, ALU_AND, RAX, 0xFF);
+  else
+    alu_ri(e, ALU_AND, RAX, 0xFFFF);
+}
+
+/*
+ * Adds the page-cross cycle of an absolute indexed read to r15d. Emitted
+ * after the access, like the interpreter adds it after the handler
+ * (clobbers rcx).
+ */
+static void emit_page_penalty(Emitter *e, AddressingMode mode,
+                              uint16_t operand) {
+  if (mode != MODE_ABSOLUTE_X && mode != MODE_ABSOLUTE_Y)
+    return;
+  lea32(e, RCX, index_register(mode), operand);
+  shift_ri(e, SHIFT_SHR, RCX, 8);
+  alu_ri(e, ALU_AND, RCX, 0xFF);
+  alu_ri(e, ALU_CMP, RCX, operand >> 8);
+  setcc(e, CC_NE, RCX);
+  movzx_rr8(e, RCX, RCX);
+  alu_rr(e, 0x01, R15, RCX);
+}
+
+/* Reads the operand value of a load/ALU instruction into eax. */
+static void emit_read(Emitter *e, AddressingMode mode, const DecodedOp *op,
+                      uint32_t known) {
+  uint16_t operand = op->operand;
+  size_t slow, done;
+
+  if (mode == MODE_IMMEDIATE) {
+    mov_ri(e, RAX, operand & 0xFF);
+    return;
+  }
+
+  if (mode == MODE_ZEROPAGE || mode == MODE_ABSOLUTE) {
+    load64(e, RDX, RBX, OFF_READ_MAP + (operand >> 8) * sizeof(void *));
+    test_rr64(e, RDX);
+    slow = jcc_fwd(e, CC_E);
+    load8(e, RAX, RDX, operand & 0xFF);
+    done = jmp_fwd(e);
+    patch_here(e, slow);
+    mov_ri(e, RAX, operand);
+    emit_read_slow(e, op, known);
+    patch_here(e, done);
+    return;
+  }
+
+  emit_indexed_address(e, mode, operand);
+  movzx_rr8(e, RCX, RAX);
+  mov_rr(e, RDX, RAX);
+  shift_ri(e, SHIFT_SHR, RDX, 8);
+  load64_idx8(e, RDX, RBX, RDX, OFF_READ_MAP);
+  test_rr64(e, RDX);
+  slow = jcc_fwd(e, CC_E);
+  load8_idx(e, RAX, RDX, RCX);
+  done = jmp_fwd(e);
+  patch_here(e, slow);
+  emit_read_slow(e, op, known);
+  patch_here(e, done);
+  emit_page_penalty(e, mode, operand);
+}
+
+/*
+ * Writes @p val (a guest register); a slow write exits the block if it
+ * invalidated it.
+ */
+static void emit_write(Emitter *e, AddressingMode mode, const DecodedOp *op,
+                       int val, uint32_t known) {
+  uint16_t operand = op->operand;
+  int direct = mode == MODE_ZEROPAGE || mode == MODE_ABSOLUTE;
+  size_t slow, done;
+
+  if (direct) {
+    load64(e, RDX, RBX, OFF_WRITE_MAP + (operand >> 8) * sizeof(void *));
+  } else {
+    emit_indexed_address(e, mode, operand);
+    movzx_rr8(e, RCX, RAX);
+    mov_rr(e, RDX, RAX);
+    shift_ri(e, SHIFT_SHR, RDX, 8);
+    load64_idx8(e, RDX, RBX, RDX, OFF_WRITE_MAP);
+  }
+
+  test_rr64(e, RDX);
+  slow = jcc_fwd(e, CC_E);
+  if (direct)
+    store8(e, RDX, operand & 0xFF, val);
+  else
+    store8_idx(e, RDX, RCX, val);
+  done = jmp_fwd(e);
+
+  patch_here(e, slow);
+  if (direct)
+    mov_ri(e, RAX, operand);
+  emit_write_slow(e, op, known, val);
+  emit_check_invalidated(e, op->next_pc, known + op->cycles);
+  patch_here(e, done);
+}
+
+/* --- Instructions ----------------------------------------------------- */
+
+/* Runs an instruction through its interpreter handler. */
+static void emit_fallback(Emitter *e, const DecodedOp *op, uint32_t known,
+                          int flow) {
+  emit_sync_state(e, op, known);
+  mov_rr64(e, RDI, RBX);
+  mov_ri(e, RSI, op->operand);
+  call_abs(e, (const void *)op->handler);
+  movzx_rr8(e, RAX, RAX);
+  alu_rr(e, 0x01, R15, RAX);
+  emit_load_state(e);
+
+  if (flow != FLOW_NONE)
+    emit_exit(e, -1, known);
+  else
+    emit_check_invalidated(e, -1, known);
+}
+
+static void emit_adc(Emitter *e) {
+  // eax = operand value
+  mov_rr(e, RCX, REG_A);
+  lea32_idx(e, RDX, RCX, RAX, 0);
+  alu_rr(e, 0x01, RDX, REG_C);
+  mov_rr(e, REG_C, RDX);
+  shift_ri(e, SHIFT_SHR, REG_C, 8);
+  movzx_rr8(e, RDX, RDX);
+  mov_rr(e, REG_V, RCX);
+  alu_rr(e, 0x31, REG_V, RAX);
+  not_r(e, REG_V);
+  mov_rr(e, RSI, RCX);
+  alu_rr(e, 0x31, RSI, RDX);
+  alu_rr(e, 0x21, REG_V, RSI);
+  mov_rr(e, REG_A, RDX);
+  emit_set_nz(e, REG_A);
+}
+
+static void emit_step_index(Emitter *e, int reg, int ext) {
+  alu_ri(e, ext, reg, 1);
+  movzx_rr8(e, reg, reg);
+  emit_set_nz(e, reg);
+}
+
+static void emit_branch(Emitter *e, const DecodedOp *op, int mnemonic,
+                        uint32_t known) {
+  int reg, cc;
+  uint32_t mask;
+
+  switch (mnemonic) {
+  case MN_BPL: reg = REG_N, mask = 0x80, cc = CC_E; break;
+  case MN_BMI: reg = REG_N, mask = 0x80, cc = CC_NE; break;
+  case MN_BVC: reg = REG_V, mask = 0x80, cc = CC_E; break;
+  case MN_BVS: reg = REG_V, mask = 0x80, cc = CC_NE; break;
+  case MN_BCC: reg = REG_C, mask = 0xFF, cc = CC_E; break;
+  case MN_BCS: reg = REG_C, mask = 0xFF, cc = CC_NE; break;
+  case MN_BNE: reg = REG_Z, mask = 0xFF, cc = CC_NE; break;
+  default:     reg = REG_Z, mask = 0xFF, cc = CC_E; break;
+  }
+
+  uint16_t target = op->next_pc + (int8_t)(op->operand & 0xFF);
+  uint32_t taken = known + op->cycles +
+                   (((op->next_pc ^ target) & 0xFF00) ? 2 : 1);
+
+  test_ri(e, reg, mask);
+  size_t jump = jcc_fwd(e, cc);
+  emit_exit(e, op->next_pc, known + op->cycles);
+  patch_here(e, jump);
+  emit_exit(e, target, taken);
+}
+
+size_t jit_emit_block(uint8_t *buf, size_t cap, const Block *block) {
+  Emitter em = {.buf = buf, .cap = cap, .block = block};
+  Emitter *e = &em;
+  uint32_t known = 0;
+  int ended = 0;
+
+  push(e, RBX);
+  push(e, RBP);
+  push(e, R12);
+  push(e, R13);
+  push(e, R14);
+  push(e, R15);
+  // 6 pushes + return address leave rsp 8 bytes off 16-byte alignment
+  rex(e, 1, 0, 0, RSP, 0);
+  emit8(e, 0x83);
+  modrm(e, 3, 5, RSP);
+  emit8(e, 8);
+
+  mov_rr64(e, RBX, RDI);
+  load64(e, RBP, RBX, OFF_CYCLES);
+  alu_rr(e, 0x31, R15, R15);
+  emit_load_state(e);
+
+  for (unsigned i = 0; i < block->count && !ended; i++) {
+    const DecodedOp *op = &block->ops[i];
+    const Instruction *instr = &instruction_table[op->opcode];
+    AddressingMode mode = instr->mode;
+    int mnemonic = mnemonic_of[op->opcode];
+    int plain_mode = mode == MODE_IMMEDIATE || mode == MODE_ZEROPAGE ||
+                     mode == MODE_ABSOLUTE || mode == MODE_ZEROPAGE_X ||
+                     mode == MODE_ZEROPAGE_Y || mode == MODE_ABSOLUTE_X ||
+                     mode == MODE_ABSOLUTE_Y;
+
+    switch (mnemonic) {
+    case MN_LDA:
+    case MN_LDX:
+    case MN_LDY:
+    case MN_ADC:
+      if (!plain_mode)
+        goto fallback;
+      emit_read(e, mode, op, known);
+      if (mnemonic == MN_ADC) {
+        emit_adc(e);
+      } else {
+        int dst = mnemonic == MN_LDA ? REG_A
+                  : mnemonic == MN_LDX ? REG_X
+                                       : REG_Y;
+        mov_rr(e, dst, RAX);
+        emit_set_nz(e, dst);
+      }
+      break;
+    case MN_STA:
+    case MN_STX:
+    case MN_STY:
+      if (!plain_mode)
+        goto fallback;
+      emit_write(e, mode, op,
+                 mnemonic == MN_STA   ? REG_A
+                 : mnemonic == MN_STX ? REG_X
+                                      : REG_Y,
+                 known);
+      break;
+    case MN_LSR:
+      if (mode != MODE_ACCUMULATOR)
+        goto fallback;
+      mov_rr(e, REG_C, REG_A);
+      alu_ri(e, ALU_AND, REG_C, 1);
+      shift_ri(e, SHIFT_SHR, REG_A, 1);
+      emit_set_nz(e, REG_A);
+      break;
+    case MN_INX:
+      emit_step_index(e, REG_X, ALU_ADD);
+      break;
+    case MN_INY:
+      emit_step_index(e, REG_Y, ALU_ADD);
+      break;
+    case MN_DEX:
+      emit_step_index(e, REG_X, ALU_SUB);
+      break;
+    case MN_DEY:
+      emit_step_index(e, REG_Y, ALU_SUB);
+      break;
+    case MN_NOP:
+      break;
+    case MN_JMP:
+      if (mode != MODE_ABSOLUTE)
+        goto fallback;
+      emit_exit(e, op->operand, known + op->cycles);
+      ended = 1;
+      break;
+    case MN_BPL:
+    case MN_BMI:
+    case MN_BVC:
+    case MN_BVS:
+    case MN_BCC:
+    case MN_BCS:
+    case MN_BNE:
+    case MN_BEQ:
+      emit_branch(e, op, mnemonic, known);
+      ended = 1;
+      break;
+    default:
+    fallback:
+      emit_fallback(e, op, known, instr->flow);
+      ended = instr->flow != FLOW_NONE;
+      // The handler's cycles were added to r15d at run time
+      continue;
+    }
+    known += op->cycles;
+  }
+
+  if (!ended)
+    emit_exit(e, block->next_pc, known);
+
+  // Shared epilogue; eax holds the cycles used by the block
+  for (int i = 0; i < e->exit_count; i++)
+    patch_here(e, e->exits[i]);
+  emit_store_state(e);
+  lea64_idx(e, RDX, RBP, RAX, 0);
+  store64(e, RBX, OFF_CYCLES, RDX);
+  rex(e, 1, 0, 0, RSP, 0);
+  emit8(e, 0x83);
+  modrm(e, 3, 0, RSP);
+  emit8(e, 8);
+  pop(e, R15);
+  pop(e, R14);
+  pop(e, R13);
+  pop(e, R12);
+  pop(e, RBP);
+  pop(e, RBX);
+  emit8(e, 0xC3);
+
+  return e->overflow ? 0 : e->pos;
+}
+
+#endif
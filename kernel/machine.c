@@ -0,0 +1,304 @@
+/*
+ * rvm-8/kernel/machine.c
+ *
+ * Self-contained rvm-8 emulator instances.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ *
+ * Notes:
+ * - The CPU's bus and the PPU keep pointers into the Machine, so a
+ *   machine must not be moved or copied once created.
+ * - Frames are measured from the last load: frame n ends at cycle
+ *   n * MACHINE_FRAME_CYCLES, however far the previous frame overran.
+ *   Line ends are spread over the frame by integer division, so lines
+ *   differ by a cycle but the frame length is exact.
+ * - The CPU stops at the first instruction boundary at or after the
+ *   next event is due, so events run up to an instruction late, but
+ *   always in due order.
+ * - Loading writes memory directly, behind the bus, so every cached
+ *   block and tile is dropped first by machine_clear().
+ * - BUS_INPUT_PAGE is shared by the input registers, the RIOT and the
+ *   TIA, so the machine maps it and routes each access by address.
+ * - Input is latched when machine_run_frame() is called, not when the
+ *   frame's first cycle is reached, so what a frame sees depends only on
+ *   what was published before the call.
+ */
+
+#include "machine.h"
+#include "block.h"
+#include "debug.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Cycle, counted from the start of its frame, at which a line
+ * ends.
+ */
+static uint64_t machine_line_end(unsigned line) {
+  return (uint64_t)(line + 1) * MACHINE_FRAME_CYCLES / MACHINE_FRAME_LINES;
+}
+
+/**
+ * @brief SCHED_EVENT_LINE: renders the visible line that just ended.
+ */
+static void machine_on_line(void *ctx, uint64_t when) {
+  Machine *machine = ctx;
+  unsigned line = machine->line;
+  uint64_t frame_start = when - machine_line_end(line);
+
+  if (line < PPU_HEIGHT)
+    ppu_render_line(&machine->ppu, line);
+
+  if (++line == MACHINE_FRAME_LINES) {
+    line = 0;
+    frame_start = when;
+  }
+  machine->line = line;
+  sched_add(&machine->sched, SCHED_EVENT_LINE,
+            frame_start + machine_line_end(line));
+}
+
+/**
+ * @brief SCHED_EVENT_VBLANK: publishes the frame. Due with the last
+ * visible line, and runs after it.
+ */
+static void machine_on_vblank(void *ctx, uint64_t when) {
+  Machine *machine = ctx;
+
+  ppu_end_frame(&machine->ppu);
+  sched_add(&machine->sched, SCHED_EVENT_VBLANK, when + MACHINE_FRAME_CYCLES);
+}
+
+static uint8_t machine_io_read(void *ctx, uint16_t addr) {
+  Machine *machine = ctx;
+
+  if (INPUT_REG(addr))
+    return input_read(&machine->input, addr);
+  if (RIOT_REG(addr))
+    return riot_read(&machine->riot, addr);
+  return 0;
+}
+
+/* Input is latched per frame; the TIA has nothing to read. */
+static uint64_t machine_io_steady(void *ctx, uint16_t addr) {
+  Machine *machine = ctx;
+
+  if (RIOT_REG(addr))
+    return riot_steady(&machine->riot, addr);
+  return UINT64_MAX;
+}
+
+static void machine_io_write(void *ctx, uint16_t addr, uint8_t val) {
+  Machine *machine = ctx;
+
+  if (RIOT_REG(addr))
+    riot_write(&machine->riot, addr, val);
+  else if (TIA_REG(addr))
+    tia_write(&machine->tia, addr, val);
+}
+
+/**
+ * @brief SCHED_EVENT_PROFILE: samples the PC.
+ */
+static void machine_on_profile(void *ctx, uint64_t when) {
+  Machine *machine = ctx;
+
+  profile_sample(machine->profiler, machine->cpu.pc);
+  sched_add(&machine->sched, SCHED_EVENT_PROFILE,
+            profile_next(machine->profiler, when));
+}
+
+Machine *machine_create(void) {
+  Machine *machine = calloc(1, sizeof(Machine));
+
+  if (machine == NULL)
+    return NULL;
+
+  cpu_init(&machine->cpu, machine->memory);
+  bus_map_spec(&machine->cpu.bus, machine->memory);
+  ppu_init(&machine->ppu, &machine->cpu.bus);
+  sched_init(&machine->sched);
+  sched_set_handler(&machine->sched, SCHED_EVENT_LINE, machine_on_line,
+                    machine);
+  sched_set_handler(&machine->sched, SCHED_EVENT_VBLANK, machine_on_vblank,
+                    machine);
+  sched_set_handler(&machine->sched, SCHED_EVENT_PROFILE, machine_on_profile,
+                    machine);
+  input_init(&machine->input);
+  riot_init(&machine->riot, &machine->sched, &machine->cpu.cycles);
+  tia_init(&machine->tia, &machine->sched, &machine->cpu.cycles);
+  bus_map_io(&machine->cpu.bus, BUS_INPUT_PAGE, 1, machine_io_read,
+             machine_io_write, machine);
+  bus_set_steady(&machine->cpu.bus, BUS_INPUT_PAGE, 1, machine_io_steady);
+  machine->render_interval = 1;
+  machine_reschedule(machine);
+  // Without a cache the interpreter runs the same programs, only slower
+  block_cache_attach(&machine->cpu);
+  return machine;
+}
+
+void machine_destroy(Machine *machine) {
+  if (machine == NULL)
+    return;
+
+  debug_detach(&machine->cpu);
+  block_cache_detach(&machine->cpu);
+  ppu_detach(&machine->ppu);
+  free(machine);
+}
+
+void machine_clear(Machine *machine) {
+  Bus *bus = &machine->cpu.bus;
+  uint8_t *memory = machine->memory;
+
+  memset(memory, 0, RVM_MEM_SIZE);
+  bus_map_ram(bus, 0x00, BUS_PPU_PAGE, memory);
+  bus_map_ram(bus, BUS_INPUT_PAGE + 1, BUS_ROM_PAGE - BUS_INPUT_PAGE - 1,
+              memory + (BUS_INPUT_PAGE + 1) * BUS_PAGE_SIZE);
+  bus_map_rom(bus, BUS_ROM_PAGE, 1, memory + BUS_ROM_PAGE * BUS_PAGE_SIZE);
+
+  if (machine->cpu.blocks != NULL) {
+    for (unsigned page = 0; page < BUS_PAGE_COUNT; page++)
+      block_cache_invalidate_page(machine->cpu.blocks, page);
+  }
+  ppu_reset(&machine->ppu);
+  ppu_invalidate(&machine->ppu);
+  input_reset(&machine->input);
+  riot_reset(&machine->riot);
+  tia_reset(&machine->tia);
+}
+
+int machine_load_image(Machine *machine, const uint8_t *image, size_t size) {
+  if (size > MACHINE_IMAGE_MAX)
+    return -1;
+
+  machine_clear(machine);
+  memcpy(machine->memory + RVM_MEM_SIZE - size, image, size);
+  cpu_reset(&machine->cpu);
+  machine->frames = 0;
+  machine_reschedule(machine);
+  return 0;
+}
+
+StopReason machine_run_frame(Machine *machine) {
+  CPU *cpu = &machine->cpu;
+  // Budget up to the end of the frame, so that instructions running past
+  // the end of one frame are taken out of the next
+  uint64_t end = (uint64_t)(machine->frames + 1) * MACHINE_FRAME_CYCLES;
+  StopReason reason = STOP_BUDGET;
+  uint32_t interval = machine->render_interval;
+
+  ppu_skip_frame(&machine->ppu,
+                 interval == 0 || (machine->frames + 1) % interval != 0);
+  input_latch(&machine->input);
+  while (cpu->cycles < end && reason == STOP_BUDGET) {
+    uint64_t next = sched_next(&machine->sched);
+
+    if (next > end)
+      next = end;
+    if (next > cpu->cycles)
+      reason = cpu_run(cpu, (uint32_t)(next - cpu->cycles), NULL);
+    sched_run_until(&machine->sched, cpu->cycles);
+  }
+
+  // A CPU that stopped early leaves the rest of the frame to run without
+  // it
+  sched_run_until(&machine->sched, end);
+  machine->frames++;
+  return reason;
+}
+
+void machine_reschedule(Machine *machine) {
+  uint64_t start = (uint64_t)machine->frames * MACHINE_FRAME_CYCLES;
+
+  sched_clear(&machine->sched);
+  machine->line = 0;
+  sched_add(&machine->sched, SCHED_EVENT_LINE, start + machine_line_end(0));
+  sched_add(&machine->sched, SCHED_EVENT_VBLANK,
+            start + machine_line_end(PPU_HEIGHT - 1));
+  riot_reschedule(&machine->riot);
+  tia_reschedule(&machine->tia);
+  if (machine->profiler != NULL)
+    sched_add(&machine->sched, SCHED_EVENT_PROFILE,
+              profile_next(machine->profiler, machine->cpu.cycles));
+}
+
+void machine_set_input(Machine *machine, InputPort *port) {
+  input_set_port(&machine->input, port);
+}
+
+void machine_set_render_interval(Machine *machine, uint32_t interval) {
+  machine->render_interval = interval;
+}
+
+uint32_t machine_render_interval(const Machine *machine) {
+  return machine->render_interval;
+}
+
+void machine_set_tracer(Machine *machine, Tracer *tracer) {
+  machine->cpu.tracer = tracer;
+}
+
+void machine_set_profiler(Machine *machine, Profiler *profiler) {
+  machine->profiler = profiler;
+  if (profiler != NULL)
+    sched_add(&machine->sched, SCHED_EVENT_PROFILE,
+              profile_next(profiler, machine->cpu.cycles));
+  else
+    sched_cancel(&machine->sched, SCHED_EVENT_PROFILE);
+}
+
+uint64_t machine_input(const Machine *machine) {
+  return machine->input.latched;
+}
+
+void machine_set_audio(Machine *machine, TiaRing *ring) {
+  tia_set_ring(&machine->tia, ring);
+}
+
+/**
+ * @brief Folds bytes into a 64-bit FNV-1a hash.
+ */
+static uint64_t fnv1a(uint64_t hash, const uint8_t *data, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    hash ^= data[i];
+    hash *= 0x100000001B3ull;
+  }
+  return hash;
+}
+
+uint64_t machine_hash(const Machine *machine) {
+  const CPU *cpu = &machine->cpu;
+  uint8_t regs[8] = {
+      cpu->a,      cpu->x,      cpu->y, cpu->flags, cpu->pc & 0xFF,
+      cpu->pc >> 8, cpu->sp & 0xFF, cpu->sp >> 8,
+  };
+  uint64_t hash = 0xCBF29CE484222325ull;
+
+  hash = fnv1a(hash, regs, sizeof(regs));
+  hash = fnv1a(hash, machine->memory, RVM_MEM_SIZE);
+  return fnv1a(hash, ppu_front_buffer(&machine->ppu, NULL),
+               PPU_WIDTH * PPU_HEIGHT);
+}
+
+const PpuFrames *machine_frames(const Machine *machine) {
+  return &machine->ppu.frames;
+}
+
+const Stats *machine_stats(const Machine *machine) {
+#if RVM_STATS
+  return &machine->cpu.bus.stats;
+#else
+  (void)machine;
+  return NULL;
+#endif
+}
+
+void machine_reset_stats(Machine *machine) {
+#if RVM_STATS
+  memset(&machine->cpu.bus.stats, 0, sizeof(Stats));
+#else
+  (void)machine;
+#endif
+}
@@ -0,0 +1,265 @@
+/**
+ * rvm-8/kernel/machine.h
+ *
+ * Self-contained rvm-8 emulator instances.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ *
+ * A Machine is one complete console: CPU, bus, PPU, input, RIOT, TIA
+ * and the 64 KB of memory behind them, in a single allocation. Machines share nothing
+ * but the read-only instruction table, so any number of them can run
+ * at once on different threads, one thread per machine at a time.
+ *
+ * This is the interface the Rust host binds to (emulator/src/ffi.rs).
+ */
+
+#ifndef RVM_MACHINE_H
+#define RVM_MACHINE_H
+
+#include "cpu.h"
+#include "input.h"
+#include "ppu.h"
+#include "profile.h"
+#include "riot.h"
+#include "sched.h"
+#include "tia.h"
+#include <stddef.h>
+
+/** CPU clock, in cycles per second */
+#define MACHINE_CLOCK_HZ 1789773
+/** Frames per second (specs/SPEC.md, section 8) */
+#define MACHINE_FRAME_RATE 60
+/** CPU cycles run per frame */
+#define MACHINE_FRAME_CYCLES (MACHINE_CLOCK_HZ / MACHINE_FRAME_RATE)
+/** Scanlines per frame: PPU_HEIGHT visible ones, then vblank */
+#define MACHINE_FRAME_LINES 154
+/** Audio samples per second, see machine_set_audio() */
+#define MACHINE_AUDIO_RATE (MACHINE_CLOCK_HZ / TIA_CYCLES_PER_SAMPLE)
+
+/** Lowest address a raw image may be loaded at, the first RAM page above
+ *  the device pages */
+#define MACHINE_IMAGE_BASE 0x2600
+/** Largest raw image, see machine_load_image() */
+#define MACHINE_IMAGE_MAX (RVM_MEM_SIZE - MACHINE_IMAGE_BASE)
+
+/**
+ * @brief One emulator instance.
+ */
+typedef struct {
+  CPU cpu;
+  Ppu ppu;
+  Input input;
+  Riot riot;
+  Tia tia;
+  /** Peripheral events the CPU runs up to */
+  Scheduler sched;
+  /** Frames run since the last load */
+  uint32_t frames;
+  /** Render every this many frames, see machine_set_render_interval() */
+  uint32_t render_interval;
+  /** Scanline the PPU is on, 0 to MACHINE_FRAME_LINES - 1 */
+  unsigned line;
+  /** Sampling profiler, see machine_set_profiler() */
+  Profiler *profiler;
+  /** Backing memory for the SPEC memory map */
+  uint8_t memory[RVM_MEM_SIZE];
+} Machine;
+
+/**
+ * @brief Allocate and power on a machine with the SPEC memory map.
+ *
+ * Memory starts out zeroed. The block cache (and the recompiler, where
+ * available) is attached when it can be allocated.
+ *
+ * @return The new machine, or NULL if allocation failed.
+ */
+Machine *machine_create(void);
+
+/**
+ * @brief Free a machine created with machine_create().
+ *
+ * @param machine The machine, or NULL.
+ */
+void machine_destroy(Machine *machine);
+
+/**
+ * @brief Return memory and the memory map to their power-on state.
+ *
+ * Clears memory, maps every page except the device pages back to it
+ * (as RAM with the ROM page on top), resets the PPU registers and the
+ * input latch, stops the RIOT timer and silences the TIA. The CPU is not
+ * reset.
+ *
+ * @param machine Pointer to the machine.
+ */
+void machine_clear(Machine *machine);
+
+/**
+ * @brief Load a raw program image and reset.
+ *
+ * The image is copied so that it ends at 0xFFFF, which puts the reset
+ * vector in its last bytes. Memory below it is cleared and the memory
+ * map is reset, see machine_clear().
+ *
+ * @param machine Pointer to the machine.
+ * @param image Image bytes.
+ * @param size Image size, at most MACHINE_IMAGE_MAX.
+ * @return 0 on success, -1 if the image is too large.
+ */
+int machine_load_image(Machine *machine, const uint8_t *image, size_t size);
+
+/**
+ * @brief Run one frame of CPU cycles and render it, unless the render
+ *        interval skips it.
+ *
+ * The input port is latched first; the input registers read that latch
+ * for the whole frame. The CPU runs freely between scheduled events. Each visible line is
+ * rendered when the CPU reaches its end, so mid-frame register and VRAM
+ * writes show from the next line on, and the frame is published at the
+ * start of vblank. If the CPU stops early, the remaining lines are
+ * rendered as things stand and the frame is still published.
+ *
+ * A skipped frame runs the same, but its lines are not rasterized and
+ * it is not published (see ppu_skip_frame()).
+ *
+ * @param machine Pointer to the machine.
+ * @return Why the CPU stopped; STOP_BUDGET if it ran the whole frame.
+ */
+StopReason machine_run_frame(Machine *machine);
+
+/**
+ * @brief Rebuild the event schedule for the current frame.
+ *
+ * Call after setting machine->frames or the CPU cycle counter from
+ * outside, as rewind_restore() does. The schedule restarts at the first
+ * line of frame machine->frames.
+ *
+ * @param machine Pointer to the machine.
+ */
+void machine_reschedule(Machine *machine);
+
+/**
+ * @brief Fast-forward by rasterizing only some frames.
+ *
+ * With @p interval N, machine_run_frame() renders the frames that
+ * complete a group of N (machine->frames + 1 a multiple of N) and skips
+ * the others; 1, the default, renders every frame and 0 none. The CPU,
+ * devices and VRAM caches run exactly as when rendering, so only the
+ * front buffer, and with it machine_hash(), can differ: it holds the
+ * last frame rendered. Set the interval to 1 before the last frame of a
+ * run to end on the same picture as a run that rendered them all.
+ *
+ * @param machine Pointer to the machine.
+ * @param interval Frames per rendered frame, 0 for none.
+ */
+void machine_set_render_interval(Machine *machine, uint32_t interval);
+
+/**
+ * @brief The interval set with machine_set_render_interval().
+ *
+ * @param machine Pointer to the machine.
+ * @return Frames per rendered frame, 0 for none.
+ */
+uint32_t machine_render_interval(const Machine *machine);
+
+/**
+ * @brief Select the port the machine latches its input from.
+ *
+ * Until one is given, the machine latches machine->input.local. The host
+ * publishes to the port with input_publish() from any thread.
+ *
+ * @param machine Pointer to the machine.
+ * @param port The port, or NULL for the local one; it must stay valid
+ *        until another one is selected or the machine is destroyed.
+ */
+void machine_set_input(Machine *machine, InputPort *port);
+
+/**
+ * @brief Attach an execution tracer, see trace.h.
+ *
+ * While one is attached the CPU single-steps and records every
+ * instruction; detach it before trace_close().
+ *
+ * @param machine Pointer to the machine.
+ * @param tracer The tracer, or NULL to stop tracing.
+ */
+void machine_set_tracer(Machine *machine, Tracer *tracer);
+
+/**
+ * @brief Attach a sampling profiler, see profile.h.
+ *
+ * Samples are taken from the current cycle on, between and during
+ * frames alike, including frames run again after a rewind. The machine
+ * runs exactly as it does without one.
+ *
+ * @param machine Pointer to the machine.
+ * @param profiler The profiler, or NULL to stop sampling; detach it
+ *        before profile_destroy().
+ */
+void machine_set_profiler(Machine *machine, Profiler *profiler);
+
+/**
+ * @brief Get the input word latched at the start of the current (or
+ * last) frame.
+ *
+ * Recording it per frame and publishing it again before each frame of a
+ * replay reproduces the run.
+ *
+ * @param machine Pointer to the machine.
+ * @return The word, see INPUT_WORD().
+ */
+uint64_t machine_input(const Machine *machine);
+
+/**
+ * @brief Attach the ring the machine's audio is pushed to.
+ *
+ * With a ring attached the TIA renders MACHINE_AUDIO_RATE samples per
+ * second of emulated time, in batches, from the cycle of this call on.
+ * The host drains the ring with tia_ring_read() from any one thread.
+ * Detach the ring before destroying it.
+ *
+ * @param machine Pointer to the machine.
+ * @param ring The ring, or NULL to stop synthesizing audio.
+ */
+void machine_set_audio(Machine *machine, TiaRing *ring);
+
+/**
+ * @brief Hash the observable state of a machine.
+ *
+ * Covers the registers, memory and the front framebuffer, so two
+ * machines that ran the same program the same way hash alike.
+ *
+ * @param machine Pointer to the machine.
+ * @return 64-bit FNV-1a hash.
+ */
+uint64_t machine_hash(const Machine *machine);
+
+/**
+ * @brief Get the framebuffers of a machine.
+ *
+ * @param machine Pointer to the machine.
+ * @return The PPU's double-buffered output, see PpuFrames.
+ */
+const PpuFrames *machine_frames(const Machine *machine);
+
+/**
+ * @brief Get the instrumentation counters of a machine.
+ *
+ * They count from machine_create() or the last machine_reset_stats().
+ * Read them between frames, on the thread that runs the machine.
+ *
+ * @param machine Pointer to the machine.
+ * @return The counters, or NULL when built without RVM_STATS (stats.h).
+ */
+const Stats *machine_stats(const Machine *machine);
+
+/**
+ * @brief Zero the instrumentation counters; does nothing without
+ * RVM_STATS.
+ *
+ * @param machine Pointer to the machine.
+ */
+void machine_reset_stats(Machine *machine);
+
+#endif
@@ -1,400 +1,488 @@
 /*
  * rvm-8/kernel/opcodes.c
  *
- * Implementation of opcode tables/handlers for rvm-8 (currently a stub).
+ * Implementation of opcode tables/handlers for rvm-8.
  *
  * Copyright (c) 2025 foxomax
  * SPDX-License-Identifier: MIT
+ *
+ * Notes:
+ * - Each mnemonic is written once as an op_<mnemonic>() function that
+ *   takes the addressing mode as a parameter. The per-opcode handlers and
+ *   the dispatch loop are generated from RVM_ISA in isa.h, so the mode is
+ *   always a compile-time constant and the mode switch folds away.
+ * - Operands are fetched before the handler runs; handlers receive the
+ *   raw operand (immediate byte, zero-page address or 16-bit address).
+ * - Memory is accessed through the inline bus_read()/bus_write() fast
+ *   path from bus.h rather than the out-of-line mem_read()/mem_write().
+ * - The dispatch loop adds to cpu->cycles after every instruction, so a
+ *   device callback sees the cycle the instruction started at, as in the
+ *   block cache and the recompiler. The compiler only has to store the
+ *   count before the slow-path calls.
+ * - instruction_table and instruction_info are constant initializers
+ *   generated from the same list, so they cost nothing to set up and sit
+ *   in read-only pages that every CPU in the process shares.
+ * - In RVM_STATS builds the handlers and the dispatch loop count every
+ *   instruction they run (stats.h); otherwise the hook is empty.
  */
 #include "cpu.h"
-#include <stdio.h>
+#include "isa.h"
 #include <string.h>
 
-Instruction instruction_table[256];
-
 /**
- * @brief Reads the address for the immediate addressing mode.
+ * @brief Fetches the operand bytes that follow an opcode.
  *
- * In immediate addressing, the operand is the byte immediately following the
- * opcode. This function returns the current program counter and increments it.
+ * Reads 0, 1 or 2 bytes from the program counter depending on the
+ * addressing mode and advances the PC past them.
  *
  * @param cpu Pointer to the CPU instance.
- * @return The address of the immediate value.
+ * @param mode The addressing mode of the current instruction.
+ * @return The raw operand (little-endian for 16-bit operands).
  */
-uint16_t addr_immediate(CPU *cpu) { return cpu->pc++; }
+RVM_ALWAYS_INLINE uint16_t operand_fetch(CPU *cpu, AddressingMode mode) {
+  switch (mode) {
+  case MODE_IMPLIED:
+  case MODE_ACCUMULATOR:
+    return 0;
+  case MODE_ABSOLUTE:
+  case MODE_ABSOLUTE_X:
+  case MODE_ABSOLUTE_Y:
+  case MODE_INDIRECT: {
+    uint16_t lo = bus_read(&cpu->bus, cpu->pc++);
+    uint16_t hi = bus_read(&cpu->bus, cpu->pc++);
+    return (hi << 8) | lo;
+  }
+  default:
+    return bus_read(&cpu->bus, cpu->pc++);
+  }
+}
+
+uint16_t fetch_operand(CPU *cpu, AddressingMode mode) {
+  return operand_fetch(cpu, mode);
+}
 
 /**
- * @brief Reads the address for the zero-page addressing mode.
+ * @brief Resolves the effective address of a memory operand.
  *
- * In zero-page addressing, the operand is an 8-bit address in the first
- * 256 bytes of memory (0x0000-0x00FF). This function reads the address
- * from the current program counter.
+ * Indexed modes that cross a page boundary add one cycle to
+ * @p penalty; handlers that always take the long path ignore it.
  *
  * @param cpu Pointer to the CPU instance.
- * @return The 8-bit zero-page address.
+ * @param mode The addressing mode of the current instruction.
+ * @param operand The raw operand returned by operand_fetch().
+ * @param penalty Incremented by one on a page crossing.
+ * @return The 16-bit effective address.
  */
-uint16_t addr_zeropage(CPU *cpu) { return mem_read(cpu, cpu->pc++); }
+RVM_ALWAYS_INLINE uint16_t effective_address(CPU *cpu, AddressingMode mode,
+                                             uint16_t operand,
+                                             uint8_t *penalty) {
+  switch (mode) {
+  case MODE_ZEROPAGE_X:
+    return (operand + cpu->x) & 0xFF;
+  case MODE_ZEROPAGE_Y:
+    return (operand + cpu->y) & 0xFF;
+  case MODE_ABSOLUTE_X: {
+    uint16_t addr = operand + cpu->x;
+    if ((operand & 0xFF00) != (addr & 0xFF00))
+      *penalty += 1;
+    return addr;
+  }
+  case MODE_ABSOLUTE_Y: {
+    uint16_t addr = operand + cpu->y;
+    if ((operand & 0xFF00) != (addr & 0xFF00))
+      *penalty += 1;
+    return addr;
+  }
+  case MODE_INDIRECT: {
+    uint16_t lo = bus_read(&cpu->bus, operand);
+    uint16_t hi = bus_read(&cpu->bus, operand + 1);
+    return (hi << 8) | lo;
+  }
+  case MODE_INDIRECT_X: {
+    uint8_t ptr_addr = (operand + cpu->x) & 0xFF;
+    uint16_t lo = bus_read(&cpu->bus, ptr_addr);
+    uint16_t hi = bus_read(&cpu->bus, (ptr_addr + 1) & 0xFF);
+    return (hi << 8) | lo;
+  }
+  case MODE_INDIRECT_Y: {
+    uint16_t lo = bus_read(&cpu->bus, operand);
+    uint16_t hi = bus_read(&cpu->bus, (operand + 1) & 0xFF);
+    uint16_t base_addr = (hi << 8) | lo;
+    uint16_t addr = base_addr + cpu->y;
+    if ((base_addr & 0xFF00) != (addr & 0xFF00))
+      *penalty += 1;
+    return addr;
+  }
+  default:
+    return operand;
+  }
+}
 
 /**
- * @brief Reads the address for the absolute addressing mode.
- *
- * In absolute addressing, the operand is a full 16-bit address. This
- * function reads the two bytes following the opcode to form the address.
+ * @brief Reads the value an instruction operates on.
  *
  * @param cpu Pointer to the CPU instance.
- * @return The 16-bit absolute address.
+ * @param mode The addressing mode of the current instruction.
+ * @param operand The raw operand returned by operand_fetch().
+ * @param penalty Incremented by one on a page crossing.
+ * @return The operand value.
  */
-uint16_t addr_absolute(CPU *cpu) {
-  uint16_t lo = mem_read(cpu, cpu->pc++);
-  uint16_t hi = mem_read(cpu, cpu->pc++);
-  return (hi << 8) | lo;
+RVM_ALWAYS_INLINE uint8_t load_operand(CPU *cpu, AddressingMode mode,
+                                       uint16_t operand, uint8_t *penalty) {
+  if (mode == MODE_IMMEDIATE)
+    return lo8(operand);
+  return bus_read(&cpu->bus, effective_address(cpu, mode, operand, penalty));
+}
+
+/* Flags are tracked lazily (see LazyFlags): store the result, not the
+ * flag bits. */
+RVM_ALWAYS_INLINE void set_nz(CPU *cpu, uint8_t val) {
+  cpu->lazy.z = val;
+  cpu->lazy.n = val;
 }
 
-uint8_t lsr_op(CPU *cpu, uint8_t val) {
-  cpu->flags = val & 0x01 ? (cpu->flags | FLAG_C) : (cpu->flags & ~FLAG_C);
+RVM_ALWAYS_INLINE uint8_t lsr_value(CPU *cpu, uint8_t val) {
+  cpu->lazy.c = val & 0x01;
   val >>= 1;
-  cpu->flags = val == 0 ? (cpu->flags | FLAG_Z) : (cpu->flags & ~FLAG_Z);
-  cpu->flags &= ~(FLAG_N);
+  set_nz(cpu, val);
   return val;
 }
 
 /**
- * @brief Handles the LDA (Load Accumulator) instruction.
+ * @brief LDA (Load Accumulator).
  *
- * This function loads a byte from memory into the accumulator, updating the
- * Zero (Z) and Negative (N) flags based on the value loaded.
+ * Loads a byte into the accumulator, updating the Zero (Z) and
+ * Negative (N) flags based on the value loaded.
  *
  * @param cpu Pointer to the CPU instance.
  * @param mode The addressing mode used by the instruction.
+ * @param operand The raw operand.
+ * @param cycles The base cycle count of the opcode.
  * @return The number of cycles consumed by the instruction.
  */
-uint8_t handler_lda(CPU *cpu, AddressingMode mode) {
-  uint16_t addr;
-  uint8_t value = 0;
-  uint8_t cycles_used = 0;
+RVM_ALWAYS_INLINE uint8_t op_LDA(CPU *cpu, AddressingMode mode,
+                                 uint16_t operand, uint8_t cycles) {
+  cpu->a = load_operand(cpu, mode, operand, &cycles);
+  set_nz(cpu, cpu->a);
+  return cycles;
+}
 
-  switch (mode) {
-  case MODE_IMMEDIATE:
-    addr = addr_immediate(cpu);
-    value = mem_read(cpu, addr);
-    cycles_used += 2;
-    break;
-  case MODE_ZEROPAGE:
-    addr = addr_zeropage(cpu);
-    value = mem_read(cpu, addr);
-    cycles_used += 3;
-    break;
-  case MODE_ABSOLUTE:
-    addr = addr_absolute(cpu);
-    value = mem_read(cpu, addr);
-    cycles_used += 4;
-    break;
-  case MODE_ZEROPAGE_X:
-    addr = (addr_zeropage(cpu) + cpu->x) & 0xFF;
-    value = mem_read(cpu, addr);
-    cycles_used += 4;
-    break;
-  case MODE_ABSOLUTE_X: {
-    uint16_t base_addr = addr_absolute(cpu);
-    addr = base_addr + cpu->x;
-    if ((base_addr & 0xFF00) != (addr & 0xFF00)) {
-      cycles_used += 1;
-    }
-    value = mem_read(cpu, addr);
-    cycles_used += 4;
-    break;
-  }
-  case MODE_ABSOLUTE_Y: {
-    uint16_t base_addr = addr_absolute(cpu);
-    addr = base_addr + cpu->y;
-    if ((base_addr & 0xFF00) != (addr & 0xFF00)) {
-      cycles_used += 1;
-    }
-    value = mem_read(cpu, addr);
-    cycles_used += 4;
-    break;
-  }
-  case MODE_INDIRECT_X: {
-    uint8_t ptr_addr = (addr_zeropage(cpu) + cpu->x) & 0xFF;
-    uint8_t low_byte = mem_read(cpu, ptr_addr);
-    uint8_t high_byte = mem_read(cpu, (ptr_addr + 1) & 0xFF);
-    addr = (high_byte << 8) | low_byte;
-    value = mem_read(cpu, addr);
-    cycles_used = 6;
-    break;
+/**
+ * @brief LDX (Load X Register).
+ *
+ * Loads a byte into the X register, updating the Z and N flags.
+ */
+RVM_ALWAYS_INLINE uint8_t op_LDX(CPU *cpu, AddressingMode mode,
+                                 uint16_t operand, uint8_t cycles) {
+  cpu->x = load_operand(cpu, mode, operand, &cycles);
+  set_nz(cpu, cpu->x);
+  return cycles;
+}
+
+/**
+ * @brief LDY (Load Y Register).
+ *
+ * Loads a byte into the Y register, updating the Z and N flags.
+ */
+RVM_ALWAYS_INLINE uint8_t op_LDY(CPU *cpu, AddressingMode mode,
+                                 uint16_t operand, uint8_t cycles) {
+  cpu->y = load_operand(cpu, mode, operand, &cycles);
+  set_nz(cpu, cpu->y);
+  return cycles;
+}
+
+/**
+ * @brief LSR (Logical Shift Right).
+ *
+ * Shifts the accumulator or a memory byte right by one. Bit 0 goes to
+ * the Carry (C) flag; Z and N reflect the result (N is always clear).
+ * Read-modify-write forms always take their full cycle count.
+ */
+RVM_ALWAYS_INLINE uint8_t op_LSR(CPU *cpu, AddressingMode mode,
+                                 uint16_t operand, uint8_t cycles) {
+  if (mode == MODE_ACCUMULATOR) {
+    cpu->a = lsr_value(cpu, cpu->a);
+    return cycles;
   }
-  case MODE_INDIRECT_Y: {
-    uint8_t zp_ptr_addr = addr_zeropage(cpu);
 
-    uint8_t lo = mem_read(cpu, zp_ptr_addr);
-    uint8_t hi = mem_read(cpu, (zp_ptr_addr + 1) & 0xFF);
+  uint8_t unused = 0;
+  uint16_t addr = effective_address(cpu, mode, operand, &unused);
+  bus_write(&cpu->bus, addr, lsr_value(cpu, bus_read(&cpu->bus, addr)));
+  return cycles;
+}
 
-    uint16_t base_addr = (hi << 8) | lo;
+/**
+ * @brief ADC (Add with Carry).
+ *
+ * Adds a value and the carry flag to the accumulator. It updates the
+ * Zero (Z), Negative (N), Overflow (V), and Carry (C) flags based on the
+ * result of the addition.
+ */
+RVM_ALWAYS_INLINE uint8_t op_ADC(CPU *cpu, AddressingMode mode,
+                                 uint16_t operand, uint8_t cycles) {
+  uint8_t value = load_operand(cpu, mode, operand, &cycles);
+  uint16_t result_16 = (uint16_t)cpu->a + (uint16_t)value + cpu->lazy.c;
+  uint8_t final_result = lo8(result_16);
 
-    addr = base_addr + cpu->y;
+  set_nz(cpu, final_result);
+  cpu->lazy.c = result_16 >> 8;
+  cpu->lazy.v_a = cpu->a;
+  cpu->lazy.v_b = value;
+  cpu->lazy.v_r = final_result;
 
-    if ((addr & 0xFF00) != (base_addr & 0xFF00)) {
-      cycles_used += 1;
-    }
+  cpu->a = final_result;
+  return cycles;
+}
 
-    value = mem_read(cpu, addr);
-    break;
-  }
-  default:
-    break;
-  }
+/**
+ * @brief STA/STX/STY (Store Register).
+ *
+ * Stores a register to memory. Stores never take the page-cross
+ * penalty; their indexed forms are already costed for the long path.
+ */
+RVM_ALWAYS_INLINE uint8_t store(CPU *cpu, AddressingMode mode,
+                                uint16_t operand, uint8_t cycles,
+                                uint8_t val) {
+  uint8_t unused = 0;
+  bus_write(&cpu->bus, effective_address(cpu, mode, operand, &unused), val);
+  return cycles;
+}
 
-  cpu->a = lo8(value);
+RVM_ALWAYS_INLINE uint8_t op_STA(CPU *cpu, AddressingMode mode,
+                                 uint16_t operand, uint8_t cycles) {
+  return store(cpu, mode, operand, cycles, cpu->a);
+}
 
-  cpu->flags &= ~(FLAG_Z | FLAG_N);
-  if (cpu->a == 0)
-    cpu->flags |= FLAG_Z;
-  if (cpu->a & 0x80)
-    cpu->flags |= FLAG_N;
+RVM_ALWAYS_INLINE uint8_t op_STX(CPU *cpu, AddressingMode mode,
+                                 uint16_t operand, uint8_t cycles) {
+  return store(cpu, mode, operand, cycles, cpu->x);
+}
 
-  return cycles_used;
+RVM_ALWAYS_INLINE uint8_t op_STY(CPU *cpu, AddressingMode mode,
+                                 uint16_t operand, uint8_t cycles) {
+  return store(cpu, mode, operand, cycles, cpu->y);
 }
 
 /**
- * @brief Handles the LDX (Load X Register) instruction.
+ * @brief INX/INY/DEX/DEY (Increment/Decrement Index Register).
  *
- * This function loads a byte from memory into the X register, updating the
- * Zero (Z) and Negative (N) flags based on the value loaded.
- *
- * @param cpu Pointer to the CPU instance.
- * @param mode The addressing mode used by the instruction.
- * @return The number of cycles consumed by the instruction.
+ * Adds @p delta to an index register and updates the Z and N flags.
  */
-uint8_t handler_ldx(CPU *cpu, AddressingMode mode) {
-  uint16_t addr;
-  uint8_t value;
-  uint8_t cycles_used = 0;
+RVM_ALWAYS_INLINE uint8_t step_index(CPU *cpu, uint8_t *reg, int delta,
+                                     uint8_t cycles) {
+  *reg = lo8(*reg + delta);
+  set_nz(cpu, *reg);
+  return cycles;
+}
 
-  switch (mode) {
-  case MODE_IMMEDIATE:
-    addr = addr_immediate(cpu);
-    value = mem_read(cpu, addr);
-      cycles_used += 2;
-    break;
-  case MODE_ZEROPAGE:
-    addr = addr_zeropage(cpu);
-    value = mem_read(cpu, addr);
-      cycles_used += 3;
-    break;
-  case MODE_ABSOLUTE:
-    addr = addr_absolute(cpu);
-    value = mem_read(cpu, addr);
-    cycles_used += 3;
-    break;
-  case MODE_ZEROPAGE_Y:
-      addr = (addr_zeropage(cpu) + cpu->y) & 0xFF;
-      value = mem_read(cpu, addr);
-      cycles_used += 4;
-      break;
-  case MODE_ABSOLUTE_Y: {
-      uint16_t base_addr = addr_absolute(cpu);
-      addr = base_addr + cpu->y;
-      if ((base_addr & 0xFF00) != (addr & 0xFF00)) {
-        cycles_used += 1;
-      }
-      value = mem_read(cpu, addr);
-      cycles_used += 4;
-      break;
-  }
-  default:
-    printf("Unimplemented addressing mode\n");
-    return 0;
-  }
+RVM_ALWAYS_INLINE uint8_t op_INX(CPU *cpu, AddressingMode mode,
+                                 uint16_t operand, uint8_t cycles) {
+  return step_index(cpu, &cpu->x, 1, cycles);
+}
 
-  cpu->x = lo8(value);
-  return cycles_used;
+RVM_ALWAYS_INLINE uint8_t op_INY(CPU *cpu, AddressingMode mode,
+                                 uint16_t operand, uint8_t cycles) {
+  return step_index(cpu, &cpu->y, 1, cycles);
 }
 
-uint8_t handler_ldy(CPU *cpu, AddressingMode mode) {
-  uint16_t addr;
-  uint8_t value;
-  uint8_t cycles_used = 0;
-  switch (mode) {
-    case MODE_IMMEDIATE:
-      addr = addr_immediate(cpu);
-      value = mem_read(cpu, addr);
-      cycles_used += 2;
-      break;
-    case MODE_ZEROPAGE:
-      addr = addr_zeropage(cpu);
-      value = mem_read(cpu, addr);
-      cycles_used += 3;
-      break;
-    case MODE_ABSOLUTE:
-      addr = addr_absolute(cpu);
-      value = mem_read(cpu, addr);
-      cycles_used += 3;
-      break;
-    case MODE_ZEROPAGE_X:
-      addr = (addr_zeropage(cpu) + cpu->x) & 0xFF;
-      value = mem_read(cpu, addr);
-      cycles_used += 4;
-      break;
-    case MODE_ABSOLUTE_X: {
-      uint16_t base_addr = addr_absolute(cpu);
-      addr = base_addr + cpu->x;
-      if ((base_addr & 0xFF00) != (addr & 0xFF00)) {
-        cycles_used += 1;
-      }
-      value = mem_read(cpu, addr);
-      cycles_used += 4;
-      break;
-    }
-    default:
-      printf("Unimplemented addressing mode\n");
-      return 0;
-  }
+RVM_ALWAYS_INLINE uint8_t op_DEX(CPU *cpu, AddressingMode mode,
+                                 uint16_t operand, uint8_t cycles) {
+  return step_index(cpu, &cpu->x, -1, cycles);
+}
 
-  cpu->x = lo8(value);
-  return cycles_used;
+RVM_ALWAYS_INLINE uint8_t op_DEY(CPU *cpu, AddressingMode mode,
+                                 uint16_t operand, uint8_t cycles) {
+  return step_index(cpu, &cpu->y, -1, cycles);
+}
+
+RVM_ALWAYS_INLINE uint8_t op_NOP(CPU *cpu, AddressingMode mode,
+                                 uint16_t operand, uint8_t cycles) {
+  return cycles;
 }
 
 /**
- * @brief Handles the ADC (Add with Carry) instruction.
+ * @brief JMP (Jump).
  *
- * This function adds a value from memory and the carry flag to the
- * accumulator. It updates the Zero (Z), Negative (N), Overflow (V), and
- * Carry (C) flags based on the result of the addition.
+ * Loads the PC with the absolute or indirect target address.
+ */
+RVM_ALWAYS_INLINE uint8_t op_JMP(CPU *cpu, AddressingMode mode,
+                                 uint16_t operand, uint8_t cycles) {
+  uint8_t unused = 0;
+  cpu->pc = effective_address(cpu, mode, operand, &unused);
+  return cycles;
+}
+
+/**
+ * @brief Conditional relative branch.
+ *
+ * The offset is relative to the PC after the branch instruction. A
+ * taken branch costs one extra cycle, two if it lands in another page.
  *
  * @param cpu Pointer to the CPU instance.
- * @param mode The addressing mode used by the instruction.
+ * @param taken Whether the branch condition holds.
+ * @param operand Signed 8-bit offset.
+ * @param cycles The base cycle count of the opcode.
  * @return The number of cycles consumed by the instruction.
  */
-uint8_t handler_adc(CPU *cpu, AddressingMode mode) {
-  uint16_t addr;
+RVM_ALWAYS_INLINE uint8_t branch(CPU *cpu, int taken, uint16_t operand,
+                                 uint8_t cycles) {
+  if (!taken)
+    return cycles;
 
-  switch (mode) {
-  case MODE_IMMEDIATE:
-    addr = addr_immediate(cpu);
-    break;
-  case MODE_ZEROPAGE:
-    addr = addr_zeropage(cpu);
-    break;
-  case MODE_ABSOLUTE:
-    addr = addr_absolute(cpu);
-    break;
-  default:
-    printf("Unimplemented addressing mode\n");
-    return 0;
-  }
-
-  uint8_t value = mem_read(cpu, addr);
-  uint8_t carry_in = (cpu->flags & FLAG_C) ? 1 : 0;
-  uint16_t result_16 = (uint16_t)cpu->a + (uint16_t)value + (uint16_t)carry_in;
-  uint8_t final_result = lo8(result_16);
+  uint16_t target = cpu->pc + (int8_t)lo8(operand);
+  cycles += ((cpu->pc & 0xFF00) != (target & 0xFF00)) ? 2 : 1;
+  cpu->pc = target;
+  return cycles;
+}
 
-  if (final_result == 0)
-    cpu->flags |= FLAG_Z;
-  else
-    cpu->flags &= ~FLAG_Z;
-  if (final_result & 0x80)
-    cpu->flags |= FLAG_N;
-  else
-    cpu->flags &= ~FLAG_N;
-  if (~(cpu->a ^ value) & (cpu->a ^ final_result) & 0x80)
-    cpu->flags |= FLAG_V;
-  else
-    cpu->flags &= ~FLAG_V;
-  if (result_16 & 0x100)
-    cpu->flags |= FLAG_C;
-  else
-    cpu->flags &= ~FLAG_C;
+#define DEFINE_BRANCH(mn, cond)                                                \
+  RVM_ALWAYS_INLINE uint8_t op_##mn(CPU *cpu, AddressingMode mode,             \
+                                    uint16_t operand, uint8_t cycles) {        \
+    return branch(cpu, cond, operand, cycles);                                 \
+  }
+DEFINE_BRANCH(BPL, !(cpu->lazy.n & FLAG_N))
+DEFINE_BRANCH(BMI, cpu->lazy.n & FLAG_N)
+DEFINE_BRANCH(BVC, !cpu_lazy_v(cpu))
+DEFINE_BRANCH(BVS, cpu_lazy_v(cpu))
+DEFINE_BRANCH(BCC, !cpu->lazy.c)
+DEFINE_BRANCH(BCS, cpu->lazy.c)
+DEFINE_BRANCH(BNE, cpu->lazy.z)
+DEFINE_BRANCH(BEQ, !cpu->lazy.z)
+#undef DEFINE_BRANCH
 
-  cpu->a = final_result;
-  return 2;
-}
+/*
+ * One handler per opcode, e.g. exec_0xA9() for LDA #imm. These back the
+ * instruction table (cpu_step, debugger) while the dispatch loop below
+ * inlines the same op_<mnemonic>() bodies directly.
+ */
+#define DEFINE_HANDLER(opc, mn, mode, cyc)                                     \
+  static uint8_t exec_##opc(CPU *cpu, uint16_t operand) {                      \
+    uint8_t spent = op_##mn(cpu, MODE_##mode, operand, cyc);                   \
+    RVM_STATS_INSN(&cpu->bus.stats, opc, MODE_##mode, cyc, spent);             \
+    return spent;                                                              \
+  }
+RVM_ISA(DEFINE_HANDLER)
+#undef DEFINE_HANDLER
 
-uint8_t handler_lsr(CPU *cpu, AddressingMode mode) {
-  uint16_t addr;
-  uint8_t value;
-  uint8_t cycles_used = 0;
-  switch (mode) {
-    case MODE_ACCUMULATOR:
-      cpu->a = lsr_op(cpu, cpu->a);
-      cycles_used = 2;
-      break;
-    case MODE_ZEROPAGE:
-      addr = addr_zeropage(cpu);
-      value = mem_read(cpu, addr);
-      value = lsr_op(cpu, value);
-      mem_write(cpu, addr, value);
-      cycles_used = 5;
-    case MODE_ZEROPAGE_X:
-      addr = (addr_zeropage(cpu) + cpu->x) & 0xFF;
-      value = mem_read(cpu, addr);
-      value = lsr_op(cpu, value);
-      mem_write(cpu, addr, value);
-      cycles_used = 6;
-    case MODE_ABSOLUTE:
-      addr = addr_absolute(cpu);
-      value = mem_read(cpu, addr);
-      value = lsr_op(cpu, value);
-      mem_write(cpu, addr, value);
-     cycles_used = 6;
-    case MODE_ABSOLUTE_X:
-      uint16_t base_addr = addr_absolute(cpu);
-      addr = base_addr + cpu->x;
-      if ((base_addr & 0xFF00) != (addr & 0xFF00)) {
-        cycles_used += 1;
-      }
-      value = mem_read(cpu, addr);
-      value = lsr_op(cpu, value);
-      mem_write(cpu, addr, value);
-      cycles_used += 7;
-    default:
-      printf("Unimplemented addressing mode\n");
-      return 0;
+/*
+ * Body of one dispatched instruction: fetch the operand for the
+ * compile-time mode and run the inlined semantic.
+ */
+#define EXECUTE(opc, mn, mode, cyc)                                            \
+  {                                                                            \
+    uint16_t operand = operand_fetch(cpu, MODE_##mode);                        \
+    uint8_t spent = op_##mn(cpu, MODE_##mode, operand, cyc);                   \
+    RVM_STATS_INSN(&cpu->bus.stats, opc, MODE_##mode, cyc, spent);             \
+    cpu->cycles += spent;                                                      \
   }
-  return cycles_used;
-}
 
 /**
- * @brief Initializes the instruction table.
+ * @brief Runs the interpreter until the cycle budget is consumed.
+ *
+ * This is the hot loop behind cpu_run(). With GCC/Clang every opcode
+ * ends in its own indirect jump to the next one (threaded dispatch);
+ * other compilers get an equivalent switch loop. Breakpoints and the
+ * halted flag are handled by the caller.
  *
- * This function populates the instruction table with all the implemented
- * opcodes, their handlers, addressing modes, and cycle counts.
+ * @param cpu Pointer to the CPU instance.
+ * @param cycle_budget Number of cycles to execute.
+ * @param reason Set to STOP_BUDGET or STOP_ILLEGAL.
+ * @return The number of cycles consumed.
  */
-void init_instruction_table() {
-  for (int i = 0; i < 256; i++)
-    instruction_table[i] = (Instruction){"???", NULL, MODE_IMPLIED, 0};
-
-  instruction_table[0xA9] =
-      (Instruction){"LDA", handler_lda, MODE_IMMEDIATE, 2};
-  instruction_table[0xA5] = (Instruction){"LDA", handler_lda, MODE_ZEROPAGE, 3};
-  instruction_table[0xAD] = (Instruction){"LDA", handler_lda, MODE_ABSOLUTE, 4};
-  instruction_table[0xB5] =
-      (Instruction){"LDA", handler_lda, MODE_ZEROPAGE_X, 4};
-  instruction_table[0xBD] =
-      (Instruction){"LDA", handler_lda, MODE_ABSOLUTE_X, 4};
-  instruction_table[0xB9] =
-      (Instruction){"LDA", handler_lda, MODE_ABSOLUTE_Y, 4};
-  instruction_table[0xA1] =
-      (Instruction){"LDA", handler_lda, MODE_INDIRECT_X, 2};
-  instruction_table[0xB1] =
-      (Instruction){"LDA", handler_lda, MODE_INDIRECT_Y, 2};
-  instruction_table[0xA2] =
-      (Instruction){"LDX", handler_ldx, MODE_IMMEDIATE, 2};
-  instruction_table[0xA6] = (Instruction){"LDX", handler_ldx, MODE_ZEROPAGE, 3};
-  instruction_table[0xAE] = (Instruction){"LDX", handler_ldx, MODE_ABSOLUTE, 4};
-  instruction_table[0xB6] = (Instruction){"LDX", handler_ldx, MODE_ZEROPAGE_Y, 4};
-  instruction_table[0xBE] = (Instruction){"LDX", handler_ldx, MODE_ABSOLUTE_Y, 4};
-  instruction_table[0xA0] = (Instruction){"LDY", handler_ldy, MODE_IMMEDIATE, 2};
-  instruction_table[0xA4] = (Instruction){"LDY", handler_ldy, MODE_ZEROPAGE, 3};
-  instruction_table[0xB4] = (Instruction){"LDY", handler_ldy, MODE_ZEROPAGE_X, 4};
-  instruction_table[0xAC] = (Instruction){"LDY", handler_ldy, MODE_ABSOLUTE, 4};
-  instruction_table[0xBC] = (Instruction){"LDY", handler_ldy, MODE_ABSOLUTE_X, 4};
-  instruction_table[0x4A] = (Instruction){"LSR", handler_lsr, MODE_ACCUMULATOR, 2};
-  instruction_table[0x46] = (Instruction){"LSR", handler_lsr, MODE_ZEROPAGE, 5};
-  instruction_table[0x56] = (Instruction){"LSR", handler_lsr, MODE_ZEROPAGE_X, 6};
-  instruction_table[0x4E] = (Instruction){"LSR", handler_lsr, MODE_ABSOLUTE, 6};
-  instruction_table[0x5E] = (Instruction){"LSR", handler_lsr, MODE_ABSOLUTE_X, 7};
-  instruction_table[0x69] =
-      (Instruction){"ADC", handler_adc, MODE_IMMEDIATE, 2};
-  instruction_table[0x65] = (Instruction){"ADC", handler_adc, MODE_ZEROPAGE, 3};
-  instruction_table[0x6D] = (Instruction){"ADC", handler_adc, MODE_ABSOLUTE, 4};
+uint32_t opcodes_run(CPU *cpu, uint32_t cycle_budget, StopReason *reason) {
+  uint64_t start = cpu->cycles;
+  uint8_t opcode;
+
+  *reason = STOP_BUDGET;
+
+#if RVM_THREADED_DISPATCH
+#define LABEL_ENTRY(opc, mn, mode, cyc) [opc] = &&L_##opc,
+#define THREADED_CASE(opc, mn, mode, cyc)                                      \
+  L_##opc : EXECUTE(opc, mn, mode, cyc) DISPATCH();
+
+#pragma GCC diagnostic push
+#if defined(__clang__)
+#pragma GCC diagnostic ignored "-Winitializer-overrides"
+#else
+#pragma GCC diagnostic ignored "-Woverride-init"
+#endif
+  static const void *const dispatch_table[256] = {
+      [0 ... 255] = &&op_illegal, RVM_ISA(LABEL_ENTRY)};
+#pragma GCC diagnostic pop
+
+#define DISPATCH()                                                             \
+  do {                                                                         \
+    if (cpu->cycles - start >= cycle_budget)                                   \
+      goto done;                                                               \
+    opcode = bus_read(&cpu->bus, cpu->pc++);                                   \
+    goto *dispatch_table[opcode];                                              \
+  } while (0)
+
+  DISPATCH();
+  RVM_ISA(THREADED_CASE)
+
+op_illegal:
+  cpu->pc--;
+  *reason = STOP_ILLEGAL;
+done:
+  return (uint32_t)(cpu->cycles - start);
+
+#undef DISPATCH
+#undef THREADED_CASE
+#undef LABEL_ENTRY
+#else
+#define SWITCH_CASE(opc, mn, mode, cyc)                                        \
+  case opc:                                                                    \
+    EXECUTE(opc, mn, mode, cyc) break;
+
+  while (cpu->cycles - start < cycle_budget) {
+    opcode = bus_read(&cpu->bus, cpu->pc++);
+    switch (opcode) {
+      RVM_ISA(SWITCH_CASE)
+    default:
+      cpu->pc--;
+      *reason = STOP_ILLEGAL;
+      return (uint32_t)(cpu->cycles - start);
+    }
+  }
+
+  return (uint32_t)(cpu->cycles - start);
+
+#undef SWITCH_CASE
+#endif
 }
+
+#undef EXECUTE
+
+#define MNEMONIC_PROPERTIES(mn, flow, flags, stores)                           \
+  enum { FLOW_OF_##mn = flow, FLAGS_OF_##mn = flags, STORES_OF_##mn = stores };
+RVM_MNEMONICS(MNEMONIC_PROPERTIES)
+#undef MNEMONIC_PROPERTIES
+
+/* instruction_size() of each mode, as constants for the tables */
+enum {
+  SIZE_OF_IMMEDIATE = 2,
+  SIZE_OF_ZEROPAGE = 2,
+  SIZE_OF_ABSOLUTE = 3,
+  SIZE_OF_ZEROPAGE_X = 2,
+  SIZE_OF_ZEROPAGE_Y = 2,
+  SIZE_OF_ABSOLUTE_X = 3,
+  SIZE_OF_ABSOLUTE_Y = 3,
+  SIZE_OF_INDIRECT = 3,
+  SIZE_OF_INDIRECT_X = 2,
+  SIZE_OF_INDIRECT_Y = 2,
+  SIZE_OF_IMPLIED = 1,
+  SIZE_OF_ACCUMULATOR = 1,
+  SIZE_OF_RELATIVE = 2,
+};
+
+#define TABLE_ENTRY(opc, mn, mode, cyc)                                        \
+  [opc] = {exec_##opc, MODE_##mode, cyc, FLOW_OF_##mn,                         \
+           STORES_OF_##mn && MODE_##mode != MODE_ACCUMULATOR},
+const Instruction instruction_table[256] = {RVM_ISA(TABLE_ENTRY)};
+#undef TABLE_ENTRY
+
+#define INFO_ENTRY(opc, mn, mode, cyc)                                         \
+  [opc] = {#mn, SIZE_OF_##mode, FLAGS_OF_##mn},
+const InstructionInfo instruction_info[256] = {RVM_ISA(INFO_ENTRY)};
+#undef INFO_ENTRY
@@ -0,0 +1,544 @@
+/*
+ * rvm-8/kernel/ppu.c
+ *
+ * Scanline tile renderer for rvm-8.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ *
+ * Notes:
+ * - Line buffers hold raw color indices. The background line has one
+ *   entry per screen pixel; the sprite line is padded by 8 bytes on
+ *   either side so sprites hanging off the screen edges need no
+ *   clipping. Sprite index 0 means transparent.
+ * - Only two kernels are ISA specific: ppu_decode_tile() and
+ *   ppu_compose_line(). Everything else moves 8 pixels at a time as a
+ *   uint64_t.
+ * - The sequence number is only written by the rendering thread, so the
+ *   back buffer index can be read with a relaxed load. Publishing uses a
+ *   release store so a reader that acquires the new sequence also sees
+ *   every pixel of the frame.
+ * - Dirty lines are found by comparing each line, once drawn, with the
+ *   same line of the front buffer: one memcmp() of PPU_WIDTH bytes,
+ *   exact whatever the program did to VRAM. Lines a frame did not draw
+ *   still hold the frame before the front one, so they are compared
+ *   when it is published.
+ */
+
+#include "ppu.h"
+#include <string.h>
+
+#if !defined(RVM_NO_SIMD) && defined(__SSE2__)
+#define RVM_PPU_SSE2 1
+#include <emmintrin.h>
+#elif !defined(RVM_NO_SIMD) && defined(__ARM_NEON)
+#define RVM_PPU_NEON 1
+#include <arm_neon.h>
+#elif !defined(RVM_NO_SIMD) && defined(__wasm_simd128__)
+#define RVM_PPU_WASM 1
+#include <wasm_simd128.h>
+#endif
+
+#define SPRITE_PAD 8
+
+static const uint8_t zero_page[BUS_PAGE_SIZE];
+
+/**
+ * @brief Host memory behind a VRAM page, or zeros if it has none.
+ */
+static const uint8_t *ppu_page(const Ppu *ppu, uint16_t addr) {
+  const uint8_t *host = ppu->bus->read_map[BUS_PAGE(addr)];
+  return host ? host : zero_page;
+}
+
+/* --- Kernels ---------------------------------------------------------- */
+
+/**
+ * @brief Decodes a 2bpp planar tile into one color index per pixel.
+ *
+ * @param src 16 bytes: low plane then high plane of each of 8 rows.
+ * @param dst 64 color indices, row-major, leftmost pixel first.
+ */
+static void ppu_decode_tile(const uint8_t *src, uint8_t *dst) {
+#if RVM_PPU_SSE2
+  const __m128i bits = _mm_set_epi8(1, 2, 4, 8, 16, 32, 64, (char)128, 1, 2,
+                                    4, 8, 16, 32, 64, (char)128);
+  const __m128i one = _mm_set1_epi8(1);
+  __m128i t = _mm_loadu_si128((const __m128i *)src);
+  // l0..l7 h0..h7, then every plane byte repeated 8 times, two rows per
+  // vector
+  __m128i planes = _mm_packus_epi16(_mm_and_si128(t, _mm_set1_epi16(0xFF)),
+                                    _mm_srli_epi16(t, 8));
+  __m128i lo = _mm_unpacklo_epi8(planes, planes);
+  __m128i hi = _mm_unpackhi_epi8(planes, planes);
+  __m128i lo4[2] = {_mm_unpacklo_epi16(lo, lo), _mm_unpackhi_epi16(lo, lo)};
+  __m128i hi4[2] = {_mm_unpacklo_epi16(hi, hi), _mm_unpackhi_epi16(hi, hi)};
+
+  for (int i = 0; i < 4; i++) {
+    __m128i l = (i & 1) ? _mm_unpackhi_epi32(lo4[i >> 1], lo4[i >> 1])
+                        : _mm_unpacklo_epi32(lo4[i >> 1], lo4[i >> 1]);
+    __m128i h = (i & 1) ? _mm_unpackhi_epi32(hi4[i >> 1], hi4[i >> 1])
+                        : _mm_unpacklo_epi32(hi4[i >> 1], hi4[i >> 1]);
+    __m128i lb = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(l, bits), bits),
+                               one);
+    __m128i hb = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(h, bits), bits),
+                               one);
+    _mm_storeu_si128((__m128i *)(dst + 16 * i),
+                     _mm_or_si128(lb, _mm_add_epi8(hb, hb)));
+  }
+#elif RVM_PPU_NEON
+  static const uint8_t bit_table[8] = {0x80, 0x40, 0x20, 0x10,
+                                       0x08, 0x04, 0x02, 0x01};
+  const uint8x8_t bits = vld1_u8(bit_table);
+  const uint8x8_t one = vdup_n_u8(1);
+
+  for (int row = 0; row < 8; row++) {
+    uint8x8_t l = vand_u8(vtst_u8(vdup_n_u8(src[2 * row]), bits), one);
+    uint8x8_t h = vand_u8(vtst_u8(vdup_n_u8(src[2 * row + 1]), bits), one);
+    vst1_u8(dst + 8 * row, vorr_u8(l, vshl_n_u8(h, 1)));
+  }
+#elif RVM_PPU_WASM
+  const v128_t bits = wasm_i8x16_make((int8_t)0x80, 0x40, 0x20, 0x10, 0x08,
+                                      0x04, 0x02, 0x01, (int8_t)0x80, 0x40,
+                                      0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+  const v128_t one = wasm_i8x16_splat(1);
+  const v128_t zero = wasm_i8x16_splat(0);
+  const uint64_t spread = 0x0101010101010101ULL;
+
+  for (int row = 0; row < 8; row += 2) {
+    v128_t l = wasm_i64x2_make(src[2 * row] * spread,
+                               src[2 * row + 2] * spread);
+    v128_t h = wasm_i64x2_make(src[2 * row + 1] * spread,
+                               src[2 * row + 3] * spread);
+    v128_t lb = wasm_v128_and(wasm_i8x16_ne(wasm_v128_and(l, bits), zero), one);
+    v128_t hb = wasm_v128_and(wasm_i8x16_ne(wasm_v128_and(h, bits), zero), one);
+    wasm_v128_store(dst + 8 * row, wasm_v128_or(lb, wasm_i8x16_add(hb, hb)));
+  }
+#else
+  // Broadcast each plane byte to 8 bytes, keep bit (7 - i) in byte i,
+  // then turn every non-zero byte into 1.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  const uint64_t bits = 0x8040201008040201ULL;
+#else
+  const uint64_t bits = 0x0102040810204080ULL;
+#endif
+  const uint64_t spread = 0x0101010101010101ULL;
+
+  for (int row = 0; row < 8; row++) {
+    uint64_t l = ((src[2 * row] * spread & bits) + 0x7F7F7F7F7F7F7F7FULL) >> 7;
+    uint64_t h =
+        ((src[2 * row + 1] * spread & bits) + 0x7F7F7F7F7F7F7F7FULL) >> 7;
+    uint64_t px = (l & spread) | (h & spread) << 1;
+    memcpy(dst + 8 * row, &px, 8);
+  }
+#endif
+}
+
+/**
+ * @brief Maps a line of color indices through the palettes.
+ *
+ * out[i] = spr[i] ? obp[spr[i]] : bgp[bg[i]]
+ *
+ * @param out PPU_WIDTH shades.
+ * @param bg PPU_WIDTH background color indices.
+ * @param spr PPU_WIDTH sprite color indices, 0 where transparent.
+ * @param bgp Shades of the 4 background colors, padded to 16 bytes.
+ * @param obp Shades of the 4 sprite colors, padded to 16 bytes.
+ */
+static void ppu_compose_line(uint8_t *out, const uint8_t *bg,
+                             const uint8_t *spr, const uint8_t *bgp,
+                             const uint8_t *obp) {
+#if RVM_PPU_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  __m128i bg_shade[4], spr_shade[4];
+
+  for (int c = 0; c < 4; c++) {
+    bg_shade[c] = _mm_set1_epi8(bgp[c]);
+    spr_shade[c] = _mm_set1_epi8(obp[c]);
+  }
+
+  for (int x = 0; x < PPU_WIDTH; x += 16) {
+    __m128i b = _mm_loadu_si128((const __m128i *)(bg + x));
+    __m128i s = _mm_loadu_si128((const __m128i *)(spr + x));
+    __m128i bv = bg_shade[0], sv = spr_shade[0];
+
+    // No byte shuffle in SSE2: select each of the 3 other colors
+    for (int c = 1; c < 4; c++) {
+      __m128i cv = _mm_set1_epi8(c);
+      __m128i bm = _mm_cmpeq_epi8(b, cv);
+      __m128i sm = _mm_cmpeq_epi8(s, cv);
+      bv = _mm_or_si128(_mm_andnot_si128(bm, bv),
+                        _mm_and_si128(bm, bg_shade[c]));
+      sv = _mm_or_si128(_mm_andnot_si128(sm, sv),
+                        _mm_and_si128(sm, spr_shade[c]));
+    }
+
+    __m128i clear = _mm_cmpeq_epi8(s, zero);
+    _mm_storeu_si128((__m128i *)(out + x),
+                     _mm_or_si128(_mm_and_si128(clear, bv),
+                                  _mm_andnot_si128(clear, sv)));
+  }
+#elif RVM_PPU_NEON
+  const uint8x8_t bg_table = vld1_u8(bgp);
+  const uint8x8_t spr_table = vld1_u8(obp);
+  const uint8x8_t zero = vdup_n_u8(0);
+
+  for (int x = 0; x < PPU_WIDTH; x += 8) {
+    uint8x8_t s = vld1_u8(spr + x);
+    uint8x8_t bv = vtbl1_u8(bg_table, vld1_u8(bg + x));
+    uint8x8_t sv = vtbl1_u8(spr_table, s);
+    vst1_u8(out + x, vbsl_u8(vceq_u8(s, zero), bv, sv));
+  }
+#elif RVM_PPU_WASM
+  const v128_t bg_table = wasm_v128_load(bgp);
+  const v128_t spr_table = wasm_v128_load(obp);
+  const v128_t zero = wasm_i8x16_splat(0);
+
+  for (int x = 0; x < PPU_WIDTH; x += 16) {
+    v128_t s = wasm_v128_load(spr + x);
+    v128_t bv = wasm_i8x16_swizzle(bg_table, wasm_v128_load(bg + x));
+    v128_t sv = wasm_i8x16_swizzle(spr_table, s);
+    wasm_v128_store(out + x,
+                    wasm_v128_bitselect(bv, sv, wasm_i8x16_eq(s, zero)));
+  }
+#else
+  for (int x = 0; x < PPU_WIDTH; x++)
+    out[x] = spr[x] ? obp[spr[x] & 3] : bgp[bg[x] & 3];
+#endif
+}
+
+/* --- VRAM caches ----------------------------------------------------- */
+
+/* Pages the PPU derives cached state from: both tile pages, then the
+ * page holding OAM. */
+static const uint8_t watched_page[3] = {
+    BUS_PAGE(PPU_TILE_DATA), BUS_PAGE(PPU_TILE_DATA) + 1, BUS_PAGE(PPU_OAM)};
+
+/**
+ * @brief Bus trap hook: a write hit a VRAM page the PPU caches.
+ *
+ * Only sprite Y bytes affect the line buckets; X, tile and attribute
+ * writes are picked up when the sprite is drawn.
+ */
+static void ppu_on_write(void *ctx, uint16_t addr) {
+  Ppu *ppu = ctx;
+
+  if (addr >= PPU_TILE_DATA &&
+      addr < PPU_TILE_DATA + PPU_TILE_COUNT * PPU_TILE_BYTES)
+    ppu->dirty_tiles |= 1u << ((addr - PPU_TILE_DATA) / PPU_TILE_BYTES);
+  else if (addr >= PPU_OAM && addr < PPU_OAM + PPU_SPRITE_COUNT * 4 &&
+           (addr & 3) == 0)
+    ppu->moved_sprites |= 1u << ((addr - PPU_OAM) / 4);
+}
+
+/**
+ * @brief Sets or clears a sprite's bit on the lines a Y position covers.
+ */
+static void ppu_bucket_sprite(Ppu *ppu, unsigned sprite, uint8_t y, int set) {
+  int first = y - 8, last = y - 1;
+  uint16_t bit = 1u << sprite;
+
+  if (first < 0)
+    first = 0;
+  if (last >= PPU_HEIGHT)
+    last = PPU_HEIGHT - 1;
+  for (int line = first; line <= last; line++) {
+    if (set)
+      ppu->line_sprites[line] |= bit;
+    else
+      ppu->line_sprites[line] &= ~bit;
+  }
+}
+
+/**
+ * @brief Brings the tile cache and sprite buckets up to date with VRAM.
+ *
+ * A watched page that was remapped, or lost its trap, is treated as
+ * entirely rewritten and its trap is re-armed.
+ */
+static void ppu_sync_vram(Ppu *ppu) {
+  Bus *bus = ppu->bus;
+
+  for (int i = 0; i < 3; i++) {
+    uint8_t page = watched_page[i];
+    const uint8_t *host = bus->read_map[page];
+    int trapped = bus->pages[page].write_traps & (1 << BUS_TRAP_PPU);
+
+    if (host != ppu->vram_source[i] ||
+        (bus->pages[page].kind == BUS_RAM && !trapped)) {
+      if (i < 2)
+        ppu->dirty_tiles |= 0xFFFFu << (16 * i);
+      else
+        ppu->moved_sprites = 0xFFFF;
+      ppu->vram_source[i] = host;
+      bus_trap_writes(bus, page, BUS_TRAP_PPU);
+    }
+  }
+
+  uint32_t dirty = ppu->dirty_tiles;
+  for (unsigned tile = 0; dirty; tile++, dirty >>= 1) {
+    uint16_t addr = PPU_TILE_DATA + tile * PPU_TILE_BYTES;
+
+    if (dirty & 1)
+      ppu_decode_tile(ppu_page(ppu, addr) + (addr & 0xFF), ppu->tiles[tile]);
+  }
+  ppu->dirty_tiles = 0;
+
+  const uint8_t *oam = ppu_page(ppu, PPU_OAM) + (PPU_OAM & 0xFF);
+  uint16_t moved = ppu->moved_sprites;
+  for (unsigned i = 0; moved; i++, moved >>= 1) {
+    if ((moved & 1) && oam[4 * i] != ppu->sprite_y[i]) {
+      ppu_bucket_sprite(ppu, i, ppu->sprite_y[i], 0);
+      ppu_bucket_sprite(ppu, i, oam[4 * i], 1);
+      ppu->sprite_y[i] = oam[4 * i];
+    }
+  }
+  ppu->moved_sprites = 0;
+}
+
+void ppu_invalidate(Ppu *ppu) {
+  ppu->dirty_tiles = 0xFFFFFFFFu;
+  ppu->moved_sprites = 0xFFFF;
+}
+
+/* --- Registers -------------------------------------------------------- */
+
+static uint8_t ppu_reg_read(void *ctx, uint16_t addr) {
+  const Ppu *ppu = ctx;
+
+  switch (addr) {
+  case PPU_REG_CTRL:
+    return ppu->ctrl;
+  case PPU_REG_BGP:
+    return ppu->bgp;
+  case PPU_REG_OBP:
+    return ppu->obp;
+  default:
+    return 0;
+  }
+}
+
+/* The registers only change when the CPU writes them. */
+static uint64_t ppu_reg_steady(void *ctx, uint16_t addr) {
+  (void)ctx;
+  (void)addr;
+  return UINT64_MAX;
+}
+
+static void ppu_reg_write(void *ctx, uint16_t addr, uint8_t val) {
+  Ppu *ppu = ctx;
+
+  switch (addr) {
+  case PPU_REG_CTRL:
+    ppu->ctrl = val;
+    break;
+  case PPU_REG_BGP:
+    ppu->bgp = val;
+    break;
+  case PPU_REG_OBP:
+    ppu->obp = val;
+    break;
+  default:
+    break;
+  }
+}
+
+void ppu_reset(Ppu *ppu) {
+  ppu->ctrl = PPU_CTRL_BG | PPU_CTRL_SPRITES;
+  ppu->bgp = 0xE4; // Color n is shade n
+  ppu->obp = 0xE4;
+}
+
+void ppu_init(Ppu *ppu, Bus *bus) {
+  memset(ppu, 0, sizeof(Ppu));
+  atomic_init(&ppu->frames.sequence, 0);
+  ppu->bus = bus;
+  ppu_reset(ppu);
+  ppu_invalidate(ppu);
+
+  bus_set_trap_hook(bus, BUS_TRAP_PPU, ppu_on_write, ppu);
+  bus_map_io(bus, BUS_PPU_PAGE, 1, ppu_reg_read, ppu_reg_write, ppu);
+  bus_set_steady(bus, BUS_PPU_PAGE, 1, ppu_reg_steady);
+  ppu_sync_vram(ppu);
+}
+
+void ppu_detach(Ppu *ppu) {
+  Bus *bus = ppu->bus;
+
+  for (int i = 0; i < 3; i++)
+    bus_release_writes(bus, watched_page[i], BUS_TRAP_PPU);
+  bus_set_trap_hook(bus, BUS_TRAP_PPU, NULL, NULL);
+  bus_unmap(bus, BUS_PPU_PAGE, 1);
+}
+
+/* --- Rendering -------------------------------------------------------- */
+
+/**
+ * @brief Copies the cached tile rows of one background line.
+ */
+static void ppu_render_background(const Ppu *ppu, unsigned line,
+                                  uint8_t *out) {
+  uint16_t map = PPU_TILEMAP + (line / 8) * PPU_TILEMAP_WIDTH;
+
+  // The tilemap spans two pages, so look each entry up on its own
+  for (int col = 0; col < PPU_TILEMAP_WIDTH; col++) {
+    uint16_t addr = map + col;
+    uint8_t tile = ppu_page(ppu, addr)[addr & 0xFF] % PPU_TILE_COUNT;
+    memcpy(out + col * 8, ppu->tiles[tile] + (line & 7) * 8, 8);
+  }
+}
+
+static uint64_t ppu_reverse_bytes(uint64_t v) {
+  v = (v & 0x00FF00FF00FF00FFULL) << 8 | (v >> 8 & 0x00FF00FF00FF00FFULL);
+  v = (v & 0x0000FFFF0000FFFFULL) << 16 | (v >> 16 & 0x0000FFFF0000FFFFULL);
+  return v << 32 | v >> 32;
+}
+
+/**
+ * @brief Overlays the sprites that cover one line.
+ *
+ * OAM entries are {y, x, tile, attributes}; a sprite covers the screen
+ * from (x - 8, y - 8), so 0 hides it. Only sprites in the line's bucket
+ * are visited, highest entry first, so lower entries end up on top.
+ */
+static void ppu_render_sprites(const Ppu *ppu, unsigned line, uint8_t *out) {
+  const uint8_t *oam = ppu_page(ppu, PPU_OAM) + (PPU_OAM & 0xFF);
+  uint16_t bucket = ppu->line_sprites[line];
+
+  for (int i = PPU_SPRITE_COUNT - 1; bucket; i--) {
+    const uint8_t *s = oam + 4 * i;
+    unsigned row = line + 8 - s[0];
+
+    if (!(bucket & (1u << i)))
+      continue;
+    bucket &= ~(1u << i);
+    // Only possible after a host write the PPU was not told about
+    if (row >= 8)
+      continue;
+    if (s[3] & PPU_ATTR_FLIP_Y)
+      row = 7 - row;
+
+    uint64_t px, dst, opaque;
+    memcpy(&px, ppu->tiles[s[2] % PPU_TILE_COUNT] + row * 8, 8);
+    if (s[3] & PPU_ATTR_FLIP_X)
+      px = ppu_reverse_bytes(px);
+
+    // 0xFF in every byte holding a non-zero color (all bytes are <= 3)
+    opaque = ((px + 0x7F7F7F7F7F7F7F7FULL) & 0x8080808080808080ULL) >> 7;
+    opaque *= 0xFF;
+
+    memcpy(&dst, out + s[1], 8);
+    dst = (dst & ~opaque) | (px & opaque);
+    memcpy(out + s[1], &dst, 8);
+  }
+}
+
+/**
+ * @brief Returns the framebuffer the next frame is drawn into.
+ */
+static uint8_t (*ppu_back_buffer(Ppu *ppu))[PPU_WIDTH] {
+  uint32_t seq =
+      atomic_load_explicit(&ppu->frames.sequence, memory_order_relaxed);
+  return ppu->frames.buffers[(seq + 1) & 1];
+}
+
+/**
+ * @brief Marks a line of the back buffer dirty if it differs from the
+ *        front buffer.
+ */
+static void ppu_diff_line(Ppu *ppu, unsigned line) {
+  PpuFrames *frames = &ppu->frames;
+  uint32_t seq = atomic_load_explicit(&frames->sequence, memory_order_relaxed);
+  uint32_t *dirty = &frames->dirty[(seq + 1) & 1][line / 32];
+  uint32_t bit = 1u << (line % 32);
+
+  if (memcmp(frames->buffers[(seq + 1) & 1][line],
+             frames->buffers[seq & 1][line], PPU_WIDTH) != 0)
+    *dirty |= bit;
+  else
+    *dirty &= ~bit;
+  ppu->drawn[line / 32] |= bit;
+}
+
+/**
+ * @brief Expands a palette register to one shade per color.
+ */
+static void ppu_palette(uint8_t reg, uint8_t *shades) {
+  memset(shades, 0, 16);
+  for (int c = 0; c < 4; c++)
+    shades[c] = (reg >> (2 * c)) & 3;
+}
+
+void ppu_skip_frame(Ppu *ppu, int skip) { ppu->skip = skip != 0; }
+
+void ppu_render_line(Ppu *ppu, unsigned line) {
+  uint8_t bg[PPU_WIDTH];
+  uint8_t spr[SPRITE_PAD + 256 + SPRITE_PAD];
+  uint8_t bgp[16], obp[16];
+
+  if (line >= PPU_HEIGHT || ppu->skip)
+    return;
+
+  ppu_sync_vram(ppu);
+
+  if (ppu->ctrl & PPU_CTRL_BG)
+    ppu_render_background(ppu, line, bg);
+  else
+    memset(bg, 0, sizeof(bg));
+
+  memset(spr, 0, sizeof(spr));
+  if (ppu->ctrl & PPU_CTRL_SPRITES)
+    ppu_render_sprites(ppu, line, spr);
+
+  ppu_palette(ppu->bgp, bgp);
+  ppu_palette(ppu->obp, obp);
+  ppu_compose_line(ppu_back_buffer(ppu)[line], bg, spr + SPRITE_PAD, bgp,
+                   obp);
+  ppu_diff_line(ppu, line);
+}
+
+void ppu_render_frame(Ppu *ppu) {
+  for (unsigned line = 0; line < PPU_HEIGHT; line++)
+    ppu_render_line(ppu, line);
+  ppu_end_frame(ppu);
+}
+
+void ppu_end_frame(Ppu *ppu) {
+  uint32_t seq =
+      atomic_load_explicit(&ppu->frames.sequence, memory_order_relaxed);
+
+  // Once a frame instead of after every line, so a long run of skipped
+  // frames costs one sync each and the next rendered line starts current
+  if (ppu->skip) {
+    ppu_sync_vram(ppu);
+    return;
+  }
+
+  for (unsigned line = 0; line < PPU_HEIGHT; line++) {
+    if (!(ppu->drawn[line / 32] & (1u << (line % 32))))
+      ppu_diff_line(ppu, line);
+  }
+  memset(ppu->drawn, 0, sizeof(ppu->drawn));
+  atomic_store_explicit(&ppu->frames.sequence, seq + 1,
+                        memory_order_release);
+}
+
+const uint8_t *ppu_front_buffer(const Ppu *ppu, uint32_t *sequence) {
+  uint32_t seq = ppu_frame_sequence(ppu);
+
+  if (sequence)
+    *sequence = seq;
+  return &ppu->frames.buffers[seq & 1][0][0];
+}
+
+const uint32_t *ppu_front_dirty(const Ppu *ppu, uint32_t *sequence) {
+  uint32_t seq = ppu_frame_sequence(ppu);
+
+  if (sequence)
+    *sequence = seq;
+  return ppu->frames.dirty[seq & 1];
+}
+
+uint32_t ppu_frame_sequence(const Ppu *ppu) {
+  return atomic_load_explicit(&ppu->frames.sequence, memory_order_acquire);
+}
@@ -0,0 +1,250 @@
+/**
+ * rvm-8/kernel/ppu.h
+ *
+ * Tilemap PPU for the rvm-8 emulator.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ *
+ * The PPU renders a 160x144 screen of 8x8 tiles with a 4-shade palette
+ * into a framebuffer of shade indices (0 = lightest, 3 = darkest). The
+ * VRAM layout and the registers are described in specs/SPEC.md.
+ *
+ * Rendering works a scanline at a time, eight pixels at a time:
+ *
+ * - Tiles are decoded from their 2bpp planes into one color index per
+ *   byte and kept in a tile cache. VRAM tile pages carry a BUS_TRAP_PPU
+ *   write trap, so only tiles that were written since the last line are
+ *   decoded again.
+ * - The background pass copies cached tile rows into a line buffer.
+ * - Each line keeps a bucket of the sprites that cover it, as a bitmask
+ *   in OAM order (which is also priority order). The OAM page is trapped
+ *   too, and only sprites whose Y byte was written are re-bucketed, so
+ *   the sprite pass touches just the sprites on the current line.
+ * - A final pass maps both line buffers through their palettes into
+ *   the framebuffer.
+ *
+ * The PPU owns two framebuffers. Lines are rendered into the back
+ * buffer, and ppu_render_frame() publishes it as the new front buffer
+ * by bumping an atomic frame sequence number, so a host thread can read
+ * the front buffer in place while the next frame is being drawn.
+ *
+ * Each buffer also carries the lines that differ from the frame
+ * published before it, so a host that showed that frame only needs to
+ * upload those lines, and none for a frame identical to it.
+ *
+ * A frame nobody will look at can be skipped (ppu_skip_frame()): its
+ * lines are not rasterized, but the tile cache and sprite buckets are
+ * still brought up to date. Rasterization has no state of its own that
+ * the CPU can read, so skipping is invisible to the program.
+ *
+ * Tile decoding and the palette pass use SSE2, NEON or WebAssembly
+ * SIMD128 when the target has them, and portable 64-bit code otherwise
+ * (or with RVM_NO_SIMD defined).
+ *
+ * Writes that bypass the bus (a host filling the backing memory
+ * directly) are not seen by the trap; call ppu_invalidate() after
+ * them.
+ */
+
+#ifndef RVM_PPU_H
+#define RVM_PPU_H
+
+#include "bus.h"
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define PPU_WIDTH 160
+#define PPU_HEIGHT 144
+#define PPU_LINE_WORDS ((PPU_HEIGHT + 31) / 32) // Words of a line bitmask
+
+/* VRAM layout (specs/SPEC.md, section 4) */
+#define PPU_TILE_DATA 0x2000 // 32 tiles of 16 bytes, 2bpp planar
+#define PPU_TILE_COUNT 32
+#define PPU_TILE_BYTES 16
+#define PPU_TILEMAP 0x2200 // 20x18 tile indices, row-major
+#define PPU_TILEMAP_WIDTH (PPU_WIDTH / 8)
+#define PPU_TILEMAP_HEIGHT (PPU_HEIGHT / 8)
+#define PPU_OAM 0x23C0 // 16 sprites of 4 bytes
+#define PPU_SPRITE_COUNT 16
+
+/* PPU registers, in the BUS_PPU_PAGE page */
+#define PPU_REG_CTRL 0x2400 // Bit 0: background on, bit 1: sprites on
+#define PPU_REG_BGP 0x2401  // Background palette, 2 bits per color
+#define PPU_REG_OBP 0x2402  // Sprite palette, 2 bits per color
+
+#define PPU_CTRL_BG 0x01
+#define PPU_CTRL_SPRITES 0x02
+
+/* Sprite attribute bits (byte 3 of an OAM entry) */
+#define PPU_ATTR_FLIP_X 0x20
+#define PPU_ATTR_FLIP_Y 0x40
+
+/**
+ * @brief Double-buffered PPU output, shared with the host.
+ *
+ * The low bit of the sequence number selects the front buffer; the
+ * other one is the back buffer the PPU is drawing into. The layout is
+ * mirrored by emulator/src/ffi.rs.
+ */
+typedef struct {
+  /** Frames published since init */
+  _Atomic uint32_t sequence;
+  /** Rendered shades (0-3), one byte per pixel */
+  uint8_t buffers[2][PPU_HEIGHT][PPU_WIDTH];
+  /** Lines of each buffer that differ from the frame published before
+   *  it: bit line % 32 of word line / 32 */
+  uint32_t dirty[2][PPU_LINE_WORDS];
+} PpuFrames;
+
+/**
+ * @brief PPU state and output for one emulator instance.
+ */
+typedef struct {
+  /** Bus the PPU reads VRAM from and maps its registers on */
+  Bus *bus;
+  /** PPU_REG_CTRL */
+  uint8_t ctrl;
+  /** PPU_REG_BGP */
+  uint8_t bgp;
+  /** PPU_REG_OBP */
+  uint8_t obp;
+  /** Tiles whose cache entry is stale, one bit per tile */
+  uint32_t dirty_tiles;
+  /** Sprites whose Y byte was written since they were bucketed */
+  uint16_t moved_sprites;
+  /** Host memory behind the two tile pages and the OAM page at the last
+   *  sync */
+  const uint8_t *vram_source[3];
+  /** Y each sprite was bucketed with */
+  uint8_t sprite_y[PPU_SPRITE_COUNT];
+  /** Sprites covering each line, bit i for OAM entry i */
+  uint16_t line_sprites[PPU_HEIGHT];
+  /** Lines of the back buffer drawn since the last frame was published */
+  uint32_t drawn[PPU_LINE_WORDS];
+  /** Non-zero while the frame being drawn is skipped */
+  uint8_t skip;
+  /** Decoded tiles: one color index (0-3) per pixel, row-major */
+  uint8_t tiles[PPU_TILE_COUNT][64];
+  /** Front and back framebuffers */
+  PpuFrames frames;
+} Ppu;
+
+/**
+ * @brief Initialize a PPU and connect it to a bus.
+ *
+ * Maps the PPU registers over BUS_PPU_PAGE and installs the
+ * BUS_TRAP_PPU hook, which watches the tile and OAM pages. Call after
+ * the memory map is set up.
+ *
+ * @param ppu Pointer to the PPU to initialize.
+ * @param bus Bus to read VRAM from; must outlive the PPU.
+ */
+void ppu_init(Ppu *ppu, Bus *bus);
+
+/**
+ * @brief Disconnect a PPU from its bus.
+ *
+ * Removes the trap hook and the VRAM traps; the register page is left
+ * unmapped.
+ *
+ * @param ppu Pointer to the PPU.
+ */
+void ppu_detach(Ppu *ppu);
+
+/**
+ * @brief Set the PPU registers to their reset values.
+ *
+ * @param ppu Pointer to the PPU.
+ */
+void ppu_reset(Ppu *ppu);
+
+/**
+ * @brief Mark every cached tile and sprite bucket stale.
+ *
+ * @param ppu Pointer to the PPU.
+ */
+void ppu_invalidate(Ppu *ppu);
+
+/**
+ * @brief Skip rasterizing the frame being drawn, or stop skipping.
+ *
+ * While skipping, ppu_render_line() does nothing and ppu_end_frame()
+ * only syncs the tile cache and sprite buckets with VRAM; no frame is
+ * published, so the front buffer keeps the last rendered one. Set it
+ * before the first line of a frame: lines already drawn are not redone.
+ *
+ * @param ppu Pointer to the PPU.
+ * @param skip Nonzero to skip.
+ */
+void ppu_skip_frame(Ppu *ppu, int skip);
+
+/**
+ * @brief Render one scanline into the back buffer.
+ *
+ * @param ppu Pointer to the PPU.
+ * @param line Scanline, 0 to PPU_HEIGHT - 1.
+ */
+void ppu_render_line(Ppu *ppu, unsigned line);
+
+/**
+ * @brief Render all scanlines of a frame and publish it.
+ *
+ * After this returns, the new frame is the front buffer and the old
+ * front buffer becomes the back buffer.
+ *
+ * @param ppu Pointer to the PPU.
+ */
+void ppu_render_frame(Ppu *ppu);
+
+/**
+ * @brief Publish the back buffer as the new front buffer.
+ *
+ * For callers that render the lines themselves, one at a time with
+ * ppu_render_line(); ppu_render_frame() does both.
+ *
+ * @param ppu Pointer to the PPU.
+ */
+void ppu_end_frame(Ppu *ppu);
+
+/**
+ * @brief Get the most recently published frame.
+ *
+ * Safe to call from another thread. The buffer stays intact until the
+ * PPU publishes the frame after it; check with ppu_frame_sequence()
+ * once done reading.
+ *
+ * @param ppu Pointer to the PPU.
+ * @param sequence Receives the frame's sequence number; may be NULL.
+ * @return PPU_HEIGHT rows of PPU_WIDTH shades.
+ */
+const uint8_t *ppu_front_buffer(const Ppu *ppu, uint32_t *sequence);
+
+/**
+ * @brief Get the lines of the most recently published frame that differ
+ *        from the frame published before it.
+ *
+ * The lines are compared by content, so a line redrawn the same is not
+ * dirty, and a frame with no dirty line looks exactly like the one
+ * before. A host that missed frames (the sequence number moved by more
+ * than one) has to take the whole frame instead. Read it like the front
+ * buffer, with the same sequence check.
+ *
+ * @param ppu Pointer to the PPU.
+ * @param sequence Receives the frame's sequence number; may be NULL.
+ * @return PPU_LINE_WORDS words, bit line % 32 of word line / 32 set for
+ *         each dirty line.
+ */
+const uint32_t *ppu_front_dirty(const Ppu *ppu, uint32_t *sequence);
+
+/**
+ * @brief Get the number of frames published so far.
+ *
+ * Safe to call from another thread.
+ *
+ * @param ppu Pointer to the PPU.
+ * @return Sequence number of the current front buffer.
+ */
+uint32_t ppu_frame_sequence(const Ppu *ppu);
+
+#endif
@@ -0,0 +1,151 @@
+/*
+ * rvm-8/kernel/profile.c
+ *
+ * Sampling guest profiler for rvm-8.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ *
+ * Notes:
+ * - A sample is one increment in a flat 64K histogram; labels are only
+ *   looked at when the profile is written, by merging the sampled
+ *   addresses with the sorted labels in one pass.
+ * - The jitter is a xorshift generator with a fixed seed, so a replayed
+ *   run samples the same cycles. Sampling never changes what the
+ *   machine computes: the CPU only stops and resumes.
+ * - Of several labels at one address the map's first is kept, which for
+ *   maps from asm_write_labels() is the first in name order.
+ */
+
+#include "profile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROFILE_SEED 0x9E3779B9u
+#define LABEL_LINE_MAX 512
+
+Profiler *profile_create(uint32_t interval) {
+  Profiler *profiler = calloc(1, sizeof(Profiler));
+
+  if (profiler == NULL)
+    return NULL;
+  profiler->interval = interval ? interval : PROFILE_DEFAULT_INTERVAL;
+  profiler->seed = PROFILE_SEED;
+  return profiler;
+}
+
+static void free_labels(ProfileLabel *labels, unsigned count) {
+  for (unsigned i = 0; i < count; i++)
+    free(labels[i].name);
+  free(labels);
+}
+
+void profile_destroy(Profiler *profiler) {
+  if (profiler == NULL)
+    return;
+  free_labels(profiler->labels, profiler->label_count);
+  free(profiler);
+}
+
+static int compare_labels(const void *a, const void *b) {
+  const ProfileLabel *x = a, *y = b;
+
+  if (x->addr != y->addr)
+    return x->addr < y->addr ? -1 : 1;
+  return strcmp(x->name, y->name);
+}
+
+int profile_load_labels(Profiler *profiler, const char *path) {
+  FILE *in = fopen(path, "r");
+  ProfileLabel *labels = NULL;
+  unsigned count = 0, cap = 0;
+  char line[LABEL_LINE_MAX], name[LABEL_LINE_MAX];
+  int ok = in != NULL;
+
+  while (ok && fgets(line, sizeof(line), in)) {
+    unsigned addr;
+
+    if (line[strspn(line, " \t\r\n")] == '\0')
+      continue;
+    if (sscanf(line, "%x %s", &addr, name) != 2 || addr >= RVM_MEM_SIZE) {
+      ok = 0;
+      break;
+    }
+    if (count == cap) {
+      ProfileLabel *grown;
+
+      cap = cap ? 2 * cap : 64;
+      grown = realloc(labels, cap * sizeof(ProfileLabel));
+      if (grown == NULL) {
+        ok = 0;
+        break;
+      }
+      labels = grown;
+    }
+    labels[count].addr = (uint16_t)addr;
+    labels[count].name = strdup(name);
+    if (labels[count].name == NULL) {
+      ok = 0;
+      break;
+    }
+    count++;
+  }
+  if (in != NULL)
+    fclose(in);
+  if (!ok) {
+    free_labels(labels, count);
+    return -1;
+  }
+
+  // Sort, then keep the first label at each address
+  qsort(labels, count, sizeof(ProfileLabel), compare_labels);
+  unsigned kept = 0;
+  for (unsigned i = 0; i < count; i++) {
+    if (kept > 0 && labels[kept - 1].addr == labels[i].addr)
+      free(labels[i].name);
+    else
+      labels[kept++] = labels[i];
+  }
+  free_labels(profiler->labels, profiler->label_count);
+  profiler->labels = labels;
+  profiler->label_count = kept;
+  return 0;
+}
+
+uint64_t profile_samples(const Profiler *profiler) {
+  return profiler->samples;
+}
+
+uint64_t profile_next(Profiler *profiler, uint64_t now) {
+  uint32_t r = profiler->seed;
+
+  r ^= r << 13;
+  r ^= r >> 17;
+  r ^= r << 5;
+  profiler->seed = r;
+  return now + (profiler->interval - profiler->interval / 2) +
+         r % profiler->interval;
+}
+
+int profile_write(const Profiler *profiler, const char *root,
+                  const char *path) {
+  FILE *out = fopen(path, "w");
+  const ProfileLabel *label = NULL;
+  unsigned next = 0;
+  int ok = out != NULL;
+
+  for (unsigned pc = 0; ok && pc < RVM_MEM_SIZE; pc++) {
+    while (next < profiler->label_count &&
+           profiler->labels[next].addr <= pc)
+      label = &profiler->labels[next++];
+    if (profiler->counts[pc] == 0)
+      continue;
+    ok = fprintf(out, "%s%s%s%s$%04X %u\n", root ? root : "",
+                 root ? ";" : "", label ? label->name : "", label ? ";" : "",
+                 pc, profiler->counts[pc]) > 0;
+  }
+  if (out != NULL && fclose(out) != 0)
+    ok = 0;
+  return ok ? 0 : -1;
+}
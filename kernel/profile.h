@@ -0,0 +1,139 @@
+/**
+ * rvm-8/kernel/profile.h
+ *
+ * Sampling guest profiler for the rvm-8 emulator.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ *
+ * A Profiler attached to a machine (machine_set_profiler()) is a
+ * scheduler event like any device: every `interval` CPU cycles, on
+ * average, it counts the PC the CPU is at into a histogram of all 64K
+ * addresses. Nothing runs per instruction, so the engines keep their
+ * fast paths and the cost is one more stop of the CPU per sample. The
+ * intervals are jittered so that samples do not lock onto code that
+ * runs once per frame or per line.
+ *
+ * Every engine stops at the first instruction boundary at or after a
+ * sample is due, so the interpreter, the block cache and the recompiler
+ * all sample the same PCs.
+ *
+ * profile_write() symbolizes the histogram with the label map rvm-asm
+ * writes (`-l FILE`) and prints it as collapsed stacks, the input of
+ * flamegraph.pl and speedscope: `ROOT;LABEL;$ADDR COUNT`, one line per
+ * sampled address, under the nearest label at or below it. The CPU has
+ * no JSR/RTS yet (isa.h), so the routine a PC is in is all the stack
+ * there is to show.
+ */
+
+#ifndef RVM_PROFILE_H
+#define RVM_PROFILE_H
+
+#include "cpu.h"
+
+/** Mean cycles between samples when none are given, about 1800 samples
+ *  per second of emulated time */
+#define PROFILE_DEFAULT_INTERVAL 1000
+
+/**
+ * @brief A label of the program, as read from a label map.
+ */
+typedef struct {
+  uint16_t addr;
+  char *name;
+} ProfileLabel;
+
+/**
+ * @brief Samples of one machine and the labels to name them by.
+ *
+ * The fields are public for inspection; change them through the
+ * functions below.
+ */
+typedef struct Profiler {
+  /** Samples taken at each address */
+  uint32_t counts[RVM_MEM_SIZE];
+  /** Samples taken in all */
+  uint64_t samples;
+  /** Mean cycles between samples */
+  uint32_t interval;
+  /** State of the jitter generator */
+  uint32_t seed;
+  /** Labels sorted by address */
+  ProfileLabel *labels;
+  unsigned label_count;
+} Profiler;
+
+/**
+ * @brief Create a profiler with no samples and no labels.
+ *
+ * @param interval Mean cycles between samples, or 0 for
+ *        PROFILE_DEFAULT_INTERVAL.
+ * @return The profiler, or NULL if allocation failed.
+ */
+Profiler *profile_create(uint32_t interval);
+
+/**
+ * @brief Free a profiler; detach it from its machine first.
+ *
+ * @param profiler The profiler, or NULL.
+ */
+void profile_destroy(Profiler *profiler);
+
+/**
+ * @brief Read a label map, replacing the labels read before.
+ *
+ * The map has one `ADDR NAME` line per label, the address in hex, as
+ * asm_write_labels() writes it; blank lines are skipped.
+ *
+ * @param profiler Pointer to the profiler.
+ * @param path Label map.
+ * @return 0 on success, -1 if the file could not be read, a line is
+ *         malformed or allocation failed; the labels are then unchanged.
+ */
+int profile_load_labels(Profiler *profiler, const char *path);
+
+/**
+ * @brief Count one sample.
+ *
+ * @param profiler Pointer to the profiler.
+ * @param pc Address the CPU is at.
+ */
+static inline void profile_sample(Profiler *profiler, uint16_t pc) {
+  profiler->counts[pc]++;
+  profiler->samples++;
+}
+
+/**
+ * @brief Samples taken so far, for hosts that hold a profiler opaquely.
+ *
+ * @param profiler Pointer to the profiler.
+ * @return The number of samples.
+ */
+uint64_t profile_samples(const Profiler *profiler);
+
+/**
+ * @brief Pick the cycle the next sample is due at.
+ *
+ * @param profiler Pointer to the profiler.
+ * @param now Cycle of the last sample, or of attaching.
+ * @return A cycle from about now + interval / 2 to now + 3 * interval / 2,
+ *         interval cycles after @p now on average and never at it.
+ */
+uint64_t profile_next(Profiler *profiler, uint64_t now);
+
+/**
+ * @brief Write the samples as collapsed stacks.
+ *
+ * Lines come in address order. Addresses below the first label have no
+ * LABEL frame.
+ *
+ * @param profiler Pointer to the profiler.
+ * @param root First frame of every stack, e.g. the ROM name, or NULL
+ *        for none.
+ * @param path Output file.
+ * @return 0 on success, -1 if the file could not be written.
+ */
+int profile_write(const Profiler *profiler, const char *root,
+                  const char *path);
+
+#endif
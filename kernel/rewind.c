@@ -0,0 +1,261 @@
+/*
+ * rvm-8/kernel/rewind.c
+ *
+ * Copy-on-write save states and a rewind ring for rvm-8 machines.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ *
+ * Notes:
+ * - Snapshot n's undo record holds the contents pages had when n was
+ *   taken, for the pages written before snapshot n + 1. Only the newest
+ *   record is still growing.
+ * - Invariant: a RAM page has its BUS_TRAP_SNAPSHOT trap released
+ *   exactly when it is in the newest undo record. Taking a snapshot
+ *   re-arms just those pages, and restoring re-arms the pages it wrote
+ *   back.
+ * - A page is copied at most once per interval, so one record never
+ *   holds more than BUS_PAGE_COUNT copies. With a pool at least that
+ *   big, running out of copies always leaves an older snapshot to drop.
+ * - Page copies are linked through indices into one pool, so snapshots
+ *   never allocate after rewind_create().
+ */
+
+#include "rewind.h"
+#include "block.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define NO_COPY -1
+
+typedef struct {
+  uint8_t data[BUS_PAGE_SIZE];
+  /** Host memory the page was copied from */
+  uint8_t *host;
+  uint8_t page;
+  /** Next copy in the same undo record, or in the free list */
+  int32_t next;
+} PageCopy;
+
+typedef struct {
+  uint8_t a, x, y, flags, halted;
+  uint16_t pc, sp;
+  uint64_t cycles;
+  uint8_t ppu_ctrl, ppu_bgp, ppu_obp;
+  RiotTimer riot;
+  TiaRegs tia;
+  uint64_t input;
+  uint32_t frames;
+  /** First copy of the undo record */
+  int32_t copies;
+} Snapshot;
+
+struct Rewind {
+  Machine *machine;
+  /** Ring of snapshots, oldest at first */
+  Snapshot *ring;
+  unsigned capacity;
+  unsigned first;
+  unsigned depth;
+  /** Page copies and the head of their free list */
+  PageCopy *pool;
+  int32_t free_copies;
+  unsigned used;
+};
+
+static Snapshot *rewind_slot(Rewind *rewind, unsigned n) {
+  return &rewind->ring[(rewind->first + n) % rewind->capacity];
+}
+
+/**
+ * @brief Returns the copies of an undo record to the pool.
+ */
+static void rewind_free_record(Rewind *rewind, Snapshot *snap) {
+  while (snap->copies != NO_COPY) {
+    PageCopy *copy = &rewind->pool[snap->copies];
+    int32_t next = copy->next;
+
+    copy->next = rewind->free_copies;
+    rewind->free_copies = snap->copies;
+    rewind->used--;
+    snap->copies = next;
+  }
+}
+
+static void rewind_drop_oldest(Rewind *rewind) {
+  rewind_free_record(rewind, rewind_slot(rewind, 0));
+  rewind->first = (rewind->first + 1) % rewind->capacity;
+  rewind->depth--;
+}
+
+/**
+ * @brief Copies a page into the newest undo record before its first
+ * write.
+ */
+static void rewind_on_write(void *ctx, uint16_t addr) {
+  Rewind *rewind = ctx;
+  Bus *bus = &rewind->machine->cpu.bus;
+  uint8_t page = BUS_PAGE(addr);
+
+  bus_release_writes(bus, page, BUS_TRAP_SNAPSHOT);
+  if (rewind->depth == 0)
+    return;
+
+  while (rewind->free_copies == NO_COPY)
+    rewind_drop_oldest(rewind);
+
+  Snapshot *newest = rewind_slot(rewind, rewind->depth - 1);
+  int32_t index = rewind->free_copies;
+  PageCopy *copy = &rewind->pool[index];
+
+  rewind->free_copies = copy->next;
+  rewind->used++;
+  memcpy(copy->data, bus->pages[page].host, BUS_PAGE_SIZE);
+  copy->host = bus->pages[page].host;
+  copy->page = page;
+  copy->next = newest->copies;
+  newest->copies = index;
+}
+
+Rewind *rewind_create(Machine *machine, unsigned snapshots, unsigned pages) {
+  Rewind *rewind = calloc(1, sizeof(Rewind));
+
+  if (snapshots == 0)
+    snapshots = 1;
+  if (pages < BUS_PAGE_COUNT)
+    pages = BUS_PAGE_COUNT;
+  if (rewind == NULL)
+    return NULL;
+
+  rewind->ring = calloc(snapshots, sizeof(Snapshot));
+  rewind->pool = malloc(pages * sizeof(PageCopy));
+  if (rewind->ring == NULL || rewind->pool == NULL) {
+    free(rewind->ring);
+    free(rewind->pool);
+    free(rewind);
+    return NULL;
+  }
+
+  rewind->machine = machine;
+  rewind->capacity = snapshots;
+  for (unsigned i = 0; i < pages; i++)
+    rewind->pool[i].next = i + 1 < pages ? (int32_t)i + 1 : NO_COPY;
+  rewind->free_copies = 0;
+
+  bus_set_trap_hook(&machine->cpu.bus, BUS_TRAP_SNAPSHOT, rewind_on_write,
+                    rewind);
+  return rewind;
+}
+
+void rewind_destroy(Rewind *rewind) {
+  if (rewind == NULL)
+    return;
+
+  rewind_clear(rewind);
+  bus_set_trap_hook(&rewind->machine->cpu.bus, BUS_TRAP_SNAPSHOT, NULL, NULL);
+  free(rewind->ring);
+  free(rewind->pool);
+  free(rewind);
+}
+
+void rewind_snapshot(Rewind *rewind) {
+  Machine *machine = rewind->machine;
+  Bus *bus = &machine->cpu.bus;
+  const CPU *cpu = &machine->cpu;
+
+  if (rewind->depth == 0) {
+    // ROM never changes, so only RAM pages need copying
+    for (unsigned page = 0; page < BUS_PAGE_COUNT; page++) {
+      if (bus->pages[page].kind == BUS_RAM)
+        bus_trap_writes(bus, page, BUS_TRAP_SNAPSHOT);
+    }
+  } else {
+    // Freeze the newest record; its pages start a new interval clean
+    const Snapshot *newest = rewind_slot(rewind, rewind->depth - 1);
+    for (int32_t i = newest->copies; i != NO_COPY; i = rewind->pool[i].next)
+      bus_trap_writes(bus, rewind->pool[i].page, BUS_TRAP_SNAPSHOT);
+  }
+
+  if (rewind->depth == rewind->capacity)
+    rewind_drop_oldest(rewind);
+
+  *rewind_slot(rewind, rewind->depth++) = (Snapshot){
+      .a = cpu->a,
+      .x = cpu->x,
+      .y = cpu->y,
+      .flags = cpu->flags,
+      .halted = cpu->halted,
+      .pc = cpu->pc,
+      .sp = cpu->sp,
+      .cycles = cpu->cycles,
+      .ppu_ctrl = machine->ppu.ctrl,
+      .ppu_bgp = machine->ppu.bgp,
+      .ppu_obp = machine->ppu.obp,
+      .riot = machine->riot.timer,
+      .tia = tia_regs(&machine->tia),
+      .input = machine->input.latched,
+      .frames = machine->frames,
+      .copies = NO_COPY,
+  };
+}
+
+int rewind_restore(Rewind *rewind, unsigned back) {
+  Machine *machine = rewind->machine;
+  CPU *cpu = &machine->cpu;
+  int vram = 0;
+
+  if (back >= rewind->depth)
+    return -1;
+
+  // Newest first, so older contents win where records overlap
+  unsigned target = rewind->depth - 1 - back;
+  for (unsigned n = rewind->depth; n-- > target;) {
+    Snapshot *snap = rewind_slot(rewind, n);
+
+    for (int32_t i = snap->copies; i != NO_COPY; i = rewind->pool[i].next) {
+      const PageCopy *copy = &rewind->pool[i];
+
+      memcpy(copy->host, copy->data, BUS_PAGE_SIZE);
+      if (cpu->blocks != NULL)
+        block_cache_invalidate_page(cpu->blocks, copy->page);
+      if (copy->page >= BUS_VRAM_PAGE &&
+          copy->page < BUS_VRAM_PAGE + BUS_VRAM_PAGES)
+        vram = 1;
+      bus_trap_writes(&cpu->bus, copy->page, BUS_TRAP_SNAPSHOT);
+    }
+    rewind_free_record(rewind, snap);
+  }
+  rewind->depth = target + 1;
+
+  const Snapshot *snap = rewind_slot(rewind, target);
+  cpu->a = snap->a;
+  cpu->x = snap->x;
+  cpu->y = snap->y;
+  cpu->flags = snap->flags;
+  cpu->halted = snap->halted;
+  cpu->pc = snap->pc;
+  cpu->sp = snap->sp;
+  cpu->cycles = snap->cycles;
+  machine->ppu.ctrl = snap->ppu_ctrl;
+  machine->ppu.bgp = snap->ppu_bgp;
+  machine->ppu.obp = snap->ppu_obp;
+  machine->riot.timer = snap->riot;
+  tia_set_regs(&machine->tia, &snap->tia);
+  machine->input.latched = snap->input;
+  machine->frames = snap->frames;
+  machine_reschedule(machine);
+  if (vram)
+    ppu_invalidate(&machine->ppu);
+  return 0;
+}
+
+void rewind_clear(Rewind *rewind) {
+  while (rewind->depth > 0)
+    rewind_drop_oldest(rewind);
+  for (unsigned page = 0; page < BUS_PAGE_COUNT; page++)
+    bus_release_writes(&rewind->machine->cpu.bus, page, BUS_TRAP_SNAPSHOT);
+}
+
+unsigned rewind_depth(const Rewind *rewind) { return rewind->depth; }
+
+unsigned rewind_pages_used(const Rewind *rewind) { return rewind->used; }
@@ -0,0 +1,99 @@
+/**
+ * rvm-8/kernel/rewind.h
+ *
+ * Copy-on-write save states and a rewind ring for rvm-8 machines.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ *
+ * A snapshot is a small header (CPU registers, PPU registers, RIOT
+ * timer, frame count) plus an undo record: the old contents of each page written
+ * since that snapshot was taken. Between snapshots every RAM page
+ * carries a BUS_TRAP_SNAPSHOT write trap. The first write to a page
+ * copies it into the newest undo record and releases the trap, so an
+ * interval costs one page copy per page it dirties and nothing per
+ * write after that.
+ *
+ * Restoring a snapshot plays the undo records back from the newest one
+ * to the target, which touches only the pages written since the target
+ * was taken.
+ *
+ * The ring holds a fixed number of snapshots and draws page copies
+ * from a fixed pool. When either runs out, the oldest snapshot is
+ * dropped, so memory use is bounded however long the machine runs.
+ *
+ * Writes that bypass the bus (machine_load_image(), a host filling
+ * memory directly) are not recorded; call rewind_clear() after them.
+ * Restoring assumes the memory map has not changed since the snapshot.
+ */
+
+#ifndef RVM_REWIND_H
+#define RVM_REWIND_H
+
+#include "machine.h"
+
+typedef struct Rewind Rewind;
+
+/**
+ * @brief Attach a rewind ring to a machine.
+ *
+ * @param machine Machine to snapshot; must outlive the ring.
+ * @param snapshots Number of snapshots kept, at least 1.
+ * @param pages Page copies in the pool; raised to BUS_PAGE_COUNT if
+ *        lower, so one interval can always dirty every page.
+ * @return The ring, or NULL if allocation failed.
+ */
+Rewind *rewind_create(Machine *machine, unsigned snapshots, unsigned pages);
+
+/**
+ * @brief Detach a rewind ring from its machine and free it.
+ *
+ * @param rewind The ring, or NULL.
+ */
+void rewind_destroy(Rewind *rewind);
+
+/**
+ * @brief Take a snapshot of the machine's current state.
+ *
+ * Call between frames. Drops the oldest snapshot when the ring is full.
+ *
+ * @param rewind Pointer to the ring.
+ */
+void rewind_snapshot(Rewind *rewind);
+
+/**
+ * @brief Return the machine to an earlier snapshot.
+ *
+ * Snapshots newer than the target are dropped; the target stays in the
+ * ring, so it can be restored again.
+ *
+ * @param rewind Pointer to the ring.
+ * @param back 0 for the newest snapshot, 1 for the one before it, ...
+ * @return 0 on success, -1 if the ring holds no such snapshot.
+ */
+int rewind_restore(Rewind *rewind, unsigned back);
+
+/**
+ * @brief Drop every snapshot.
+ *
+ * @param rewind Pointer to the ring.
+ */
+void rewind_clear(Rewind *rewind);
+
+/**
+ * @brief Get the number of snapshots that can be restored.
+ *
+ * @param rewind Pointer to the ring.
+ * @return Snapshots in the ring.
+ */
+unsigned rewind_depth(const Rewind *rewind);
+
+/**
+ * @brief Get the number of page copies in use.
+ *
+ * @param rewind Pointer to the ring.
+ * @return Pages held by all undo records.
+ */
+unsigned rewind_pages_used(const Rewind *rewind);
+
+#endif
@@ -1,3 +1,126 @@
-//
-// Created by Holman Rugama on 6/12/25.
-//
\ No newline at end of file
+/*
+ * rvm-8/kernel/riot.c
+ *
+ * RIOT interval timer for rvm-8.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ *
+ * Notes:
+ * - A timer started with value N at cycle S reads N - (t - S) / P while
+ *   t < U = S + (N + 1) * P, then 0xFF - (t - U) (mod 256). The flag is
+ *   likewise derived: it is set for any read at t >= U unless it was
+ *   cleared at or after U.
+ * - Reading INTIM or starting the timer clears the flag and lowers the
+ *   interrupt line. The unused read addresses read as 0.
+ */
+
+#include "riot.h"
+
+/**
+ * @brief Cycle the running timer underflows at.
+ */
+static uint64_t riot_underflow(const RiotTimer *timer) {
+  return timer->start + ((uint64_t)(timer->value + 1) << timer->shift);
+}
+
+static int riot_flag(const RiotTimer *timer, uint64_t now) {
+  uint64_t underflow = riot_underflow(timer);
+  return timer->running && now >= underflow && timer->ack < underflow;
+}
+
+static uint8_t riot_count(const RiotTimer *timer, uint64_t now) {
+  uint64_t underflow = riot_underflow(timer);
+
+  if (!timer->running)
+    return 0;
+  if (now < underflow)
+    return timer->value - (uint8_t)((now - timer->start) >> timer->shift);
+  return (uint8_t)(0xFF - (now - underflow));
+}
+
+/**
+ * @brief SCHED_EVENT_RIOT_TIMER: raises the interrupt line.
+ */
+static void riot_on_underflow(void *ctx, uint64_t when) {
+  Riot *riot = ctx;
+
+  (void)when;
+  riot->timer.irq = 1;
+}
+
+uint8_t riot_read(Riot *riot, uint16_t addr) {
+  RiotTimer *timer = &riot->timer;
+  uint64_t now = *riot->clock;
+
+  switch (addr) {
+  case RIOT_REG_INTIM:
+    timer->ack = now;
+    timer->irq = 0;
+    return riot_count(timer, now);
+  case RIOT_REG_TIMINT:
+    return riot_flag(timer, now) ? RIOT_TIMINT_UNDERFLOW : 0;
+  default:
+    return 0;
+  }
+}
+
+uint64_t riot_steady(const Riot *riot, uint16_t addr) {
+  const RiotTimer *timer = &riot->timer;
+  uint64_t underflow = riot_underflow(timer);
+
+  switch (addr) {
+  case RIOT_REG_INTIM:
+    return 0;
+  case RIOT_REG_TIMINT:
+    // Until then the flag reads 0; after it, only INTIM reads clear it
+    if (timer->running && *riot->clock < underflow && timer->ack < underflow)
+      return underflow;
+    return UINT64_MAX;
+  default:
+    return UINT64_MAX;
+  }
+}
+
+void riot_write(Riot *riot, uint16_t addr, uint8_t val) {
+  static const uint8_t shifts[4] = {0, 3, 6, 10};
+  RiotTimer *timer = &riot->timer;
+
+  *timer = (RiotTimer){
+      .start = *riot->clock,
+      .ack = *riot->clock,
+      .value = val,
+      .shift = shifts[addr & 3],
+      .running = 1,
+      .irq_enabled = (addr & RIOT_IRQ_ENABLE) != 0,
+  };
+  riot_reschedule(riot);
+}
+
+void riot_init(Riot *riot, Scheduler *sched, const uint64_t *clock) {
+  riot->sched = sched;
+  riot->clock = clock;
+  sched_set_handler(sched, SCHED_EVENT_RIOT_TIMER, riot_on_underflow, riot);
+  riot_reset(riot);
+}
+
+void riot_reset(Riot *riot) {
+  riot->timer = (RiotTimer){0};
+  sched_cancel(riot->sched, SCHED_EVENT_RIOT_TIMER);
+}
+
+void riot_reschedule(Riot *riot) {
+  const RiotTimer *timer = &riot->timer;
+
+  // An interrupt already raised, or one that can no longer be, needs no
+  // event
+  if (timer->irq_enabled && !timer->irq &&
+      timer->ack < riot_underflow(timer))
+    sched_add(riot->sched, SCHED_EVENT_RIOT_TIMER, riot_underflow(timer));
+  else
+    sched_cancel(riot->sched, SCHED_EVENT_RIOT_TIMER);
+}
+
+uint8_t riot_timer(const Riot *riot) {
+  return riot_count(&riot->timer, *riot->clock);
+}
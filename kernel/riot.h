@@ -0,0 +1,161 @@
+/**
+ * rvm-8/kernel/riot.h
+ *
+ * RIOT interval timer for the rvm-8 emulator.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ *
+ * The RIOT's registers sit on the device page it shares with the input
+ * registers and the TIA (BUS_INPUT_PAGE, routed by machine.c). Its
+ * interval timer counts down once every 1, 8, 64 or 1024 cycles from the
+ * value last written, and after passing zero keeps counting down once
+ * per cycle from 0xFF with its underflow flag set (specs/SPEC.md,
+ * section 5.1).
+ *
+ * The timer is never ticked. A write records the cycle, the value and
+ * the prescaler, and reads derive the count from the CPU cycle counter,
+ * so a timer nobody reads costs nothing. Only a timer with its
+ * interrupt enabled schedules an event (SCHED_EVENT_RIOT_TIMER), for
+ * the cycle it underflows at.
+ *
+ * Reads see the cycle counter as it was when the reading instruction
+ * started, in every execution engine.
+ */
+
+#ifndef RVM_RIOT_H
+#define RVM_RIOT_H
+
+#include "sched.h"
+#include <stdint.h>
+
+/* Timer registers, in the BUS_INPUT_PAGE page */
+#define RIOT_REG_TIM1T 0x2510  // Write: start, 1 cycle per count
+#define RIOT_REG_TIM8T 0x2511  // Write: 8 cycles per count
+#define RIOT_REG_TIM64T 0x2512 // Write: 64 cycles per count
+#define RIOT_REG_T1024T 0x2513 // Write: 1024 cycles per count
+#define RIOT_REG_INTIM 0x2510  // Read: current count
+#define RIOT_REG_TIMINT 0x2511 // Read: bit 7 set after an underflow
+
+/** Added to a start register to enable the underflow interrupt */
+#define RIOT_IRQ_ENABLE 0x04
+
+#define RIOT_TIMINT_UNDERFLOW 0x80
+
+/**
+ * @brief Interval timer state, as written by the CPU.
+ *
+ * Plain data, so save states can copy it (rewind.c).
+ */
+typedef struct {
+  /** Cycle the timer was last started at */
+  uint64_t start;
+  /** Cycle the underflow flag was last cleared at */
+  uint64_t ack;
+  /** Value it was started with */
+  uint8_t value;
+  /** log2 of the prescaler: 0, 3, 6 or 10 */
+  uint8_t shift;
+  /** Non-zero once started; an idle timer reads 0 */
+  uint8_t running;
+  /** Underflow interrupt enabled */
+  uint8_t irq_enabled;
+  /** Interrupt line, raised by the underflow event until acknowledged */
+  uint8_t irq;
+} RiotTimer;
+
+/**
+ * @brief RIOT state for one emulator instance.
+ */
+typedef struct {
+  /** Scheduler the underflow event is queued on */
+  Scheduler *sched;
+  /** CPU cycle counter the timer runs from */
+  const uint64_t *clock;
+  RiotTimer timer;
+} Riot;
+
+/** Whether an address is one of the timer registers */
+#define RIOT_REG(addr)                                                         \
+  ((addr) >= RIOT_REG_TIM1T && (addr) <= RIOT_REG_T1024T + RIOT_IRQ_ENABLE)
+
+/**
+ * @brief Initialize a RIOT.
+ *
+ * Installs the SCHED_EVENT_RIOT_TIMER handler. The timer starts out
+ * idle.
+ *
+ * @param riot Pointer to the RIOT to initialize.
+ * @param sched Scheduler for the underflow event; must outlive the RIOT.
+ * @param clock CPU cycle counter; must outlive the RIOT.
+ */
+void riot_init(Riot *riot, Scheduler *sched, const uint64_t *clock);
+
+/**
+ * @brief Bus read of a timer register.
+ *
+ * @param riot Pointer to the RIOT.
+ * @param addr Address, see RIOT_REG().
+ * @return The register value.
+ */
+uint8_t riot_read(Riot *riot, uint16_t addr);
+
+/**
+ * @brief How long reads of a timer register keep their value, as a
+ *        BusSteadyFn.
+ *
+ * INTIM counts down and acknowledges the underflow, so it is never
+ * steady; TIMINT holds still until the running timer underflows.
+ *
+ * @param riot Pointer to the RIOT.
+ * @param addr Address, see RIOT_REG().
+ * @return The first cycle a read could differ, UINT64_MAX if never, or
+ *         0 for INTIM.
+ */
+uint64_t riot_steady(const Riot *riot, uint16_t addr);
+
+/**
+ * @brief Bus write of a timer register.
+ *
+ * @param riot Pointer to the RIOT.
+ * @param addr Address, see RIOT_REG().
+ * @param val Value written.
+ */
+void riot_write(Riot *riot, uint16_t addr, uint8_t val);
+
+/**
+ * @brief Stop the timer and drop its event.
+ *
+ * @param riot Pointer to the RIOT.
+ */
+void riot_reset(Riot *riot);
+
+/**
+ * @brief Queue the underflow event again after the scheduler was
+ * cleared or the timer state was replaced (machine_reschedule()).
+ *
+ * @param riot Pointer to the RIOT.
+ */
+void riot_reschedule(Riot *riot);
+
+/**
+ * @brief Get the timer count at the current cycle (RIOT_REG_INTIM).
+ *
+ * Does not clear the underflow flag, unlike a CPU read.
+ *
+ * @param riot Pointer to the RIOT.
+ * @return The count.
+ */
+uint8_t riot_timer(const Riot *riot);
+
+/**
+ * @brief Get the state of the interrupt line.
+ *
+ * The CPU has no interrupt input yet; this is for hosts and tests.
+ *
+ * @param riot Pointer to the RIOT.
+ * @return Non-zero while the underflow interrupt is raised.
+ */
+static inline int riot_irq(const Riot *riot) { return riot->timer.irq; }
+
+#endif
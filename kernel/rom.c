@@ -0,0 +1,207 @@
+/*
+ * rvm-8/kernel/rom.c
+ *
+ * `.rvm` ROM loader for rvm-8.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ *
+ * Notes:
+ * - All fields are little-endian and read bytewise, so the file needs
+ *   no alignment and the loader no byte swapping.
+ * - Section sizes are whole pages so a mapped page never reads past its
+ *   section. Only the palette section is small, and it is copied into
+ *   the PPU registers rather than mapped.
+ * - Hosts without mmap() read the file into the heap instead; rom_load()
+ *   cannot tell the difference.
+ */
+
+#include "rom.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define RVM_ROM_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+typedef struct {
+  uint8_t type;
+  uint8_t page;
+  uint32_t offset;
+  uint32_t size;
+} RomSection;
+
+static uint16_t rom_u16(const uint8_t *p) { return p[0] | p[1] << 8; }
+
+static uint32_t rom_u32(const uint8_t *p) {
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint16_t rom_section_count(const Rom *rom) {
+  return rom_u16(rom->data + 6);
+}
+
+static RomSection rom_section(const Rom *rom, unsigned index) {
+  const uint8_t *p = rom->data + ROM_HEADER_SIZE + index * ROM_SECTION_SIZE;
+  return (RomSection){p[0], p[1], rom_u32(p + 4), rom_u32(p + 8)};
+}
+
+/**
+ * @brief Checks a section's bounds, size and pages.
+ *
+ * @param used Pages claimed by earlier sections, one bit each; updated.
+ */
+static RomError rom_check_section(const Rom *rom, const RomSection *s,
+                                  uint8_t used[BUS_PAGE_COUNT / 8]) {
+  unsigned pages = s->size / BUS_PAGE_SIZE;
+
+  if (s->offset > rom->size || s->size > rom->size - s->offset)
+    return ROM_ERR_SECTION;
+
+  switch (s->type) {
+  case ROM_SECTION_CODE:
+  case ROM_SECTION_DATA:
+    break;
+  case ROM_SECTION_TILES:
+    if (s->page != BUS_VRAM_PAGE || pages > 2)
+      return ROM_ERR_PLACEMENT;
+    break;
+  case ROM_SECTION_PALETTE:
+    return s->size == 2 ? ROM_OK : ROM_ERR_SECTION;
+  default:
+    return ROM_ERR_SECTION;
+  }
+
+  if (s->size == 0 || s->size % BUS_PAGE_SIZE != 0)
+    return ROM_ERR_SECTION;
+  if (s->page + pages > BUS_PAGE_COUNT)
+    return ROM_ERR_PLACEMENT;
+
+  for (unsigned page = s->page; page < s->page + pages; page++) {
+    if (page == BUS_PPU_PAGE || page == BUS_INPUT_PAGE ||
+        (used[page / 8] & (1 << (page % 8))))
+      return ROM_ERR_PLACEMENT;
+    used[page / 8] |= 1 << (page % 8);
+  }
+  return ROM_OK;
+}
+
+RomError rom_parse(Rom *rom, const uint8_t *data, size_t size) {
+  Rom parsed = {data, size, 0};
+  uint8_t used[BUS_PAGE_COUNT / 8] = {0};
+
+  if (size < ROM_HEADER_SIZE || memcmp(data, ROM_MAGIC, 4) != 0 ||
+      rom_u16(data + 4) != ROM_VERSION)
+    return ROM_ERR_HEADER;
+  if (rom_section_count(&parsed) >
+      (size - ROM_HEADER_SIZE) / ROM_SECTION_SIZE)
+    return ROM_ERR_HEADER;
+
+  for (unsigned i = 0; i < rom_section_count(&parsed); i++) {
+    RomSection s = rom_section(&parsed, i);
+    RomError err = rom_check_section(&parsed, &s, used);
+
+    if (err != ROM_OK)
+      return err;
+  }
+
+  *rom = parsed;
+  return ROM_OK;
+}
+
+/**
+ * @brief Maps (or reads) a whole file.
+ *
+ * @return The contents, or NULL on failure.
+ */
+static uint8_t *rom_read_file(const char *path, size_t *size) {
+#if RVM_ROM_MMAP
+  struct stat st;
+  void *data = MAP_FAILED;
+  int fd = open(path, O_RDONLY);
+
+  if (fd < 0)
+    return NULL;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    *size = (size_t)st.st_size;
+    data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  // The mapping keeps the file alive on its own
+  close(fd);
+  return data == MAP_FAILED ? NULL : data;
+#else
+  FILE *file = fopen(path, "rb");
+  uint8_t *data = NULL;
+  long len;
+
+  if (file == NULL)
+    return NULL;
+  if (fseek(file, 0, SEEK_END) == 0 && (len = ftell(file)) > 0 &&
+      fseek(file, 0, SEEK_SET) == 0 && (data = malloc(len)) != NULL &&
+      fread(data, 1, len, file) != (size_t)len) {
+    free(data);
+    data = NULL;
+  }
+  fclose(file);
+  *size = data ? (size_t)len : 0;
+  return data;
+#endif
+}
+
+static void rom_free_file(const uint8_t *data, size_t size) {
+#if RVM_ROM_MMAP
+  munmap((void *)data, size);
+#else
+  (void)size;
+  free((void *)data);
+#endif
+}
+
+RomError rom_open(Rom *rom, const char *path) {
+  size_t size = 0;
+  uint8_t *data = rom_read_file(path, &size);
+  RomError err;
+
+  if (data == NULL)
+    return ROM_ERR_IO;
+
+  err = rom_parse(rom, data, size);
+  if (err != ROM_OK) {
+    rom_free_file(data, size);
+    return err;
+  }
+  rom->mapped = 1;
+  return ROM_OK;
+}
+
+void rom_close(Rom *rom) {
+  if (rom->mapped)
+    rom_free_file(rom->data, rom->size);
+  memset(rom, 0, sizeof(Rom));
+}
+
+void rom_load(Machine *machine, const Rom *rom) {
+  Bus *bus = &machine->cpu.bus;
+
+  machine_clear(machine);
+
+  for (unsigned i = 0; i < rom_section_count(rom); i++) {
+    RomSection s = rom_section(rom, i);
+
+    if (s.type == ROM_SECTION_PALETTE) {
+      bus_write(bus, PPU_REG_BGP, rom->data[s.offset]);
+      bus_write(bus, PPU_REG_OBP, rom->data[s.offset + 1]);
+    } else {
+      bus_map_rom(bus, s.page, s.size / BUS_PAGE_SIZE, rom->data + s.offset);
+    }
+  }
+
+  cpu_reset(&machine->cpu);
+  machine->frames = 0;
+  machine_reschedule(machine);
+}
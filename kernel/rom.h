@@ -0,0 +1,103 @@
+/**
+ * rvm-8/kernel/rom.h
+ *
+ * `.rvm` ROM loader for the rvm-8 emulator.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ *
+ * The container format is described in specs/SPEC.md, section 6.
+ *
+ * A ROM file is mapped into memory read-only and left there. Loading it
+ * into a machine does not copy the code, data or tile sections: their
+ * pages in the bus page table point straight into the mapping, as ROM
+ * pages. Every machine running the same Rom shares one mapping, and
+ * through it the OS page cache.
+ */
+
+#ifndef RVM_ROM_H
+#define RVM_ROM_H
+
+#include "machine.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define ROM_MAGIC "RVM8"
+#define ROM_VERSION 1
+#define ROM_HEADER_SIZE 16
+#define ROM_SECTION_SIZE 12
+
+/** Section types */
+typedef enum {
+  ROM_SECTION_CODE = 1,   // Mapped read-only at its page
+  ROM_SECTION_DATA = 2,   // Mapped read-only at its page
+  ROM_SECTION_TILES = 3,  // Mapped over the PPU tile pages
+  ROM_SECTION_PALETTE = 4 // BGP and OBP values
+} RomSectionType;
+
+/**
+ * @brief Result of opening or validating a ROM.
+ */
+typedef enum {
+  ROM_OK,
+  ROM_ERR_IO,       // The file could not be read or mapped
+  ROM_ERR_HEADER,   // Bad magic, version or section table
+  ROM_ERR_SECTION,  // A section lies outside the file or has a bad size
+  ROM_ERR_PLACEMENT // A section overlaps the device pages or another one
+} RomError;
+
+/**
+ * @brief A validated ROM image.
+ */
+typedef struct {
+  /** The whole file */
+  const uint8_t *data;
+  size_t size;
+  /** Non-zero when data is a mapping owned by this Rom */
+  int mapped;
+} Rom;
+
+/**
+ * @brief Map a ROM file and validate it.
+ *
+ * @param rom Receives the ROM; untouched on failure.
+ * @param path File to open.
+ * @return ROM_OK, or why the file was rejected.
+ */
+RomError rom_open(Rom *rom, const char *path);
+
+/**
+ * @brief Validate a ROM image that is already in memory.
+ *
+ * The Rom borrows @p data, which must stay valid and unchanged while
+ * the Rom is in use.
+ *
+ * @param rom Receives the ROM; untouched on failure.
+ * @param data Image bytes.
+ * @param size Image size.
+ * @return ROM_OK, or why the image was rejected.
+ */
+RomError rom_parse(Rom *rom, const uint8_t *data, size_t size);
+
+/**
+ * @brief Release a ROM.
+ *
+ * Machines it was loaded into must be reloaded or destroyed first.
+ *
+ * @param rom Pointer to the ROM.
+ */
+void rom_close(Rom *rom);
+
+/**
+ * @brief Load a ROM into a machine and reset it.
+ *
+ * Clears the machine (machine_clear()), maps the code, data and tile
+ * sections, sets the palettes and resets the CPU. The ROM must outlive
+ * the load.
+ *
+ * @param machine Pointer to the machine.
+ * @param rom A ROM from rom_open() or rom_parse().
+ */
+void rom_load(Machine *machine, const Rom *rom);
+
+#endif
@@ -0,0 +1,106 @@
+/*
+ * rvm-8/kernel/sched.c
+ *
+ * Event scheduler for rvm-8.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ *
+ * Notes:
+ * - There are only a handful of slots, so the heap is a small array of
+ *   slot numbers and every slot remembers where it sits, which makes
+ *   moving and cancelling a pending event O(log n) without a search.
+ * - A callback runs after its event left the heap, so it can schedule
+ *   the same slot again.
+ */
+
+#include "sched.h"
+#include <string.h>
+
+/**
+ * @brief Whether slot @p a is due before slot @p b.
+ */
+static int sched_before(const Scheduler *sched, uint8_t a, uint8_t b) {
+  return sched->when[a] != sched->when[b] ? sched->when[a] < sched->when[b]
+                                          : a < b;
+}
+
+static void sched_place(Scheduler *sched, unsigned i, uint8_t event) {
+  sched->heap[i] = event;
+  sched->position[event] = (uint8_t)i;
+}
+
+/**
+ * @brief Moves the slot at heap position @p i to where it belongs.
+ */
+static void sched_fix(Scheduler *sched, unsigned i) {
+  uint8_t event = sched->heap[i];
+
+  while (i > 0 && sched_before(sched, event, sched->heap[(i - 1) / 2])) {
+    sched_place(sched, i, sched->heap[(i - 1) / 2]);
+    i = (i - 1) / 2;
+  }
+  // count never exceeds SCHED_EVENT_COUNT; saying so spares the
+  // compiler's bounds checks
+  unsigned count =
+      sched->count < SCHED_EVENT_COUNT ? sched->count : SCHED_EVENT_COUNT;
+
+  for (;;) {
+    unsigned child = 2 * i + 1;
+
+    if (child >= count)
+      break;
+    if (child + 1 < count &&
+        sched_before(sched, sched->heap[child + 1], sched->heap[child]))
+      child++;
+    if (!sched_before(sched, sched->heap[child], event))
+      break;
+    sched_place(sched, i, sched->heap[child]);
+    i = child;
+  }
+  sched_place(sched, i, event);
+}
+
+void sched_init(Scheduler *sched) {
+  memset(sched, 0, sizeof(Scheduler));
+  sched_clear(sched);
+}
+
+void sched_set_handler(Scheduler *sched, SchedEvent event,
+                       SchedHandler handler, void *ctx) {
+  sched->handlers[event] = handler;
+  sched->contexts[event] = ctx;
+}
+
+void sched_add(Scheduler *sched, SchedEvent event, uint64_t when) {
+  sched->when[event] = when;
+  if (!sched_pending(sched, event))
+    sched_place(sched, sched->count++, (uint8_t)event);
+  sched_fix(sched, sched->position[event]);
+}
+
+void sched_cancel(Scheduler *sched, SchedEvent event) {
+  unsigned i = sched->position[event];
+
+  if (!sched_pending(sched, event))
+    return;
+  sched->position[event] = SCHED_EVENT_COUNT;
+  if (i != --sched->count) {
+    sched_place(sched, i, sched->heap[sched->count]);
+    sched_fix(sched, i);
+  }
+}
+
+void sched_clear(Scheduler *sched) {
+  sched->count = 0;
+  memset(sched->position, SCHED_EVENT_COUNT, sizeof(sched->position));
+}
+
+void sched_run_until(Scheduler *sched, uint64_t now) {
+  while (sched->count > 0 && sched->when[sched->heap[0]] <= now) {
+    uint8_t event = sched->heap[0];
+
+    sched_cancel(sched, (SchedEvent)event);
+    sched->handlers[event](sched->contexts[event], sched->when[event]);
+  }
+}
@@ -0,0 +1,144 @@
+/**
+ * rvm-8/kernel/sched.h
+ *
+ * Event scheduler for the rvm-8 emulator.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ *
+ * Peripherals do not tick along with the CPU. Each one schedules the
+ * next point at which it has something to do (the end of a scanline, a
+ * timer underflow, a batch of audio samples) as an absolute CPU cycle,
+ * and the machine runs the CPU freely up to the earliest of them, see
+ * machine_run_frame(). Devices that the CPU reads in between catch up
+ * from the cycle counter on demand.
+ *
+ * Every peripheral owns a fixed slot in SchedEvent, so each event is
+ * pending at most once and scheduling it again moves it. The pending
+ * events form a binary min-heap ordered by due cycle, then by slot, so
+ * events due on the same cycle always run in SchedEvent order.
+ */
+
+#ifndef RVM_SCHED_H
+#define RVM_SCHED_H
+
+#include <stdint.h>
+
+/**
+ * @brief Event slots, one per peripheral event.
+ */
+typedef enum {
+  SCHED_EVENT_LINE,        // End of a scanline (machine.c)
+  SCHED_EVENT_VBLANK,      // End of the last visible line (machine.c)
+  SCHED_EVENT_RIOT_TIMER,  // Timer underflow, interrupt enabled (riot.c)
+  SCHED_EVENT_TIA_SAMPLES, // Batch of audio samples, with a ring (tia.c)
+  SCHED_EVENT_PROFILE,     // PC sample, with a profiler (machine.c)
+  SCHED_EVENT_COUNT
+} SchedEvent;
+
+/** Due cycle of an idle scheduler, see sched_next() */
+#define SCHED_NEVER UINT64_MAX
+
+/**
+ * @brief Event callback.
+ *
+ * Called once the CPU has reached @p when. The callback may schedule
+ * any event again, itself included; computing the next due cycle from
+ * @p when rather than from the CPU keeps periodic events from drifting.
+ *
+ * @param ctx Context given to sched_set_handler().
+ * @param when Cycle the event was due at.
+ */
+typedef void (*SchedHandler)(void *ctx, uint64_t when);
+
+/**
+ * @brief Pending events of one machine.
+ */
+typedef struct {
+  /** Due cycle of each slot, valid while it is pending */
+  uint64_t when[SCHED_EVENT_COUNT];
+  SchedHandler handlers[SCHED_EVENT_COUNT];
+  void *contexts[SCHED_EVENT_COUNT];
+  /** Min-heap of pending slots */
+  uint8_t heap[SCHED_EVENT_COUNT];
+  /** Heap position of each slot, or SCHED_EVENT_COUNT when idle */
+  uint8_t position[SCHED_EVENT_COUNT];
+  /** Pending events */
+  uint8_t count;
+} Scheduler;
+
+/**
+ * @brief Initialize a scheduler with no handlers and nothing pending.
+ *
+ * @param sched Pointer to the scheduler.
+ */
+void sched_init(Scheduler *sched);
+
+/**
+ * @brief Install the callback of an event slot.
+ *
+ * @param sched Pointer to the scheduler.
+ * @param event Slot.
+ * @param handler Callback, run by sched_run_until().
+ * @param ctx Passed to the callback.
+ */
+void sched_set_handler(Scheduler *sched, SchedEvent event,
+                       SchedHandler handler, void *ctx);
+
+/**
+ * @brief Schedule an event, or move it if it is already pending.
+ *
+ * @param sched Pointer to the scheduler.
+ * @param event Slot; must have a handler.
+ * @param when Absolute CPU cycle it is due at.
+ */
+void sched_add(Scheduler *sched, SchedEvent event, uint64_t when);
+
+/**
+ * @brief Drop a pending event; does nothing if it is idle.
+ *
+ * @param sched Pointer to the scheduler.
+ * @param event Slot.
+ */
+void sched_cancel(Scheduler *sched, SchedEvent event);
+
+/**
+ * @brief Drop every pending event; handlers stay installed.
+ *
+ * @param sched Pointer to the scheduler.
+ */
+void sched_clear(Scheduler *sched);
+
+/**
+ * @brief Run the callbacks of every event due at or before a cycle.
+ *
+ * Events run in due order; those scheduled by a callback run too if
+ * they are due by @p now.
+ *
+ * @param sched Pointer to the scheduler.
+ * @param now Current CPU cycle.
+ */
+void sched_run_until(Scheduler *sched, uint64_t now);
+
+/**
+ * @brief Check whether an event is pending.
+ *
+ * @param sched Pointer to the scheduler.
+ * @param event Slot.
+ * @return Non-zero while it is pending.
+ */
+static inline int sched_pending(const Scheduler *sched, SchedEvent event) {
+  return sched->position[event] != SCHED_EVENT_COUNT;
+}
+
+/**
+ * @brief Get the cycle the earliest pending event is due at.
+ *
+ * @param sched Pointer to the scheduler.
+ * @return The due cycle, or SCHED_NEVER if nothing is pending.
+ */
+static inline uint64_t sched_next(const Scheduler *sched) {
+  return sched->count ? sched->when[sched->heap[0]] : SCHED_NEVER;
+}
+
+#endif
@@ -0,0 +1,94 @@
+/**
+ * rvm-8/kernel/stats.h
+ *
+ * Optional hot-path instrumentation for the rvm-8 emulator.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ *
+ * Built with RVM_STATS=1 (`make STATS=1`, or the `stats` feature of the
+ * Rust host), every bus carries a Stats block that counts, per opcode,
+ * how often it ran, the cycles it took and the page-crossing penalties
+ * it paid, and per region the accesses that went through the bus slow
+ * path (device registers and trapped pages). Without it the Stats field
+ * does not exist and the hooks below expand to nothing.
+ *
+ * Native code does not pass through the opcode handlers, so instrumented
+ * builds leave the recompiler out (see jit.h) and count everything the
+ * interpreter and block cache run.
+ */
+
+#ifndef RVM_STATS_H
+#define RVM_STATS_H
+
+#include <stdint.h>
+
+#ifndef RVM_STATS
+#define RVM_STATS 0
+#endif
+
+/**
+ * @brief Regions slow-path accesses are counted by.
+ */
+typedef enum {
+  STATS_REGION_VRAM,  // 0x2000-0x23FF, trapped for the PPU caches
+  STATS_REGION_PPU,   // 0x2400-0x24FF PPU registers
+  STATS_REGION_INPUT, // 0x2500-0x25FF input, timer and sound registers
+  STATS_REGION_OTHER, // Trapped code pages and unmapped pages
+  STATS_REGION_COUNT
+} StatsRegion;
+
+/**
+ * @brief Instrumentation counters of one CPU and its bus.
+ *
+ * Shared with the Rust host (emulator/src/ffi.rs); keep the layout in
+ * sync.
+ */
+typedef struct {
+  /** Times each opcode ran */
+  uint64_t executed[256];
+  /** Cycles spent in each opcode, penalties included */
+  uint64_t cycles[256];
+  /** Page crossings that cost each opcode an extra cycle */
+  uint64_t page_crossings[256];
+  /** Slow-path reads and writes per StatsRegion */
+  uint64_t reads[STATS_REGION_COUNT];
+  uint64_t writes[STATS_REGION_COUNT];
+} Stats;
+
+/**
+ * @brief Region of a page, for Stats.reads and Stats.writes.
+ */
+static inline StatsRegion stats_region(uint8_t page) {
+  if (page >= 0x20 && page < 0x24)
+    return STATS_REGION_VRAM;
+  if (page == 0x24)
+    return STATS_REGION_PPU;
+  if (page == 0x25)
+    return STATS_REGION_INPUT;
+  return STATS_REGION_OTHER;
+}
+
+#if RVM_STATS
+/*
+ * Records one executed instruction. @p spent is what the handler
+ * returned, @p base the opcode's base cycles: the difference is the
+ * page-crossing penalty, except for branches, which also pay one cycle
+ * for being taken and cross a page only when they pay two.
+ */
+#define RVM_STATS_INSN(stats, opc, mode, base, spent)                          \
+  do {                                                                         \
+    (stats)->executed[opc]++;                                                  \
+    (stats)->cycles[opc] += (spent);                                           \
+    (stats)->page_crossings[opc] += (mode) == MODE_RELATIVE                    \
+                                        ? (spent) - (base) == 2                \
+                                        : (spent) - (base);                    \
+  } while (0)
+#define RVM_STATS_ACCESS(stats, dir, addr)                                     \
+  ((stats)->dir[stats_region((uint8_t)((addr) >> 8))]++)
+#else
+#define RVM_STATS_INSN(stats, opc, mode, base, spent) ((void)0)
+#define RVM_STATS_ACCESS(stats, dir, addr) ((void)0)
+#endif
+
+#endif
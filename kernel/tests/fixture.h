@@ -0,0 +1,34 @@
+/**
+ * rvm-8/kernel/tests/fixture.h
+ *
+ * Shared setup for the rvm-8 kernel tests that run a whole Machine.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef RVM_TESTS_FIXTURE_H
+#define RVM_TESTS_FIXTURE_H
+
+#include <assert.h>
+#include <stddef.h>
+
+#include "../machine.h"
+
+/**
+ * @brief Create a machine with an image loaded, asserting that both
+ *        steps succeed.
+ *
+ * @param image Image bytes, see machine_load_image().
+ * @param size Size of @p image.
+ * @return The machine; destroy it with machine_destroy().
+ */
+static inline Machine *fixture_machine(const uint8_t *image, size_t size) {
+  Machine *machine = machine_create();
+
+  assert(machine != NULL);
+  assert(machine_load_image(machine, image, size) == 0);
+  return machine;
+}
+
+#endif
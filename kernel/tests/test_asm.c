@@ -0,0 +1,300 @@
+/*
+ * rvm-8/kernel/tests/test_asm.c
+ *
+ * Unit tests for the rvm-8 assembler.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../asm.h"
+#include "../isa.h"
+#include "../rom.h"
+
+#define MAIN_PATH "test_asm_main.asm"
+#define LIB_PATH "test_asm_lib.inc"
+
+static void write_file(const char *path, const char *text) {
+  FILE *f = fopen(path, "w");
+  assert(f != NULL);
+  assert(fputs(text, f) >= 0);
+  fclose(f);
+}
+
+/* Assembles a file and loads the result into a fresh machine. */
+static Machine *assemble_and_load(Asm *as, const char *path, uint8_t **image) {
+  size_t size;
+  Rom rom;
+
+  assert(asm_assemble(as, path) == 0);
+  assert(asm_error(as) == NULL);
+  size = asm_build_rom(as, NULL, 0);
+  *image = malloc(size);
+  assert(asm_build_rom(as, *image, size) == size);
+  assert(rom_parse(&rom, *image, size) == ROM_OK);
+
+  Machine *machine = machine_create();
+  assert(machine != NULL);
+  rom_load(machine, &rom);
+  return machine;
+}
+
+static const char *lib_source = "; Shared definitions\n"
+                                "SCORE = $10\n"
+                                ".macro store value, addr\n"
+                                "  LDA #value\n"
+                                "  STA addr\n"
+                                ".endm\n";
+
+void test_program_runs() {
+  printf("TEST: Assembled Programs Load And Run...\n");
+
+  write_file(LIB_PATH, lib_source);
+  write_file(MAIN_PATH, ".include \"" LIB_PATH "\"\n"
+                        ".include \"" LIB_PATH "\" ; only read once\n"
+                        ".org $8000\n"
+                        "start:\n"
+                        "  store $42, SCORE\n"
+                        "  LDX #0\n"
+                        "copy:\n"
+                        "  LDA msg,X\n"
+                        "  BEQ done\n"
+                        "  STA $0300,X\n"
+                        "  INX\n"
+                        "  BNE copy\n"
+                        "done:\n"
+                        "  STX count\n"
+                        "  JMP (vector)\n"
+                        "halt: JMP halt\n"
+                        ".data\n"
+                        ".org $9000\n"
+                        "msg: .db \"Hi\", '!', 0\n"
+                        "vector: .dw halt\n"
+                        "count = $11\n"
+                        ".org $2000\n"
+                        ".db %11111111, $FF\n"
+                        ".palette $1B, $39\n"
+                        ".reset start\n");
+
+  Asm *as = asm_create();
+  uint8_t *image;
+  Machine *machine = assemble_and_load(as, MAIN_PATH, &image);
+  int32_t value;
+
+  assert(asm_file_count(as) == 2);
+  assert(strcmp(asm_file(as, 1)->path, LIB_PATH) == 0);
+  assert(asm_symbol(as, "start", &value) == 0 && value == 0x8000);
+  assert(asm_symbol(as, "msg", &value) == 0 && value == 0x9000);
+  assert(asm_symbol(as, "SCORE", &value) == 0 && value == 0x10);
+  assert(asm_symbol(as, "value", &value) == -1);
+
+  // Zero page operands get the short form, forward references do not
+  assert(mem_read(&machine->cpu, 0x8002) == 0x85);
+  assert(mem_read(&machine->cpu, 0x8011) == 0x8E);
+
+  assert(machine->cpu.pc == 0x8000);
+  assert(machine->ppu.bgp == 0x1B && machine->ppu.obp == 0x39);
+  assert(machine_run_frame(machine) == STOP_BUDGET);
+  assert(machine->ppu.tiles[0][0] == 3);
+  assert(machine->memory[0x10] == 0x42);
+  assert(memcmp(&machine->memory[0x300], "Hi!", 3) == 0);
+  assert(machine->memory[0x11] == 3);
+  assert(asm_symbol(as, "halt", &value) == 0);
+  assert(machine->cpu.pc == value);
+
+  machine_destroy(machine);
+  asm_destroy(as);
+  free(image);
+  printf("PASS!\n");
+}
+
+void test_encodings_match_isa() {
+  printf("TEST: Every Instruction Encodes To Its Opcode...\n");
+
+  static const struct {
+    uint8_t opcode;
+    const char *name;
+    AddressingMode mode;
+  } isa[] = {
+#define ROW(opc, mn, mode, cycles) {opc, #mn, MODE_##mode},
+      RVM_ISA(ROW)
+#undef ROW
+  };
+  static const char *operands[] = {
+      [MODE_IMMEDIATE] = "#1",        [MODE_ZEROPAGE] = "$10",
+      [MODE_ABSOLUTE] = "$1234",      [MODE_ZEROPAGE_X] = "$10,X",
+      [MODE_ZEROPAGE_Y] = "$10,y",    [MODE_ABSOLUTE_X] = "$1234,X",
+      [MODE_ABSOLUTE_Y] = "$1234,Y",  [MODE_INDIRECT] = "($1234)",
+      [MODE_INDIRECT_X] = "($10,X)",  [MODE_INDIRECT_Y] = "($10),Y",
+      [MODE_IMPLIED] = "",            [MODE_ACCUMULATOR] = "A",
+      [MODE_RELATIVE] = "*",
+  };
+  size_t count = sizeof(isa) / sizeof(isa[0]);
+  static char source[16384];
+  size_t len = 0;
+
+  for (size_t i = 0; i < count; i++)
+    len += sprintf(source + len, "i%zu: %s %s\n", i, isa[i].name,
+                   operands[isa[i].mode]);
+  len += sprintf(source + len, ".reset i0\n");
+  assert(len < sizeof(source));
+  write_file(MAIN_PATH, source);
+
+  Asm *as = asm_create();
+  uint8_t *image;
+  Machine *machine = assemble_and_load(as, MAIN_PATH, &image);
+
+  for (size_t i = 0; i < count; i++) {
+    char label[16];
+    int32_t addr;
+
+    sprintf(label, "i%zu", i);
+    assert(asm_symbol(as, label, &addr) == 0);
+    uint8_t opcode = mem_read(&machine->cpu, (uint16_t)addr);
+    assert(opcode == isa[i].opcode);
+    assert(instruction_table[opcode].mode == isa[i].mode);
+    assert(strcmp(instruction_info[opcode].name, isa[i].name) == 0);
+  }
+
+  machine_destroy(machine);
+  asm_destroy(as);
+  free(image);
+  printf("PASS!\n");
+}
+
+void test_demo_rooms() {
+  printf("TEST: Demo Rooms Assemble...\n");
+
+  static const struct {
+    const char *path;
+    uint8_t code[4];
+    unsigned len;
+  } rooms[] = {
+      {"../rooms/demo/room0.asm", {0xA9, 0x0A, 0x69, 0x05}, 4},
+      {"../rooms/demo/room1.asm", {0xAD, 0xFF, 0xDD}, 3},
+  };
+
+  for (size_t i = 0; i < sizeof(rooms) / sizeof(rooms[0]); i++) {
+    Asm *as = asm_create();
+    uint8_t *image;
+    Machine *machine = assemble_and_load(as, rooms[i].path, &image);
+
+    for (unsigned n = 0; n < rooms[i].len; n++)
+      assert(mem_read(&machine->cpu, ASM_DEFAULT_ORG + n) == rooms[i].code[n]);
+
+    machine_destroy(machine);
+    asm_destroy(as);
+    free(image);
+  }
+  printf("PASS!\n");
+}
+
+/* Assembles a source that must fail and checks the start of the error. */
+static void expect_error(const char *source, const char *prefix) {
+  Asm *as = asm_create();
+
+  write_file(MAIN_PATH, source);
+  assert(asm_assemble(as, MAIN_PATH) == -1);
+  assert(strncmp(asm_error(as), prefix, strlen(prefix)) == 0);
+  asm_destroy(as);
+}
+
+void test_errors_name_the_line() {
+  printf("TEST: Errors Point At The Offending Line...\n");
+
+  expect_error("NOP\nNOP\nLDA missing\n",
+               MAIN_PATH ":3: undefined symbol missing");
+  expect_error("a: NOP\na: NOP\n", MAIN_PATH ":2: a is already defined");
+  expect_error("FOO #1\n", MAIN_PATH ":1: unknown instruction or macro FOO");
+  expect_error("INX #1\n", MAIN_PATH ":1: INX does not take this operand");
+  expect_error("LDA #$1FF\n", MAIN_PATH ":1: value 511 does not fit");
+  expect_error("BNE far\n.org $9000\nfar: NOP\n",
+               MAIN_PATH ":1: branch target is");
+  expect_error(".org $2400\n.db 1\n", MAIN_PATH ":2: $2400 is not ROM");
+  expect_error(".org $8000\nNOP\n.org $8000\nNOP\n",
+               MAIN_PATH ":4: $8000 is written twice");
+  expect_error(".macro m a\n NOP\n.endm\nm\n",
+               MAIN_PATH ":4: m takes 1 arguments, not 0");
+  expect_error(".macro r\n r\n.endm\nr\n",
+               MAIN_PATH ":2: macros nest too deeply");
+
+  // Errors inside an include name the include
+  write_file(LIB_PATH, "\n LDA #\n");
+  expect_error(".include \"" LIB_PATH "\"\n",
+               LIB_PATH ":2: expected an expression");
+  expect_error(".include \"no_such.inc\"\n",
+               MAIN_PATH ":1: cannot read no_such.inc");
+
+  Asm *as = asm_create();
+  assert(asm_assemble(as, "no_such.asm") == -1);
+  assert(strcmp(asm_error(as), "cannot read no_such.asm") == 0);
+  asm_destroy(as);
+  printf("PASS!\n");
+}
+
+/* Assembles a file on its own and returns its exports hash. */
+static uint64_t exports_of(const char *path, uint64_t *hash) {
+  Asm *as = asm_create();
+  uint64_t exports;
+
+  assert(asm_assemble(as, path) == 0);
+  exports = asm_file(as, 0)->exports;
+  *hash = asm_file(as, 0)->hash;
+  asm_destroy(as);
+  return exports;
+}
+
+void test_exports_hash() {
+  printf("TEST: Exports Change Only With Definitions And Output...\n");
+  uint64_t hash, base_hash, file_hash;
+
+  write_file(LIB_PATH, lib_source);
+  uint64_t base = exports_of(LIB_PATH, &base_hash);
+  assert(asm_hash_file(LIB_PATH, &file_hash) == 0 && file_hash == base_hash);
+
+  // Comments and spacing change the file but not its exports
+  write_file(LIB_PATH, "; Shared definitions, reformatted\n\n"
+                       "SCORE   =   $10   ; zero page\n"
+                       ".macro store value, addr\n"
+                       "    LDA #value\n"
+                       "    STA addr\n"
+                       ".endm\n");
+  assert(exports_of(LIB_PATH, &hash) == base && hash != base_hash);
+
+  // A new value, a changed macro body or new output all show
+  write_file(LIB_PATH, "SCORE = $11\n");
+  assert(exports_of(LIB_PATH, &hash) != base);
+  write_file(LIB_PATH, "SCORE = $10\n"
+                       ".macro store value, addr\n"
+                       "  LDA #value\n"
+                       "  STA addr,X\n"
+                       ".endm\n");
+  assert(exports_of(LIB_PATH, &hash) != base);
+  write_file(LIB_PATH, lib_source);
+  assert(exports_of(LIB_PATH, &hash) == base);
+
+  write_file(MAIN_PATH, ".org $8000\nNOP\n");
+  uint64_t code = exports_of(MAIN_PATH, &hash);
+  write_file(MAIN_PATH, ".org $8000\nINX\n");
+  assert(exports_of(MAIN_PATH, &hash) != code);
+
+  remove(MAIN_PATH);
+  remove(LIB_PATH);
+  printf("PASS!\n");
+}
+
+int main() {
+  test_program_runs();
+  test_encodings_match_isa();
+  test_demo_rooms();
+  test_errors_name_the_line();
+  test_exports_hash();
+
+  printf("\nALL TESTS WERE PASSED.\n");
+  return 0;
+}
@@ -0,0 +1,262 @@
+/*
+ * rvm-8/kernel/tests/test_batch.c
+ *
+ * Unit tests for the rvm-8 lockstep batch interpreter.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../batch.h"
+#include "../machine.h"
+
+#define LANES 40
+#define FRAMES 8
+#define CODE 0x8000
+
+/*
+ * Driven by the pads, so that the lanes split up at every branch and
+ * meet again at the jumps: loops as long as the buttons are, stores to
+ * addresses that cross pages in some lanes, pointers through the zero
+ * page, a jump through a pointer, and an operand rewritten with the
+ * buttons. Lanes reading 0xFF on pad 1 run into an illegal opcode.
+ */
+static const uint8_t prog[] = {
+    0xAD, 0x00, 0x25, // 8000 LDA $2500
+    0x85, 0x10,       // 8003 STA $10
+    0xAE, 0x01, 0x25, // 8005 LDX $2501
+    0x86, 0x11,       // 8008 STX $11
+    0xA0, 0x00,       // 800A LDY #$00
+    0x46, 0x10,       // 800C LSR $10
+    0x90, 0x05,       // 800E BCC $8015
+    0x6D, 0x11, 0x00, // 8010 ADC $0011
+    0x85, 0x12,       // 8013 STA $12
+    0xC8,             // 8015 INY
+    0xA5, 0x10,       // 8016 LDA $10
+    0xD0, 0xF2,       // 8018 BNE $800C
+    0xA5, 0x12,       // 801A LDA $12
+    0x9D, 0xF0, 0x30, // 801C STA $30F0,X
+    0xBD, 0xF0, 0x30, // 801F LDA $30F0,X
+    0x99, 0x00, 0x04, // 8022 STA $0400,Y
+    0xAD, 0x00, 0x25, // 8025 LDA $2500
+    0x85, 0x20,       // 8028 STA $20
+    0xA9, 0x31,       // 802A LDA #$31
+    0x85, 0x21,       // 802C STA $21
+    0xA5, 0x11,       // 802E LDA $11
+    0x91, 0x20,       // 8030 STA ($20),Y
+    0xB1, 0x20,       // 8032 LDA ($20),Y
+    0xA2, 0x00,       // 8034 LDX #$00
+    0xA1, 0x20,       // 8036 LDA ($20,X)
+    0x81, 0x20,       // 8038 STA ($20,X)
+    0xAD, 0x00, 0x25, // 803A LDA $2500
+    0x4A,             // 803D LSR A
+    0xA9, 0x50,       // 803E LDA #$50
+    0x90, 0x02,       // 8040 BCC $8044
+    0xA9, 0x60,       // 8042 LDA #$60
+    0x85, 0x22,       // 8044 STA $22
+    0xA9, 0x80,       // 8046 LDA #$80
+    0x85, 0x23,       // 8048 STA $23
+    0x6C, 0x22, 0x00, // 804A JMP ($0022)
+    [0x50] = 0xE8,    // 8050 INX
+    0xCA,             // 8051 DEX
+    0x4C, 0x70, 0x80, // 8052 JMP $8070
+    [0x60] = 0x88,    // 8060 DEY
+    0x50, 0x02,       // 8061 BVC $8065
+    0xEA,             // 8063 NOP
+    0xEA,             // 8064 NOP
+    0x4C, 0x70, 0x80, // 8065 JMP $8070
+    [0x70] = 0xA5,    // 8070 LDA $11
+    0x11,             //
+    0x8D, 0x78, 0x80, // 8072 STA $8078
+    0xEA,             // 8075 NOP
+    0xEA,             // 8076 NOP
+    0xA2, 0x00,       // 8077 LDX #$00, operand rewritten above
+    0x86, 0x13,       // 8079 STX $13
+    0xE8,             // 807B INX
+    0xD0, 0x01,       // 807C BNE $807F
+    0x00,             // 807E illegal
+    0xA6, 0x14,       // 807F LDX $14
+    0xE8,             // 8081 INX
+    0x86, 0x14,       // 8082 STX $14
+    0xAC, 0x00, 0x25, // 8084 LDY $2500
+    0xA5, 0x15,       // 8087 LDA $15
+    0x69, 0x01,       // 8089 ADC #$01
+    0x85, 0x15,       // 808B STA $15
+    0x70, 0x00,       // 808D BVS $808F
+    0x88,             // 808F DEY
+    0xD0, 0xF5,       // 8090 BNE $8087
+    0x56, 0x30,       // 8092 LSR $30,X
+    0x5E, 0x00, 0x31, // 8094 LSR $3100,X
+    0xB5, 0x30,       // 8097 LDA $30,X
+    0x96, 0x40,       // 8099 STX $40,Y
+    0x94, 0x50,       // 809B STY $50,X
+    0x4C, 0xFA, 0x80, // 809D JMP $80FA
+    [0xFA] = 0xA5,    // 80FA LDA $13
+    0x13,             //
+    0xF0, 0x03,       // 80FC BEQ $8101, into the next page
+    0x4C, 0x00, 0x80, // 80FE JMP $8000
+    0x4C, 0x00, 0x80, // 8101 JMP $8000
+};
+
+static uint8_t image[RVM_MEM_SIZE - CODE];
+
+static void setup_image() {
+  memcpy(image, prog, sizeof(prog));
+  image[0xFFFC - CODE] = (uint8_t)CODE;
+  image[0xFFFD - CODE] = CODE >> 8;
+}
+
+/* The buttons of a lane in a frame. */
+static uint16_t buttons(unsigned lane, int frame) {
+  uint16_t b = (uint16_t)rand();
+
+  if (lane % 7 == 0)
+    b &= 0x00FF; // Takes the branch into the next page
+  if (lane % 4 == 1)
+    b = (uint16_t)(lane * 0x0101); // Some lanes agree for a while
+  if (lane == 5 && frame == 3)
+    b |= 0xFF00; // Illegal opcode
+  return b;
+}
+
+/* Asserts that a lane is in the state its own Machine is in. */
+static void check_lane(const Batch *batch, unsigned lane,
+                       const Machine *machine, StopReason reason) {
+  const CPU *cpu = &machine->cpu;
+  BatchLane state;
+
+  batch_lane(batch, lane, &state);
+  assert(state.reason == reason);
+  assert(state.pc == cpu->pc && state.sp == cpu->sp);
+  assert(state.a == cpu->a && state.x == cpu->x && state.y == cpu->y);
+  assert(state.flags == cpu->flags);
+  assert(state.cycles == cpu->cycles);
+  for (unsigned addr = 0; addr < RVM_MEM_SIZE; addr++) {
+    if (BUS_PAGE(addr) != BUS_PPU_PAGE && BUS_PAGE(addr) != BUS_INPUT_PAGE)
+      assert(batch_read(batch, lane, addr) == machine->memory[addr]);
+  }
+}
+
+/* Runs the batch next to one Machine per lane, frame by frame. */
+static void run_against_machines(unsigned min_group, uint64_t *vector,
+                                 uint64_t *scalar) {
+  Machine *machines[LANES];
+  StopReason reasons[LANES];
+  Batch *batch = batch_create(image, sizeof(image), LANES);
+
+  assert(batch != NULL);
+  batch_set_min_group(batch, min_group);
+  for (unsigned lane = 0; lane < LANES; lane++) {
+    machines[lane] = machine_create();
+    assert(machines[lane] != NULL);
+    assert(machine_load_image(machines[lane], image, sizeof(image)) == 0);
+    machine_set_render_interval(machines[lane], 0);
+    reasons[lane] = STOP_BUDGET;
+  }
+
+  srand(27);
+  for (int frame = 0; frame < FRAMES; frame++) {
+    int running = 0;
+
+    for (unsigned lane = 0; lane < LANES; lane++) {
+      uint16_t b = buttons(lane, frame);
+
+      batch_set_buttons(batch, lane, b);
+      if (reasons[lane] == STOP_BUDGET) {
+        input_publish(&machines[lane]->input.local, b, frame);
+        reasons[lane] = machine_run_frame(machines[lane]);
+      }
+      running += reasons[lane] == STOP_BUDGET;
+    }
+    assert(batch_run(batch, (uint64_t)(frame + 1) * MACHINE_FRAME_CYCLES) ==
+           running);
+    for (unsigned lane = 0; lane < LANES; lane++)
+      check_lane(batch, lane, machines[lane], reasons[lane]);
+  }
+  assert(reasons[5] == STOP_ILLEGAL);
+
+  batch_steps(batch, vector, scalar);
+  for (unsigned lane = 0; lane < LANES; lane++)
+    machine_destroy(machines[lane]);
+  batch_destroy(batch);
+}
+
+void test_lanes_match_machines() {
+  printf("TEST: Every Lane Runs As Its Own Machine Would...\n");
+  uint64_t vector, scalar, total;
+
+  setup_image();
+  printf("  vector steps\n");
+  run_against_machines(1, &vector, &scalar);
+  // Builds without the vector path (batch.c) step every lane alone
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(RVM_NO_SIMD)
+  assert(vector > scalar);
+#else
+  assert(vector == 0);
+#endif
+  total = vector + scalar;
+
+  printf("  scalar steps\n");
+  run_against_machines(BATCH_LANES_MAX + 1, &vector, &scalar);
+  assert(vector == 0 && scalar == total);
+
+  printf("  default groups\n");
+  run_against_machines(LANES / 4, &vector, &scalar);
+  assert(vector + scalar == total);
+
+  printf("PASS!\n");
+}
+
+void test_copy_on_write() {
+  printf("TEST: Pages Are Shared Until Written...\n");
+  static const uint8_t rom[256] = {
+      0xAD, 0x00, 0x25, // FF00 LDA $2500
+      0x8D, 0x00, 0x02, // FF03 STA $0200
+      0x8D, 0x10, 0xFF, // FF06 STA $FF10
+      0xAE, 0x00, 0x24, // FF09 LDX $2400
+      0x4C, 0x0C, 0xFF, // FF0C JMP $FF0C
+      [0x80] = 0x42,    //
+      [0xFC] = 0x00,    // Reset vector -> $FF00
+      [0xFD] = 0xFF,
+  };
+  Batch *batch = batch_create(rom, sizeof(rom), 3);
+  BatchLane state;
+
+  assert(batch != NULL);
+  for (unsigned lane = 0; lane < 3; lane++)
+    batch_set_buttons(batch, lane, 0x10 + lane);
+  batch_lane(batch, 2, &state);
+  assert(state.pc == 0xFF00 && state.sp == 0xFD && state.flags == FLAG_I);
+  assert(batch_run(batch, 100) == 3);
+
+  for (unsigned lane = 0; lane < 3; lane++) {
+    batch_lane(batch, lane, &state);
+    assert(state.pc == 0xFF0C && state.x == 0);
+    assert(batch_read(batch, lane, 0x0200) == 0x10 + lane);
+    // Unwritten RAM and ROM read the image; ROM ignores the write
+    assert(batch_read(batch, lane, 0x0300) == 0);
+    assert(batch_read(batch, lane, 0xFF80) == 0x42);
+    assert(batch_read(batch, lane, 0xFF10) == 0);
+    assert(batch_read(batch, lane, INPUT_REG_PAD0) == 0x10 + lane);
+  }
+  batch_destroy(batch);
+
+  assert(batch_create(image, MACHINE_IMAGE_MAX + 1, 1) == NULL);
+  assert(batch_create(rom, sizeof(rom), 0) == NULL);
+  assert(batch_create(rom, sizeof(rom), BATCH_LANES_MAX + 1) == NULL);
+
+  printf("PASS!\n");
+}
+
+int main() {
+  test_lanes_match_machines();
+  test_copy_on_write();
+
+  printf("\nALL TESTS WERE PASSED.\n");
+  return 0;
+}
@@ -0,0 +1,281 @@
+/*
+ * rvm-8/kernel/tests/test_block.c
+ *
+ * Unit tests for the rvm-8 predecoded block cache.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../block.h"
+
+uint8_t memory[65536];
+uint8_t memory_ref[65536];
+CPU cpu;
+CPU cpu_ref;
+
+void setup_test() {
+  memset(memory, 0, 65536);
+  memory[0xFFFC] = 0x00;
+  memory[0xFFFD] = 0x80;
+}
+
+static void load(uint16_t addr, const uint8_t *code, size_t len) {
+  memcpy(&memory[addr], code, len);
+}
+
+/* Starts a reference CPU running the plain interpreter on a copy. */
+static void start_both() {
+  memcpy(memory_ref, memory, sizeof(memory));
+  cpu_init(&cpu_ref, memory_ref);
+  cpu_init(&cpu, memory);
+  assert(block_cache_attach(&cpu) == 0);
+}
+
+static void assert_same_state() {
+  assert(cpu.a == cpu_ref.a && cpu.x == cpu_ref.x && cpu.y == cpu_ref.y);
+  assert(cpu.pc == cpu_ref.pc);
+  assert(cpu.flags == cpu_ref.flags);
+  assert(cpu.cycles == cpu_ref.cycles);
+  assert(memcmp(memory, memory_ref, sizeof(memory)) == 0);
+}
+
+void test_matches_interpreter() {
+  printf("TEST: Block Cache Matches Interpreter...\n");
+  setup_test();
+
+  static const uint8_t prog[] = {
+      0xA2, 0x40,       // 8000 LDX #$40
+      0xBD, 0xF0, 0x10, // 8002 LDA $10F0,X (crosses a page for X >= $10)
+      0x69, 0x03,       // 8005 ADC #$03
+      0x9D, 0x00, 0x03, // 8007 STA $0300,X
+      0x4A,             // 800A LSR A
+      0xCA,             // 800B DEX
+      0xD0, 0xF4,       // 800C BNE $8002
+      0xC8,             // 800E INY
+      0x4C, 0x00, 0x80, // 800F JMP $8000
+  };
+  load(0x8000, prog, sizeof(prog));
+  for (int i = 0; i < 0x200; i++)
+    memory[0x1000 + i] = (uint8_t)(i * 7);
+
+  start_both();
+
+  // Odd budgets make both engines stop in the middle of blocks
+  for (int slice = 0; slice < 500; slice++) {
+    uint32_t ran, ran_ref;
+    assert(cpu_run(&cpu, 7 + slice % 5, &ran) == STOP_BUDGET);
+    assert(cpu_run(&cpu_ref, 7 + slice % 5, &ran_ref) == STOP_BUDGET);
+    assert(ran == ran_ref);
+    assert_same_state();
+  }
+  assert(cpu.y > 0);
+  assert(block_lookup(cpu.blocks, 0x8002) != NULL);
+
+  block_cache_detach(&cpu);
+  printf("PASS!\n");
+}
+
+void test_self_modifying_code() {
+  printf("TEST: Self-Modifying Code Invalidates Blocks...\n");
+  setup_test();
+
+  static const uint8_t prog[] = {
+      0xA9, 0x05,       // 0200 LDA #$05
+      0x8D, 0x06, 0x02, // 0202 STA $0206 (patches the LDX operand)
+      0xA2, 0x00,       // 0205 LDX #$00
+      0x4C, 0x00, 0x03, // 0207 JMP $0300
+  };
+  load(0x0200, prog, sizeof(prog));
+  memory[0x0300] = 0xFF; // Illegal: stops the run
+  memory[0xFFFC] = 0x00;
+  memory[0xFFFD] = 0x02;
+
+  start_both();
+
+  assert(cpu_run(&cpu, 1000, NULL) == STOP_ILLEGAL);
+  assert(cpu_run(&cpu_ref, 1000, NULL) == STOP_ILLEGAL);
+  assert(cpu.x == 0x05);
+  assert_same_state();
+
+  // The block at $0205 was decoded after the patch; patch it again from
+  // the host and run it once more.
+  assert(block_lookup(cpu.blocks, 0x0205) != NULL);
+  mem_write(&cpu, 0x0206, 0x09);
+  assert(block_lookup(cpu.blocks, 0x0205) == NULL);
+  cpu.pc = 0x0205;
+  assert(cpu_run(&cpu, 1000, NULL) == STOP_ILLEGAL);
+  assert(cpu.x == 0x09);
+
+  block_cache_detach(&cpu);
+  // No trap may be left behind once the cache is gone
+  assert(cpu.bus.write_map[0x02] == &memory[0x0200]);
+  printf("PASS!\n");
+}
+
+void test_rom_and_io_pages() {
+  printf("TEST: ROM Code Is Cached, I/O Code Is Stepped...\n");
+  setup_test();
+
+  memory[0xFF00] = 0xE8; // INX
+  memory[0xFF01] = 0x4C; // JMP $2400
+  memory[0xFF02] = 0x00;
+  memory[0xFF03] = 0x24;
+  memory[0xFFFC] = 0x00;
+  memory[0xFFFD] = 0xFF;
+
+  cpu_init(&cpu, memory);
+  bus_map_spec(&cpu.bus, memory);
+  cpu_reset(&cpu);
+  assert(block_cache_attach(&cpu) == 0);
+
+  // Unmapped I/O reads as 0x00, which is not a valid opcode
+  assert(cpu_run(&cpu, 1000, NULL) == STOP_ILLEGAL);
+  assert(cpu.pc == 0x2400);
+  assert(cpu.x == 1);
+  assert(block_lookup(cpu.blocks, 0xFF00) != NULL);
+  assert(cpu.bus.write_map[0xFF] == cpu.bus.rom_sink);
+
+  block_cache_detach(&cpu);
+  printf("PASS!\n");
+}
+
+void test_rom_remap() {
+  printf("TEST: Remapping a ROM Page Drops Its Blocks...\n");
+  setup_test();
+
+  static uint8_t bank0[256] = {
+      0xA9, 0x01,       // 8000 LDA #$01
+      0x4C, 0x00, 0x80, // 8002 JMP $8000
+  };
+  static uint8_t bank1[256] = {
+      0xA9, 0x02,       // 8000 LDA #$02
+      0x4C, 0x00, 0x80, // 8002 JMP $8000
+  };
+
+  start_both();
+  bus_map_rom(&cpu.bus, 0x80, 1, bank0);
+  bus_map_rom(&cpu_ref.bus, 0x80, 1, bank0);
+
+  assert(cpu_run(&cpu, 100, NULL) == STOP_BUDGET);
+  assert(cpu_run(&cpu_ref, 100, NULL) == STOP_BUDGET);
+  assert(cpu.a == 1);
+  assert(block_lookup(cpu.blocks, 0x8000) != NULL);
+
+  bus_map_rom(&cpu.bus, 0x80, 1, bank1);
+  bus_map_rom(&cpu_ref.bus, 0x80, 1, bank1);
+  assert(block_lookup(cpu.blocks, 0x8000) == NULL);
+
+  assert(cpu_run(&cpu, 100, NULL) == STOP_BUDGET);
+  assert(cpu_run(&cpu_ref, 100, NULL) == STOP_BUDGET);
+  assert(cpu.a == 2);
+  assert_same_state();
+
+  block_cache_detach(&cpu);
+  printf("PASS!\n");
+}
+
+/* A register that reads 0 until cycle `ready`, then 1. */
+typedef struct {
+  const uint64_t *clock;
+  uint64_t ready;
+  unsigned reads;
+} PollDevice;
+
+static uint8_t poll_read(void *ctx, uint16_t addr) {
+  PollDevice *dev = ctx;
+
+  (void)addr;
+  dev->reads++;
+  return *dev->clock >= dev->ready;
+}
+
+static uint64_t poll_steady(void *ctx, uint16_t addr) {
+  const PollDevice *dev = ctx;
+
+  (void)addr;
+  return *dev->clock < dev->ready ? dev->ready : UINT64_MAX;
+}
+
+/* Polls the device, then counts Y around a loop that never repeats. */
+static void run_idle_loop(int steady, unsigned *reads, unsigned *reads_ref) {
+  static const uint8_t prog[] = {
+      0xA2, 0x00,       // 8000 LDX #$00
+      0xAD, 0x00, 0x25, // 8002 LDA $2500
+      0xF0, 0xFB,       // 8005 BEQ $8002
+      0xE8,             // 8007 INX
+      0xC8,             // 8008 INY
+      0xD0, 0xFD,       // 8009 BNE $8008
+      0x4C, 0x07, 0x80, // 800B JMP $8007
+  };
+  PollDevice dev = {&cpu.cycles, 20000, 0};
+  PollDevice dev_ref = {&cpu_ref.cycles, 20000, 0};
+
+  setup_test();
+  load(0x8000, prog, sizeof(prog));
+  start_both();
+  bus_map_io(&cpu.bus, 0x25, 1, poll_read, NULL, &dev);
+  bus_map_io(&cpu_ref.bus, 0x25, 1, poll_read, NULL, &dev_ref);
+  if (steady)
+    bus_set_steady(&cpu.bus, 0x25, 1, poll_steady);
+
+  for (int slice = 0; cpu.cycles < 40000; slice++) {
+    uint32_t ran, ran_ref;
+    assert(cpu_run(&cpu, 1000 + slice % 13, &ran) == STOP_BUDGET);
+    assert(cpu_run(&cpu_ref, 1000 + slice % 13, &ran_ref) == STOP_BUDGET);
+    assert(ran == ran_ref);
+    assert_same_state();
+  }
+  assert(cpu.x > 0 && block_lookup(cpu.blocks, 0x8002)->idle);
+  assert(block_lookup(cpu.blocks, 0x8008)->idle);
+  *reads = dev.reads;
+  *reads_ref = dev_ref.reads;
+  block_cache_detach(&cpu);
+}
+
+void test_idle_loops() {
+  printf("TEST: Idle Loops Are Skipped Exactly...\n");
+  unsigned reads, reads_ref;
+
+  // Each run of the poll loop comes down to a few turns, except where
+  // every instruction is counted
+  run_idle_loop(1, &reads, &reads_ref);
+  assert(reads_ref > 2800);
+#if RVM_STATS
+  assert(reads == reads_ref);
+#else
+  assert(reads * 10 < reads_ref);
+#endif
+
+  // A register that is never steady is read on every turn
+  run_idle_loop(0, &reads, &reads_ref);
+  assert(reads == reads_ref);
+
+  // Loops that store are run in full
+  static const uint8_t store[] = {
+      0x8D, 0x00, 0x02, // 8000 STA $0200
+      0x4C, 0x00, 0x80, // 8003 JMP $8000
+  };
+  setup_test();
+  load(0x8000, store, sizeof(store));
+  start_both();
+  assert(cpu_run(&cpu, 100, NULL) == STOP_BUDGET);
+  assert(!block_lookup(cpu.blocks, 0x8000)->idle);
+  block_cache_detach(&cpu);
+  printf("PASS!\n");
+}
+
+int main() {
+  test_matches_interpreter();
+  test_self_modifying_code();
+  test_rom_and_io_pages();
+  test_rom_remap();
+  test_idle_loops();
+
+  printf("\nALL TESTS WERE PASSED.\n");
+  return 0;
+}
@@ -0,0 +1,140 @@
+/*
+ * rvm-8/kernel/tests/test_bus.c
+ *
+ * Unit tests for the rvm-8 memory bus.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../cpu.h"
+
+uint8_t memory[65536];
+CPU cpu;
+
+typedef struct {
+  uint8_t regs[BUS_PAGE_SIZE];
+  int reads;
+  int writes;
+} FakeDevice;
+
+static uint8_t fake_read(void *ctx, uint16_t addr) {
+  FakeDevice *dev = ctx;
+  dev->reads++;
+  return dev->regs[addr & 0xFF];
+}
+
+static void fake_write(void *ctx, uint16_t addr, uint8_t val) {
+  FakeDevice *dev = ctx;
+  dev->writes++;
+  dev->regs[addr & 0xFF] = val;
+}
+
+void setup_test() { memset(memory, 0, 65536); }
+
+void test_flat_ram() {
+  printf("TEST: Flat RAM Mapping...\n");
+  setup_test();
+
+  cpu_init(&cpu, memory);
+
+  mem_write(&cpu, 0x1234, 0xAB);
+  assert(memory[0x1234] == 0xAB);
+  assert(mem_read(&cpu, 0x1234) == 0xAB);
+
+  mem_write(&cpu, 0xFFFF, 0x42);
+  assert(memory[0xFFFF] == 0x42);
+
+  printf("PASS!\n");
+}
+
+void test_spec_map() {
+  printf("TEST: SPEC Memory Map (ROM, I/O, Unmapped)...\n");
+  setup_test();
+
+  FakeDevice ppu;
+  memset(&ppu, 0, sizeof(ppu));
+
+  memory[0xFFFC] = 0x00;
+  memory[0xFFFD] = 0x10;
+  memory[0x2400] = 0x99; // Hidden behind the PPU page
+
+  cpu_init(&cpu, memory);
+  bus_map_spec(&cpu.bus, memory);
+  bus_map_io(&cpu.bus, BUS_PPU_PAGE, 1, fake_read, fake_write, &ppu);
+  cpu_reset(&cpu);
+  assert(cpu.pc == 0x1000);
+
+  // ROM writes are dropped
+  mem_write(&cpu, 0xFFFC, 0x55);
+  assert(memory[0xFFFC] == 0x00);
+  assert(mem_read(&cpu, 0xFFFD) == 0x10);
+
+  // VRAM is plain memory
+  mem_write(&cpu, 0x2001, 0x77);
+  assert(memory[0x2001] == 0x77);
+
+  // PPU page reaches the device callbacks
+  mem_write(&cpu, 0x2403, 0x12);
+  assert(ppu.writes == 1 && ppu.regs[0x03] == 0x12);
+  assert(mem_read(&cpu, 0x2403) == 0x12);
+  assert(mem_read(&cpu, 0x2400) == 0x00);
+  assert(ppu.reads == 2);
+  assert(memory[0x2403] == 0x00);
+
+  // Input page has no device yet
+  mem_write(&cpu, 0x2500, 0xFF);
+  assert(mem_read(&cpu, 0x2500) == 0x00);
+
+  printf("PASS!\n");
+}
+
+void test_opcodes_through_bus() {
+  printf("TEST: Opcodes Use the Bus...\n");
+  setup_test();
+
+  FakeDevice io;
+  memset(&io, 0, sizeof(io));
+  io.regs[0x10] = 0x84;
+
+  memory[0xFFFC] = 0x00;
+  memory[0xFFFD] = 0x80;
+  memory[0x8000] = 0xAD; // LDA $2410
+  memory[0x8001] = 0x10;
+  memory[0x8002] = 0x24;
+  memory[0x8003] = 0x4E; // LSR $2410
+  memory[0x8004] = 0x10;
+  memory[0x8005] = 0x24;
+  memory[0x8006] = 0x4E; // LSR $FF00 (ROM)
+  memory[0x8007] = 0x00;
+  memory[0x8008] = 0xFF;
+  memory[0xFF00] = 0x02;
+
+  cpu_init(&cpu, memory);
+  bus_map_spec(&cpu.bus, memory);
+  bus_map_io(&cpu.bus, BUS_PPU_PAGE, 1, fake_read, fake_write, &io);
+
+  assert(cpu_run(&cpu, 10, NULL) == STOP_BUDGET);
+  assert(cpu.a == 0x84);
+  assert(io.regs[0x10] == 0x42);
+  assert(io.reads == 2 && io.writes == 1);
+
+  cpu_step(&cpu);
+  assert(memory[0xFF00] == 0x02);
+  assert((cpu.flags & FLAG_C) == 0);
+
+  printf("PASS!\n");
+}
+
+int main() {
+  test_flat_ram();
+  test_spec_map();
+  test_opcodes_through_bus();
+
+  printf("\nALL TESTS WERE PASSED.\n");
+  return 0;
+}
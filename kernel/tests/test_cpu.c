@@ -12,6 +12,7 @@
 #include <string.h>
 
 #include "../cpu.h"
+#include "../debug.h"
 
 uint8_t memory[65536];
 CPU cpu;
@@ -193,10 +194,178 @@ void test_lda_modes() {
   printf("PASS!\n");
 }
 
+void test_run_budget() {
+  printf("TEST: cpu_run Budget and Stop Reasons...\n");
+  setup_test();
+
+  memory[0xFFFC] = 0x00;
+  memory[0xFFFD] = 0x80;
+
+  // LDA #$01 / ADC #$01 repeated, then an illegal opcode (0xFF)
+  for (int i = 0; i < 8; i += 2) {
+    memory[0x8000 + i] = (i % 4) ? 0x69 : 0xA9;
+    memory[0x8001 + i] = 0x01;
+  }
+  memory[0x8008] = 0xFF;
+
+  cpu_init(&cpu, memory);
+
+  uint32_t ran = 0;
+  assert(cpu_run(&cpu, 3, &ran) == STOP_BUDGET);
+  assert(ran == 4); // Two 2-cycle instructions, the second overshoots
+  assert(cpu.pc == 0x8004);
+  assert(cpu.a == 2);
+
+  assert(cpu_run(&cpu, 1000, &ran) == STOP_ILLEGAL);
+  assert(ran == 4);
+  assert(cpu.pc == 0x8008);
+  assert(cpu_step(&cpu) == STOP_ILLEGAL);
+  assert(cpu.pc == 0x8008);
+
+  // Breakpoint on 0x8002: stops before it, and resuming skips it once
+  cpu_reset(&cpu);
+  assert(debug_attach(&cpu) == 0);
+  debug_set_breakpoint(&cpu, 0x8002, 1);
+
+  assert(cpu_run(&cpu, 1000, &ran) == STOP_BREAKPOINT);
+  assert(cpu.pc == 0x8002);
+  assert(ran == 2);
+  assert(cpu_run(&cpu, 2, NULL) == STOP_BUDGET);
+  assert(cpu.pc == 0x8004);
+  debug_detach(&cpu);
+
+  cpu.halted = 1;
+  assert(cpu_run(&cpu, 1000, &ran) == STOP_HALT);
+  assert(ran == 0);
+
+  printf("PASS!\n");
+}
+
+void test_ldy_lsr_cycles() {
+  printf("TEST: LDY, LSR and Page-Cross Cycles...\n");
+  setup_test();
+
+  memory[0xFFFC] = 0x00;
+  memory[0xFFFD] = 0x80;
+
+  memory[0x8000] = 0xA0; // LDY #$80
+  memory[0x8001] = 0x80;
+  memory[0x8002] = 0xA2; // LDX #$FF
+  memory[0x8003] = 0xFF;
+  memory[0x8004] = 0xBD; // LDA $10FF,X (crosses into $11xx)
+  memory[0x8005] = 0xFF;
+  memory[0x8006] = 0x10;
+  memory[0x8007] = 0x46; // LSR $20
+  memory[0x8008] = 0x20;
+  memory[0x8009] = 0x4A; // LSR A
+  memory[0x0020] = 0x03;
+  memory[0x11FE] = 0x02;
+
+  cpu_init(&cpu, memory);
+
+  cpu_step(&cpu);
+  assert(cpu.y == 0x80);
+  assert(cpu.x == 0x00);
+  assert(cpu.flags & FLAG_N);
+
+  cpu_step(&cpu);
+  uint64_t before = cpu.cycles;
+  cpu_step(&cpu);
+  assert(cpu.a == 0x02);
+  assert(cpu.cycles - before == 5);
+
+  cpu_step(&cpu);
+  assert(memory[0x0020] == 0x01);
+  assert(cpu.flags & FLAG_C);
+  assert(cpu.pc == 0x8009);
+
+  cpu_step(&cpu);
+  assert(cpu.a == 0x01);
+  assert((cpu.flags & FLAG_C) == 0);
+  assert(cpu.cycles == 2 + 2 + 5 + 5 + 2);
+
+  printf("PASS!\n");
+}
+
+void test_host_flags() {
+  printf("TEST: Flags Written By The Host Are Honored...\n");
+  setup_test();
+
+  memory[0xFFFC] = 0x00;
+  memory[0xFFFD] = 0x80;
+  memory[0x8000] = 0xEA; // NOP
+  memory[0x8001] = 0x70; // BVS +2
+  memory[0x8002] = 0x02;
+  memory[0x8005] = 0x69; // ADC #$00
+  memory[0x8006] = 0x00;
+
+  cpu_init(&cpu, memory);
+
+  // Flags that no instruction touched come back unchanged
+  cpu.flags = FLAG_N | FLAG_V | FLAG_Z | FLAG_C | FLAG_I | FLAG_D;
+  cpu_step(&cpu);
+  assert(cpu.flags == (FLAG_N | FLAG_V | FLAG_Z | FLAG_C | FLAG_I | FLAG_D));
+
+  // Branches and the adder read them too
+  assert(cpu_run(&cpu, 2, NULL) == STOP_BUDGET);
+  assert(cpu.pc == 0x8005);
+  cpu_step(&cpu);
+  assert(cpu.a == 0x01);
+  assert(cpu.flags == (FLAG_I | FLAG_D));
+
+  printf("PASS!\n");
+}
+
+void test_instruction_info() {
+  printf("TEST: Instruction Info Matches What Runs...\n");
+  uint32_t seed = 7;
+
+  for (int opcode = 0; opcode < 256; opcode++) {
+    const Instruction *instr = &instruction_table[opcode];
+    const InstructionInfo *info = &instruction_info[opcode];
+
+    assert((instr->handler == NULL) == (info->name == NULL));
+    if (instr->handler == NULL) {
+      assert(info->size == 0 && info->flags == 0);
+      continue;
+    }
+    assert(info->size == instruction_size(instr->mode));
+
+    // From many random states, only the listed flags ever change
+    for (int round = 0; round < 64; round++) {
+      setup_test();
+      memory[0xFFFC] = 0x00;
+      memory[0xFFFD] = 0x80;
+      cpu_init(&cpu, memory);
+      seed = seed * 1103515245 + 12345;
+      memory[0x8000] = (uint8_t)opcode;
+      memory[0x8001] = (uint8_t)(seed >> 8);
+      memory[0x8002] = (uint8_t)(seed >> 16) & 0x7F;
+      memory[(uint8_t)(seed >> 8)] = (uint8_t)(seed >> 24);
+      cpu.a = (uint8_t)(seed >> 4);
+      cpu.x = (uint8_t)(seed >> 12);
+      cpu.y = (uint8_t)(seed >> 20);
+      cpu.flags = (uint8_t)(seed >> 24) & ~FLAG_B;
+      uint8_t before = cpu.flags;
+
+      assert(cpu_step(&cpu) == STOP_BUDGET);
+      assert(((before ^ cpu.flags) & ~info->flags) == 0);
+      if (instr->flow == FLOW_NONE)
+        assert(cpu.pc == 0x8000 + info->size);
+    }
+  }
+
+  printf("PASS!\n");
+}
+
 int main() {
   test_simple_addition();
   test_overflow_carry();
   test_lda_modes();
+  test_run_budget();
+  test_ldy_lsr_cycles();
+  test_host_flags();
+  test_instruction_info();
 
   printf("\nALL TESTS WERE PASSED.\n");
   return 0;
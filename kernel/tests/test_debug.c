@@ -0,0 +1,178 @@
+/*
+ * rvm-8/kernel/tests/test_debug.c
+ *
+ * Unit tests for the rvm-8 breakpoints and watchpoints.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../block.h"
+#include "../debug.h"
+
+/* Execution engines cpu_run() can debug on */
+enum { ENGINE_STEP, ENGINE_BLOCKS, ENGINE_JIT, ENGINE_COUNT };
+
+static const char *const engine_name[ENGINE_COUNT] = {"step", "blocks", "jit"};
+
+uint8_t memory[65536];
+CPU cpu;
+
+/* One 15-cycle loop: INX, then X stored to $20 and through A to $0480. */
+static const uint8_t prog[] = {
+    0xE8,             // 8000 INX
+    0x86, 0x20,       // 8001 STX $20
+    0xA5, 0x20,       // 8003 LDA $20
+    0x8D, 0x80, 0x04, // 8005 STA $0480
+    0x4C, 0x00, 0x80, // 8008 JMP $8000
+};
+
+#define LOOP_CYCLES 15
+
+/* Starts the loop on an engine, warmed up so that its blocks are hot. */
+static void start(int engine) {
+  memset(memory, 0, sizeof(memory));
+  memcpy(&memory[0x8000], prog, sizeof(prog));
+  memory[0xFFFC] = 0x00;
+  memory[0xFFFD] = 0x80;
+  cpu_init(&cpu, memory);
+  if (engine != ENGINE_STEP) {
+    assert(block_cache_attach(&cpu) == 0);
+    block_cache_set_jit(&cpu, engine == ENGINE_JIT);
+  }
+  assert(cpu_run(&cpu, 100 * LOOP_CYCLES, NULL) == STOP_BUDGET);
+  assert(cpu.pc == 0x8000);
+  assert(debug_attach(&cpu) == 0);
+}
+
+static void stop(void) {
+  debug_detach(&cpu);
+  block_cache_detach(&cpu);
+}
+
+void test_breakpoints() {
+  printf("TEST: Breakpoints Stop Every Engine Before The Instruction...\n");
+
+  for (int engine = 0; engine < ENGINE_COUNT; engine++) {
+    uint32_t ran;
+
+    printf("  %s\n", engine_name[engine]);
+    start(engine);
+    // In the middle of a block that already ran many times
+    debug_set_breakpoint(&cpu, 0x8003, 1);
+    assert(cpu_run(&cpu, 1000, &ran) == STOP_BREAKPOINT);
+    assert(cpu.pc == 0x8003 && ran == 3 + 2);
+    assert(cpu.x == 101 && memory[0x20] == 101);
+
+    // Resuming runs the instruction, then stops a loop later
+    assert(cpu_run(&cpu, 1000, &ran) == STOP_BREAKPOINT);
+    assert(cpu.pc == 0x8003 && ran == LOOP_CYCLES);
+    assert(cpu.x == 102 && cpu.a == 101);
+
+    // Moving the PC off the breakpoint forgets the resume
+    cpu.pc = 0x8000;
+    assert(cpu_run(&cpu, 1000, &ran) == STOP_BREAKPOINT);
+    assert(cpu.pc == 0x8003 && ran == 2 + 3);
+
+    debug_set_breakpoint(&cpu, 0x8003, 0);
+    assert(cpu_run(&cpu, 10 * LOOP_CYCLES, &ran) == STOP_BUDGET);
+    assert(ran == 10 * LOOP_CYCLES);
+    stop();
+  }
+
+  printf("PASS!\n");
+}
+
+void test_breakpoint_at_run_start() {
+  printf("TEST: A Run Starting On A Breakpoint Stops At Once...\n");
+
+  for (int engine = 0; engine < ENGINE_COUNT; engine++) {
+    uint32_t ran;
+
+    printf("  %s\n", engine_name[engine]);
+    start(engine);
+    debug_set_breakpoint(&cpu, 0x8005, 1);
+    // A budget that ends right on it, like a scheduler slice
+    assert(cpu_run(&cpu, 2 + 3 + 3, &ran) == STOP_BUDGET);
+    assert(cpu.pc == 0x8005);
+    assert(cpu_run(&cpu, 1000, &ran) == STOP_BREAKPOINT);
+    assert(cpu.pc == 0x8005 && ran == 0);
+    assert(cpu_run(&cpu, 1000, &ran) == STOP_BREAKPOINT);
+    assert(cpu.pc == 0x8005 && ran == LOOP_CYCLES);
+    stop();
+  }
+
+  printf("PASS!\n");
+}
+
+void test_watchpoints() {
+  printf("TEST: Watchpoints Stop After The Write...\n");
+
+  for (int engine = 0; engine < ENGINE_COUNT; engine++) {
+    uint32_t ran;
+
+    printf("  %s\n", engine_name[engine]);
+    start(engine);
+    assert(debug_set_watchpoint(&cpu, 0x0480, 1) == 0);
+    assert(cpu.bus.write_map[0x04] == NULL);
+    assert(cpu_run(&cpu, 1000, &ran) == STOP_WATCHPOINT);
+    assert(cpu.pc == 0x8008 && ran == 2 + 3 + 3 + 4);
+    assert(cpu.debug->hit == 0x0480 && memory[0x0480] == 101);
+
+    assert(cpu_run(&cpu, 1000, &ran) == STOP_WATCHPOINT);
+    assert(cpu.pc == 0x8008 && ran == LOOP_CYCLES);
+    assert(memory[0x0480] == 102);
+
+    // Other addresses on the page, and the host's own writes, never hit
+    assert(debug_set_watchpoint(&cpu, 0x0480, 0) == 0);
+    assert(debug_set_watchpoint(&cpu, 0x0481, 1) == 0);
+    mem_write(&cpu, 0x0481, 0x55);
+    assert(cpu_run(&cpu, 10 * LOOP_CYCLES, &ran) == STOP_BUDGET);
+    assert(memory[0x0481] == 0x55);
+
+    // A remapped page gets its trap back
+    assert(debug_set_watchpoint(&cpu, 0x0481, 0) == 0);
+    assert(debug_set_watchpoint(&cpu, 0x0480, 1) == 0);
+    bus_map_ram(&cpu.bus, 0x04, 1, &memory[0x0400]);
+    assert(cpu.bus.write_map[0x04] != NULL);
+    assert(cpu_run(&cpu, 1000, &ran) == STOP_WATCHPOINT);
+    assert(cpu.pc == 0x8008);
+
+    // cpu_step() reports the hit of the instruction it ran
+    cpu.pc = 0x8005;
+    assert(cpu_step(&cpu) == STOP_WATCHPOINT);
+    assert(cpu_step(&cpu) == STOP_BUDGET);
+    assert(cpu.pc == 0x8000);
+    stop();
+    assert(cpu.bus.write_map[0x04] != NULL);
+  }
+
+  printf("PASS!\n");
+}
+
+void test_watch_needs_ram() {
+  printf("TEST: Only RAM Can Be Watched...\n");
+  start(ENGINE_BLOCKS);
+
+  bus_map_rom(&cpu.bus, BUS_ROM_PAGE, 1, &memory[0xFF00]);
+  assert(debug_set_watchpoint(&cpu, 0xFF10, 1) == -1);
+  assert(debug_set_watchpoint(&cpu, 0xFF10, 0) == 0);
+  assert(cpu.debug->watched[BUS_ROM_PAGE] == 0);
+  stop();
+
+  printf("PASS!\n");
+}
+
+int main() {
+  test_breakpoints();
+  test_breakpoint_at_run_start();
+  test_watchpoints();
+  test_watch_needs_ram();
+
+  printf("\nALL TESTS WERE PASSED.\n");
+  return 0;
+}
@@ -0,0 +1,176 @@
+/*
+ * rvm-8/kernel/tests/test_input.c
+ *
+ * Unit tests for the rvm-8 input latch.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../rewind.h"
+#include "fixture.h"
+
+#define FRAMES 40
+
+/* Logs both pads into $0300 and $0400 and sums pad 0 into $10. */
+static const uint8_t image[256] = {
+    0xAD, 0x00, 0x25, // FF00 LDA PAD0
+    0x9D, 0x00, 0x03, // FF03 STA $0300,X
+    0xAD, 0x01, 0x25, // FF06 LDA PAD1
+    0x9D, 0x00, 0x04, // FF09 STA $0400,X
+    0xA5, 0x10,       // FF0C LDA $10
+    0x6D, 0x00, 0x25, // FF0E ADC PAD0
+    0x85, 0x10,       // FF11 STA $10
+    0xE8,             // FF13 INX
+    0x4C, 0x00, 0xFF, // FF14 JMP $FF00
+    [0xFC] = 0x00,    // Reset vector -> $FF00
+    [0xFD] = 0xFF,
+};
+
+void test_latched_at_frame_start() {
+  printf("TEST: Registers Read The State Latched At Frame Start...\n");
+  Machine *machine = fixture_machine(image, sizeof(image));
+  Bus *bus = &machine->cpu.bus;
+
+  input_publish(&machine->input.local, 0x8001, 1234);
+  assert(bus_read(bus, INPUT_REG_PAD0) == 0);
+  assert(machine_run_frame(machine) == STOP_BUDGET);
+  assert(machine_input(machine) == INPUT_WORD(0x8001, 1234));
+  assert(INPUT_WORD_STAMP(machine_input(machine)) == 1234);
+  for (int i = 0; i < 256; i++)
+    assert(machine->memory[0x300 + i] == 0x01 &&
+           machine->memory[0x400 + i] == 0x80);
+
+  // Published mid-frame, seen from the next frame on
+  input_publish(&machine->input.local, INPUT_BUTTON_START, 1235);
+  assert(bus_read(bus, INPUT_REG_PAD0) == 0x01);
+  assert(bus_read(bus, INPUT_REG_PAD1) == 0x80);
+  assert(bus_read(bus, INPUT_REG_PAD0 + 0x0F) == 0);
+  assert(machine_run_frame(machine) == STOP_BUDGET);
+  assert(bus_read(bus, INPUT_REG_PAD0) == INPUT_BUTTON_START);
+  assert(bus_read(bus, INPUT_REG_PAD1) == 0);
+
+  // Writes are ignored, and clearing drops the latch but keeps the port
+  bus_write(bus, INPUT_REG_PAD0, 0xFF);
+  assert(bus_read(bus, INPUT_REG_PAD0) == INPUT_BUTTON_START);
+  machine_clear(machine);
+  assert(bus_read(bus, INPUT_REG_PAD0) == 0);
+  input_latch(&machine->input);
+  assert(bus_read(bus, INPUT_REG_PAD0) == INPUT_BUTTON_START);
+
+  machine_destroy(machine);
+  printf("PASS!\n");
+}
+
+void test_host_port() {
+  printf("TEST: A Host Port Replaces The Local One...\n");
+  Machine *machine = fixture_machine(image, sizeof(image));
+  InputPort port;
+
+  atomic_init(&port.word, 0);
+  input_publish(&port, INPUT_BUTTON_A, 1);
+  input_publish(&machine->input.local, INPUT_BUTTON_B, 2);
+  machine_set_input(machine, &port);
+  assert(machine_run_frame(machine) == STOP_BUDGET);
+  assert(machine_input(machine) == INPUT_WORD(INPUT_BUTTON_A, 1));
+
+  machine_set_input(machine, NULL);
+  assert(machine_run_frame(machine) == STOP_BUDGET);
+  assert(machine_input(machine) == INPUT_WORD(INPUT_BUTTON_B, 2));
+
+  // Stamps keep their low 48 bits
+  input_publish(&port, 0, UINT64_MAX);
+  assert(INPUT_WORD_STAMP(atomic_load(&port.word)) ==
+         (1ull << INPUT_STAMP_BITS) - 1);
+  machine_destroy(machine);
+  printf("PASS!\n");
+}
+
+typedef struct {
+  InputPort port;
+  atomic_int stop;
+} Publisher;
+
+/* Publishes a new state as fast as it can, stamped with its number. */
+static void *publisher_main(void *arg) {
+  Publisher *publisher = arg;
+
+  for (uint32_t n = 1; !atomic_load(&publisher->stop); n++)
+    input_publish(&publisher->port, (uint16_t)(n * 0x0101), n);
+  return NULL;
+}
+
+void test_concurrent_publish_replays() {
+  printf("TEST: Input Published From Another Thread Replays Exactly...\n");
+  Publisher publisher;
+  pthread_t thread;
+  uint64_t words[FRAMES];
+
+  atomic_init(&publisher.port.word, 0);
+  atomic_init(&publisher.stop, 0);
+  Machine *machine = fixture_machine(image, sizeof(image));
+  machine_set_input(machine, &publisher.port);
+  assert(pthread_create(&thread, NULL, publisher_main, &publisher) == 0);
+
+  for (int frame = 0; frame < FRAMES; frame++) {
+    assert(machine_run_frame(machine) == STOP_BUDGET);
+    words[frame] = machine_input(machine);
+    // Buttons and stamp come from the same publish, and hold all frame
+    uint16_t buttons = INPUT_WORD_BUTTONS(words[frame]);
+    assert(buttons == (uint16_t)(INPUT_WORD_STAMP(words[frame]) * 0x0101));
+    for (int i = 0; i < 256; i++)
+      assert(machine->memory[0x300 + i] == (uint8_t)buttons &&
+             machine->memory[0x400 + i] == (uint8_t)(buttons >> 8));
+  }
+  atomic_store(&publisher.stop, 1);
+  assert(pthread_join(thread, NULL) == 0);
+  uint64_t expected = machine_hash(machine);
+  machine_destroy(machine);
+
+  // Publishing the latched words again before each frame replays the run
+  machine = fixture_machine(image, sizeof(image));
+  for (int frame = 0; frame < FRAMES; frame++) {
+    input_publish(&machine->input.local, INPUT_WORD_BUTTONS(words[frame]),
+                  INPUT_WORD_STAMP(words[frame]));
+    assert(machine_run_frame(machine) == STOP_BUDGET);
+    assert(machine_input(machine) == words[frame]);
+  }
+  assert(machine_hash(machine) == expected);
+  machine_destroy(machine);
+  printf("PASS!\n");
+}
+
+void test_rewind_restores_latch() {
+  printf("TEST: Save States Restore The Latch...\n");
+  Machine *machine = fixture_machine(image, sizeof(image));
+  Rewind *rewind = rewind_create(machine, 4, 0);
+
+  assert(rewind != NULL);
+  input_publish(&machine->input.local, INPUT_BUTTON_LEFT, 7);
+  assert(machine_run_frame(machine) == STOP_BUDGET);
+  rewind_snapshot(rewind);
+  input_publish(&machine->input.local, INPUT_BUTTON_RIGHT, 8);
+  assert(machine_run_frame(machine) == STOP_BUDGET);
+  assert(rewind_restore(rewind, 0) == 0);
+  assert(machine_input(machine) == INPUT_WORD(INPUT_BUTTON_LEFT, 7));
+  assert(bus_read(&machine->cpu.bus, INPUT_REG_PAD0) == INPUT_BUTTON_LEFT);
+
+  rewind_destroy(rewind);
+  machine_destroy(machine);
+  printf("PASS!\n");
+}
+
+int main() {
+  test_latched_at_frame_start();
+  test_host_port();
+  test_concurrent_publish_replays();
+  test_rewind_restores_latch();
+
+  printf("\nALL TESTS WERE PASSED.\n");
+  return 0;
+}
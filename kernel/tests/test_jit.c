@@ -0,0 +1,263 @@
+/*
+ * rvm-8/kernel/tests/test_jit.c
+ *
+ * Unit tests for the rvm-8 block recompiler.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../jit.h"
+
+uint8_t memory[65536];
+uint8_t memory_ref[65536];
+CPU cpu;
+CPU cpu_ref;
+
+/* Logs what a device sees on each access. */
+typedef struct {
+  uint64_t cycles[64];
+  uint16_t pc[64];
+  uint8_t a[64];
+  int count;
+} DeviceLog;
+
+DeviceLog log_jit;
+DeviceLog log_ref;
+
+static void device_log(DeviceLog *log, CPU *c) {
+  assert(log->count < 64);
+  log->cycles[log->count] = c->cycles;
+  log->pc[log->count] = c->pc;
+  log->a[log->count] = c->a;
+  log->count++;
+}
+
+static uint8_t device_read(void *ctx, uint16_t addr) {
+  CPU *c = ctx;
+  device_log(c == &cpu ? &log_jit : &log_ref, c);
+  return (uint8_t)(addr + c->cycles);
+}
+
+static void device_write(void *ctx, uint16_t addr, uint8_t val) {
+  CPU *c = ctx;
+  (void)addr;
+  (void)val;
+  device_log(c == &cpu ? &log_jit : &log_ref, c);
+}
+
+void setup_test() {
+  memset(memory, 0, 65536);
+  memset(&log_jit, 0, sizeof(log_jit));
+  memset(&log_ref, 0, sizeof(log_ref));
+  memory[0xFFFC] = 0x00;
+  memory[0xFFFD] = 0x80;
+}
+
+static void load(uint16_t addr, const uint8_t *code, size_t len) {
+  memcpy(&memory[addr], code, len);
+}
+
+/* Starts a reference CPU running the plain interpreter on a copy. */
+static int start_both() {
+  memcpy(memory_ref, memory, sizeof(memory));
+  cpu_init(&cpu_ref, memory_ref);
+  cpu_init(&cpu, memory);
+  assert(block_cache_attach(&cpu) == 0);
+  return block_cache_set_jit(&cpu, 1) == 0;
+}
+
+static void assert_same_state() {
+  assert(cpu.a == cpu_ref.a && cpu.x == cpu_ref.x && cpu.y == cpu_ref.y);
+  assert(cpu.pc == cpu_ref.pc);
+  assert(cpu.flags == cpu_ref.flags);
+  assert(cpu.cycles == cpu_ref.cycles);
+  assert(memcmp(memory, memory_ref, sizeof(memory)) == 0);
+}
+
+static void run_slice(uint32_t budget) {
+  uint32_t ran, ran_ref;
+  assert(cpu_run(&cpu, budget, &ran) == STOP_BUDGET);
+  assert(cpu_run(&cpu_ref, budget, &ran_ref) == STOP_BUDGET);
+  assert(ran == ran_ref);
+  assert_same_state();
+}
+
+/* Budgets from 5 to 65 cycles stop runs inside and between blocks. */
+static void run_both(int slices) {
+  for (int slice = 0; slice < slices; slice++)
+    run_slice(5 + slice % 61);
+}
+
+void test_native_matches_interpreter() {
+  printf("TEST: Native Blocks Match Interpreter...\n");
+  setup_test();
+
+  static const uint8_t prog[] = {
+      0xA2, 0x40,       // 8000 LDX #$40
+      0xBD, 0xF0, 0x10, // 8002 LDA $10F0,X (crosses a page for X >= $10)
+      0x69, 0x93,       // 8005 ADC #$93
+      0x9D, 0x00, 0x03, // 8007 STA $0300,X
+      0xB9, 0x80, 0x10, // 800A LDA $1080,Y
+      0x65, 0x20,       // 800D ADC $20
+      0x6D, 0x00, 0x11, // 800F ADC $1100
+      0x85, 0x21,       // 8012 STA $21
+      0x95, 0x30,       // 8014 STA $30,X
+      0x96, 0x30,       // 8016 STX $30,Y
+      0x94, 0x40,       // 8018 STY $40,X
+      0xB4, 0x40,       // 801A LDY $40,X
+      0xB6, 0x30,       // 801C LDX $30,Y
+      0xA6, 0x30,       // 801E LDX $30
+      0xAE, 0x40, 0x03, // 8020 LDX $0340
+      0xBE, 0x00, 0x10, // 8023 LDX $1000,Y
+      0xA1, 0x50,       // 8026 LDA ($50,X)
+      0xB1, 0x52,       // 8028 LDA ($52),Y
+      0x91, 0x52,       // 802A STA ($52),Y
+      0x46, 0x21,       // 802C LSR $21
+      0x4A,             // 802E LSR A
+      0xEA,             // 802F NOP
+      0x88,             // 8030 DEY
+      0x10, 0x02,       // 8031 BPL $8035
+      0xA0, 0x7F,       // 8033 LDY #$7F
+      0xE8,             // 8035 INX
+      0x70, 0x00,       // 8036 BVS $8038
+      0x50, 0x00,       // 8038 BVC $803A
+      0x90, 0x00,       // 803A BCC $803C
+      0xB0, 0x00,       // 803C BCS $803E
+      0x30, 0x00,       // 803E BMI $8040
+      0xF0, 0x00,       // 8040 BEQ $8042
+      0xCA,             // 8042 DEX
+      0xD0, 0xBD,       // 8043 BNE $8002
+      0xC8,             // 8045 INY
+      0x6C, 0x60, 0x00, // 8046 JMP ($0060)
+  };
+  load(0x8000, prog, sizeof(prog));
+  for (int i = 0; i < 0x200; i++)
+    memory[0x1000 + i] = (uint8_t)(i * 7 + 3);
+  memory[0x50] = 0x10; // ($50,X) and ($52),Y pointers
+  memory[0x51] = 0x11;
+  memory[0x52] = 0xC0;
+  memory[0x53] = 0x04;
+  memory[0x60] = 0x00; // JMP ($0060) -> $8000
+  memory[0x61] = 0x80;
+
+  int jit = start_both();
+  run_both(4000);
+
+  if (jit) {
+    assert(block_lookup(cpu.blocks, 0x8002)->native != NULL);
+    assert(block_lookup(cpu.blocks, 0x8038)->native != NULL);
+  }
+
+  block_cache_detach(&cpu);
+  printf("PASS!\n");
+}
+
+void test_device_sees_same_state() {
+  printf("TEST: Devices See The Same State From Native Code...\n");
+  setup_test();
+
+  static const uint8_t prog[] = {
+      0xA0, 0x03,       // 8000 LDY #$03
+      0xAD, 0x00, 0x24, // 8002 LDA $2400
+      0xBD, 0xFF, 0x23, // 8005 LDA $23FF,X (crosses into the device page)
+      0x8D, 0x01, 0x24, // 8008 STA $2401
+      0x88,             // 800B DEY
+      0xD0, 0xF4,       // 800C BNE $8002
+      0xE8,             // 800E INX
+      0x4C, 0x00, 0x80, // 800F JMP $8000
+  };
+  load(0x8000, prog, sizeof(prog));
+
+  int jit = start_both();
+  // Compare against interpreted blocks, which run the same blocks.
+  assert(block_cache_attach(&cpu_ref) == 0);
+  assert(block_cache_set_jit(&cpu_ref, 0) == 0);
+  bus_map_io(&cpu.bus, BUS_PPU_PAGE, 1, device_read, device_write, &cpu);
+  bus_map_io(&cpu_ref.bus, BUS_PPU_PAGE, 1, device_read, device_write,
+             &cpu_ref);
+
+  for (int slice = 0; slice < 200; slice++) {
+    log_jit.count = log_ref.count = 0;
+    run_slice(5 + slice % 61);
+    assert(log_jit.count == log_ref.count);
+    for (int i = 0; i < log_jit.count; i++) {
+      assert(log_jit.cycles[i] == log_ref.cycles[i]);
+      assert(log_jit.pc[i] == log_ref.pc[i]);
+      assert(log_jit.a[i] == log_ref.a[i]);
+    }
+  }
+
+  if (jit)
+    assert(block_lookup(cpu.blocks, 0x8002)->native != NULL);
+
+  block_cache_detach(&cpu_ref);
+  block_cache_detach(&cpu);
+  printf("PASS!\n");
+}
+
+void test_self_modifying_hot_block() {
+  printf("TEST: Writes Invalidate Running Native Blocks...\n");
+  setup_test();
+
+  static const uint8_t prog[] = {
+      0xE8,             // 0200 INX
+      0xA9, 0xE8,       // 0201 LDA #$E8
+      0x9D, 0x01, 0x01, // 0203 STA $0101,X (rewrites $0200 when X = $FF)
+      0x4C, 0x00, 0x02, // 0206 JMP $0200
+  };
+  load(0x0200, prog, sizeof(prog));
+  memory[0xFFFC] = 0x00;
+  memory[0xFFFD] = 0x02;
+
+  int jit = start_both();
+  run_both(2000);
+
+  // The block went hot again after each rewrite
+  assert(cpu.cycles > 256 * 12 * 4);
+  if (jit)
+    assert(block_lookup(cpu.blocks, 0x0200)->native != NULL);
+
+  block_cache_detach(&cpu);
+  printf("PASS!\n");
+}
+
+void test_disable_jit() {
+  printf("TEST: JIT Can Be Switched Off...\n");
+  setup_test();
+
+  static const uint8_t prog[] = {
+      0xE8,             // 8000 INX
+      0x4C, 0x00, 0x80, // 8001 JMP $8000
+  };
+  load(0x8000, prog, sizeof(prog));
+
+  int jit = start_both();
+  run_both(100);
+  if (jit)
+    assert(block_lookup(cpu.blocks, 0x8000)->native != NULL);
+
+  assert(block_cache_set_jit(&cpu, 0) == 0);
+  assert(block_lookup(cpu.blocks, 0x8000)->native == NULL);
+  run_both(100);
+  assert(block_lookup(cpu.blocks, 0x8000)->native == NULL);
+
+  assert(block_cache_set_jit(&cpu, 1) == (jit ? 0 : -1));
+
+  block_cache_detach(&cpu);
+  printf("PASS!\n");
+}
+
+int main() {
+  test_native_matches_interpreter();
+  test_device_sees_same_state();
+  test_self_modifying_hot_block();
+  test_disable_jit();
+
+  printf("\nALL TESTS WERE PASSED.\n");
+  return 0;
+}
@@ -0,0 +1,167 @@
+/*
+ * rvm-8/kernel/tests/test_machine.c
+ *
+ * Unit tests for rvm-8 emulator instances.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../machine.h"
+
+#define THREADS 8
+#define FRAMES 30
+
+/* Fills VRAM and zero page with a changing pattern, forever. */
+static const uint8_t image[256] = {
+    0xA2, 0x00,       // FF00 LDX #$00
+    0xE8,             // FF02 INX
+    0x8E, 0x00, 0x22, // FF03 STX $2200
+    0xBD, 0x00, 0x20, // FF06 LDA $2000,X
+    0x69, 0x03,       // FF09 ADC #$03
+    0x9D, 0x00, 0x20, // FF0B STA $2000,X
+    0x95, 0x80,       // FF0E STA $80,X
+    0x4C, 0x02, 0xFF, // FF10 JMP $FF02
+    [0xFC] = 0x00,    // Reset vector -> $FF00
+    [0xFD] = 0xFF,
+};
+
+static uint64_t run_image(Machine *machine, int frames) {
+  assert(machine_load_image(machine, image, sizeof(image)) == 0);
+  for (int i = 0; i < frames; i++)
+    assert(machine_run_frame(machine) == STOP_BUDGET);
+  assert(machine->frames == (uint32_t)frames);
+  return machine_hash(machine);
+}
+
+void test_instances_are_independent() {
+  printf("TEST: Machines Share No State...\n");
+
+  Machine *a = machine_create();
+  Machine *b = machine_create();
+  assert(a != NULL && b != NULL);
+
+  uint64_t idle = machine_hash(a);
+  assert(machine_hash(b) == idle);
+
+  // Interleaved runs give the same result as separate ones
+  assert(machine_load_image(a, image, sizeof(image)) == 0);
+  assert(machine_load_image(b, image, sizeof(image)) == 0);
+  for (int i = 0; i < FRAMES; i++) {
+    assert(machine_run_frame(a) == STOP_BUDGET);
+    assert(machine_run_frame(b) == STOP_BUDGET);
+  }
+  assert(machine_hash(a) == machine_hash(b));
+  assert(machine_hash(a) != idle);
+  // Overruns are not carried from frame to frame
+  assert(a->cpu.cycles - FRAMES * MACHINE_FRAME_CYCLES < 8);
+
+  // Reloading starts over
+  uint64_t short_run = run_image(b, 2);
+  assert(run_image(a, 2) == short_run);
+  assert(machine_frames(a)->sequence == 2 + FRAMES);
+
+  machine_destroy(a);
+  machine_destroy(b);
+  printf("PASS!\n");
+}
+
+static void *thread_main(void *arg) {
+  uint64_t *hash = arg;
+  Machine *machine = machine_create();
+
+  assert(machine != NULL);
+  *hash = run_image(machine, FRAMES);
+  machine_destroy(machine);
+  return NULL;
+}
+
+void test_parallel_instances() {
+  printf("TEST: Machines Run On Several Threads At Once...\n");
+
+  pthread_t threads[THREADS];
+  uint64_t hashes[THREADS];
+
+  // Threads create their machines concurrently too, racing cpu_init()
+  for (int i = 0; i < THREADS; i++)
+    assert(pthread_create(&threads[i], NULL, thread_main, &hashes[i]) == 0);
+  for (int i = 0; i < THREADS; i++)
+    assert(pthread_join(threads[i], NULL) == 0);
+
+  Machine *machine = machine_create();
+  uint64_t expected = run_image(machine, FRAMES);
+  for (int i = 0; i < THREADS; i++)
+    assert(hashes[i] == expected);
+
+  machine_destroy(machine);
+  printf("PASS!\n");
+}
+
+void test_load_image() {
+  printf("TEST: Images Load Below The Top Of Memory...\n");
+
+  static uint8_t big[MACHINE_IMAGE_MAX + 1];
+  Machine *machine = machine_create();
+
+  assert(machine_load_image(machine, big, sizeof(big)) == -1);
+
+  // An image of zeros resets to $0000, below the image, and stops there
+  assert(machine_load_image(machine, big, MACHINE_IMAGE_MAX) == 0);
+  assert(machine->cpu.pc == 0x0000);
+  machine->memory[0x0000] = 0x02; // No such opcode
+  assert(machine_run_frame(machine) == STOP_ILLEGAL);
+  assert(machine->cpu.pc == 0x0000);
+  assert(machine_frames(machine)->sequence == 1);
+
+  assert(machine_load_image(machine, image, sizeof(image)) == 0);
+  assert(machine->cpu.pc == 0xFF00 && machine->memory[0x0000] == 0);
+  assert(memcmp(&machine->memory[0xFF00], image, sizeof(image)) == 0);
+
+  machine_destroy(machine);
+  printf("PASS!\n");
+}
+
+void test_render_interval() {
+  printf("TEST: Skipped Frames Change Nothing But The Picture...\n");
+  Machine *plain = machine_create(), *fast = machine_create();
+  assert(plain != NULL && fast != NULL);
+
+  assert(machine_load_image(fast, image, sizeof(image)) == 0);
+  uint32_t published = machine_frames(fast)->sequence;
+  machine_set_render_interval(fast, 4);
+  for (int i = 0; i < 8; i++)
+    assert(machine_run_frame(fast) == STOP_BUDGET);
+  // Frames 4 and 8 were rendered, and the picture is frame 8's
+  assert(machine_frames(fast)->sequence == published + 2);
+  assert(machine_hash(fast) == run_image(plain, 8));
+
+  // Only the last frame of a run rendered ends on the same picture
+  machine_set_render_interval(fast, 0);
+  for (int i = 8; i < FRAMES - 1; i++)
+    assert(machine_run_frame(fast) == STOP_BUDGET);
+  assert(machine_frames(fast)->sequence == published + 2);
+  machine_set_render_interval(fast, 1);
+  assert(machine_run_frame(fast) == STOP_BUDGET);
+  assert(machine_frames(fast)->sequence == published + 3);
+  assert(machine_hash(fast) == run_image(plain, FRAMES));
+  assert(fast->cpu.cycles == plain->cpu.cycles);
+
+  machine_destroy(fast);
+  machine_destroy(plain);
+  printf("PASS!\n");
+}
+
+int main() {
+  test_instances_are_independent();
+  test_parallel_instances();
+  test_load_image();
+  test_render_interval();
+
+  printf("\nALL TESTS WERE PASSED.\n");
+  return 0;
+}
@@ -0,0 +1,350 @@
+/*
+ * rvm-8/kernel/tests/test_ppu.c
+ *
+ * Unit tests for the rvm-8 PPU renderer.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../cpu.h"
+#include "../ppu.h"
+
+uint8_t memory[65536];
+uint8_t expected[PPU_HEIGHT][PPU_WIDTH];
+CPU cpu;
+Ppu ppu;
+
+static uint32_t seed = 12345;
+
+static uint8_t next_random() {
+  seed = seed * 1103515245 + 12345;
+  return seed >> 16;
+}
+
+void setup_test() {
+  memset(memory, 0, 65536);
+  memory[0xFFFC] = 0x00;
+  memory[0xFFFD] = 0x80;
+  cpu_init(&cpu, memory);
+  bus_map_spec(&cpu.bus, memory);
+  ppu_init(&ppu, &cpu.bus);
+}
+
+/* Pixel-at-a-time renderer straight from the SPEC, reading memory[]. */
+static uint8_t tile_pixel(uint8_t tile, unsigned x, unsigned y) {
+  const uint8_t *row = &memory[PPU_TILE_DATA + (tile % 32) * 16 + y * 2];
+  return ((row[0] >> (7 - x)) & 1) | ((row[1] >> (7 - x)) & 1) << 1;
+}
+
+static void render_reference() {
+  for (unsigned y = 0; y < PPU_HEIGHT; y++) {
+    for (unsigned x = 0; x < PPU_WIDTH; x++) {
+      uint8_t bg = 0, spr = 0;
+
+      if (ppu.ctrl & PPU_CTRL_BG)
+        bg = tile_pixel(memory[PPU_TILEMAP + (y / 8) * 20 + x / 8], x & 7,
+                        y & 7);
+
+      for (int i = 0; i < 16 && (ppu.ctrl & PPU_CTRL_SPRITES); i++) {
+        const uint8_t *s = &memory[PPU_OAM + 4 * i];
+        int sx = (int)x - (s[1] - 8), sy = (int)y - (s[0] - 8);
+
+        if (sx < 0 || sx > 7 || sy < 0 || sy > 7)
+          continue;
+        if (s[3] & PPU_ATTR_FLIP_X)
+          sx = 7 - sx;
+        if (s[3] & PPU_ATTR_FLIP_Y)
+          sy = 7 - sy;
+        spr = tile_pixel(s[2], sx, sy);
+        if (spr)
+          break;
+      }
+
+      expected[y][x] = spr ? (ppu.obp >> (2 * spr)) & 3
+                           : (ppu.bgp >> (2 * bg)) & 3;
+    }
+  }
+}
+
+/* Shade of a pixel in the last published frame. */
+static uint8_t front_pixel(unsigned x, unsigned y) {
+  return ppu_front_buffer(&ppu, NULL)[y * PPU_WIDTH + x];
+}
+
+static void assert_frame() {
+  ppu_render_frame(&ppu);
+  render_reference();
+  assert(memcmp(ppu_front_buffer(&ppu, NULL), expected, sizeof(expected)) ==
+         0);
+}
+
+static void fill_vram() {
+  for (int addr = 0x2000; addr < 0x2400; addr++)
+    memory[addr] = next_random();
+  for (int i = 0; i < 16; i++) {
+    // Keep most sprites on screen, some across the edges
+    memory[PPU_OAM + 4 * i] = next_random() % 168;
+    memory[PPU_OAM + 4 * i + 1] = next_random() % 176;
+  }
+  ppu_invalidate(&ppu);
+}
+
+void test_matches_reference() {
+  printf("TEST: PPU Matches Reference Renderer...\n");
+  setup_test();
+
+  for (int round = 0; round < 20; round++) {
+    fill_vram();
+    mem_write(&cpu, PPU_REG_BGP, next_random());
+    mem_write(&cpu, PPU_REG_OBP, next_random());
+    mem_write(&cpu, PPU_REG_CTRL, round % 4);
+    assert(mem_read(&cpu, PPU_REG_CTRL) == round % 4);
+    assert_frame();
+  }
+
+  ppu_detach(&ppu);
+  printf("PASS!\n");
+}
+
+void test_tile_cache_invalidation() {
+  printf("TEST: VRAM Writes Invalidate Cached Tiles...\n");
+  setup_test();
+
+  fill_vram();
+  assert_frame();
+
+  // Writes through the bus reach the cache without any host call
+  for (int i = 0; i < 100; i++) {
+    uint16_t addr = PPU_TILE_DATA + next_random() * 2;
+    mem_write(&cpu, addr, next_random());
+  }
+  assert(ppu.dirty_tiles != 0);
+  assert_frame();
+  assert(ppu.dirty_tiles == 0);
+
+  // A CPU store does too
+  static const uint8_t prog[] = {
+      0xA9, 0xFF,       // 8000 LDA #$FF
+      0x8D, 0x00, 0x20, // 8002 STA $2000
+      0x8D, 0x01, 0x20, // 8005 STA $2001
+  };
+  memcpy(&memory[0x8000], prog, sizeof(prog));
+  memory[PPU_TILEMAP] = 0;
+  memset(&memory[PPU_OAM], 0, PPU_SPRITE_COUNT * 4); // Hide all sprites
+  for (int i = 0; i < 3; i++)
+    cpu_step(&cpu);
+  assert_frame();
+  assert(front_pixel(0, 0) == ((ppu.bgp >> 6) & 3));
+
+  // Direct host writes are only seen after an explicit invalidation
+  memory[PPU_TILE_DATA] = 0x00;
+  memory[PPU_TILE_DATA + 1] = 0x00;
+  ppu_render_frame(&ppu);
+  assert(front_pixel(0, 0) == ((ppu.bgp >> 6) & 3));
+  ppu_invalidate(&ppu);
+  assert_frame();
+  assert(front_pixel(0, 0) == (ppu.bgp & 3));
+
+  ppu_detach(&ppu);
+  assert(cpu.bus.write_map[0x20] == &memory[0x2000]);
+  printf("PASS!\n");
+}
+
+void test_remap_rearms_trap() {
+  printf("TEST: Remapping VRAM Keeps The Cache Coherent...\n");
+  setup_test();
+
+  static uint8_t other_vram[2 * BUS_PAGE_SIZE];
+
+  fill_vram();
+  assert_frame();
+
+  // Point the tile pages elsewhere, then back at the usual memory
+  memset(other_vram, 0xFF, sizeof(other_vram));
+  bus_map_ram(&cpu.bus, 0x20, 2, other_vram);
+  ppu_render_line(&ppu, 0);
+  assert(ppu.tiles[0][0] == 3);
+
+  bus_map_ram(&cpu.bus, 0x20, 2, &memory[0x2000]);
+  assert_frame();
+  mem_write(&cpu, PPU_TILE_DATA + 5, 0xA5);
+  assert_frame();
+
+  ppu_detach(&ppu);
+  printf("PASS!\n");
+}
+
+/* Checks every line's bucket against a scan of OAM. */
+static void assert_buckets() {
+  for (unsigned line = 0; line < PPU_HEIGHT; line++) {
+    uint16_t want = 0;
+    for (int i = 0; i < 16; i++) {
+      unsigned row = line + 8 - memory[PPU_OAM + 4 * i];
+      if (row < 8)
+        want |= 1u << i;
+    }
+    assert(ppu.line_sprites[line] == want);
+  }
+}
+
+void test_sprite_buckets() {
+  printf("TEST: Sprite Buckets Follow OAM Writes...\n");
+  setup_test();
+
+  fill_vram();
+  assert_frame();
+  assert_buckets();
+
+  // Only Y writes mark a sprite as moved
+  mem_write(&cpu, PPU_OAM + 1, 40);
+  mem_write(&cpu, PPU_OAM + 2, 7);
+  mem_write(&cpu, PPU_OAM + 3, PPU_ATTR_FLIP_X);
+  assert(ppu.moved_sprites == 0);
+  mem_write(&cpu, PPU_OAM + 4 * 3, 100);
+  assert(ppu.moved_sprites == 1u << 3);
+  assert_frame();
+  assert_buckets();
+
+  // Sprites moved between lines show up on the next line
+  for (int round = 0; round < 50; round++) {
+    int i = next_random() % 16;
+    mem_write(&cpu, PPU_OAM + 4 * i, next_random() % 168);
+    mem_write(&cpu, PPU_OAM + 4 * i + 1, next_random() % 176);
+    ppu_render_line(&ppu, round);
+    assert_buckets();
+  }
+  assert_frame();
+
+  // A remapped OAM page is re-bucketed from scratch
+  static uint8_t other_page[BUS_PAGE_SIZE];
+  memcpy(other_page, &memory[0x2300], BUS_PAGE_SIZE);
+  other_page[PPU_OAM & 0xFF] = 20;
+  bus_map_ram(&cpu.bus, 0x23, 1, other_page);
+  ppu_render_line(&ppu, 0);
+  assert(ppu.line_sprites[12] & 1);
+  bus_map_ram(&cpu.bus, 0x23, 1, &memory[0x2300]);
+  assert_frame();
+  assert_buckets();
+
+  ppu_detach(&ppu);
+  assert(cpu.bus.write_map[0x23] == &memory[0x2300]);
+  printf("PASS!\n");
+}
+
+void test_double_buffering() {
+  printf("TEST: Frames Are Published To The Front Buffer...\n");
+  setup_test();
+
+  uint32_t seq, seq_next;
+  const uint8_t *front, *front_next;
+
+  fill_vram();
+  front = ppu_front_buffer(&ppu, &seq);
+  assert(seq == 0);
+  assert_frame();
+  front_next = ppu_front_buffer(&ppu, &seq_next);
+  assert(seq_next == 1 && ppu_frame_sequence(&ppu) == 1);
+  assert(front_next != front);
+
+  // Lines render into the back buffer; the front one is left alone
+  memcpy(expected, front_next, sizeof(expected));
+  mem_write(&cpu, PPU_REG_BGP, ~ppu.bgp);
+  for (unsigned line = 0; line < PPU_HEIGHT; line++)
+    ppu_render_line(&ppu, line);
+  assert(memcmp(front_next, expected, sizeof(expected)) == 0);
+  assert(ppu_frame_sequence(&ppu) == 1);
+
+  // The buffers swap back and forth on every frame
+  assert_frame();
+  assert(ppu_front_buffer(&ppu, &seq) == front && seq == 2);
+  assert_frame();
+  assert(ppu_front_buffer(&ppu, &seq) == front_next && seq == 3);
+
+  ppu_detach(&ppu);
+  printf("PASS!\n");
+}
+
+/* Asserts that the dirty lines are the ones that differ from @p before. */
+static void assert_dirty(const uint8_t (*before)[PPU_WIDTH], unsigned *count) {
+  uint32_t seq, dirty_seq;
+  const uint8_t *front = ppu_front_buffer(&ppu, &seq);
+  const uint32_t *dirty = ppu_front_dirty(&ppu, &dirty_seq);
+
+  assert(seq == dirty_seq);
+  *count = 0;
+  for (unsigned line = 0; line < PPU_HEIGHT; line++) {
+    int changed =
+        memcmp(front + line * PPU_WIDTH, before[line], PPU_WIDTH) != 0;
+    assert(!!(dirty[line / 32] & (1u << (line % 32))) == changed);
+    *count += changed;
+  }
+}
+
+void test_dirty_lines() {
+  printf("TEST: Frames Carry The Lines That Changed...\n");
+  setup_test();
+
+  static uint8_t before[PPU_HEIGHT][PPU_WIDTH];
+  unsigned count, first = 5 * 8;
+
+  // The first frame is compared with the blank one before it
+  fill_vram();
+  memcpy(before, ppu_front_buffer(&ppu, NULL), sizeof(before));
+  assert_frame();
+  assert_dirty(before, &count);
+  assert(count > 0);
+
+  // Redrawn the same, nothing is dirty
+  memcpy(before, ppu_front_buffer(&ppu, NULL), sizeof(before));
+  assert_frame();
+  assert_dirty(before, &count);
+  assert(count == 0);
+
+  // One tile changed dirties exactly the eight lines it covers
+  mem_write(&cpu, PPU_REG_CTRL, PPU_CTRL_BG);
+  for (int i = 0; i < 16; i++)
+    mem_write(&cpu, PPU_TILE_DATA + 16 + i, ~memory[PPU_TILE_DATA + i]);
+  for (int i = 0; i < PPU_TILEMAP_WIDTH * PPU_TILEMAP_HEIGHT; i++)
+    mem_write(&cpu, PPU_TILEMAP + i, 0);
+  assert_frame();
+  memcpy(before, ppu_front_buffer(&ppu, NULL), sizeof(before));
+  mem_write(&cpu, PPU_TILEMAP + 5 * PPU_TILEMAP_WIDTH + 3, 1);
+  assert_frame();
+  assert_dirty(before, &count);
+  assert(count == 8);
+  const uint32_t *dirty = ppu_front_dirty(&ppu, NULL);
+  for (unsigned line = 0; line < PPU_HEIGHT; line++) {
+    assert(!!(dirty[line / 32] & (1u << (line % 32))) ==
+           (line >= first && line < first + 8));
+  }
+
+  // Lines left undrawn still hold the frame before, without the tile,
+  // and are compared when the frame is published
+  memcpy(before, ppu_front_buffer(&ppu, NULL), sizeof(before));
+  mem_write(&cpu, PPU_REG_BGP, ~ppu.bgp);
+  for (unsigned line = 0; line < 10; line++)
+    ppu_render_line(&ppu, line);
+  ppu_end_frame(&ppu);
+  assert_dirty(before, &count);
+  assert(count == 10 + 8);
+
+  ppu_detach(&ppu);
+  printf("PASS!\n");
+}
+
+int main() {
+  test_matches_reference();
+  test_tile_cache_invalidation();
+  test_remap_rearms_trap();
+  test_sprite_buckets();
+  test_double_buffering();
+  test_dirty_lines();
+
+  printf("\nALL TESTS WERE PASSED.\n");
+  return 0;
+}
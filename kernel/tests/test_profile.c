@@ -0,0 +1,222 @@
+/*
+ * rvm-8/kernel/tests/test_profile.c
+ *
+ * Unit tests for the rvm-8 sampling profiler.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../asm.h"
+#include "../block.h"
+#include "../machine.h"
+#include "../profile.h"
+#include "../rom.h"
+
+#define SOURCE_PATH "test_profile.asm"
+#define LABELS_PATH "test_profile.labels"
+#define PROFILE_PATH "test_profile.out"
+#define FRAMES 30
+#define INTERVAL 500
+
+/*
+ * Spends 12 cycles a turn 256 times in `slow` for every 7 in `main` and
+ * `fast`, so nearly all samples should land in `slow`.
+ */
+static const char *source = "PAD = $2500\n"
+                            ".org $8000\n"
+                            "main:\n"
+                            "  LDX #0\n"
+                            "slow:\n"
+                            "  LDA PAD\n"
+                            "  STA $10\n"
+                            "  INX\n"
+                            "  BNE slow\n"
+                            "fast:\n"
+                            "  INY\n"
+                            "  BNE main\n"
+                            "  JMP main\n"
+                            ".reset main\n";
+
+static void write_file(const char *path, const char *text) {
+  FILE *f = fopen(path, "w");
+  assert(f != NULL);
+  assert(fputs(text, f) >= 0);
+  fclose(f);
+}
+
+static char *read_file(const char *path) {
+  FILE *f = fopen(path, "r");
+  char *text = calloc(1, 1 << 16);
+  size_t size;
+
+  assert(f != NULL && text != NULL);
+  size = fread(text, 1, (1 << 16) - 1, f);
+  text[size] = 0;
+  fclose(f);
+  return text;
+}
+
+/* Assembles the source, writing its label map, into a ROM image. */
+static uint8_t *build(size_t *size) {
+  Asm *as = asm_create();
+  uint8_t *image;
+
+  write_file(SOURCE_PATH, source);
+  assert(as != NULL && asm_assemble(as, SOURCE_PATH) == 0);
+  assert(asm_write_labels(as, LABELS_PATH) == 0);
+  *size = asm_build_rom(as, NULL, 0);
+  image = malloc(*size);
+  assert(asm_build_rom(as, image, *size) == *size);
+  asm_destroy(as);
+  return image;
+}
+
+/* Runs the ROM for FRAMES, profiled if @p profiler is given. */
+static uint64_t run(const uint8_t *image, size_t size, int jit,
+                    int blocks, Profiler *profiler) {
+  Machine *machine = machine_create();
+  Rom rom;
+
+  assert(machine != NULL);
+  assert(rom_parse(&rom, image, size) == ROM_OK);
+  rom_load(machine, &rom);
+  if (!blocks)
+    block_cache_detach(&machine->cpu);
+  else if (jit)
+    block_cache_set_jit(&machine->cpu, 1);
+  machine_set_profiler(machine, profiler);
+  for (int frame = 0; frame < FRAMES; frame++)
+    assert(machine_run_frame(machine) == STOP_BUDGET);
+  machine_set_profiler(machine, NULL);
+
+  uint64_t hash = machine_hash(machine);
+  machine_destroy(machine);
+  return hash;
+}
+
+void test_label_map() {
+  printf("TEST: The Assembler Writes A Label Map...\n");
+  size_t size;
+  uint8_t *image = build(&size);
+  char *labels = read_file(LABELS_PATH);
+  Profiler *profiler = profile_create(0);
+
+  // Constants are left out; labels are in address order
+  assert(strcmp(labels, "8000 main\n8002 slow\n800A fast\n") == 0);
+  assert(profiler != NULL && profiler->interval == PROFILE_DEFAULT_INTERVAL);
+  assert(profile_load_labels(profiler, LABELS_PATH) == 0);
+  assert(profiler->label_count == 3);
+  assert(profiler->labels[1].addr == 0x8002);
+  assert(strcmp(profiler->labels[1].name, "slow") == 0);
+
+  // A bad map leaves the labels as they were
+  write_file(LABELS_PATH, "8000 main\nnot a label\n");
+  assert(profile_load_labels(profiler, LABELS_PATH) == -1);
+  assert(profile_load_labels(profiler, "missing.labels") == -1);
+  assert(profiler->label_count == 3);
+
+  // Labels sharing an address keep the first name
+  write_file(LABELS_PATH, "\n8002 zed\n8000 main\n8002 alpha\n");
+  assert(profile_load_labels(profiler, LABELS_PATH) == 0);
+  assert(profiler->label_count == 2);
+  assert(strcmp(profiler->labels[1].name, "alpha") == 0);
+
+  profile_destroy(profiler);
+  free(labels);
+  free(image);
+  remove(LABELS_PATH);
+  remove(SOURCE_PATH);
+  printf("PASS!\n");
+}
+
+void test_samples_name_the_hot_code() {
+  printf("TEST: Samples Land In The Hot Code, Named By Label...\n");
+  size_t size;
+  uint8_t *image = build(&size);
+  Profiler *profiler = profile_create(INTERVAL);
+  uint64_t expected = (uint64_t)FRAMES * MACHINE_FRAME_CYCLES / INTERVAL;
+  uint64_t plain = run(image, size, 0, 1, NULL), total = 0, slow = 0;
+
+  assert(profiler != NULL);
+  assert(profile_load_labels(profiler, LABELS_PATH) == 0);
+  // Profiling does not change what the machine computes
+  assert(run(image, size, 0, 1, profiler) == plain);
+  assert(profiler->samples > expected * 95 / 100);
+  assert(profiler->samples < expected * 105 / 100);
+
+  assert(profile_write(profiler, "room", PROFILE_PATH) == 0);
+  char *text = read_file(PROFILE_PATH);
+  for (char *line = strtok(text, "\n"); line; line = strtok(NULL, "\n")) {
+    char label[16];
+    unsigned addr, count;
+
+    assert(sscanf(line, "room;%15[^;];$%4X %u", label, &addr, &count) == 3);
+    assert(addr >= 0x8000 && addr < 0x8010 && count > 0);
+    assert(profiler->counts[addr] == count);
+    assert(strcmp(label, addr < 0x8002 ? "main"
+                         : addr < 0x800A ? "slow"
+                                         : "fast") == 0);
+    total += count;
+    slow += strcmp(label, "slow") == 0 ? count : 0;
+  }
+  assert(total == profiler->samples);
+  assert(slow * 100 > total * 98 && slow < total);
+
+  // Without labels or a root, only the address is left
+  Profiler *bare = profile_create(INTERVAL);
+  assert(bare != NULL);
+  profile_sample(bare, 0x1234);
+  assert(profile_write(bare, NULL, PROFILE_PATH) == 0);
+  free(text);
+  text = read_file(PROFILE_PATH);
+  assert(strcmp(text, "$1234 1\n") == 0);
+
+  profile_destroy(bare);
+  profile_destroy(profiler);
+  free(text);
+  free(image);
+  remove(PROFILE_PATH);
+  remove(LABELS_PATH);
+  remove(SOURCE_PATH);
+  printf("PASS!\n");
+}
+
+void test_engines_sample_alike() {
+  printf("TEST: Every Engine Takes The Same Samples...\n");
+  size_t size;
+  uint8_t *image = build(&size);
+  Profiler *profilers[3];
+
+  for (int engine = 0; engine < 3; engine++) {
+    profilers[engine] = profile_create(INTERVAL);
+    assert(profilers[engine] != NULL);
+    run(image, size, engine == 2, engine > 0, profilers[engine]);
+  }
+  for (int engine = 1; engine < 3; engine++) {
+    assert(profilers[engine]->samples == profilers[0]->samples);
+    assert(memcmp(profilers[engine]->counts, profilers[0]->counts,
+                  sizeof(profilers[0]->counts)) == 0);
+  }
+
+  for (int engine = 0; engine < 3; engine++)
+    profile_destroy(profilers[engine]);
+  free(image);
+  remove(LABELS_PATH);
+  remove(SOURCE_PATH);
+  printf("PASS!\n");
+}
+
+int main() {
+  test_label_map();
+  test_samples_name_the_hot_code();
+  test_engines_sample_alike();
+
+  printf("\nALL TESTS WERE PASSED.\n");
+  return 0;
+}
@@ -0,0 +1,177 @@
+/*
+ * rvm-8/kernel/tests/test_rewind.c
+ *
+ * Unit tests for rvm-8 save states and rewind.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../rewind.h"
+#include "fixture.h"
+
+#define FRAMES 40
+
+/* Scribbles over RAM, VRAM and the zero page, forever. */
+static const uint8_t image[256] = {
+    0xA2, 0x00,       // FF00 LDX #$00
+    0xE8,             // FF02 INX
+    0x8E, 0x00, 0x22, // FF03 STX $2200
+    0xBD, 0x00, 0x20, // FF06 LDA $2000,X
+    0x69, 0x03,       // FF09 ADC #$03
+    0x9D, 0x00, 0x20, // FF0B STA $2000,X
+    0x95, 0x80,       // FF0E STA $80,X
+    0x99, 0x00, 0x30, // FF10 STA $3000,Y
+    0xC8,             // FF13 INY
+    0x4C, 0x02, 0xFF, // FF14 JMP $FF02
+    [0xFC] = 0x00,    // Reset vector -> $FF00
+    [0xFD] = 0xFF,
+};
+
+Machine *machine;
+uint64_t hashes[FRAMES + 1];
+
+static void setup_test() {
+  machine = fixture_machine(image, sizeof(image));
+}
+
+/* Runs a frame and returns the machine's hash. */
+static uint64_t run_frame() {
+  assert(machine_run_frame(machine) == STOP_BUDGET);
+  return machine_hash(machine);
+}
+
+void test_restore_replays_frames() {
+  printf("TEST: Restored Snapshots Replay The Same Frames...\n");
+  setup_test();
+
+  Rewind *rewind = rewind_create(machine, FRAMES, 0);
+  assert(rewind != NULL);
+
+  for (int frame = 0; frame < FRAMES; frame++) {
+    rewind_snapshot(rewind);
+    hashes[frame + 1] = run_frame();
+  }
+  assert(rewind_depth(rewind) == FRAMES);
+
+  // Each interval dirties RAM, VRAM and zero page, not all of memory
+  assert(rewind_pages_used(rewind) <= FRAMES * 6);
+
+  // Going back 10 frames and running forward ends up in the same place
+  assert(rewind_restore(rewind, 9) == 0);
+  assert(rewind_depth(rewind) == FRAMES - 9);
+  assert(machine->frames == FRAMES - 10);
+  for (int frame = FRAMES - 10; frame < FRAMES; frame++)
+    assert(run_frame() == hashes[frame + 1]);
+
+  // A snapshot can be restored more than once
+  assert(rewind_restore(rewind, 0) == 0);
+  assert(run_frame() == hashes[FRAMES - 9]);
+  assert(rewind_restore(rewind, 0) == 0);
+  assert(run_frame() == hashes[FRAMES - 9]);
+
+  // All the way back to the first frame
+  assert(rewind_restore(rewind, rewind_depth(rewind) - 1) == 0);
+  assert(machine->cpu.pc == 0xFF00 && machine->cpu.cycles == 0);
+  assert(run_frame() == hashes[1]);
+  assert(rewind_restore(rewind, 1) == -1);
+
+  rewind_destroy(rewind);
+  machine_destroy(machine);
+  printf("PASS!\n");
+}
+
+void test_ring_is_bounded() {
+  printf("TEST: The Ring Drops The Oldest Snapshots...\n");
+  setup_test();
+
+  Rewind *rewind = rewind_create(machine, 8, 0);
+  for (int frame = 0; frame < FRAMES; frame++) {
+    rewind_snapshot(rewind);
+    hashes[frame + 1] = run_frame();
+  }
+  assert(rewind_depth(rewind) == 8);
+  assert(rewind_restore(rewind, 8) == -1);
+  assert(rewind_restore(rewind, 7) == 0);
+  assert(machine->frames == FRAMES - 8);
+  assert(run_frame() == hashes[FRAMES - 7]);
+  rewind_destroy(rewind);
+  machine_destroy(machine);
+
+  // A small pool drops snapshots to make room for new page copies
+  static uint8_t written[BUS_PAGE_COUNT];
+  setup_test();
+  memset(written, 0, sizeof(written));
+  rewind = rewind_create(machine, FRAMES, BUS_PAGE_COUNT);
+  for (int frame = 1; frame <= FRAMES; frame++) {
+    rewind_snapshot(rewind);
+    // Dirty a different spread of 100 pages each frame
+    for (int i = 0; i < 100; i++) {
+      uint8_t page = 0x30 + (frame * 37 + i) % 200;
+      mem_write(&machine->cpu, page << 8, frame);
+      if (frame < FRAMES - 1)
+        written[page] = frame;
+    }
+    assert(rewind_pages_used(rewind) <= BUS_PAGE_COUNT);
+  }
+  assert(rewind_depth(rewind) < FRAMES && rewind_depth(rewind) >= 2);
+
+  // Back to the start of frame FRAMES - 1
+  assert(rewind_restore(rewind, 1) == 0);
+  for (int page = 0x30; page < 0x30 + 200; page++)
+    assert(machine->memory[page << 8] == written[page]);
+
+  rewind_destroy(rewind);
+  machine_destroy(machine);
+  printf("PASS!\n");
+}
+
+void test_untouched_pages_cost_nothing() {
+  printf("TEST: Snapshots Only Copy Written Pages...\n");
+  setup_test();
+
+  Rewind *rewind = rewind_create(machine, 4, 0);
+  rewind_snapshot(rewind);
+  rewind_snapshot(rewind);
+  assert(rewind_pages_used(rewind) == 0);
+
+  // Only the first write to a page copies it
+  mem_write(&machine->cpu, 0x4000, 1);
+  mem_write(&machine->cpu, 0x4001, 2);
+  mem_write(&machine->cpu, 0x40FF, 3);
+  assert(rewind_pages_used(rewind) == 1);
+  assert(machine->cpu.bus.write_map[0x40] != NULL);
+
+  // ROM and device pages are never copied
+  mem_write(&machine->cpu, 0xFF00, 1);
+  mem_write(&machine->cpu, PPU_REG_BGP, 0x1B);
+  assert(rewind_pages_used(rewind) == 1);
+
+  // Restoring puts back the page and the PPU registers
+  assert(rewind_restore(rewind, 0) == 0);
+  assert(machine->memory[0x4000] == 0 && machine->memory[0x40FF] == 0);
+  assert(machine->ppu.bgp == 0xE4);
+  assert(rewind_pages_used(rewind) == 0);
+  assert(machine->cpu.bus.write_map[0x40] == NULL);
+
+  rewind_clear(rewind);
+  assert(rewind_depth(rewind) == 0);
+  assert(machine->cpu.bus.write_map[0x40] == &machine->memory[0x4000]);
+
+  rewind_destroy(rewind);
+  machine_destroy(machine);
+  printf("PASS!\n");
+}
+
+int main() {
+  test_restore_replays_frames();
+  test_ring_is_bounded();
+  test_untouched_pages_cost_nothing();
+
+  printf("\nALL TESTS WERE PASSED.\n");
+  return 0;
+}
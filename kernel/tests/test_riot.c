@@ -0,0 +1,221 @@
+/*
+ * rvm-8/kernel/tests/test_riot.c
+ *
+ * Unit tests for the rvm-8 RIOT timer.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../block.h"
+#include "../rewind.h"
+#include "fixture.h"
+
+/* Starts a 1024-cycle timer and polls it until it underflows. */
+static const uint8_t image[256] = {
+    0xA9, 0x14,       // FF00 LDA #$14
+    0x8D, 0x13, 0x25, // FF02 STA T1024T
+    0xA2, 0x00,       // FF05 LDX #$00
+    0xE8,             // FF07 INX
+    0xAD, 0x11, 0x25, // FF08 LDA TIMINT
+    0x10, 0xFA,       // FF0B BPL $FF07
+    0x8E, 0x00, 0x03, // FF0D STX $0300
+    0xAD, 0x10, 0x25, // FF10 LDA INTIM
+    0x8D, 0x01, 0x03, // FF13 STA $0301
+    0xAD, 0x11, 0x25, // FF16 LDA TIMINT
+    0x8D, 0x02, 0x03, // FF19 STA $0302
+    0x4C, 0x1C, 0xFF, // FF1C JMP $FF1C
+    [0xFC] = 0x00,    // Reset vector -> $FF00
+    [0xFD] = 0xFF,
+};
+
+void test_timer_counts_lazily() {
+  printf("TEST: The Timer Count Is Derived From The Cycle Counter...\n");
+  Machine *machine = fixture_machine(image, sizeof(image));
+  Bus *bus = &machine->cpu.bus;
+  uint64_t *now = &machine->cpu.cycles;
+
+  assert(bus_read(bus, RIOT_REG_INTIM) == 0);
+  assert(bus_read(bus, RIOT_REG_TIMINT) == 0);
+
+  *now = 1000;
+  bus_write(bus, RIOT_REG_TIM8T, 10);
+  assert(riot_timer(&machine->riot) == 10);
+  *now = 1000 + 3 * 8 + 7;
+  assert(bus_read(bus, RIOT_REG_INTIM) == 7);
+  *now = 1000 + 11 * 8 - 1;
+  assert(bus_read(bus, RIOT_REG_INTIM) == 0);
+  assert(bus_read(bus, RIOT_REG_TIMINT) == 0);
+
+  // Past zero it counts once per cycle from 0xFF, with the flag up
+  *now = 1000 + 11 * 8;
+  assert(bus_read(bus, RIOT_REG_TIMINT) == RIOT_TIMINT_UNDERFLOW);
+  *now += 5;
+  assert(bus_read(bus, RIOT_REG_TIMINT) == RIOT_TIMINT_UNDERFLOW);
+  assert(bus_read(bus, RIOT_REG_INTIM) == 0xFA);
+  assert(bus_read(bus, RIOT_REG_TIMINT) == 0);
+  *now += 0x100;
+  assert(riot_timer(&machine->riot) == 0xFA);
+
+  // Without its interrupt the timer schedules nothing
+  assert(!sched_pending(&machine->sched, SCHED_EVENT_RIOT_TIMER));
+  bus_write(bus, RIOT_REG_T1024T, 1);
+  assert(riot_timer(&machine->riot) == 1);
+  *now += 1024;
+  assert(riot_timer(&machine->riot) == 0);
+
+  machine_clear(machine);
+  assert(bus_read(bus, RIOT_REG_INTIM) == 0);
+  machine_destroy(machine);
+  printf("PASS!\n");
+}
+
+void test_underflow_interrupt() {
+  printf("TEST: An Enabled Interrupt Is Raised At Underflow...\n");
+  Machine *machine = fixture_machine(image, sizeof(image));
+  Bus *bus = &machine->cpu.bus;
+
+  bus_write(bus, RIOT_REG_TIM64T + RIOT_IRQ_ENABLE, 2);
+  assert(sched_pending(&machine->sched, SCHED_EVENT_RIOT_TIMER));
+  assert(machine->sched.when[SCHED_EVENT_RIOT_TIMER] == 3 * 64);
+
+  // The events of a frame run even when the CPU is halted
+  machine->cpu.halted = 1;
+  assert(machine_run_frame(machine) == STOP_HALT);
+  assert(riot_irq(&machine->riot));
+  assert(!sched_pending(&machine->sched, SCHED_EVENT_RIOT_TIMER));
+  bus_read(bus, RIOT_REG_INTIM);
+  assert(!riot_irq(&machine->riot));
+
+  // Restarting moves the event
+  bus_write(bus, RIOT_REG_TIM1T + RIOT_IRQ_ENABLE, 100);
+  assert(machine->sched.when[SCHED_EVENT_RIOT_TIMER] ==
+         machine->cpu.cycles + 101);
+  bus_write(bus, RIOT_REG_TIM1T, 100);
+  assert(!sched_pending(&machine->sched, SCHED_EVENT_RIOT_TIMER));
+  machine_destroy(machine);
+  printf("PASS!\n");
+}
+
+/* Runs the polling program and returns what it stored. */
+static void run_poll(int engine, uint8_t out[3], uint64_t *cycles) {
+  Machine *machine = fixture_machine(image, sizeof(image));
+
+  if (engine == 0)
+    block_cache_detach(&machine->cpu);
+  else if (machine->cpu.blocks != NULL)
+    block_cache_set_jit(&machine->cpu, engine == 2);
+  assert(machine_run_frame(machine) == STOP_BUDGET);
+  memcpy(out, &machine->memory[0x300], 3);
+  *cycles = machine->cpu.cycles;
+  machine_destroy(machine);
+}
+
+void test_engines_poll_alike() {
+  printf("TEST: Polling Loops See The Same Count In Every Engine...\n");
+  uint8_t ref[3], out[3];
+  uint64_t ref_cycles, cycles;
+
+  run_poll(0, ref, &ref_cycles);
+  // Started at cycle 2, so it underflows at 2 + 21 * 1024. The first
+  // poll reads at cycle 10 and each one takes 9 cycles.
+  uint64_t underflow = 2 + 21 * 1024;
+  unsigned polls = (underflow - 10 + 8) / 9 + 1;
+  uint64_t last = 10 + 9 * (polls - 1);
+  assert(ref[0] == (uint8_t)polls);
+  assert(ref[1] == 0xFF - (last + 10 - underflow) && ref[2] == 0);
+
+  for (int engine = 1; engine <= 2; engine++) {
+    run_poll(engine, out, &cycles);
+    assert(memcmp(out, ref, sizeof(ref)) == 0);
+    assert(cycles == ref_cycles);
+  }
+  printf("PASS!\n");
+}
+
+void test_steadiness() {
+  printf("TEST: TIMINT Holds Still Until The Underflow...\n");
+  static const uint8_t wait[256] = {
+      0xA9, 0x10,       // FF00 LDA #$10
+      0x8D, 0x12, 0x25, // FF02 STA TIM64T
+      0xAD, 0x11, 0x25, // FF05 LDA TIMINT
+      0x10, 0xFB,       // FF08 BPL $FF05
+      0xAE, 0x10, 0x25, // FF0A LDX INTIM
+      0x4C, 0x0D, 0xFF, // FF0D JMP $FF0D
+      [0xFC] = 0x00,    // Reset vector -> $FF00
+      [0xFD] = 0xFF,
+  };
+  Machine *machine = fixture_machine(image, sizeof(image));
+  Bus *bus = &machine->cpu.bus;
+  uint64_t *now = &machine->cpu.cycles;
+
+  assert(bus_steady_until(bus, RIOT_REG_TIMINT) == UINT64_MAX);
+  *now = 100;
+  bus_write(bus, RIOT_REG_TIM8T, 3);
+  assert(bus_steady_until(bus, RIOT_REG_TIMINT) == 100 + 4 * 8);
+  assert(bus_steady_until(bus, RIOT_REG_INTIM) == 0);
+  assert(bus_steady_until(bus, INPUT_REG_PAD0) == UINT64_MAX);
+  assert(bus_steady_until(bus, 0x0200) == UINT64_MAX);
+  // Up, the flag stays up until INTIM is read
+  *now = 100 + 4 * 8;
+  assert(bus_steady_until(bus, RIOT_REG_TIMINT) == UINT64_MAX);
+  machine_destroy(machine);
+
+  // The loop waiting on it ends on the same cycle in every engine
+  uint64_t cycles[3];
+  uint8_t x[3];
+  for (int engine = 0; engine < 3; engine++) {
+    machine = fixture_machine(wait, sizeof(wait));
+    if (engine == 0)
+      block_cache_detach(&machine->cpu);
+    else
+      block_cache_set_jit(&machine->cpu, engine == 2);
+    assert(machine_run_frame(machine) == STOP_BUDGET);
+    cycles[engine] = machine->cpu.cycles;
+    x[engine] = machine->cpu.x;
+    assert(machine->cpu.pc == 0xFF0D || machine->cpu.pc == 0xFF10);
+    machine_destroy(machine);
+  }
+  assert(x[0] > 0xF0);
+  assert(x[1] == x[0] && x[2] == x[0]);
+  assert(cycles[1] == cycles[0] && cycles[2] == cycles[0]);
+  printf("PASS!\n");
+}
+
+void test_rewind_restores_timer() {
+  printf("TEST: Save States Restore The Timer...\n");
+  Machine *machine = fixture_machine(image, sizeof(image));
+  Rewind *rewind = rewind_create(machine, 4, 0);
+
+  // The program is done with the timer after the first frame
+  assert(rewind != NULL);
+  assert(machine_run_frame(machine) == STOP_BUDGET);
+  bus_write(&machine->cpu.bus, RIOT_REG_T1024T + RIOT_IRQ_ENABLE, 200);
+  uint8_t count = riot_timer(&machine->riot);
+
+  rewind_snapshot(rewind);
+  assert(machine_run_frame(machine) == STOP_BUDGET);
+  bus_write(&machine->cpu.bus, RIOT_REG_TIM1T, 5);
+  assert(rewind_restore(rewind, 0) == 0);
+  assert(riot_timer(&machine->riot) == count);
+  assert(sched_pending(&machine->sched, SCHED_EVENT_RIOT_TIMER));
+
+  rewind_destroy(rewind);
+  machine_destroy(machine);
+  printf("PASS!\n");
+}
+
+int main() {
+  test_timer_counts_lazily();
+  test_underflow_interrupt();
+  test_engines_poll_alike();
+  test_steadiness();
+  test_rewind_restores_timer();
+
+  printf("\nALL TESTS WERE PASSED.\n");
+  return 0;
+}
@@ -0,0 +1,190 @@
+/*
+ * rvm-8/kernel/tests/test_rom.c
+ *
+ * Unit tests for the rvm-8 .rvm loader.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../rom.h"
+
+#define ROM_PATH "test_rom.rvm"
+
+uint8_t file[8192];
+size_t file_size;
+
+/* Starts a ROM image with an empty section table. */
+static void rom_begin(unsigned sections) {
+  memset(file, 0, sizeof(file));
+  memcpy(file, ROM_MAGIC, 4);
+  file[4] = ROM_VERSION;
+  file[6] = sections;
+  file_size = ROM_HEADER_SIZE + sections * ROM_SECTION_SIZE;
+}
+
+/* Appends a section's data and fills in its table entry. */
+static uint8_t *rom_add(unsigned index, uint8_t type, uint8_t page,
+                        uint32_t size) {
+  uint8_t *entry = &file[ROM_HEADER_SIZE + index * ROM_SECTION_SIZE];
+  uint32_t offset = file_size;
+
+  entry[0] = type;
+  entry[1] = page;
+  for (int i = 0; i < 4; i++) {
+    entry[4 + i] = offset >> (8 * i);
+    entry[8 + i] = size >> (8 * i);
+  }
+  file_size += size;
+  assert(file_size <= sizeof(file));
+  return &file[offset];
+}
+
+/* A ROM with code at $8000, data, a vector page, tiles and palettes. */
+static void build_demo() {
+  rom_begin(5);
+
+  uint8_t *code = rom_add(0, ROM_SECTION_CODE, 0x80, 256);
+  static const uint8_t prog[] = {
+      0xAD, 0x00, 0x90, // 8000 LDA $9000
+      0x85, 0x10,       // 8003 STA $10
+      0x8D, 0x00, 0x90, // 8005 STA $9000 (discarded)
+      0x8D, 0x00, 0x80, // 8008 STA $8000 (discarded)
+      0x4C, 0x0B, 0x80, // 800B JMP $800B
+  };
+  memcpy(code, prog, sizeof(prog));
+
+  uint8_t *data = rom_add(1, ROM_SECTION_DATA, 0x90, 512);
+  data[0] = 0x5A;
+
+  uint8_t *tiles = rom_add(2, ROM_SECTION_TILES, BUS_VRAM_PAGE, 512);
+  memset(tiles, 0xFF, 16); // Tile 0 is solid color 3
+
+  uint8_t *palette = rom_add(3, ROM_SECTION_PALETTE, 0, 2);
+  palette[0] = 0x1B;
+  palette[1] = 0x39;
+
+  uint8_t *vectors = rom_add(4, ROM_SECTION_CODE, BUS_ROM_PAGE, 256);
+  vectors[0xFC] = 0x00; // Reset vector -> $8000
+  vectors[0xFD] = 0x80;
+}
+
+static RomError parse() {
+  Rom rom;
+  return rom_parse(&rom, file, file_size);
+}
+
+void test_rejects_bad_roms() {
+  printf("TEST: Malformed ROMs Are Rejected...\n");
+
+  build_demo();
+  assert(parse() == ROM_OK);
+
+  file[0] = 'X';
+  assert(parse() == ROM_ERR_HEADER);
+  build_demo();
+  file[4] = ROM_VERSION + 1;
+  assert(parse() == ROM_ERR_HEADER);
+  build_demo();
+  file[6] = 200; // Table runs past the end
+  assert(parse() == ROM_ERR_HEADER);
+  assert(rom_parse(&(Rom){0}, file, 8) == ROM_ERR_HEADER);
+
+  // Sections outside the file, or not a whole number of pages
+  rom_begin(1);
+  rom_add(0, ROM_SECTION_CODE, 0x80, 256);
+  file_size -= 1;
+  assert(parse() == ROM_ERR_SECTION);
+  rom_begin(1);
+  rom_add(0, ROM_SECTION_CODE, 0x80, 100);
+  assert(parse() == ROM_ERR_SECTION);
+  rom_begin(1);
+  rom_add(0, ROM_SECTION_PALETTE, 0, 3);
+  assert(parse() == ROM_ERR_SECTION);
+  rom_begin(1);
+  rom_add(0, 9, 0x80, 256);
+  assert(parse() == ROM_ERR_SECTION);
+
+  // Sections over the device pages, the end of memory or each other
+  rom_begin(1);
+  rom_add(0, ROM_SECTION_DATA, 0x23, 512);
+  assert(parse() == ROM_ERR_PLACEMENT);
+  rom_begin(1);
+  rom_add(0, ROM_SECTION_CODE, 0xFF, 512);
+  assert(parse() == ROM_ERR_PLACEMENT);
+  rom_begin(2);
+  rom_add(0, ROM_SECTION_CODE, 0x80, 512);
+  rom_add(1, ROM_SECTION_DATA, 0x81, 256);
+  assert(parse() == ROM_ERR_PLACEMENT);
+  rom_begin(1);
+  rom_add(0, ROM_SECTION_TILES, 0x21, 256);
+  assert(parse() == ROM_ERR_PLACEMENT);
+
+  assert(rom_open(&(Rom){0}, "no/such/file.rvm") == ROM_ERR_IO);
+  printf("PASS!\n");
+}
+
+void test_load_maps_sections() {
+  printf("TEST: ROM Sections Are Mapped In Place...\n");
+
+  build_demo();
+  FILE *out = fopen(ROM_PATH, "wb");
+  assert(out != NULL);
+  assert(fwrite(file, 1, file_size, out) == file_size);
+  fclose(out);
+
+  Rom rom;
+  assert(rom_open(&rom, ROM_PATH) == ROM_OK);
+  assert(rom.mapped && rom.size == file_size);
+
+  Machine *a = machine_create();
+  Machine *b = machine_create();
+  rom_load(a, &rom);
+  rom_load(b, &rom);
+  assert(a->cpu.pc == 0x8000);
+
+  // Both machines read the same file pages; nothing was copied
+  const uint8_t *code = a->cpu.bus.read_map[0x80];
+  assert(code != &a->memory[0x8000]);
+  assert(code == b->cpu.bus.read_map[0x80]);
+  assert(code >= rom.data && code < rom.data + rom.size);
+  assert(a->cpu.bus.read_map[0x91] == a->cpu.bus.read_map[0x90] + 256);
+  assert(a->memory[0x8000] == 0);
+
+  // Code runs, and writes to ROM sections are dropped
+  assert(machine_run_frame(a) == STOP_BUDGET);
+  assert(a->memory[0x10] == 0x5A);
+  assert(mem_read(&a->cpu, 0x9000) == 0x5A);
+  assert(mem_read(&a->cpu, 0x8000) == 0xAD);
+
+  // Tiles go to the PPU straight from the file, palettes to its registers
+  assert(a->ppu.bgp == 0x1B && a->ppu.obp == 0x39);
+  assert(a->ppu.tiles[0][0] == 3 && a->ppu.tiles[1][0] == 0);
+  assert(ppu_front_buffer(&a->ppu, NULL)[0] == ((0x1B >> 6) & 3));
+
+  // Loading a raw image puts RAM back everywhere
+  static const uint8_t image[4];
+  assert(machine_load_image(a, image, sizeof(image)) == 0);
+  assert(a->cpu.bus.read_map[0x80] == &a->memory[0x8000]);
+  assert(a->cpu.bus.read_map[0x20] == &a->memory[0x2000]);
+  assert(a->ppu.bgp == 0xE4);
+
+  machine_destroy(a);
+  machine_destroy(b);
+  rom_close(&rom);
+  assert(rom.data == NULL);
+  remove(ROM_PATH);
+  printf("PASS!\n");
+}
+
+int main() {
+  test_rejects_bad_roms();
+  test_load_maps_sections();
+
+  printf("\nALL TESTS WERE PASSED.\n");
+  return 0;
+}
@@ -0,0 +1,174 @@
+/*
+ * rvm-8/kernel/tests/test_sched.c
+ *
+ * Unit tests for the rvm-8 event scheduler.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../machine.h"
+#include "../sched.h"
+#include "fixture.h"
+
+#define EVENT_A SCHED_EVENT_LINE
+#define EVENT_PERIOD 100
+
+typedef struct {
+  Scheduler *sched;
+  uint64_t when[16];
+  unsigned count;
+  /** Reschedule every EVENT_PERIOD cycles while non-zero */
+  unsigned repeat;
+} Log;
+
+static void on_event(void *ctx, uint64_t when) {
+  Log *log = ctx;
+
+  log->when[log->count++] = when;
+  if (log->repeat > 0) {
+    log->repeat--;
+    sched_add(log->sched, EVENT_A, when + EVENT_PERIOD);
+  }
+}
+
+void test_events_run_in_order() {
+  printf("TEST: Events Run When Due, In Order...\n");
+  Scheduler sched;
+  Log log = {.sched = &sched};
+
+  sched_init(&sched);
+  sched_set_handler(&sched, EVENT_A, on_event, &log);
+  assert(sched_next(&sched) == SCHED_NEVER);
+
+  sched_add(&sched, EVENT_A, 500);
+  assert(sched_pending(&sched, EVENT_A) && sched_next(&sched) == 500);
+  sched_run_until(&sched, 499);
+  assert(log.count == 0);
+
+  // Moving a pending event does not add a second one
+  sched_add(&sched, EVENT_A, 300);
+  assert(sched_next(&sched) == 300);
+  sched_run_until(&sched, 1000);
+  assert(log.count == 1 && log.when[0] == 300);
+  assert(!sched_pending(&sched, EVENT_A));
+
+  sched_add(&sched, EVENT_A, 2000);
+  sched_cancel(&sched, EVENT_A);
+  sched_cancel(&sched, EVENT_A);
+  assert(sched_next(&sched) == SCHED_NEVER);
+  sched_run_until(&sched, 5000);
+  assert(log.count == 1);
+  printf("PASS!\n");
+}
+
+void test_periodic_events_do_not_drift() {
+  printf("TEST: Rescheduled Events Keep Their Period...\n");
+  Scheduler sched;
+  Log log = {.sched = &sched, .repeat = 4};
+
+  sched_init(&sched);
+  sched_set_handler(&sched, EVENT_A, on_event, &log);
+  sched_add(&sched, EVENT_A, 1000);
+
+  // Late runs still see the due cycle, and catch up in one call
+  sched_run_until(&sched, 1150);
+  assert(log.count == 2 && log.when[1] == 1100);
+  sched_run_until(&sched, 1400);
+  assert(log.count == 5 && log.when[4] == 1400);
+  assert(!sched_pending(&sched, EVENT_A));
+
+  // Cycles are 64-bit
+  log.repeat = 1;
+  sched_add(&sched, EVENT_A, 0x100000000ull - 50);
+  sched_run_until(&sched, 0x100000000ull + EVENT_PERIOD);
+  assert(log.count == 7 && log.when[6] == 0x100000000ull + 50);
+  printf("PASS!\n");
+}
+
+/* Splits the screen: light background on top, dark from line 72. */
+static const uint8_t image[256] = {
+    0xA9, 0x01,       // FF00 LDA #$01
+    0x8D, 0x00, 0x24, // FF02 STA $2400 (background on)
+    0xA9, 0x00,       // FF05 LDA #$00
+    0x8D, 0x01, 0x24, // FF07 STA $2401 (all shades 0)
+    0xA2, 0x00,       // FF0A LDX #$00
+    0xE8,             // FF0C INX
+    0xD0, 0xFD,       // FF0D BNE $FF0C
+    0xA9, 0xFF,       // FF0F LDA #$FF
+    0x8D, 0x01, 0x24, // FF11 STA $2401 (all shades 3)
+    0x4C, 0x14, 0xFF, // FF14 JMP $FF14
+    [0xFC] = 0x00,    // Reset vector -> $FF00
+    [0xFD] = 0xFF,
+};
+
+void test_lines_render_when_they_end() {
+  printf("TEST: Scanlines Show Mid-Frame Register Writes...\n");
+  Machine *machine = fixture_machine(image, sizeof(image));
+
+  assert(machine_run_frame(machine) == STOP_BUDGET);
+  assert(machine->line == 0 && ppu_frame_sequence(&machine->ppu) == 1);
+
+  // 2 + 4 + 2 + 4 + 2 cycles, 256 loops of INX/BNE, then the store
+  unsigned split = (2 + 4 + 2 + 4 + 2 + 256 * (2 + 3) - 1 + 2 + 4) *
+                   MACHINE_FRAME_LINES / MACHINE_FRAME_CYCLES;
+  const uint8_t *frame = ppu_front_buffer(&machine->ppu, NULL);
+  assert(split > 0 && split + 1 < PPU_HEIGHT);
+  assert(frame[(split - 1) * PPU_WIDTH] == 0);
+  assert(frame[(split + 1) * PPU_WIDTH] == 3);
+
+  // The next frame starts dark
+  assert(machine_run_frame(machine) == STOP_BUDGET);
+  frame = ppu_front_buffer(&machine->ppu, NULL);
+  assert(frame[0] == 3 && frame[(PPU_HEIGHT - 1) * PPU_WIDTH] == 3);
+  machine_destroy(machine);
+  printf("PASS!\n");
+}
+
+void test_frames_past_32_bits() {
+  printf("TEST: Frames Keep Their Length Past 2^32 Cycles...\n");
+  Machine *machine = fixture_machine(image, sizeof(image));
+  uint32_t frames = (uint32_t)(0x100000000ull / MACHINE_FRAME_CYCLES);
+
+  machine->frames = frames;
+  machine->cpu.cycles = (uint64_t)frames * MACHINE_FRAME_CYCLES;
+  machine_reschedule(machine);
+
+  for (int i = 0; i < 3; i++)
+    assert(machine_run_frame(machine) == STOP_BUDGET);
+  assert(machine->cpu.cycles >= (uint64_t)(frames + 3) * MACHINE_FRAME_CYCLES);
+  assert(machine->cpu.cycles - (uint64_t)(frames + 3) * MACHINE_FRAME_CYCLES <
+         8);
+  assert(ppu_frame_sequence(&machine->ppu) == 3);
+  machine_destroy(machine);
+  printf("PASS!\n");
+}
+
+void test_halted_frames_are_published() {
+  printf("TEST: Frames Are Published When The CPU Stops...\n");
+  Machine *machine = fixture_machine(image, sizeof(image));
+
+  machine->cpu.halted = 1;
+  assert(machine_run_frame(machine) == STOP_HALT);
+  assert(machine_run_frame(machine) == STOP_HALT);
+  assert(ppu_frame_sequence(&machine->ppu) == 2 && machine->frames == 2);
+  assert(machine->line == 0);
+  assert(sched_next(&machine->sched) > 2 * MACHINE_FRAME_CYCLES);
+  machine_destroy(machine);
+  printf("PASS!\n");
+}
+
+int main() {
+  test_events_run_in_order();
+  test_periodic_events_do_not_drift();
+  test_lines_render_when_they_end();
+  test_frames_past_32_bits();
+  test_halted_frames_are_published();
+
+  printf("\nALL TESTS WERE PASSED.\n");
+  return 0;
+}
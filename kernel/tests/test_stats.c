@@ -0,0 +1,120 @@
+/*
+ * rvm-8/kernel/tests/test_stats.c
+ *
+ * Unit tests for the rvm-8 instrumentation counters. The full checks
+ * need an instrumented build (make clean && make STATS=1 test_stats).
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../block.h"
+#include "../machine.h"
+#include "fixture.h"
+
+#if RVM_STATS
+/* Page crossings, device registers and VRAM, forever. */
+static const uint8_t image[256] = {
+    0xA2, 0x10,       // FF00 LDX #$10
+    0xBD, 0xF8, 0x30, // FF02 LDA $30F8,X (crosses)
+    0xBD, 0x00, 0x30, // FF05 LDA $3000,X
+    0x8D, 0x01, 0x24, // FF08 STA $2401
+    0xAD, 0x00, 0x25, // FF0B LDA $2500
+    0x8D, 0x00, 0x20, // FF0E STA $2000 (tile data)
+    0x4C, 0x02, 0xFF, // FF11 JMP $FF02
+    [0xFC] = 0x00,    // Reset vector -> $FF00
+    [0xFD] = 0xFF,
+};
+
+static Machine *start_machine(int blocks) {
+  Machine *machine = fixture_machine(image, sizeof(image));
+
+  if (!blocks)
+    block_cache_detach(&machine->cpu);
+  machine_reset_stats(machine);
+  return machine;
+}
+
+void test_counts_instructions() {
+  printf("TEST: Opcodes, Cycles And Page Crossings Are Counted...\n");
+  Machine *machine = start_machine(0);
+
+  // The PPU arms its VRAM traps when it renders the first frame
+  assert(machine_run_frame(machine) == STOP_BUDGET);
+  machine_reset_stats(machine);
+  uint64_t start = machine->cpu.cycles;
+  assert(machine_run_frame(machine) == STOP_BUDGET);
+  const Stats *stats = machine_stats(machine);
+  uint64_t loops = stats->executed[0x4C], cycles = 0;
+
+  assert(loops > 1000);
+  assert(stats->executed[0xBD] >= 2 * loops);
+  assert(stats->page_crossings[0xBD] == (stats->executed[0xBD] + 1) / 2);
+  assert(stats->cycles[0xBD] ==
+         4 * stats->executed[0xBD] + stats->page_crossings[0xBD]);
+  assert(stats->page_crossings[0x8D] == 0);
+  for (int opc = 0; opc < 256; opc++)
+    cycles += stats->cycles[opc];
+  assert(cycles == machine->cpu.cycles - start);
+
+  // Device registers and trapped VRAM go through the slow path
+  assert(stats->writes[STATS_REGION_PPU] + stats->writes[STATS_REGION_VRAM] ==
+         stats->executed[0x8D]);
+  assert(stats->writes[STATS_REGION_VRAM] + 1 >= loops);
+  assert(stats->writes[STATS_REGION_OTHER] == 0);
+  assert(stats->reads[STATS_REGION_INPUT] == stats->executed[0xAD]);
+  assert(stats->reads[STATS_REGION_VRAM] == 0);
+
+  machine_reset_stats(machine);
+  assert(stats->executed[0x4C] == 0 && stats->reads[STATS_REGION_INPUT] == 0);
+  machine_destroy(machine);
+  printf("PASS!\n");
+}
+
+void test_engines_agree() {
+  printf("TEST: Interpreter And Block Cache Count Alike...\n");
+  Machine *plain = start_machine(0);
+  Machine *cached = start_machine(1);
+
+  // No recompiler in instrumented builds
+  assert(block_cache_set_jit(&cached->cpu, 1) == -1);
+  for (int frame = 0; frame < 3; frame++) {
+    machine_run_frame(plain);
+    machine_run_frame(cached);
+  }
+  assert(plain->cpu.cycles == cached->cpu.cycles);
+  assert(memcmp(machine_stats(plain), machine_stats(cached), sizeof(Stats)) ==
+         0);
+
+  machine_destroy(plain);
+  machine_destroy(cached);
+  printf("PASS!\n");
+}
+#else
+void test_compiled_out() {
+  printf("TEST: Counters Are Compiled Out By Default...\n");
+  Machine *machine = machine_create();
+
+  assert(machine != NULL);
+  assert(machine_stats(machine) == NULL);
+  machine_reset_stats(machine);
+  machine_destroy(machine);
+  printf("PASS!\n");
+}
+#endif
+
+int main() {
+#if RVM_STATS
+  test_counts_instructions();
+  test_engines_agree();
+#else
+  test_compiled_out();
+#endif
+
+  printf("\nALL TESTS WERE PASSED.\n");
+  return 0;
+}
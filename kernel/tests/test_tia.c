@@ -0,0 +1,220 @@
+/*
+ * rvm-8/kernel/tests/test_tia.c
+ *
+ * Unit tests for the rvm-8 TIA and its sample ring.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../rewind.h"
+#include "fixture.h"
+
+/* Full volume on voice 0, held high, then an idle loop. */
+static const uint8_t image[256] = {
+    0xA9, 0x00,       // FF00 LDA #$00 (shape 0: held high)
+    0x8D, 0x20, 0x25, // FF02 STA AUDC0
+    0xA9, 0x0F,       // FF05 LDA #$0F
+    0x8D, 0x24, 0x25, // FF07 STA AUDV0
+    0x4C, 0x0A, 0xFF, // FF0A JMP $FF0A
+    [0xFC] = 0x00,    // Reset vector -> $FF00
+    [0xFD] = 0xFF,
+};
+
+static Machine *start_machine(TiaRing *ring) {
+  Machine *machine = fixture_machine(image, sizeof(image));
+
+  machine_set_audio(machine, ring);
+  return machine;
+}
+
+void test_ring_order_and_overflow() {
+  printf("TEST: The Ring Keeps Order And Drops What Does Not Fit...\n");
+  TiaRing *ring = tia_ring_create();
+  Machine *machine = start_machine(ring);
+  int16_t out[TIA_RING_SIZE];
+
+  assert(ring != NULL);
+  assert(tia_ring_level(ring) == 0 && tia_ring_read(ring, out, 16) == 0);
+
+  // Nobody drains the ring for a second of emulated time
+  for (int i = 0; i < MACHINE_FRAME_RATE; i++)
+    assert(machine_run_frame(machine) == STOP_BUDGET);
+  uint64_t batches = machine->cpu.cycles / TIA_BATCH_CYCLES;
+  assert(tia_ring_level(ring) == TIA_RING_SIZE);
+  assert(tia_ring_dropped(ring) ==
+         batches * TIA_BATCH_SAMPLES - TIA_RING_SIZE);
+
+  // Reads pick up where they stopped, wrapping around the buffer
+  assert(tia_ring_read(ring, out, 100) == 100);
+  assert(tia_ring_level(ring) == TIA_RING_SIZE - 100);
+  assert(machine_run_frame(machine) == STOP_BUDGET);
+  assert(tia_ring_level(ring) == TIA_RING_SIZE);
+  assert(tia_ring_read(ring, out, TIA_RING_SIZE) == TIA_RING_SIZE);
+  assert(tia_ring_level(ring) == 0);
+  for (int i = 0; i < TIA_RING_SIZE; i++)
+    assert(out[i] == 15 * TIA_SAMPLE_SCALE);
+
+  machine_set_audio(machine, NULL);
+  machine_destroy(machine);
+  tia_ring_destroy(ring);
+  printf("PASS!\n");
+}
+
+void test_batches_at_events() {
+  printf("TEST: Samples Are Rendered In Batches At Events...\n");
+  TiaRing *ring = tia_ring_create();
+  Machine *machine = start_machine(ring);
+  int16_t out[TIA_BATCH_SAMPLES * 10];
+
+  // Writes only go into the log until the next batch
+  assert(sched_pending(&machine->sched, SCHED_EVENT_TIA_SAMPLES));
+  assert(machine->sched.when[SCHED_EVENT_TIA_SAMPLES] == TIA_BATCH_CYCLES);
+  assert(cpu_run(&machine->cpu, 20, NULL) == STOP_BUDGET);
+  assert(machine->tia.logged == 2 && machine->tia.regs.audv[0] == 0);
+  assert(tia_regs(&machine->tia).audv[0] == 15);
+  assert(tia_ring_level(ring) == 0);
+
+  assert(machine_run_frame(machine) == STOP_BUDGET);
+  assert(tia_ring_level(ring) == (MACHINE_FRAME_CYCLES / TIA_BATCH_CYCLES) *
+                                     TIA_BATCH_SAMPLES);
+  assert(machine->tia.logged == 0);
+
+  // The first sample precedes the volume write at cycle 8
+  size_t count = tia_ring_read(ring, out, TIA_BATCH_SAMPLES);
+  assert(count == TIA_BATCH_SAMPLES);
+  assert(out[0] == 0 && out[1] == 15 * TIA_SAMPLE_SCALE);
+
+  // Detaching renders the rest of the batch under way: one sample for
+  // every cycle a sample is due on so far
+  machine_set_audio(machine, NULL);
+  uint64_t due = (machine->cpu.cycles + TIA_CYCLES_PER_SAMPLE - 1) /
+                 TIA_CYCLES_PER_SAMPLE;
+  assert(count + tia_ring_level(ring) == due);
+  assert(due % TIA_BATCH_SAMPLES != 0);
+
+  // Without a ring nothing is scheduled and writes apply at once
+  assert(!sched_pending(&machine->sched, SCHED_EVENT_TIA_SAMPLES));
+  bus_write(&machine->cpu.bus, TIA_REG_AUDV1, 0xFF);
+  assert(machine->tia.regs.audv[1] == 0x0F && machine->tia.logged == 0);
+
+  // A ring attached again keeps to the same sample cycles
+  machine_set_audio(machine, ring);
+  assert(machine->tia.rendered % TIA_CYCLES_PER_SAMPLE == 0);
+  assert(machine->tia.rendered >= machine->cpu.cycles &&
+         machine->tia.rendered < machine->cpu.cycles + TIA_CYCLES_PER_SAMPLE);
+  machine_set_audio(machine, NULL);
+
+  machine_destroy(machine);
+  tia_ring_destroy(ring);
+  printf("PASS!\n");
+}
+
+void test_writes_take_effect_on_time() {
+  printf("TEST: Logged Writes Apply At The Sample They Fall On...\n");
+  TiaRing *ring = tia_ring_create();
+  Machine *machine = start_machine(ring);
+  Bus *bus = &machine->cpu.bus;
+  uint64_t *now = &machine->cpu.cycles;
+  int16_t out[TIA_BATCH_SAMPLES * 2];
+
+  machine->cpu.halted = 1;
+  bus_write(bus, TIA_REG_AUDC1, 0x04);
+  bus_write(bus, TIA_REG_AUDV1, 0x08);
+  *now = 10 * TIA_CYCLES_PER_SAMPLE + 1;
+  bus_write(bus, TIA_REG_AUDV1, 0x00);
+
+  // A full log renders up to the current cycle to make room; AUDF
+  // keeps 5 bits
+  for (unsigned i = 0; i < TIA_LOG_SIZE; i++)
+    bus_write(bus, TIA_REG_AUDF0, (uint8_t)i);
+  assert(tia_ring_level(ring) == 11);
+  assert(machine->tia.logged == 3 && machine->tia.regs.audf[0] == 60 % 32);
+
+  *now = 2 * TIA_BATCH_CYCLES;
+  sched_run_until(&machine->sched, *now);
+  assert(tia_ring_read(ring, out, 2 * TIA_BATCH_SAMPLES) ==
+         2 * TIA_BATCH_SAMPLES);
+  assert(machine->tia.regs.audf[0] == 63 % 32 && machine->tia.logged == 0);
+
+  // Shape 4 halves the clock: samples 0-10 alternate, then silence
+  for (int i = 0; i <= 10; i++)
+    assert(out[i] == (i & 1 ? 8 * TIA_SAMPLE_SCALE : 0));
+  for (int i = 11; i < 2 * TIA_BATCH_SAMPLES; i++)
+    assert(out[i] == 0);
+
+  machine_destroy(machine);
+  tia_ring_destroy(ring);
+  printf("PASS!\n");
+}
+
+/* Runs noise on both voices for a few frames and returns the samples. */
+static size_t run_noise(int16_t *out, size_t max, uint8_t *regs,
+                        int rewind_once) {
+  TiaRing *ring = tia_ring_create();
+  Machine *machine = start_machine(ring);
+  Rewind *rewind = rewind_create(machine, 4, 0);
+  Bus *bus = &machine->cpu.bus;
+  size_t count = 0;
+
+  assert(rewind != NULL);
+  bus_write(bus, TIA_REG_AUDC1, 0x08);
+  bus_write(bus, TIA_REG_AUDF1, 0x03);
+  bus_write(bus, TIA_REG_AUDV1, 0x06);
+  rewind_snapshot(rewind);
+  for (int frame = 0; frame < 4; frame++) {
+    assert(machine_run_frame(machine) == STOP_BUDGET);
+    count += tia_ring_read(ring, out + count, max - count);
+  }
+  if (rewind_once) {
+    bus_write(bus, TIA_REG_AUDV1, 0x00);
+    assert(rewind_restore(rewind, 0) == 0);
+  }
+  TiaRegs now = tia_regs(&machine->tia);
+  memcpy(regs, &now, sizeof(TiaRegs));
+
+  rewind_destroy(rewind);
+  machine_destroy(machine);
+  tia_ring_destroy(ring);
+  return count;
+}
+
+void test_deterministic_output() {
+  printf("TEST: Audio Is Deterministic And Survives Rewind...\n");
+  static int16_t a[4 * 1024], b[4 * 1024];
+  uint8_t regs_a[sizeof(TiaRegs)], regs_b[sizeof(TiaRegs)];
+
+  size_t count_a = run_noise(a, 4 * 1024, regs_a, 0);
+  size_t count_b = run_noise(b, 4 * 1024, regs_b, 1);
+  assert(count_a == count_b && count_a > 2000);
+  assert(memcmp(a, b, count_a * sizeof(int16_t)) == 0);
+
+  // Voice 1 is noise: both levels show up, not a constant
+  int low = 0, high = 0;
+  for (size_t i = 0; i < count_a; i++) {
+    low += a[i] == 15 * TIA_SAMPLE_SCALE;
+    high += a[i] == 21 * TIA_SAMPLE_SCALE;
+  }
+  assert(low > 100 && high > 100 && low + high == (int)count_a - 1);
+
+  // The restored registers are the ones in the snapshot
+  assert(regs_b[4] == 0 && regs_b[5] == 0x06);
+  assert(memcmp(regs_a, regs_b, sizeof(TiaRegs)) != 0);
+  regs_a[4] = 0;
+  assert(memcmp(regs_a, regs_b, sizeof(TiaRegs)) == 0);
+  printf("PASS!\n");
+}
+
+int main() {
+  test_ring_order_and_overflow();
+  test_batches_at_events();
+  test_writes_take_effect_on_time();
+  test_deterministic_output();
+
+  printf("\nALL TESTS WERE PASSED.\n");
+  return 0;
+}
@@ -0,0 +1,209 @@
+/*
+ * rvm-8/kernel/tests/test_trace.c
+ *
+ * Unit tests for the rvm-8 execution tracer.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../machine.h"
+#include "../trace.h"
+#include "fixture.h"
+
+#define TRACE_PATH "test_trace.out"
+#define FRAMES 20
+
+/* Counts X up and sums it into $10, stored to $0300,X, forever. */
+static const uint8_t image[256] = {
+    0xE8,             // FF00 INX
+    0x86, 0x20,       // FF01 STX $20
+    0xA5, 0x20,       // FF03 LDA $20
+    0x65, 0x10,       // FF05 ADC $10
+    0x85, 0x10,       // FF07 STA $10
+    0x9D, 0x00, 0x03, // FF09 STA $0300,X
+    0xD0, 0xF2,       // FF0C BNE $FF00
+    0xC8,             // FF0E INY
+    0x4C, 0x00, 0xFF, // FF0F JMP $FF00
+    [0xFC] = 0x00,    // Reset vector -> $FF00
+    [0xFD] = 0xFF,
+};
+
+static uint32_t get_u32(const uint8_t *in) {
+  return in[0] | in[1] << 8 | in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+/* Reads a whole trace back; returns the records and sets *count. */
+static TraceRecord *read_trace(uint64_t *count, unsigned *chunks) {
+  FILE *in = fopen(TRACE_PATH, "rb");
+  uint8_t header[8], chunk[8];
+  TraceRecord *records = NULL;
+  uint8_t *payload = malloc(trace_bound(TRACE_BUFFER_RECORDS));
+
+  assert(in != NULL && payload != NULL);
+  assert(fread(header, 1, 8, in) == 8);
+  assert(memcmp(header, "RVMT\1\0\12\0", 8) == 0);
+  *count = 0;
+  *chunks = 0;
+  while (fread(chunk, 1, 8, in) == 8) {
+    uint32_t n = get_u32(chunk), size = get_u32(chunk + 4);
+
+    assert(n > 0 && n <= TRACE_BUFFER_RECORDS);
+    assert(fread(payload, 1, size, in) == size);
+    records = realloc(records, (*count + n) * sizeof(TraceRecord));
+    assert(records != NULL);
+    assert(trace_decode(payload, size, records + *count, n) == 0);
+    *count += n;
+    ++*chunks;
+  }
+  fclose(in);
+  free(payload);
+  return records;
+}
+
+void test_round_trip() {
+  printf("TEST: Records Survive Encoding...\n");
+  enum { COUNT = 5000 };
+  TraceRecord *records = malloc(COUNT * sizeof(TraceRecord));
+  TraceRecord *decoded = malloc(COUNT * sizeof(TraceRecord));
+  uint8_t *payload = malloc(trace_bound(COUNT));
+  uint32_t seed = 1;
+
+  assert(records != NULL && decoded != NULL && payload != NULL);
+  // Straight-line code in the first half, noise in the second
+  for (int i = 0; i < COUNT; i++) {
+    seed = seed * 1103515245 + 12345;
+    TraceRecord *rec = &records[i];
+    if (i < COUNT / 2) {
+      *rec = (TraceRecord){.pc = (uint16_t)(0x8000 + i), .sp = 0x1FD,
+                           .opcode = 0xE8, .x = (uint8_t)i, .cycles = 2};
+    } else {
+      memcpy(rec, &seed, 4);
+      memcpy((uint8_t *)rec + 4, &seed, 4);
+      rec->flags = (uint8_t)(seed >> 16);
+      rec->cycles = (uint8_t)(seed >> 24);
+    }
+  }
+
+  size_t size = trace_encode(records, COUNT / 2, payload);
+  // Only the X column changes (PCs are as predicted)
+  assert(size < COUNT / 2 * TRACE_RECORD_SIZE / 8);
+  assert(trace_decode(payload, size, decoded, COUNT / 2) == 0);
+  assert(memcmp(records, decoded, COUNT / 2 * sizeof(TraceRecord)) == 0);
+
+  size = trace_encode(records, COUNT, payload);
+  assert(trace_decode(payload, size, decoded, COUNT) == 0);
+  assert(memcmp(records, decoded, COUNT * sizeof(TraceRecord)) == 0);
+
+  // Truncated or padded payloads are refused
+  assert(trace_decode(payload, size - 1, decoded, COUNT) == -1);
+  assert(trace_decode(payload, size, decoded, COUNT - 1) == -1);
+  assert(trace_decode(payload, size, decoded, COUNT + 1) == -1);
+
+  free(payload);
+  free(decoded);
+  free(records);
+  printf("PASS!\n");
+}
+
+void test_traces_every_instruction() {
+  printf("TEST: A Traced Run Records Every Instruction...\n");
+  Machine *traced = fixture_machine(image, sizeof(image));
+  Machine *plain = fixture_machine(image, sizeof(image));
+  Tracer *tracer = trace_open(TRACE_PATH);
+
+  assert(tracer != NULL);
+  machine_set_tracer(traced, tracer);
+  for (int frame = 0; frame < FRAMES; frame++) {
+    assert(machine_run_frame(traced) == STOP_BUDGET);
+    assert(machine_run_frame(plain) == STOP_BUDGET);
+  }
+  // Tracing changes nothing the ROM can see
+  assert(machine_hash(traced) == machine_hash(plain));
+  uint64_t traced_count = trace_records(tracer);
+  uint64_t cycles = traced->cpu.cycles;
+  machine_set_tracer(traced, NULL);
+  assert(trace_close(tracer) == 0);
+
+  uint64_t count, sum = 0;
+  unsigned chunks;
+  TraceRecord *records = read_trace(&count, &chunks);
+  assert(count == traced_count);
+  assert(chunks == (count + TRACE_BUFFER_RECORDS - 1) / TRACE_BUFFER_RECORDS);
+  assert(chunks > 1);
+
+  assert(records[0].pc == 0xFF00 && records[0].opcode == 0xE8);
+  assert(records[0].x == 0 && records[0].sp == 0xFD);
+  for (uint64_t i = 0; i < count; i++) {
+    sum += records[i].cycles;
+    if (i == 0)
+      continue;
+    const TraceRecord *prev = &records[i - 1], *rec = &records[i];
+    switch (prev->opcode) {
+    case 0xE8: // INX
+      assert(rec->pc == 0xFF01 && rec->x == (uint8_t)(prev->x + 1));
+      break;
+    case 0xA5: // LDA $20
+      assert(rec->pc == 0xFF05 && rec->a == prev->x);
+      break;
+    case 0xD0: // BNE
+      // Taken on the flags recorded before it, as ADC left them
+      assert(rec->pc == (prev->flags & FLAG_Z ? 0xFF0E : 0xFF00));
+      assert(prev->cycles == (prev->flags & FLAG_Z ? 2 : 3));
+      break;
+    case 0xC8: // INY
+      assert(rec->y == (uint8_t)(prev->y + 1));
+      break;
+    }
+  }
+  assert(sum == cycles);
+
+  free(records);
+  remove(TRACE_PATH);
+  machine_destroy(plain);
+  machine_destroy(traced);
+  printf("PASS!\n");
+}
+
+void test_detached_runs_untraced() {
+  printf("TEST: Only Runs With A Tracer Attached Are Recorded...\n");
+  Machine *machine = fixture_machine(image, sizeof(image));
+  Tracer *tracer = trace_open(TRACE_PATH);
+
+  assert(tracer != NULL);
+  assert(machine_run_frame(machine) == STOP_BUDGET);
+  machine_set_tracer(machine, tracer);
+  uint64_t before = machine->cpu.cycles;
+  assert(cpu_run(&machine->cpu, 100, NULL) == STOP_BUDGET);
+  uint64_t spent = machine->cpu.cycles - before;
+  machine_set_tracer(machine, NULL);
+  assert(machine_run_frame(machine) == STOP_BUDGET);
+  assert(trace_close(tracer) == 0);
+
+  uint64_t count, sum = 0;
+  unsigned chunks;
+  TraceRecord *records = read_trace(&count, &chunks);
+  assert(chunks == 1 && count > 30 && count < 100);
+  for (uint64_t i = 0; i < count; i++)
+    sum += records[i].cycles;
+  assert(sum == spent);
+
+  free(records);
+  remove(TRACE_PATH);
+  machine_destroy(machine);
+  printf("PASS!\n");
+}
+
+int main() {
+  test_round_trip();
+  test_traces_every_instruction();
+  test_detached_runs_untraced();
+
+  printf("\nALL TESTS WERE PASSED.\n");
+  return 0;
+}
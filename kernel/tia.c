@@ -1,3 +1,288 @@
-//
-// Created by Holman Rugama on 6/12/25.
-//
\ No newline at end of file
+/*
+ * rvm-8/kernel/tia.c
+ *
+ * TIA sound generator for rvm-8.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ *
+ * Notes:
+ * - Samples sit on a grid of TIA_CYCLES_PER_SAMPLE cycles from the last
+ *   reschedule. A write at cycle c takes effect from the first sample at
+ *   or after c, however late the batch that renders it runs.
+ * - After rendering, the log only holds writes past the next sample, so
+ *   a forced render at the current cycle always empties it.
+ * - The voices approximate the TIA's shapes: the polynomial counters
+ *   have the TIA's tap positions, the divided tones are plain square
+ *   waves.
+ * - The producer publishes a whole batch with one release store of
+ *   head, and the consumer frees space with one release store of tail;
+ *   each side only reads the other's counter with an acquire load.
+ */
+
+#include "tia.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Stores a write into the registers.
+ *
+ * @param reg Offset of the register from TIA_REG_AUDC0.
+ */
+static void tia_apply(TiaRegs *regs, uint8_t reg, uint8_t val) {
+  static const uint8_t masks[3] = {0x0F, 0x1F, 0x0F};
+  uint8_t *fields[3] = {regs->audc, regs->audf, regs->audv};
+
+  fields[reg / 2][reg & 1] = val & masks[reg / 2];
+}
+
+/**
+ * @brief Steps a polynomial counter (a Fibonacci LFSR with taps at
+ * @p bits and @p tap) and returns the bit shifted out.
+ */
+static uint8_t tia_shift(uint16_t *lfsr, unsigned bits, unsigned tap) {
+  unsigned state = *lfsr;
+  unsigned feedback = (state ^ (state >> (bits - tap))) & 1;
+
+  *lfsr = (uint16_t)((state >> 1) | (feedback << (bits - 1)));
+  return state & 1;
+}
+
+/**
+ * @brief Counts a clock towards @p period; true every @p period clocks.
+ */
+static int tia_divide(TiaVoice *voice, unsigned period) {
+  if (++voice->phase < period)
+    return 0;
+  voice->phase = 0;
+  return 1;
+}
+
+/**
+ * @brief Square wave of @p period clocks.
+ */
+static void tia_tone(TiaVoice *voice, unsigned period) {
+  tia_divide(voice, period);
+  voice->out = voice->phase < period / 2;
+}
+
+/**
+ * @brief Advances a voice by one divided clock in the shape @p audc.
+ */
+static void tia_clock(TiaVoice *voice, uint8_t audc) {
+  switch (audc) {
+  case 0x1:
+    voice->out = tia_shift(&voice->poly4, 4, 3);
+    break;
+  case 0x2:
+    if (tia_divide(voice, 15))
+      voice->out = tia_shift(&voice->poly4, 4, 3);
+    break;
+  case 0x3:
+    if (tia_shift(&voice->poly5, 5, 3))
+      voice->out = tia_shift(&voice->poly4, 4, 3);
+    break;
+  case 0x4:
+  case 0x5:
+    tia_tone(voice, 2);
+    break;
+  case 0x6:
+  case 0xA:
+    tia_tone(voice, 31);
+    break;
+  case 0x7:
+  case 0x9:
+    voice->out = tia_shift(&voice->poly5, 5, 3);
+    break;
+  case 0x8:
+    voice->out = tia_shift(&voice->poly9, 9, 5);
+    break;
+  case 0xC:
+  case 0xD:
+    tia_tone(voice, 6);
+    break;
+  case 0xE:
+    tia_tone(voice, 93);
+    break;
+  case 0xF:
+    if (tia_divide(voice, 6))
+      voice->out = tia_shift(&voice->poly5, 5, 3);
+    break;
+  default: // 0x0 and 0xB hold the output high, at the volume
+    voice->out = 1;
+    break;
+  }
+}
+
+static int16_t tia_sample(Tia *tia) {
+  int level = 0;
+
+  for (unsigned v = 0; v < 2; v++) {
+    TiaVoice *voice = &tia->voices[v];
+
+    if (voice->divider++ >= tia->regs.audf[v]) {
+      voice->divider = 0;
+      tia_clock(voice, tia->regs.audc[v]);
+    }
+    if (voice->out)
+      level += tia->regs.audv[v];
+  }
+  return (int16_t)(level * TIA_SAMPLE_SCALE);
+}
+
+/**
+ * @brief Producer side: queues samples, dropping what does not fit.
+ */
+static void tia_ring_push(TiaRing *ring, const int16_t *samples,
+                          uint32_t count) {
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  uint32_t room = TIA_RING_SIZE - (head - tail);
+
+  if (count > room) {
+    atomic_fetch_add_explicit(&ring->dropped, count - room,
+                              memory_order_relaxed);
+    count = room;
+  }
+  for (uint32_t i = 0; i < count; i++)
+    ring->samples[(head + i) & (TIA_RING_SIZE - 1)] = samples[i];
+  atomic_store_explicit(&ring->head, head + count, memory_order_release);
+}
+
+/**
+ * @brief Renders every sample due before @p until into the ring,
+ * applying the logged writes as they come due.
+ */
+static void tia_render(Tia *tia, uint64_t until) {
+  int16_t batch[TIA_BATCH_SAMPLES];
+  unsigned count = 0, applied = 0;
+
+  for (;;) {
+    while (applied < tia->logged && tia->log[applied].cycle <= tia->rendered) {
+      tia_apply(&tia->regs, tia->log[applied].reg, tia->log[applied].val);
+      applied++;
+    }
+    if (tia->rendered >= until)
+      break;
+
+    batch[count++] = tia_sample(tia);
+    tia->rendered += TIA_CYCLES_PER_SAMPLE;
+    if (count == TIA_BATCH_SAMPLES) {
+      tia_ring_push(tia->ring, batch, count);
+      count = 0;
+    }
+  }
+  if (count > 0)
+    tia_ring_push(tia->ring, batch, count);
+
+  tia->logged -= applied;
+  memmove(tia->log, tia->log + applied, tia->logged * sizeof(TiaWrite));
+}
+
+/**
+ * @brief SCHED_EVENT_TIA_SAMPLES: renders the batch that just ended.
+ */
+static void tia_on_batch(void *ctx, uint64_t when) {
+  Tia *tia = ctx;
+
+  tia_render(tia, when);
+  sched_add(tia->sched, SCHED_EVENT_TIA_SAMPLES, when + TIA_BATCH_CYCLES);
+}
+
+void tia_init(Tia *tia, Scheduler *sched, const uint64_t *clock) {
+  tia->sched = sched;
+  tia->clock = clock;
+  tia->ring = NULL;
+  sched_set_handler(sched, SCHED_EVENT_TIA_SAMPLES, tia_on_batch, tia);
+  tia_reset(tia);
+  tia_reschedule(tia);
+}
+
+void tia_write(Tia *tia, uint16_t addr, uint8_t val) {
+  uint8_t reg = (uint8_t)(addr - TIA_REG_AUDC0);
+
+  if (tia->ring == NULL) {
+    tia_apply(&tia->regs, reg, val);
+    return;
+  }
+  if (tia->logged == TIA_LOG_SIZE)
+    tia_render(tia, *tia->clock);
+  tia->log[tia->logged++] = (TiaWrite){*tia->clock, reg, val};
+}
+
+void tia_reset(Tia *tia) {
+  memset(&tia->regs, 0, sizeof(TiaRegs));
+  for (unsigned v = 0; v < 2; v++)
+    tia->voices[v] = (TiaVoice){.poly4 = 0x0F, .poly5 = 0x1F, .poly9 = 0x1FF};
+  tia->logged = 0;
+}
+
+void tia_reschedule(Tia *tia) {
+  tia->regs = tia_regs(tia);
+  tia->logged = 0;
+  // Samples fall on multiples of TIA_CYCLES_PER_SAMPLE, so a ring
+  // attached again, or a restored state, renders the same samples
+  tia->rendered = (*tia->clock + TIA_CYCLES_PER_SAMPLE - 1) /
+                  TIA_CYCLES_PER_SAMPLE * TIA_CYCLES_PER_SAMPLE;
+  if (tia->ring != NULL)
+    sched_add(tia->sched, SCHED_EVENT_TIA_SAMPLES,
+              tia->rendered + TIA_BATCH_CYCLES);
+  else
+    sched_cancel(tia->sched, SCHED_EVENT_TIA_SAMPLES);
+}
+
+void tia_set_ring(Tia *tia, TiaRing *ring) {
+  // The samples of the batch under way belong to the old ring
+  if (tia->ring != NULL)
+    tia_render(tia, *tia->clock);
+  tia->ring = ring;
+  tia_reschedule(tia);
+}
+
+TiaRegs tia_regs(const Tia *tia) {
+  TiaRegs regs = tia->regs;
+
+  for (unsigned i = 0; i < tia->logged; i++)
+    tia_apply(&regs, tia->log[i].reg, tia->log[i].val);
+  return regs;
+}
+
+void tia_set_regs(Tia *tia, const TiaRegs *regs) {
+  tia->regs = *regs;
+  tia->logged = 0;
+}
+
+TiaRing *tia_ring_create(void) {
+  TiaRing *ring = aligned_alloc(_Alignof(TiaRing), sizeof(TiaRing));
+
+  if (ring == NULL)
+    return NULL;
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->dropped, 0);
+  atomic_init(&ring->tail, 0);
+  return ring;
+}
+
+void tia_ring_destroy(TiaRing *ring) { free(ring); }
+
+size_t tia_ring_read(TiaRing *ring, int16_t *out, size_t max) {
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+  uint32_t count = head - tail;
+
+  if (count > max)
+    count = (uint32_t)max;
+  for (uint32_t i = 0; i < count; i++)
+    out[i] = ring->samples[(tail + i) & (TIA_RING_SIZE - 1)];
+  atomic_store_explicit(&ring->tail, tail + count, memory_order_release);
+  return count;
+}
+
+size_t tia_ring_level(const TiaRing *ring) {
+  return atomic_load_explicit(&ring->head, memory_order_acquire) -
+         atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
+
+uint32_t tia_ring_dropped(const TiaRing *ring) {
+  return atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+}
@@ -0,0 +1,244 @@
+/**
+ * rvm-8/kernel/tia.h
+ *
+ * TIA sound generator for the rvm-8 emulator.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ *
+ * Two TIA-style voices, each a 5-bit frequency divider driving one of
+ * sixteen tone and noise shapes at a 4-bit volume (specs/SPEC.md,
+ * section 5.2). The registers sit on the device page the TIA shares
+ * with the input registers and the RIOT (BUS_INPUT_PAGE, routed by
+ * machine.c).
+ *
+ * Nothing is synthesized per instruction. A register write only goes
+ * into a log, stamped with the CPU cycle, and every TIA_BATCH_SAMPLES
+ * samples a scheduler event (SCHED_EVENT_TIA_SAMPLES) renders the
+ * samples since the last batch, applying the logged writes at the
+ * sample they fall on, and pushes them to a TiaRing in one go.
+ *
+ * The ring is a lock-free single-producer, single-consumer queue: the
+ * machine's thread pushes, and the host's audio thread pulls with
+ * tia_ring_read() at its own pace. Neither side ever waits for the
+ * other; a full ring drops the newest samples and counts them. Without
+ * a ring attached the TIA only tracks its registers and schedules
+ * nothing.
+ */
+
+#ifndef RVM_TIA_H
+#define RVM_TIA_H
+
+#include "sched.h"
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Sound registers, in the BUS_INPUT_PAGE page; all write-only */
+#define TIA_REG_AUDC0 0x2520 // Voice 0 shape, 4 bits
+#define TIA_REG_AUDC1 0x2521 // Voice 1 shape
+#define TIA_REG_AUDF0 0x2522 // Voice 0 divider minus one, 5 bits
+#define TIA_REG_AUDF1 0x2523 // Voice 1 divider
+#define TIA_REG_AUDV0 0x2524 // Voice 0 volume, 4 bits
+#define TIA_REG_AUDV1 0x2525 // Voice 1 volume
+
+/** Whether an address is one of the sound registers */
+#define TIA_REG(addr) ((addr) >= TIA_REG_AUDC0 && (addr) <= TIA_REG_AUDV1)
+
+/** CPU cycles per sample; the TIA clocks its voices once per sample */
+#define TIA_CYCLES_PER_SAMPLE 57
+/** Samples rendered per scheduler event */
+#define TIA_BATCH_SAMPLES 64
+/** CPU cycles between two batches */
+#define TIA_BATCH_CYCLES (TIA_BATCH_SAMPLES * TIA_CYCLES_PER_SAMPLE)
+/** Register writes logged between two batches before one is forced */
+#define TIA_LOG_SIZE 64
+/** Capacity of a TiaRing; a power of two */
+#define TIA_RING_SIZE 8192
+/** Output of one voice per volume step; both voices at full volume give
+ *  30 * TIA_SAMPLE_SCALE */
+#define TIA_SAMPLE_SCALE 1024
+
+/**
+ * @brief Sound register values, as written by the CPU.
+ *
+ * Plain data, so save states can copy it (rewind.c).
+ */
+typedef struct {
+  uint8_t audc[2];
+  uint8_t audf[2];
+  uint8_t audv[2];
+} TiaRegs;
+
+/**
+ * @brief Waveform state of one voice.
+ */
+typedef struct {
+  /** Frequency divider, counts up to AUDF */
+  uint8_t divider;
+  /** Position within the divided shapes */
+  uint8_t phase;
+  /** Current output bit */
+  uint8_t out;
+  /** 4-, 5- and 9-bit polynomial counters, never zero */
+  uint16_t poly4, poly5, poly9;
+} TiaVoice;
+
+/**
+ * @brief A logged register write.
+ */
+typedef struct {
+  uint64_t cycle;
+  uint8_t reg;
+  uint8_t val;
+} TiaWrite;
+
+/**
+ * @brief Sample queue from one machine to a host audio thread.
+ *
+ * Mono 16-bit samples at MACHINE_AUDIO_RATE. head and tail count
+ * samples since creation and wrap freely; each is written by one side
+ * only, and they sit on separate cache lines so that the two sides do
+ * not contend. The layout is mirrored by emulator/src/ffi.rs.
+ */
+typedef struct {
+  /** Samples pushed; written by the producer */
+  _Alignas(64) _Atomic uint32_t head;
+  /** Samples the ring had no room for; written by the producer */
+  _Atomic uint32_t dropped;
+  /** Samples read; written by the consumer */
+  _Alignas(64) _Atomic uint32_t tail;
+  _Alignas(64) int16_t samples[TIA_RING_SIZE];
+} TiaRing;
+
+/**
+ * @brief TIA state for one emulator instance.
+ */
+typedef struct {
+  /** Scheduler the batch event is queued on */
+  Scheduler *sched;
+  /** CPU cycle counter writes are stamped with */
+  const uint64_t *clock;
+  /** Where samples go, or NULL to synthesize nothing */
+  TiaRing *ring;
+  /** Registers as of the next sample; newer writes are in the log */
+  TiaRegs regs;
+  TiaVoice voices[2];
+  /** Cycle of the next sample to render */
+  uint64_t rendered;
+  /** Writes not yet applied to regs, oldest first */
+  TiaWrite log[TIA_LOG_SIZE];
+  unsigned logged;
+} Tia;
+
+/**
+ * @brief Initialize a TIA with silent voices and no ring.
+ *
+ * Installs the SCHED_EVENT_TIA_SAMPLES handler.
+ *
+ * @param tia Pointer to the TIA to initialize.
+ * @param sched Scheduler for the batch event; must outlive the TIA.
+ * @param clock CPU cycle counter; must outlive the TIA.
+ */
+void tia_init(Tia *tia, Scheduler *sched, const uint64_t *clock);
+
+/**
+ * @brief Bus write of a sound register.
+ *
+ * @param tia Pointer to the TIA.
+ * @param addr Address, see TIA_REG().
+ * @param val Value written.
+ */
+void tia_write(Tia *tia, uint16_t addr, uint8_t val);
+
+/**
+ * @brief Silence both voices and drop the logged writes.
+ *
+ * The ring stays attached.
+ *
+ * @param tia Pointer to the TIA.
+ */
+void tia_reset(Tia *tia);
+
+/**
+ * @brief Restart sample rendering at the current cycle.
+ *
+ * Applies the logged writes and queues the batch event again if a ring
+ * is attached. Call after the scheduler was cleared or the cycle
+ * counter was set from outside (machine_reschedule()).
+ *
+ * @param tia Pointer to the TIA.
+ */
+void tia_reschedule(Tia *tia);
+
+/**
+ * @brief Attach or detach the ring samples are pushed to.
+ *
+ * The samples due before the current cycle are rendered to the ring
+ * being replaced, so detaching between frames drops none; rendering to
+ * the new ring starts at the current cycle.
+ *
+ * @param tia Pointer to the TIA.
+ * @param ring The ring, or NULL to stop synthesizing.
+ */
+void tia_set_ring(Tia *tia, TiaRing *ring);
+
+/**
+ * @brief Get the registers as last written, logged writes included.
+ *
+ * @param tia Pointer to the TIA.
+ * @return The register values.
+ */
+TiaRegs tia_regs(const Tia *tia);
+
+/**
+ * @brief Replace the registers, dropping the logged writes.
+ *
+ * @param tia Pointer to the TIA.
+ * @param regs New register values.
+ */
+void tia_set_regs(Tia *tia, const TiaRegs *regs);
+
+/**
+ * @brief Allocate an empty ring.
+ *
+ * @return The ring, or NULL if allocation failed.
+ */
+TiaRing *tia_ring_create(void);
+
+/**
+ * @brief Free a ring; it must be detached from its machine first.
+ *
+ * @param ring The ring, or NULL.
+ */
+void tia_ring_destroy(TiaRing *ring);
+
+/**
+ * @brief Take samples out of a ring; the consumer side, for one thread.
+ *
+ * @param ring Pointer to the ring.
+ * @param out Buffer for the samples.
+ * @param max Capacity of @p out, in samples.
+ * @return Samples copied, at most @p max; 0 if the ring is empty.
+ */
+size_t tia_ring_read(TiaRing *ring, int16_t *out, size_t max);
+
+/**
+ * @brief Get the number of samples waiting in a ring.
+ *
+ * Safe on either side; the other side may change it right after.
+ *
+ * @param ring Pointer to the ring.
+ * @return Samples waiting.
+ */
+size_t tia_ring_level(const TiaRing *ring);
+
+/**
+ * @brief Get the number of samples dropped because the ring was full.
+ *
+ * @param ring Pointer to the ring.
+ * @return Samples dropped since creation.
+ */
+uint32_t tia_ring_dropped(const TiaRing *ring);
+
+#endif
@@ -0,0 +1,369 @@
+/*
+ * rvm-8/kernel/tools/rvm_asm.c
+ *
+ * rvm-asm: assembles `.asm` sources into `.rvm` ROMs.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ *
+ *   rvm-asm [-o OUT] [-l LABELS] FILE.asm
+ *   rvm-asm -i CACHE [-d DIR] FILE.asm...
+ *
+ * Notes:
+ * - -l also writes the label map, for the profiler (profile.h).
+ * - With -i, every source is a room, built to DIR/NAME.rvm (or next to
+ *   the source). CACHE lists each room built so far with the files it
+ *   read: a `room <count> <output>` line, then one `file <hash>
+ *   <exports> <path>` line per file, the source first.
+ * - A room is reassembled when its output is missing, its source
+ *   changed, or an include changed in a way that changes what it
+ *   exports. Includes whose contents changed are assembled on their own
+ *   (once per run, however many rooms share them) and their exports
+ *   compared with the cached ones, so editing comments or reformatting a
+ *   shared file does not rebuild every room. An include that does not
+ *   assemble on its own has no exports (0) and always counts as changed.
+ * - Rooms that fail are dropped from the cache so they are retried.
+ */
+
+#include "../asm.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+  char *path;
+  uint64_t hash;
+  uint64_t exports;
+} CachedFile;
+
+typedef struct {
+  char *output;
+  CachedFile *files;
+  unsigned file_count;
+} Room;
+
+typedef struct {
+  Room *rooms;
+  unsigned count;
+  unsigned cap;
+} Cache;
+
+/** Standalone exports of a changed include, memoized per run */
+typedef struct {
+  char *path;
+  uint64_t hash;
+  uint64_t exports;
+} Memo;
+
+static Memo *memos;
+static unsigned memo_count;
+
+static void *xrealloc(void *p, size_t size) {
+  p = realloc(p, size);
+  if (p == NULL) {
+    fprintf(stderr, "rvm-asm: out of memory\n");
+    exit(1);
+  }
+  return p;
+}
+
+static char *xstrdup(const char *s) {
+  return strcpy(xrealloc(NULL, strlen(s) + 1), s);
+}
+
+static void usage(void) {
+  fprintf(stderr, "usage: rvm-asm [-o OUT] [-l LABELS] FILE.asm\n"
+                  "       rvm-asm -i CACHE [-d DIR] FILE.asm...\n");
+  exit(2);
+}
+
+/**
+ * @brief Output path for a source: its name with .rvm, in dir if given.
+ */
+static char *output_path(const char *source, const char *dir) {
+  const char *base = source, *slash = strrchr(source, '/');
+  size_t len;
+
+  if (dir != NULL && slash != NULL)
+    base = slash + 1;
+  len = strlen(base);
+  if (len > 4 && strcmp(base + len - 4, ".asm") == 0)
+    len -= 4;
+
+  char *out = xrealloc(NULL, (dir ? strlen(dir) + 1 : 0) + len + 5);
+  sprintf(out, "%s%s%.*s.rvm", dir ? dir : "", dir ? "/" : "", (int)len,
+          base);
+  return out;
+}
+
+/**
+ * @brief Assembles one source.
+ *
+ * @return The assembler, or NULL after printing the error.
+ */
+static Asm *assemble(const char *path, int quiet) {
+  Asm *as = asm_create();
+
+  if (as == NULL) {
+    fprintf(stderr, "rvm-asm: out of memory\n");
+    return NULL;
+  }
+  if (asm_assemble(as, path) != 0) {
+    if (!quiet)
+      fprintf(stderr, "%s\n", asm_error(as));
+    asm_destroy(as);
+    return NULL;
+  }
+  return as;
+}
+
+/**
+ * @brief Exports of a file assembled on its own, or 0 if it does not
+ * assemble.
+ */
+static uint64_t standalone_exports(const char *path, uint64_t hash) {
+  for (unsigned i = 0; i < memo_count; i++)
+    if (memos[i].hash == hash && strcmp(memos[i].path, path) == 0)
+      return memos[i].exports;
+
+  Asm *as = assemble(path, 1);
+  uint64_t exports = as ? asm_file(as, 0)->exports : 0;
+  asm_destroy(as);
+
+  memos = xrealloc(memos, (memo_count + 1) * sizeof(Memo));
+  memos[memo_count++] = (Memo){xstrdup(path), hash, exports};
+  return exports;
+}
+
+static void room_free(Room *room) {
+  for (unsigned i = 0; i < room->file_count; i++)
+    free(room->files[i].path);
+  free(room->files);
+  free(room->output);
+  memset(room, 0, sizeof(Room));
+}
+
+/**
+ * @brief Reads the cache; a missing or damaged cache is just empty.
+ */
+static void cache_load(Cache *cache, const char *path) {
+  FILE *f = fopen(path, "r");
+  char line[4096];
+  Room *room = NULL;
+  unsigned expected = 0;
+
+  if (f == NULL)
+    return;
+  while (fgets(line, sizeof(line), f)) {
+    unsigned count;
+    uint64_t hash, exports;
+    int n = 0;
+
+    line[strcspn(line, "\n")] = 0;
+    if (sscanf(line, "room %u %n", &count, &n) == 1 && n > 0 && count > 0) {
+      if (cache->count == cache->cap) {
+        cache->cap = cache->cap ? 2 * cache->cap : 64;
+        cache->rooms = xrealloc(cache->rooms, cache->cap * sizeof(Room));
+      }
+      room = &cache->rooms[cache->count++];
+      *room = (Room){xstrdup(line + n), xrealloc(NULL, count * sizeof(CachedFile)),
+                     0};
+      expected = count;
+    } else if (room != NULL && room->file_count < expected &&
+               sscanf(line, "file %" SCNx64 " %" SCNx64 " %n", &hash, &exports,
+                      &n) == 2 &&
+               n > 0) {
+      room->files[room->file_count++] =
+          (CachedFile){xstrdup(line + n), hash, exports};
+    } else {
+      break;
+    }
+  }
+  fclose(f);
+
+  // Drop a room cut short by damage
+  if (room != NULL && room->file_count < expected)
+    room_free(&cache->rooms[--cache->count]);
+}
+
+static int cache_save(const Cache *cache, const char *path) {
+  char *tmp = xrealloc(NULL, strlen(path) + 5);
+  FILE *f;
+  int ok;
+
+  sprintf(tmp, "%s.tmp", path);
+  f = fopen(tmp, "w");
+  ok = f != NULL;
+  for (unsigned i = 0; ok && i < cache->count; i++) {
+    const Room *room = &cache->rooms[i];
+
+    if (room->output == NULL)
+      continue;
+    fprintf(f, "room %u %s\n", room->file_count, room->output);
+    for (unsigned k = 0; k < room->file_count; k++)
+      fprintf(f, "file %016" PRIx64 " %016" PRIx64 " %s\n", room->files[k].hash,
+              room->files[k].exports, room->files[k].path);
+  }
+  if (f != NULL && fclose(f) != 0)
+    ok = 0;
+  ok = ok && rename(tmp, path) == 0;
+  if (!ok)
+    remove(tmp);
+  free(tmp);
+  return ok ? 0 : -1;
+}
+
+static Room *cache_find(Cache *cache, const char *source, const char *output) {
+  for (unsigned i = 0; i < cache->count; i++) {
+    Room *room = &cache->rooms[i];
+    if (room->output && strcmp(room->output, output) == 0 &&
+        strcmp(room->files[0].path, source) == 0)
+      return room;
+  }
+  return NULL;
+}
+
+/**
+ * @brief Checks a cached room against the files on disk.
+ *
+ * Includes whose exports are unchanged get their new hash recorded.
+ */
+static int room_up_to_date(Room *room) {
+  FILE *out = fopen(room->output, "rb");
+  uint64_t hash;
+
+  if (out == NULL)
+    return 0;
+  fclose(out);
+
+  for (unsigned i = 0; i < room->file_count; i++) {
+    CachedFile *file = &room->files[i];
+
+    if (asm_hash_file(file->path, &hash) != 0)
+      return 0;
+    if (hash == file->hash)
+      continue;
+    if (i == 0 || file->exports == 0 ||
+        standalone_exports(file->path, hash) != file->exports)
+      return 0;
+    file->hash = hash;
+  }
+  return 1;
+}
+
+/**
+ * @brief Records the files an assembly read, with standalone exports
+ * for the includes.
+ */
+static void room_record(Room *room, const Asm *as, char *output) {
+  room->output = output;
+  room->file_count = asm_file_count(as);
+  room->files = xrealloc(NULL, room->file_count * sizeof(CachedFile));
+  for (unsigned i = 0; i < room->file_count; i++) {
+    const AsmFile *file = asm_file(as, i);
+    room->files[i] = (CachedFile){
+        xstrdup(file->path), file->hash,
+        i == 0 ? file->exports : standalone_exports(file->path, file->hash)};
+  }
+}
+
+static int build_one(const char *source, const char *output,
+                     const char *labels) {
+  Asm *as = assemble(source, 0);
+  char *out = output ? xstrdup(output) : output_path(source, NULL);
+  int status = 1;
+
+  if (as != NULL && asm_write_rom(as, out) != 0)
+    fprintf(stderr, "rvm-asm: cannot write %s\n", out);
+  else if (as != NULL && labels != NULL && asm_write_labels(as, labels) != 0)
+    fprintf(stderr, "rvm-asm: cannot write %s\n", labels);
+  else if (as != NULL)
+    status = 0;
+  asm_destroy(as);
+  free(out);
+  return status;
+}
+
+static int build_rooms(char **sources, int count, const char *cache_path,
+                       const char *dir) {
+  Cache cache = {0};
+  unsigned built = 0, skipped = 0, failed = 0;
+
+  cache_load(&cache, cache_path);
+
+  for (int i = 0; i < count; i++) {
+    char *output = output_path(sources[i], dir);
+    Room *room = cache_find(&cache, sources[i], output);
+
+    if (room != NULL && room_up_to_date(room)) {
+      skipped++;
+      free(output);
+      continue;
+    }
+    if (room != NULL)
+      room_free(room);
+
+    Asm *as = assemble(sources[i], 0);
+    if (as != NULL && asm_write_rom(as, output) != 0) {
+      fprintf(stderr, "rvm-asm: cannot write %s\n", output);
+      asm_destroy(as);
+      as = NULL;
+    }
+    if (as == NULL) {
+      failed++;
+      free(output);
+      continue;
+    }
+
+    if (room == NULL) {
+      if (cache.count == cache.cap) {
+        cache.cap = cache.cap ? 2 * cache.cap : 64;
+        cache.rooms = xrealloc(cache.rooms, cache.cap * sizeof(Room));
+      }
+      room = &cache.rooms[cache.count++];
+    }
+    room_record(room, as, output);
+    asm_destroy(as);
+    built++;
+  }
+
+  if (cache_save(&cache, cache_path) != 0)
+    fprintf(stderr, "rvm-asm: cannot write %s\n", cache_path);
+  fprintf(stderr, "rvm-asm: %u assembled, %u up to date, %u failed\n", built,
+          skipped, failed);
+
+  for (unsigned i = 0; i < cache.count; i++)
+    room_free(&cache.rooms[i]);
+  free(cache.rooms);
+  return failed ? 1 : 0;
+}
+
+int main(int argc, char **argv) {
+  const char *output = NULL, *labels = NULL, *cache = NULL, *dir = NULL;
+  int i = 1;
+
+  for (; i < argc && argv[i][0] == '-'; i += 2) {
+    if (i + 1 >= argc)
+      usage();
+    if (strcmp(argv[i], "-o") == 0)
+      output = argv[i + 1];
+    else if (strcmp(argv[i], "-l") == 0)
+      labels = argv[i + 1];
+    else if (strcmp(argv[i], "-i") == 0)
+      cache = argv[i + 1];
+    else if (strcmp(argv[i], "-d") == 0)
+      dir = argv[i + 1];
+    else
+      usage();
+  }
+
+  if (cache != NULL) {
+    if (i == argc || output != NULL || labels != NULL)
+      usage();
+    return build_rooms(argv + i, argc - i, cache, dir);
+  }
+  if (argc - i != 1 || dir != NULL)
+    usage();
+  return build_one(argv[i], output, labels);
+}
@@ -0,0 +1,107 @@
+/*
+ * rvm-8/kernel/tools/rvm_trace.c
+ *
+ * rvm-trace: prints an execution trace written by trace.h as text.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ *
+ *   rvm-trace [--skip N] [--count N] FILE
+ *
+ * Notes:
+ * - One line per instruction: its number in the trace, PC, opcode,
+ *   mnemonic, the registers before it ran and the cycles it took.
+ * - Chunks are decoded one at a time, so a trace of any length needs
+ *   one buffer of memory. A truncated last chunk (a run that crashed
+ *   mid-write) is reported and the records before it are still printed.
+ */
+
+#include "../cpu.h"
+#include "../trace.h"
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void usage(void) {
+  fprintf(stderr, "usage: rvm-trace [--skip N] [--count N] FILE\n");
+  exit(2);
+}
+
+static uint32_t get_u32(const uint8_t *in) {
+  return in[0] | in[1] << 8 | in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+int main(int argc, char **argv) {
+  uint64_t skip = 0, count = UINT64_MAX;
+  const char *path = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--skip") == 0 && i + 1 < argc)
+      skip = strtoull(argv[++i], NULL, 0);
+    else if (strcmp(argv[i], "--count") == 0 && i + 1 < argc)
+      count = strtoull(argv[++i], NULL, 0);
+    else if (argv[i][0] == '-' || path != NULL)
+      usage();
+    else
+      path = argv[i];
+  }
+  if (path == NULL)
+    usage();
+
+  FILE *in = fopen(path, "rb");
+  if (in == NULL) {
+    perror(path);
+    return 1;
+  }
+
+  uint8_t header[8];
+  if (fread(header, 1, sizeof(header), in) != sizeof(header) ||
+      memcmp(header, TRACE_MAGIC, 4) != 0 ||
+      (header[4] | header[5] << 8) != TRACE_VERSION ||
+      (header[6] | header[7] << 8) != TRACE_RECORD_SIZE) {
+    fprintf(stderr, "rvm-trace: %s: not a version %d trace\n", path,
+            TRACE_VERSION);
+    return 1;
+  }
+
+  TraceRecord *records = malloc(TRACE_BUFFER_RECORDS * sizeof(TraceRecord));
+  uint8_t *payload = malloc(trace_bound(TRACE_BUFFER_RECORDS));
+  if (records == NULL || payload == NULL) {
+    fprintf(stderr, "rvm-trace: out of memory\n");
+    return 1;
+  }
+
+  uint64_t end = count > UINT64_MAX - skip ? UINT64_MAX : skip + count;
+  uint64_t index = 0;
+  int status = 0;
+  uint8_t chunk[8];
+  size_t got;
+  while (index < end &&
+         (got = fread(chunk, 1, sizeof(chunk), in)) > 0) {
+    uint32_t n = get_u32(chunk), size = get_u32(chunk + 4);
+
+    if (got != sizeof(chunk) || n > TRACE_BUFFER_RECORDS ||
+        size > trace_bound(n) || fread(payload, 1, size, in) != size ||
+        trace_decode(payload, size, records, n) != 0) {
+      fprintf(stderr, "rvm-trace: %s: bad chunk after %" PRIu64 " records\n",
+              path, index);
+      status = 1;
+      break;
+    }
+    for (uint32_t i = 0; i < n && index < end; i++, index++) {
+      const TraceRecord *rec = &records[i];
+      const char *name = instruction_info[rec->opcode].name;
+
+      if (index < skip)
+        continue;
+      printf("%10" PRIu64 "  %04X  %02X  %-4s A=%02X X=%02X Y=%02X SP=%04X "
+             "P=%02X  +%u\n",
+             index, rec->pc, rec->opcode, name ? name : "???", rec->a, rec->x,
+             rec->y, rec->sp, rec->flags, rec->cycles);
+    }
+  }
+  free(payload);
+  free(records);
+  fclose(in);
+  return status;
+}
@@ -0,0 +1,265 @@
+/*
+ * rvm-8/kernel/trace.c
+ *
+ * Binary execution tracer for rvm-8.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ *
+ * Notes:
+ * - The CPU and the writer thread only meet in trace_swap(), once per
+ *   TRACE_BUFFER_RECORDS instructions; `pending` is the handshake, and
+ *   the lock is never taken while the CPU fills a buffer.
+ * - Records are serialized bytewise in little-endian order before they
+ *   are differenced, so traces read the same on any host.
+ * - The PC prediction is the only part of the coding that knows the
+ *   ISA: straight-line code leaves a column of zeros, and so do the
+ *   registers an instruction does not touch.
+ * - trace_encode() builds the column differences in the top third of
+ *   its buffer and codes them to the bottom. Coding turns k bytes into
+ *   at most 2k, so the output never catches up with the input.
+ */
+
+#include "trace.h"
+#include "cpu.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ZERO_RUN_MAX 256
+
+/**
+ * @brief The bytes of a record, little-endian, into column @p i of
+ *        TRACE_RECORD_SIZE columns of @p count bytes.
+ */
+static void trace_split(const TraceRecord *rec, uint8_t *cols, size_t count,
+                        size_t i) {
+  cols[i] = (uint8_t)rec->pc;
+  cols[count + i] = (uint8_t)(rec->pc >> 8);
+  cols[2 * count + i] = (uint8_t)rec->sp;
+  cols[3 * count + i] = (uint8_t)(rec->sp >> 8);
+  cols[4 * count + i] = rec->opcode;
+  cols[5 * count + i] = rec->a;
+  cols[6 * count + i] = rec->x;
+  cols[7 * count + i] = rec->y;
+  cols[8 * count + i] = rec->flags;
+  cols[9 * count + i] = rec->cycles;
+}
+
+size_t trace_encode(const TraceRecord *records, uint32_t count,
+                    uint8_t *out) {
+  size_t total = (size_t)count * TRACE_RECORD_SIZE;
+  uint8_t *diffs = out + 2 * total;
+  TraceRecord pred = {0};
+
+  for (uint32_t i = 0; i < count; i++) {
+    const TraceRecord *rec = &records[i];
+    TraceRecord diff = {
+        .pc = (uint16_t)((uint8_t)(rec->pc - pred.pc) |
+                         (uint8_t)((rec->pc >> 8) - (pred.pc >> 8)) << 8),
+        .sp = (uint16_t)((uint8_t)(rec->sp - pred.sp) |
+                         (uint8_t)((rec->sp >> 8) - (pred.sp >> 8)) << 8),
+        .opcode = (uint8_t)(rec->opcode - pred.opcode),
+        .a = (uint8_t)(rec->a - pred.a),
+        .x = (uint8_t)(rec->x - pred.x),
+        .y = (uint8_t)(rec->y - pred.y),
+        .flags = (uint8_t)(rec->flags - pred.flags),
+        .cycles = (uint8_t)(rec->cycles - pred.cycles),
+    };
+    trace_split(&diff, diffs, count, i);
+    pred = *rec;
+    pred.pc += instruction_info[rec->opcode].size;
+  }
+
+  size_t size = 0;
+  for (size_t i = 0; i < total;) {
+    if (diffs[i] != 0) {
+      out[size++] = diffs[i++];
+      continue;
+    }
+    size_t run = 1, max = total - i < ZERO_RUN_MAX ? total - i : ZERO_RUN_MAX;
+    uint64_t word;
+    // Long runs are the common case: skip them 8 bytes at a time
+    while (run + 8 <= max && (memcpy(&word, diffs + i + run, 8), word == 0))
+      run += 8;
+    while (run < max && diffs[i + run] == 0)
+      run++;
+    out[size++] = 0;
+    out[size++] = (uint8_t)(run - 1);
+    i += run;
+  }
+  return size;
+}
+
+int trace_decode(const uint8_t *in, size_t size, TraceRecord *records,
+                 uint32_t count) {
+  size_t total = (size_t)count * TRACE_RECORD_SIZE;
+  uint8_t *diffs = malloc(total ? total : 1);
+  size_t n = 0;
+
+  if (diffs == NULL)
+    return -1;
+  for (size_t i = 0; i < size && n <= total;) {
+    if (in[i] != 0) {
+      if (n < total)
+        diffs[n] = in[i];
+      n++;
+      i++;
+    } else if (i + 1 < size && n + in[i + 1] + 1 <= total) {
+      memset(diffs + n, 0, in[i + 1] + 1);
+      n += in[i + 1] + 1;
+      i += 2;
+    } else {
+      n = total + 1;
+    }
+  }
+  if (n != total) {
+    free(diffs);
+    return -1;
+  }
+
+  TraceRecord pred = {0};
+  const uint8_t *col[TRACE_RECORD_SIZE];
+  for (int j = 0; j < TRACE_RECORD_SIZE; j++)
+    col[j] = diffs + (size_t)j * count;
+  for (uint32_t i = 0; i < count; i++) {
+    TraceRecord *rec = &records[i];
+
+    rec->pc = (uint16_t)((uint8_t)(pred.pc + col[0][i]) |
+                         (uint8_t)((pred.pc >> 8) + col[1][i]) << 8);
+    rec->sp = (uint16_t)((uint8_t)(pred.sp + col[2][i]) |
+                         (uint8_t)((pred.sp >> 8) + col[3][i]) << 8);
+    rec->opcode = (uint8_t)(pred.opcode + col[4][i]);
+    rec->a = (uint8_t)(pred.a + col[5][i]);
+    rec->x = (uint8_t)(pred.x + col[6][i]);
+    rec->y = (uint8_t)(pred.y + col[7][i]);
+    rec->flags = (uint8_t)(pred.flags + col[8][i]);
+    rec->cycles = (uint8_t)(pred.cycles + col[9][i]);
+    pred = *rec;
+    pred.pc += instruction_info[rec->opcode].size;
+  }
+  free(diffs);
+  return 0;
+}
+
+static void put_u32(uint8_t *out, uint32_t v) {
+  for (int i = 0; i < 4; i++)
+    out[i] = (uint8_t)(v >> 8 * i);
+}
+
+/**
+ * @brief Compresses and writes one buffer as a chunk.
+ */
+static void trace_write_chunk(Tracer *tracer, const TraceRecord *records,
+                              uint32_t count) {
+  size_t size = trace_encode(records, count, tracer->scratch);
+  uint8_t header[8];
+
+  put_u32(header, count);
+  put_u32(header + 4, (uint32_t)size);
+  if (fwrite(header, 1, sizeof(header), tracer->out) != sizeof(header) ||
+      fwrite(tracer->scratch, 1, size, tracer->out) != size)
+    tracer->error = 1;
+}
+
+/**
+ * @brief Writer thread: writes every buffer handed over until stopped.
+ */
+static void *trace_main(void *arg) {
+  Tracer *tracer = arg;
+
+  pthread_mutex_lock(&tracer->lock);
+  for (;;) {
+    while (tracer->pending == NULL && !tracer->stop)
+      pthread_cond_wait(&tracer->wake, &tracer->lock);
+    if (tracer->pending == NULL)
+      break;
+    TraceRecord *records = tracer->pending;
+    uint32_t count = tracer->pending_count;
+    pthread_mutex_unlock(&tracer->lock);
+
+    trace_write_chunk(tracer, records, count);
+
+    pthread_mutex_lock(&tracer->lock);
+    tracer->pending = NULL;
+    pthread_cond_broadcast(&tracer->wake);
+  }
+  pthread_mutex_unlock(&tracer->lock);
+  return NULL;
+}
+
+Tracer *trace_open(const char *path) {
+  Tracer *tracer = calloc(1, sizeof(Tracer));
+  uint8_t header[8] = {'R', 'V', 'M', 'T', TRACE_VERSION, 0,
+                       TRACE_RECORD_SIZE, 0};
+
+  if (tracer == NULL)
+    return NULL;
+  tracer->buffers[0] = malloc(TRACE_BUFFER_RECORDS * sizeof(TraceRecord));
+  tracer->buffers[1] = malloc(TRACE_BUFFER_RECORDS * sizeof(TraceRecord));
+  tracer->scratch = malloc(trace_bound(TRACE_BUFFER_RECORDS));
+  tracer->active = tracer->buffers[0];
+  if (tracer->buffers[0] == NULL || tracer->buffers[1] == NULL ||
+      tracer->scratch == NULL || (tracer->out = fopen(path, "wb")) == NULL)
+    goto fail;
+  if (fwrite(header, 1, sizeof(header), tracer->out) != sizeof(header))
+    goto fail_file;
+
+  pthread_mutex_init(&tracer->lock, NULL);
+  pthread_cond_init(&tracer->wake, NULL);
+  if (pthread_create(&tracer->thread, NULL, trace_main, tracer) == 0)
+    return tracer;
+  pthread_cond_destroy(&tracer->wake);
+  pthread_mutex_destroy(&tracer->lock);
+fail_file:
+  fclose(tracer->out);
+fail:
+  free(tracer->scratch);
+  free(tracer->buffers[1]);
+  free(tracer->buffers[0]);
+  free(tracer);
+  return NULL;
+}
+
+void trace_swap(Tracer *tracer) {
+  pthread_mutex_lock(&tracer->lock);
+  if (tracer->pending != NULL) {
+    tracer->stalls++;
+    while (tracer->pending != NULL)
+      pthread_cond_wait(&tracer->wake, &tracer->lock);
+  }
+  tracer->pending = tracer->active;
+  tracer->pending_count = tracer->fill;
+  pthread_cond_broadcast(&tracer->wake);
+  pthread_mutex_unlock(&tracer->lock);
+
+  tracer->records += tracer->fill;
+  tracer->active = tracer->active == tracer->buffers[0] ? tracer->buffers[1]
+                                                        : tracer->buffers[0];
+  tracer->fill = 0;
+}
+
+uint64_t trace_records(const Tracer *tracer) {
+  return tracer->records + tracer->fill;
+}
+
+int trace_close(Tracer *tracer) {
+  if (tracer == NULL)
+    return 0;
+  if (tracer->fill > 0)
+    trace_swap(tracer);
+
+  pthread_mutex_lock(&tracer->lock);
+  tracer->stop = 1;
+  pthread_cond_broadcast(&tracer->wake);
+  pthread_mutex_unlock(&tracer->lock);
+  pthread_join(tracer->thread, NULL);
+
+  int err = fclose(tracer->out) != 0 || tracer->error ? -1 : 0;
+  pthread_cond_destroy(&tracer->wake);
+  pthread_mutex_destroy(&tracer->lock);
+  free(tracer->scratch);
+  free(tracer->buffers[1]);
+  free(tracer->buffers[0]);
+  free(tracer);
+  return err;
+}
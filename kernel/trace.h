@@ -0,0 +1,175 @@
+/**
+ * rvm-8/kernel/trace.h
+ *
+ * Binary execution tracer for the rvm-8 emulator.
+ *
+ * Copyright (c) 2025 foxomax
+ * SPDX-License-Identifier: MIT
+ *
+ * With a Tracer attached (CPU.tracer), cpu_run() single-steps and
+ * records one fixed-size TraceRecord per instruction into the tracer's
+ * active buffer. A full buffer is handed to the tracer's own thread,
+ * which compresses it and writes it out while the CPU fills the other
+ * one; the CPU only waits when it laps the writer. Without a tracer
+ * cpu_run() takes its usual fast paths and tracing costs nothing.
+ *
+ * File format (all fields little-endian):
+ * - Header: "RVMT", u16 version (TRACE_VERSION), u16 record size.
+ * - Chunks until the end of the file, one per buffer: u32 record count,
+ *   u32 payload size, payload.
+ * - A payload holds the records column by column, one column per byte
+ *   of TraceRecord, each byte the difference from the same byte of the
+ *   predicted record: the previous record, with its PC advanced past
+ *   the previous instruction (the first record of a chunk is predicted
+ *   as all zeros). Runs of zero differences, the common case, are coded
+ *   as a 0x00 byte followed by the run length minus one.
+ *
+ * tools/rvm_trace.c decodes a trace back into text.
+ */
+
+#ifndef RVM_TRACE_H
+#define RVM_TRACE_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define TRACE_MAGIC "RVMT"
+#define TRACE_VERSION 1
+
+/** Records per buffer, and at most per chunk */
+#define TRACE_BUFFER_RECORDS 65536
+
+/**
+ * @brief One executed instruction, with the registers it started from.
+ */
+typedef struct {
+  uint16_t pc;
+  uint16_t sp;
+  uint8_t opcode;
+  uint8_t a;
+  uint8_t x;
+  uint8_t y;
+  uint8_t flags;
+  /** Cycles the instruction took */
+  uint8_t cycles;
+} TraceRecord;
+
+/** Bytes per record, in memory and in the file */
+#define TRACE_RECORD_SIZE 10
+
+_Static_assert(sizeof(TraceRecord) == TRACE_RECORD_SIZE,
+               "TraceRecord must not be padded");
+
+/**
+ * @brief A tracer writing to one file; attach one per CPU.
+ *
+ * Only trace_next() touches the fields from the CPU's thread; the rest
+ * belongs to trace.c.
+ */
+typedef struct Tracer {
+  /** Buffer the CPU is filling, and the records in it */
+  TraceRecord *active;
+  uint32_t fill;
+  TraceRecord *buffers[2];
+  /** Buffer handed to the writer thread, or NULL, and its records */
+  TraceRecord *pending;
+  uint32_t pending_count;
+  /** Times the CPU had to wait for the writer */
+  uint32_t stalls;
+  /** Records written so far */
+  uint64_t records;
+  int stop;
+  int error;
+  FILE *out;
+  /** Compressed chunk scratch, for the writer thread */
+  uint8_t *scratch;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+} Tracer;
+
+/**
+ * @brief Create a tracer and start its writer thread.
+ *
+ * @param path File to write; it is truncated.
+ * @return The tracer, or NULL if the file, memory or thread could not
+ *         be had.
+ */
+Tracer *trace_open(const char *path);
+
+/**
+ * @brief Write out the records still buffered, stop the thread and free
+ *        the tracer. Detach it from its CPU first.
+ *
+ * @param tracer The tracer, or NULL.
+ * @return 0 on success, -1 if any write failed.
+ */
+int trace_close(Tracer *tracer);
+
+/**
+ * @brief Hand the active buffer to the writer thread and switch to the
+ *        other one, waiting for the writer if it still holds it.
+ *
+ * @param tracer Pointer to the tracer.
+ */
+void trace_swap(Tracer *tracer);
+
+/**
+ * @brief Get the number of records traced so far.
+ *
+ * @param tracer Pointer to the tracer.
+ * @return Records handed to the writer or still in the active buffer.
+ */
+uint64_t trace_records(const Tracer *tracer);
+
+/**
+ * @brief The next record to fill; called once per traced instruction.
+ *
+ * @param tracer Pointer to the tracer.
+ * @return Pointer to a record in the active buffer.
+ */
+static inline TraceRecord *trace_next(Tracer *tracer) {
+  if (tracer->fill == TRACE_BUFFER_RECORDS)
+    trace_swap(tracer);
+  return &tracer->active[tracer->fill++];
+}
+
+/**
+ * @brief Size of the buffer trace_encode() needs: the worst-case
+ *        payload, where a lone zero costs two bytes, plus working space.
+ *
+ * @param count Records in the chunk.
+ */
+static inline size_t trace_bound(uint32_t count) {
+  return 3 * (size_t)count * TRACE_RECORD_SIZE;
+}
+
+/**
+ * @brief Compress records into a chunk payload.
+ *
+ * Like trace_decode(), it predicts PCs from the instruction lengths in
+ * instruction_info.
+ *
+ * @param records The records.
+ * @param count Number of records, at most TRACE_BUFFER_RECORDS.
+ * @param out At least trace_bound(count) bytes.
+ * @return Payload size.
+ */
+size_t trace_encode(const TraceRecord *records, uint32_t count,
+                    uint8_t *out);
+
+/**
+ * @brief Decompress a chunk payload.
+ *
+ * @param in The payload.
+ * @param size Payload size.
+ * @param records Room for @p count records.
+ * @param count Number of records in the chunk.
+ * @return 0 on success, -1 if the payload is malformed.
+ */
+int trace_decode(const uint8_t *in, size_t size, TraceRecord *records,
+                 uint32_t count);
+
+#endif
@@ -1 +1,2 @@
-[0xAD] [0xFF] [0xDD]
+; Raw bytes: LDA $DDFF
+.db $AD, $FF, $DD